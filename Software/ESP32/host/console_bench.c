@@ -0,0 +1,510 @@
+/*----------------------------------------------------------------
+ *
+ * console_bench.c
+ *
+ * Compare unbuffered stdout with the block console writer
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   console_bench [-t seconds] [-p ms] [-b baud]
+ *
+ * A model of the console UART sends bytes at the baud rate.  The
+ * same output, a score and two DLT() lines every period, is sent
+ * to it two ways:
+ *
+ *   stdout   - what serial_io_init() used to set up.  stdout is
+ *              unbuffered, so every printf() is a write to the
+ *              VFS, which turns \n into \r\n and puts one byte at
+ *              a time into the 128 byte UART FIFO, spinning when
+ *              the FIFO is full.
+ *   writer   - what it does now.  stdout is collected in a 512
+ *              byte buffer that is flushed at the end of each
+ *              DLT(), and scores go through serial_console_write().
+ *              Each block is one uart_write_bytes() into the 2K
+ *              TX ring, and the task sleeps if the ring is full.
+ *
+ * The paced run reports the share of the CPU used to write the
+ * console and the number of driver calls per message.  The burst
+ * run writes 16 messages back to back and reports the bytes per
+ * second the application can hand over.
+ *
+ * Both must put the same text on the line.  The program returns
+ * non zero if they do not.
+ *
+ *---------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FIFO_SIZE     128               // UART hardware FIFO
+#define RING_SIZE     (1024 * 2)        // uart_console_size
+#define CONSOLE_SIZE  512               // CONSOLE_BUFFER in serial_io.c
+#define SINK_SIZE     (4 * 1024 * 1024) // Everything put on the line
+#define BURST         16                // Messages in the burst test
+
+/*
+ * Model of the UART
+ */
+typedef struct uart
+{
+  double        byte_ns;                // Time to send one byte
+  double        line_free;              // When everything queued has gone (ns)
+  unsigned int  depth;                  // FIFO or TX ring size
+  unsigned long calls;                  // Driver calls or FIFO writes
+  char*         sink;                   // What went out
+  unsigned long sunk;
+  char          last;                   // Last byte, for the CR LF check
+} uart_t;
+
+typedef struct result
+{
+  const char*   name;
+  double        cpu_share;              // Paced run
+  double        calls_per_msg;
+  double        held_avg_us;            // Time a message holds up the task
+  double        held_max_us;
+  double        burst_bps;              // Burst run, bytes handed over per second
+} result_t;
+
+static uart_t uart;
+static int    failures;
+
+/*----------------------------------------------------------------
+ *
+ * @function: now_ns
+ *            cpu_ns
+ *
+ * @brief:    Wall clock and CPU time in nanoseconds
+ *
+ *--------------------------------------------------------------*/
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+}
+
+static double cpu_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+}
+
+static void sleep_ns
+(
+  double ns
+)
+{
+  struct timespec ts;
+
+  if ( ns <= 0 )
+  {
+    return;
+  }
+  ts.tv_sec  = (time_t)(ns / 1.0e9);
+  ts.tv_nsec = (long)(ns - (double)ts.tv_sec * 1.0e9);
+  nanosleep(&ts, NULL);
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: uart_queue
+ *
+ * @brief:    Put bytes on the line once there is room for them
+ *
+ *--------------------------------------------------------------*/
+static void uart_queue
+(
+  const char*  data,
+  unsigned int length,
+  int          spin                     // TRUE to busy wait, FALSE to sleep
+)
+{
+  double now;
+  double wait;
+
+  while ( 1 )
+  {
+    now = now_ns();
+    if ( uart.line_free < now )
+    {
+      uart.line_free = now;             // Line has gone quiet
+    }
+    wait = (uart.line_free - now) - (double)(uart.depth - length) * uart.byte_ns;
+    if ( wait <= 0 )
+    {
+      break;
+    }
+    if ( !spin )
+    {
+      sleep_ns(wait);
+    }
+  }
+
+  uart.line_free += length * uart.byte_ns;
+  if ( uart.sunk + length <= SINK_SIZE )
+  {
+    memcpy(&uart.sink[uart.sunk], data, length);
+    uart.sunk += length;
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: vfs_write
+ *
+ * @brief:    The VFS without the driver, one byte at a time
+ *
+ *--------------------------------------------------------------*/
+static ssize_t vfs_write
+(
+  void*       cookie,
+  const char* buffer,
+  size_t      length
+)
+{
+  size_t i;
+
+  for (i=0; i != length; i++)
+  {
+    if ( buffer[i] == '\n' )
+    {
+      uart_queue("\r", 1, 1);
+      uart.calls++;
+    }
+    uart_queue(&buffer[i], 1, 1);
+    uart.calls++;
+  }
+
+  return length;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: writer_write
+ *
+ * @brief:    console_write() from serial_io.c
+ *
+ *--------------------------------------------------------------*/
+static void uart_write_bytes
+(
+  const char*  data,
+  unsigned int length
+)
+{
+  unsigned int part;
+
+  uart.calls++;
+  while ( length != 0 )
+  {
+    part = (length > RING_SIZE) ? RING_SIZE : length;
+    uart_queue(data, part, 0);
+    data   += part;
+    length -= part;
+  }
+
+  return;
+}
+
+static ssize_t writer_write
+(
+  void*       cookie,
+  const char* buffer,
+  size_t      length
+)
+{
+  size_t i, start;
+
+  start = 0;
+  for (i=0; i != length; i++)
+  {
+    if ( (buffer[i] == '\n') && (uart.last != '\r') )
+    {
+      uart_write_bytes(&buffer[start], i - start);
+      uart_write_bytes("\r", 1);
+      start = i;
+    }
+    uart.last = buffer[i];
+  }
+  uart_write_bytes(&buffer[start], length - start);
+
+  return length;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: one_message
+ *
+ * @brief:    A score and two DLT() lines
+ *
+ *--------------------------------------------------------------*/
+static void one_message
+(
+  FILE* out,
+  int   buffered,                       // TRUE for the writer
+  int   n
+)
+{
+  char         score[160];
+  int          length;
+
+  length = sprintf(score, "{\"shot\":%d, \"miss\":0, \"name\":\"%d\", \"time\":%d.%02d, \"x\":%d.%02d, \"y\":%d.%02d, \"r\":%d.%02d, \"a\":%d.%02d}\r\n",
+                   n, n % 11, n / 10, n % 100, (n * 7) % 50, n % 100, (n * 13) % 50, n % 97, (n * 3) % 70, n % 89, (n * 17) % 360, n % 83);
+
+  fprintf(out, "\r\nI (%d) ", n * 25);  // DLT(DLT_APPLICATION, ...)
+  fprintf(out, "Shot %d re-arm latency %d ms", n, n % 7);
+  if ( buffered )
+  {
+    fflush(out);                        // dlt_done()
+  }
+
+  if ( buffered )                       // serial_write_all()
+  {
+    flockfile(out);
+    fflush(out);
+    writer_write(NULL, score, length);
+    funlockfile(out);
+  }
+  else
+  {
+    fwrite(score, 1, length, out);
+  }
+
+  fprintf(out, "\r\nI (%d) ", n * 25 + 1);
+  fprintf(out, "Shot %d reduced %d us after capture, counter skew %d ns\n", n, 300 + n % 50, n % 13);
+  if ( buffered )
+  {
+    fflush(out);
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: run
+ *
+ * @brief:    Paced run then a burst
+ *
+ *--------------------------------------------------------------*/
+static void run
+(
+  result_t* r,
+  FILE*     out,
+  int       buffered,
+  double    seconds,
+  double    period_ms,
+  long      baud
+)
+{
+  double        start_wall, start_cpu, next, t, held;
+  double        held_sum;
+  unsigned long start_sunk;
+  int           n, count;
+
+  memset(&uart, 0, sizeof(uart));
+  uart.byte_ns = 10.0e9 / baud;
+  uart.depth   = buffered ? RING_SIZE : FIFO_SIZE;
+  uart.sink    = malloc(SINK_SIZE);
+
+  count = (int)(seconds * 1000.0 / period_ms);
+  held_sum = 0;
+  r->held_max_us = 0;
+  start_wall = now_ns();
+  start_cpu  = cpu_ns();
+  next = start_wall;
+  for (n=0; n != count; n++)
+  {
+    t = now_ns();
+    one_message(out, buffered, n);
+    held = (now_ns() - t) / 1000.0;
+    held_sum += held;
+    if ( held > r->held_max_us )
+    {
+      r->held_max_us = held;
+    }
+    next += period_ms * 1.0e6;
+    sleep_ns(next - now_ns());
+  }
+  sleep_ns(uart.line_free - now_ns());  // Let the line empty
+  r->cpu_share     = (cpu_ns() - start_cpu) / (now_ns() - start_wall);
+  r->calls_per_msg = (double)uart.calls / count;
+  r->held_avg_us   = held_sum / count;
+
+  start_sunk = uart.sunk;
+  t = now_ns();
+  for (n=0; n != BURST; n++)
+  {
+    one_message(out, buffered, count + n);
+  }
+  r->burst_bps = (uart.sunk - start_sunk) / ((now_ns() - t) / 1.0e9);
+  sleep_ns(uart.line_free - now_ns());
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: same_text
+ *
+ * @brief:    Compare the two outputs, ignoring \r
+ *
+ *--------------------------------------------------------------*/
+static int same_text
+(
+  const char*   a,
+  unsigned long a_length,
+  const char*   b,
+  unsigned long b_length
+)
+{
+  unsigned long i, j;
+
+  i = j = 0;
+  while ( 1 )
+  {
+    while ( (i < a_length) && (a[i] == '\r') ) i++;
+    while ( (j < b_length) && (b[j] == '\r') ) j++;
+    if ( (i == a_length) || (j == b_length) )
+    {
+      return (i == a_length) && (j == b_length);
+    }
+    if ( a[i++] != b[j++] )
+    {
+      return 0;
+    }
+  }
+}
+
+static int bare_lf
+(
+  const char*   a,
+  unsigned long length
+)
+{
+  unsigned long i;
+
+  for (i=1; i < length; i++)
+  {
+    if ( (a[i] == '\n') && (a[i-1] != '\r') )
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: report
+ *
+ *--------------------------------------------------------------*/
+static void report
+(
+  result_t* r
+)
+{
+  printf("%-8s CPU %5.1f%%  %6.1f calls/msg  held avg %8.1f us  max %8.1f us  burst %9.0f bytes/s\n",
+         r->name, r->cpu_share * 100.0, r->calls_per_msg, r->held_avg_us, r->held_max_us, r->burst_bps);
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  static const cookie_io_functions_t vfs_io    = { NULL, vfs_write,    NULL, NULL };
+  static const cookie_io_functions_t writer_io = { NULL, writer_write, NULL, NULL };
+  static char   console_buffer[CONSOLE_SIZE];
+  result_t      old_result = { "stdout" };
+  result_t      new_result = { "writer" };
+  double        seconds = 2.0;
+  double        period_ms = 25.0;
+  long          baud = 115200;
+  FILE*         old_out;
+  FILE*         new_out;
+  char*         old_sink;
+  unsigned long old_sunk;
+  int           i;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-t") == 0) && (i+1 < argc) )
+    {
+      seconds = atof(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-p") == 0) && (i+1 < argc) )
+    {
+      period_ms = atof(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-b") == 0) && (i+1 < argc) )
+    {
+      baud = atol(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-t seconds] [-p ms] [-b baud]\n", argv[0]);
+      return 2;
+    }
+  }
+  if ( (seconds <= 0) || (period_ms <= 0) || (baud <= 0) )
+  {
+    fprintf(stderr, "Usage: %s [-t seconds] [-p ms] [-b baud]\n", argv[0]);
+    return 2;
+  }
+
+  old_out = fopencookie(NULL, "w", vfs_io);
+  setvbuf(old_out, NULL, _IONBF, 0);
+  new_out = fopencookie(NULL, "w", writer_io);
+  setvbuf(new_out, console_buffer, _IOLBF, sizeof(console_buffer));
+
+  printf("%ld baud, a score and two DLT lines every %.0f ms for %.1f s\n", baud, period_ms, seconds);
+
+  run(&old_result, old_out, 0, seconds, period_ms, baud);
+  old_sink  = uart.sink;
+  old_sunk  = uart.sunk;
+  report(&old_result);
+
+  run(&new_result, new_out, 1, seconds, period_ms, baud);
+  report(&new_result);
+
+  if ( !same_text(old_sink, old_sunk, uart.sink, uart.sunk) )
+  {
+    printf("the two outputs are different  FAIL\n");
+    failures++;
+  }
+  if ( bare_lf(uart.sink, uart.sunk) )
+  {
+    printf("writer sent a \\n without a \\r  FAIL\n");
+    failures++;
+  }
+
+  if ( failures != 0 )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
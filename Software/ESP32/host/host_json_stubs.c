@@ -0,0 +1,76 @@
+/*----------------------------------------------------------------
+ *
+ * host_json_stubs.c
+ *
+ * Stand-ins for the services called from the JSON[] table
+ *
+ *----------------------------------------------------------------
+ *
+ * json.c is compiled unchanged on the host.  The commands that
+ * drive the hardware (LEDs, VREF, paper, WiFi) are replaced here
+ * by functions that only count how often they were called.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freETarget.h"
+#include "json.h"
+#include "mfs.h"
+#include "shot_queue.h"
+#include "serial_io.h"
+#include "host_stubs.h"
+
+volatile unsigned long power_save;      // Power down timer
+volatile unsigned int  run_state;       // IPC states
+unsigned int           score_overflow;  // Scores dropped
+shot_queue_t           shot_queue;      // Shots from aquire() to reduce()
+
+unsigned long host_json_calls;          // Service functions called
+
+/*
+ * Service functions from the JSON[] table
+ */
+void bye(void)                          { host_json_calls++; }
+void init_nonvol(int v)                 { host_json_calls++; }
+void set_LED_PWM_now(int percent)       { host_json_calls++; }
+void tabata_enable(int enable)          { host_json_calls++; }
+void POST_version(void)                 { host_json_calls++; }
+void set_VREF(void)                     { host_json_calls++; }
+void zapple(unsigned int test)          { host_json_calls++; }
+void self_test(unsigned int test)       { host_json_calls++; }
+void multifunction_show(unsigned int v) { host_json_calls++; }
+
+/*
+ * The multifunction switch fields are returned unchanged
+ */
+unsigned int multifunction_hold12(unsigned int x) { return x; }
+unsigned int multifunction_hold2(unsigned int x)  { return x; }
+unsigned int multifunction_hold1(unsigned int x)  { return x; }
+unsigned int multifunction_tap2(unsigned int x)   { return x; }
+unsigned int multifunction_tap1(unsigned int x)   { return x; }
+char*        multifunction_str(unsigned int x)    { return "NO_ACTION"; }
+
+/*
+ * Used by show_echo()
+ */
+float        v12_supply(void)           { return 12.0; }
+unsigned int revision(void)             { return 510; }
+int64_t      esp_timer_get_time(void)   { return 0; }
+unsigned int timer_overrun(void)        { return 0; }
+unsigned int tcpip_queue_overflow(void) { return 0; }
+int          tcpip_server_dropped(void) { return 0; }
+void         WiFi_MAC_address(char* mac){ memset(mac, 0, 6); }
+void         WiFi_my_ip_address(char* s){ strcpy(s, "127.0.0.1"); }
+
+/*
+ * There is no serial input on the host
+ */
+int  serial_available(bool console, bool aux, bool tcpip) { return 0; }
+char serial_getch(bool console, bool aux, bool tcpip)     { return 0; }
+int  serial_source_frame(int source, char* buffer, int length) { return 0; }
+unsigned int serial_source_session(int source)              { return 0; }
+void serial_reply(int source, char* str, unsigned int length){ return; }
+void serial_wait(int ticks)                                 { return; }
+void serial_set_format(int source, int format)              { host_binary = (format == SCORE_BINARY); }
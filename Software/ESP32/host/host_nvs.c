@@ -0,0 +1,174 @@
+/*----------------------------------------------------------------
+ *
+ * host_nvs.c
+ *
+ * RAM stand-in for the ESP-IDF non volatile storage
+ *
+ *----------------------------------------------------------------
+ *
+ * Keys are kept in a small table in the order they are first
+ * written.  Every set and commit is counted so that the cost of
+ * a message in flash writes can be reported.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+
+#include "nvs.h"
+#include "host_stubs.h"
+
+#define NVS_KEYS    128                 // Largest number of keys
+#define NVS_KEY     16                  // NVS key length limit (15 + '\0')
+#define NVS_TEXT    64                  // Longest string stored
+
+typedef struct
+{
+  char    key[NVS_KEY];                 // Key name
+  int32_t value;                        // Integer value
+  char    text[NVS_TEXT];               // String value
+} nvs_entry_t;
+
+static nvs_entry_t  nvs[NVS_KEYS];
+static unsigned int nvs_size;
+
+nvs_handle_t  my_handle;                // Handle to NVS space (nonvol.c)
+unsigned long host_nvs_sets;            // Calls to nvs_set_*()
+unsigned long host_nvs_commits;         // Calls to nvs_commit()
+
+static nvs_entry_t* nvs_find
+(
+  const char* key,
+  int         create
+)
+{
+  unsigned int i;
+
+  for (i=0; i != nvs_size; i++)
+  {
+    if ( strncmp(nvs[i].key, key, NVS_KEY) == 0 )
+    {
+      return &nvs[i];
+    }
+  }
+
+  if ( (create == 0) || (nvs_size == NVS_KEYS) )
+  {
+    return NULL;
+  }
+
+  memset(&nvs[nvs_size], 0, sizeof(nvs_entry_t));
+  strncpy(nvs[nvs_size].key, key, NVS_KEY - 1);
+  return &nvs[nvs_size++];
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: host_nvs_erase
+ *
+ * @brief:    Empty the store
+ *
+ *--------------------------------------------------------------*/
+void host_nvs_erase(void)
+{
+  nvs_size = 0;
+  return;
+}
+
+esp_err_t nvs_open
+(
+  const char*     name,
+  nvs_open_mode_t open_mode,
+  nvs_handle_t*   out_handle
+)
+{
+  *out_handle = 1;
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_i32
+(
+  nvs_handle_t handle,
+  const char*  key,
+  int32_t      value
+)
+{
+  nvs_entry_t* entry;
+
+  host_nvs_sets++;
+  entry = nvs_find(key, 1);
+  if ( entry == NULL )
+  {
+    return ESP_FAIL;
+  }
+  entry->value = value;
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_i32
+(
+  nvs_handle_t handle,
+  const char*  key,
+  int32_t*     out_value
+)
+{
+  nvs_entry_t* entry;
+
+  entry = nvs_find(key, 0);
+  if ( entry == NULL )
+  {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  *out_value = entry->value;
+  return ESP_OK;
+}
+
+esp_err_t nvs_set_str
+(
+  nvs_handle_t handle,
+  const char*  key,
+  const char*  value
+)
+{
+  nvs_entry_t* entry;
+
+  host_nvs_sets++;
+  entry = nvs_find(key, 1);
+  if ( entry == NULL )
+  {
+    return ESP_FAIL;
+  }
+  strncpy(entry->text, value, NVS_TEXT - 1);
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_str
+(
+  nvs_handle_t handle,
+  const char*  key,
+  char*        out_value,
+  size_t*      length
+)
+{
+  nvs_entry_t* entry;
+
+  entry = nvs_find(key, 0);
+  if ( entry == NULL )
+  {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  if ( out_value != NULL )
+  {
+    strncpy(out_value, entry->text, *length);
+  }
+  *length = strlen(entry->text) + 1;
+  return ESP_OK;
+}
+
+esp_err_t nvs_commit
+(
+  nvs_handle_t handle
+)
+{
+  host_nvs_commits++;
+  return ESP_OK;
+}
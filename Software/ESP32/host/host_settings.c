@@ -0,0 +1,40 @@
+/*----------------------------------------------------------------
+ *
+ * host_settings.c
+ *
+ * Settings used by the scoring code when json.c is not linked
+ *
+ *----------------------------------------------------------------
+ *
+ * The json_* settings are loaded with the same initial values as
+ * the JSON[] table in json.c
+ *
+ *---------------------------------------------------------------*/
+#include <stdbool.h>
+
+#include "freETarget.h"
+#include "json.h"
+#include "mechanical.h"
+#include "token.h"
+
+/*
+ * Settings normally held in NON-VOL
+ */
+int     json_calibre_x10    = 45;       // Pellet Calibre
+double  json_sensor_dia     = DIAMETER; // Sensor diameter
+int     json_sensor_angle   = 45;       // Angle sensors are rotated through
+int     json_north_x;                   // Sensor offsets
+int     json_north_y;
+int     json_east_x;
+int     json_east_y;
+int     json_south_x;
+int     json_south_y;
+int     json_west_x;
+int     json_west_y;
+int     json_z_offset       = 13;       // Distance between paper and sensor plane
+int     json_name_id;                   // Name identifier
+int     json_target_type;               // Single bull
+int     json_token          = TOKEN_NONE; // No token ring
+int     json_send_miss      = 1;        // Send the miss messages
+int     json_score_fields   = S_DEFAULT; // Shot, X-Y, timers and diagnostics
+int     json_solver;                    // compute_hit() algorithm
@@ -0,0 +1,195 @@
+/*----------------------------------------------------------------
+ *
+ * host_stubs.c
+ *
+ * Thin stand-ins for the target services used by the scoring code
+ *
+ *----------------------------------------------------------------
+ *
+ * compute_hit.c and speed_of_sound.c are compiled unchanged on the
+ * host.  This file supplies the globals and driver calls they
+ * reach for so that no FreeRTOS, I2C or UART code is needed.
+ *
+ * The json_* settings live in host_settings.c, or in json.c when
+ * the JSON dispatcher is part of the build.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freETarget.h"
+#include "json.h"
+#include "mechanical.h"
+#include "token.h"
+#include "diag_tools.h"
+#include "serial_io.h"
+#include "host_stubs.h"
+
+/*
+ * Target globals
+ */
+double        s_of_sound;               // Speed of sound
+unsigned int  is_trace;                 // Tracing level(s)
+char          _xs[512];                 // Holding buffer for sprintf
+int           my_ring   = TOKEN_UNDEF;  // Token ring address
+int           whos_ring = TOKEN_UNDEF;  // Who owns the ring right now?
+
+const char* names[] = { "TARGET", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", 0 };
+const char* which_one[] = {"North_lo", "East_lo ", "South_lo", "West_lo ", "North_hi", "East_hi ", "South_hi", "West_hi "};
+
+/*
+ * Host controls
+ */
+double        host_temperature = 20.0;  // Reported by temperature_C()
+double        host_humidity    = 50.0;  // Reported by humidity_RH()
+unsigned long host_tx_bytes;            // Bytes passed to serial_to_all()
+unsigned long host_tx_calls;            // Calls made to serial_to_all()
+bool          host_echo;                // TRUE to copy the output to stdout
+bool          host_binary;              // TRUE if the link asked for binary scores
+
+/*----------------------------------------------------------------
+ *
+ * @function: serial_to_all
+ *            serial_write_all
+ *            serial_write_score
+ *
+ * @brief:    Count the output instead of sending it
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+void serial_to_all
+(
+  char* str,                        // String to output
+  bool  console,                    // Output to the console
+  bool  aux,                        // Output to the aux port
+  bool  tcpip                       // Output to the TCPIP socket
+)
+{
+  serial_write_all(str, strlen(str), console, aux, tcpip);
+
+  return;
+}
+
+void serial_write_all
+(
+  char*        str,                 // Bytes to output
+  unsigned int length,              // Number of bytes
+  bool         console,             // Output to the console
+  bool         aux,                 // Output to the aux port
+  bool         tcpip                // Output to the TCPIP socket
+)
+{
+  host_tx_bytes += length;
+  host_tx_calls++;
+
+  if ( host_echo )
+  {
+    fwrite(str, 1, length, stdout);
+  }
+
+  return;
+}
+
+void serial_write_score
+(
+  char*        json,                // Score as JSON
+  unsigned int json_length,         // Number of bytes
+  char*        frame,               // Score as a binary frame
+  unsigned int frame_length,        // Number of bytes
+  bool         console,             // Output to the console
+  bool         aux,                 // Output to the aux port
+  bool         tcpip                // Output to the TCPIP socket
+)
+{
+  if ( host_binary && (frame_length != 0) )
+  {
+    host_tx_bytes += frame_length;
+    host_tx_calls++;
+    return;
+  }
+
+  serial_write_all(json, json_length, console, aux, tcpip);
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: timer_new / timer_delete
+ *
+ * @brief:    Load the down counter but never run it
+ *
+ *--------------------------------------------------------------*/
+int timer_new
+(
+  volatile unsigned long* new_timer,  // Pointer to new down counter
+           unsigned long  duration    // Duration of the timer
+)
+{
+  if ( new_timer != NULL )
+  {
+    *new_timer = duration;
+  }
+  return 1;
+}
+
+int timer_delete
+(
+  volatile unsigned long* old_timer   // Pointer to down counter
+)
+{
+  return 1;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: temperature_C / humidity_RH
+ *
+ * @brief:    Return the simulated environment
+ *
+ *--------------------------------------------------------------*/
+double temperature_C(void)
+{
+  return host_temperature;
+}
+
+double humidity_RH(void)
+{
+  return host_humidity;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: do_dlt
+ *
+ * @brief:    Trace only when asked for, without the time stamp
+ *
+ *--------------------------------------------------------------*/
+bool do_dlt
+(
+  unsigned int level
+)
+{
+  if ( (level & is_trace) == 0 )
+  {
+    return false;
+  }
+
+  printf("\r\n");
+  return true;
+}
+
+void dlt_done(void)
+{
+  return;
+}
+
+/*
+ * Token ring and LEDs do nothing on the host
+ */
+int  token_take(void)               { return 0; }
+int  token_give(void)               { return 0; }
+void token_poll(void)               { return; }
+void set_status_LED(char* new_state){ return; }
@@ -0,0 +1,25 @@
+/*----------------------------------------------------------------
+ *
+ * host_stubs.h
+ *
+ * Controls for the host stand-ins
+ *
+ *---------------------------------------------------------------*/
+#ifndef _HOST_STUBS_H_
+#define _HOST_STUBS_H_
+
+#include <stdbool.h>
+
+extern double        host_temperature;  // Reported by temperature_C()
+extern double        host_humidity;     // Reported by humidity_RH()
+extern unsigned long host_tx_bytes;     // Bytes passed to serial_to_all()
+extern unsigned long host_tx_calls;     // Calls made to serial_to_all()
+extern bool          host_echo;         // TRUE to copy the output to stdout
+extern bool          host_binary;       // TRUE if the link asked for binary scores
+extern unsigned long host_nvs_sets;     // Calls to nvs_set_*()
+extern unsigned long host_nvs_commits;  // Calls to nvs_commit()
+extern unsigned long host_json_calls;   // JSON[] service functions called
+
+void host_nvs_erase(void);              // Empty the RAM NVS
+
+#endif
@@ -0,0 +1,519 @@
+/*----------------------------------------------------------------
+ *
+ * json_bench.c
+ *
+ * Compare the JSON command dispatchers
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   json_bench [-r repeats] json_corpus.txt
+ *
+ * Each line of the corpus is a message as sent by the PC client.
+ * The spaces are removed the same way freeETarget_json() does and
+ * the message is handed to:
+ *
+ *   instr    - the scan that handle_json() used before, which
+ *              tries every JSON[] token at every position of the
+ *              input and commits the NVS after each position
+ *   index    - handle_json(), which walks the input once and
+ *              looks up each key in a sorted index of JSON[]
+ *
+ * Both must leave every JSON[] setting and every NONVOL key with
+ * the same value.  Then each is timed, along with the number of
+ * NVS writes and commits per message.  The new dispatcher stages
+ * the writes in nonvol_shadow, so sending the same settings again
+ * writes nothing.
+ *
+ * It also checks that a value written around a full nonvol_shadow
+ * table is committed by the next nonvol_flush().
+ *
+ * The program returns non zero if the results do not match.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#else
+#define CYCLES() 0
+#endif
+
+#include "freETarget.h"
+#include "json.h"
+#include "mfs.h"
+#include "nvs.h"
+#include "nonvol.h"
+#include "nonvol_shadow.h"
+#include "host_stubs.h"
+
+#define MAX_MESSAGES  256           // Largest corpus
+#define MAX_ENTRIES   128           // Largest JSON[] table
+
+static char   corpus[MAX_MESSAGES][256];
+static int    messages;
+
+typedef struct
+{
+  int           value[MAX_ENTRIES];   // *JSON[].value
+  double        d_value[MAX_ENTRIES]; // *JSON[].d_value
+  int           nvs_value[MAX_ENTRIES]; // NONVOL integer
+  char          nvs_text[MAX_ENTRIES][32]; // NONVOL string
+  unsigned long calls;                // Service functions called
+} snapshot_t;
+
+int instr(char* s1, char* s2);
+
+/*
+ * The dispatcher being replaced, copied from handle_json().  The
+ * MFS entries used JSON[i].non_vol, which has been corrected to j
+ * so that the copy does not read past the end of the table.
+ */
+static int to_int(char h)
+{
+  h = toupper(h);
+  
+  if ( h > '9' )
+  {
+    return 10 + (h-'A');
+  }
+  else
+  {
+    return h - '0';
+  }
+}
+
+static void old_handle_json
+(
+  char* input_JSON,
+  int   got_right_bracket
+)
+{
+  int   x;
+  float f;
+  int   i, j, k;
+  char  s[64];
+  int   m;
+
+  for ( i=0; i != got_right_bracket; i++)
+  {
+    j = 0;
+    while ( (JSON[j].token != 0) )
+    {
+      x = 0;
+      k = instr(&input_JSON[i], JSON[j].token );
+      if ( k > 0 )
+      {
+        switch ( JSON[j].convert & IS_MASK )
+        {
+          default:
+          case IS_VOID:
+          case IS_FIXED:
+            x = 0;
+          break;
+
+          case IS_MFS:
+            x = atoi(&input_JSON[i+k]);
+            switch(JSON[j].convert & FLOAT_MASK)
+            {
+              case _HOLD1:  x = multifunction_hold1(x);  break;
+              case _HOLD2:  x = multifunction_hold2(x);  break;
+              case _TAP1:   x = multifunction_tap1(x);   break;
+              case _TAP2:   x = multifunction_tap2(x);   break;
+              case _HOLD12: x = multifunction_hold12(x); break;
+            }
+            if ( JSON[j].value != 0 )
+            {
+              *JSON[j].value = x;
+            }
+            if ( JSON[j].non_vol != 0 )
+            {
+              nvs_set_i32(my_handle, JSON[j].non_vol, x);
+            }
+            break;
+
+          case IS_TEXT:
+          case IS_SECRET:
+            while ( input_JSON[i+k] != '"' )
+            {
+              k++; 
+            }
+            k++;
+            m = 0;
+            s[0] = 0;
+            while ( input_JSON[i+k] != '"' )
+            {
+              s[m] = input_JSON[i+k];
+              m++;
+              s[m] = 0;
+              k++;
+            }             
+            if ( JSON[j].non_vol != 0 )
+            {
+              nvs_set_str(my_handle, JSON[j].non_vol, s);
+            }
+            break;
+            
+          case IS_INT32:
+            if ( (input_JSON[i+k] == '0')
+                && ( (input_JSON[i+k+1] == 'X') || (input_JSON[i+k+1] == 'x')) )
+            {
+              x = (to_int(input_JSON[i+k+2]) << 4) + to_int(input_JSON[i+k+3]);
+            }
+            else
+            {
+              x = atoi(&input_JSON[i+k]);
+            }
+            if ( JSON[j].value != 0 )
+            {
+              *JSON[j].value = x;
+            }
+            if ( JSON[j].non_vol != 0 )
+            {
+              nvs_set_i32(my_handle, JSON[j].non_vol, x);
+            }
+            break;
+
+          case IS_FLOAT:
+            f = atof(&input_JSON[i+k]);
+            x = f * 1000;
+            if ( JSON[j].d_value != 0 )
+            {
+              *JSON[j].d_value = f;
+            }
+            if ( JSON[j].non_vol != 0 )
+            {
+              nvs_set_i32(my_handle, JSON[j].non_vol, x);
+            }
+            break;
+        }
+
+        if ( JSON[j].f != 0 )
+        {
+          JSON[j].f(x);
+        }            
+      }
+      j++;
+    }
+    nvs_commit(my_handle);
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: now_ns
+ *
+ * @brief:    Monotonic time in nanoseconds
+ *
+ *--------------------------------------------------------------*/
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: load
+ *
+ * @brief:    Read the corpus and strip it like freeETarget_json()
+ *
+ * @return:   Number of messages read
+ *
+ *--------------------------------------------------------------*/
+static int load
+(
+  char* file_name
+)
+{
+  FILE* f;
+  char  line[512];
+  char* p;
+  int   n, keep_space;
+
+  f = fopen(file_name, "r");
+  if ( f == NULL )
+  {
+    perror(file_name);
+    return -1;
+  }
+
+  messages = 0;
+  while ( (messages < MAX_MESSAGES) && (fgets(line, sizeof(line), f) != NULL) )
+  {
+    if ( line[0] != '{' )
+    {
+      continue;
+    }
+    n = 0;
+    keep_space = 0;
+    for (p = &line[1]; (*p != '}') && (*p != 0) && (n < sizeof(corpus[0]) - 1); p++)
+    {
+      if ( *p == '"' )
+      {
+        keep_space ^= 1;
+      }
+      if ( ((*p != ' ') || keep_space) && (*p != '\n') )
+      {
+        corpus[messages][n++] = *p;
+      }
+    }
+    corpus[messages][n] = 0;
+    messages++;
+  }
+
+  fclose(f);
+  return messages;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: reset / snapshot
+ *
+ * @brief:    Put the settings into a known state and record them
+ *
+ *--------------------------------------------------------------*/
+static int is_number
+(
+  int i
+)
+{
+  return ((JSON[i].convert & IS_MASK) != IS_TEXT)
+      && ((JSON[i].convert & IS_MASK) != IS_SECRET);
+}
+
+static void reset(void)
+{
+  int i;
+
+  for (i=0; JSON[i].token != 0; i++)
+  {
+    if ( (JSON[i].value != 0) && is_number(i) )
+    {
+      *JSON[i].value = -12345;
+    }
+    if ( JSON[i].d_value != 0 )
+    {
+      *JSON[i].d_value = -12345.0;
+    }
+  }
+  host_nvs_erase();
+  nonvol_forget();
+  host_json_calls = 0;
+
+  return;
+}
+
+/*
+ * Stage more keys than the table holds and check the last one is
+ * committed
+ */
+#define MANY_KEYS 100                       // More than SHADOW_SIZE
+
+static int full_table(void)
+{
+  static char   keys[MANY_KEYS][8];
+  int           i;
+  unsigned long commits;
+
+  reset();
+  for (i=0; i != MANY_KEYS; i++)
+  {
+    sprintf(keys[i], "K%d", i);
+    nonvol_set_i32(keys[i], i);
+  }
+  nonvol_flush();
+
+  commits = host_nvs_commits;
+  nonvol_set_i32(keys[MANY_KEYS-1], -1);    // Not in the table
+  nonvol_flush();
+  commits = host_nvs_commits - commits;
+  reset();
+
+  return commits != 0;
+}
+
+static void snapshot
+(
+  snapshot_t* snap
+)
+{
+  int    i;
+  int32_t x;
+  size_t length;
+
+  memset(snap, 0, sizeof(snapshot_t));
+  for (i=0; JSON[i].token != 0; i++)
+  {
+    if ( (JSON[i].value != 0) && is_number(i) )
+    {
+      snap->value[i] = *JSON[i].value;
+    }
+    if ( JSON[i].d_value != 0 )
+    {
+      snap->d_value[i] = *JSON[i].d_value;
+    }
+    if ( JSON[i].non_vol != 0 )
+    {
+      length = sizeof(snap->nvs_text[i]);
+      if ( is_number(i) && (nvs_get_i32(my_handle, JSON[i].non_vol, &x) == ESP_OK) )
+      {
+        snap->nvs_value[i] = x;
+      }
+      else if ( !is_number(i) )
+      {
+        nvs_get_str(my_handle, JSON[i].non_vol, snap->nvs_text[i], &length);
+      }
+    }
+  }
+  snap->calls    = host_json_calls;
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  int           repeats = 10000;    // Times through the corpus
+  char*         file_name = NULL;
+  int           i, r, bad;
+  char          work[256];
+  snapshot_t    old_snap, new_snap;
+  double        start, stop, total;
+  unsigned long long c_start, c_stop;
+  unsigned long commits, sets, bytes;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-r") == 0) && (i+1 < argc) )
+    {
+      repeats = atoi(argv[++i]);
+    }
+    else if ( argv[i][0] != '-' )
+    {
+      file_name = argv[i];
+    }
+    else
+    {
+      file_name = NULL;
+      break;
+    }
+  }
+  if ( (file_name == NULL) || (load(file_name) <= 0) )
+  {
+    fprintf(stderr, "Usage: %s [-r repeats] json_corpus.txt\n", argv[0]);
+    return 2;
+  }
+
+  for (i=0; JSON[i].token != 0; i++)
+  {
+    if ( i == MAX_ENTRIES )
+    {
+      fprintf(stderr, "JSON[] has more than %d entries\n", MAX_ENTRIES);
+      return 2;
+    }
+  }
+
+/*
+ * Both dispatchers must do the same thing
+ */
+  bad = 0;
+  bytes = 0;
+  for (i=0; i != messages; i++)
+  {
+    bytes += strlen(corpus[i]);
+
+    reset();
+    strcpy(work, corpus[i]);
+    old_handle_json(work, strlen(work));
+    snapshot(&old_snap);
+
+    reset();
+    strcpy(work, corpus[i]);
+    handle_json(work);
+    snapshot(&new_snap);
+
+    if ( memcmp(&old_snap, &new_snap, sizeof(snapshot_t)) != 0 )
+    {
+      printf("mismatch: {%s}\n", corpus[i]);
+      bad++;
+    }
+  }
+  printf("checked:      %d messages, %lu bytes, %d different\n", messages, bytes, bad);
+
+  if ( full_table() == 0 )
+  {
+    printf("full table:   write not committed\n");
+    bad++;
+  }
+
+/*
+ * Time the instr() scan
+ */
+  total = (double)messages * repeats;
+  commits = host_nvs_commits;
+  sets    = host_nvs_sets;
+  start = now_ns();
+  c_start = CYCLES();
+  for (r=0; r != repeats; r++)
+  {
+    for (i=0; i != messages; i++)
+    {
+      strcpy(work, corpus[i]);
+      old_handle_json(work, strlen(work));
+    }
+  }
+  c_stop = CYCLES();
+  stop = now_ns();
+  printf("instr:        %8.1f ns/msg  %8.0f cycles/msg  %5.1f writes/msg  %5.1f commits/msg\n",
+         (stop - start) / total, (double)(c_stop - c_start) / total,
+         (double)(host_nvs_sets - sets) / total, (double)(host_nvs_commits - commits) / total);
+
+/*
+ * Time the indexed dispatcher
+ */
+  nonvol_forget();                          // The scan wrote behind the RAM copy
+  commits = host_nvs_commits;
+  sets    = host_nvs_sets;
+  start = now_ns();
+  c_start = CYCLES();
+  for (r=0; r != repeats; r++)
+  {
+    for (i=0; i != messages; i++)
+    {
+      strcpy(work, corpus[i]);
+      handle_json(work);
+    }
+  }
+  c_stop = CYCLES();
+  stop = now_ns();
+  printf("index:        %8.1f ns/msg  %8.0f cycles/msg  %5.1f writes/msg  %5.1f commits/msg\n",
+         (stop - start) / total, (double)(c_stop - c_start) / total,
+         (double)(host_nvs_sets - sets) / total, (double)(host_nvs_commits - commits) / total);
+
+  if ( bad != 0 )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,234 @@
+/*----------------------------------------------------------------
+ *
+ * pcnt_wrap_stress.c
+ *
+ * Read a model of the PCNT counters while they wrap
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   pcnt_wrap_stress [-n counts] [-l limit]
+ *
+ * One thread plays the hardware.  It runs four counters from 0
+ * up to the limit and back to 0, setting the unit's bit in the
+ * status word every time a counter wraps, and publishes the true
+ * 32 bit count after every step.
+ *
+ * The other thread plays the target CPU.  It either services the
+ * limit interrupt (clear the status bit, then add one to wraps[]
+ * the way the driver and pcnt_limit_callback() do) or reads all
+ * four counters with pcnt_extend_read(), the way pcnt_snapshot()
+ * does.  The interrupt and the reads are on the same thread, as
+ * they are all pinned to PCNT_CORE on the target.
+ *
+ * Every reading must lie between the true count seen before the
+ * read and the true count seen after it, and must never go
+ * backwards.
+ *
+ * -l sets a smaller limit than PCNT_HIGH_LIMIT so that the wraps
+ * come more often.  The hardware waits for the interrupt before
+ * wrapping a second time, which is the same as saying that the
+ * interrupt is always serviced within one wrap period.
+ *
+ * The program returns non zero if any reading was wrong.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "pcnt_extend.h"
+
+#define UNITS 4
+
+static volatile unsigned int count_reg[UNITS];  // Count registers
+static volatile unsigned int status_reg;        // Raw interrupt status
+static volatile unsigned int wraps[UNITS];      // Serviced wraps
+static volatile long         true_count[UNITS]; // What the counters really hold
+static volatile int          hardware_done;
+
+static long          total_counts = 20000000;   // Steps taken by the hardware
+static unsigned int  limit = PCNT_HIGH_LIMIT;   // Wrap point of the model
+
+static unsigned long readings;                  // Calls to pcnt_extend_read()
+static unsigned long serviced;                  // Wraps handled by the interrupt
+static unsigned long bad_range;                 // Outside the true count
+static unsigned long backwards;                 // Smaller than the reading before
+
+/*----------------------------------------------------------------
+ *
+ * @function: hardware
+ *
+ * @brief:    Count up and wrap
+ *
+ *--------------------------------------------------------------*/
+static void* hardware
+(
+  void* arg
+)
+{
+  long i;
+  int  unit;
+
+  for (i=0; i != total_counts; i++)
+  {
+    unit = i % UNITS;
+    if ( count_reg[unit] + 1 == limit )
+    {
+      while ( status_reg & (1u << unit) )
+      {
+        sched_yield();                  // Interrupt not taken yet
+      }
+      count_reg[unit] = 0;              // Counter goes back to 0
+      __sync_synchronize();
+      __sync_fetch_and_or(&status_reg, 1u << unit);  // and raises the interrupt
+    }
+    else
+    {
+      count_reg[unit]++;
+    }
+    __sync_synchronize();
+    true_count[unit]++;
+  }
+
+  hardware_done = 1;
+  return NULL;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: cpu
+ *
+ * @brief:    Service the interrupt and read the counters
+ *
+ *--------------------------------------------------------------*/
+static void* cpu
+(
+  void* arg
+)
+{
+  int           result[UNITS];
+  long          before[UNITS];
+  long          after[UNITS];
+  long          last[UNITS];
+  unsigned int  pending;
+  int           unit;
+
+  memset(last, 0, sizeof(last));
+  while ( !hardware_done )
+  {
+    pending = status_reg;
+    if ( (pending != 0) && ((readings % 3) == 0) )   // Let some reads see the bit set
+    {
+      for (unit=0; unit != UNITS; unit++)
+      {
+        if ( pending & (1u << unit) )
+        {
+          __sync_fetch_and_and(&status_reg, ~(1u << unit)); // Driver clears the bit
+          wraps[unit]++;                                    // then calls back
+          serviced++;
+        }
+      }
+    }
+
+    for (unit=0; unit != UNITS; unit++)
+    {
+      before[unit] = true_count[unit];
+    }
+    __sync_synchronize();
+    pcnt_extend_read(count_reg, &status_reg, wraps, 0, UNITS, result);
+    __sync_synchronize();
+    for (unit=0; unit != UNITS; unit++)
+    {
+      after[unit] = true_count[unit];
+    }
+    readings++;
+
+    for (unit=0; unit != UNITS; unit++)
+    {
+      if ( limit != PCNT_HIGH_LIMIT )   // Rescale to the model's limit
+      {
+        result[unit] = (result[unit] / PCNT_HIGH_LIMIT) * limit + (result[unit] % PCNT_HIGH_LIMIT);
+      }
+      if ( (result[unit] < before[unit]) || (result[unit] > after[unit] + 1) )
+      {
+        if ( bad_range == 0 )
+        {
+          printf("unit %d read %d, true count %ld to %ld\n", unit, result[unit], before[unit], after[unit]);
+        }
+        bad_range++;
+      }
+      if ( result[unit] < last[unit] )
+      {
+        backwards++;
+      }
+      last[unit] = result[unit];
+    }
+
+    if ( (readings % 64) == 0 )
+    {
+      sched_yield();                    // Let the hardware move on
+    }
+  }
+
+  return NULL;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  pthread_t h, c;
+  int       i;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-n") == 0) && (i+1 < argc) )
+    {
+      total_counts = atol(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-l") == 0) && (i+1 < argc) )
+    {
+      limit = atoi(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-n counts] [-l limit]\n", argv[0]);
+      return 2;
+    }
+  }
+  if ( (limit < 2) || (limit > PCNT_HIGH_LIMIT) )
+  {
+    limit = PCNT_HIGH_LIMIT;
+  }
+
+  pthread_create(&c, NULL, cpu, NULL);
+  pthread_create(&h, NULL, hardware, NULL);
+  pthread_join(h, NULL);
+  pthread_join(c, NULL);
+
+  printf("counts:       %ld over %d units, limit %u\n", total_counts, UNITS, limit);
+  printf("wraps:        %lu serviced\n", serviced);
+  printf("readings:     %lu\n", readings);
+  printf("out of range: %lu\n", bad_range);
+  printf("backwards:    %lu\n", backwards);
+
+  if ( (bad_range != 0) || (backwards != 0) || (serviced == 0) )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
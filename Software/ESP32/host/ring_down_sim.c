@@ -0,0 +1,336 @@
+/*----------------------------------------------------------------
+ *
+ * ring_down_sim.c
+ *
+ * Compare the fixed and learned ring down on simulated sensors
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   ring_down_sim [-n shots] [-i interval_ms] [-r min_ring_time_ms]
+ *
+ * Time moves in 1 ms ticks, the same as the timer interrupt.
+ *
+ * Shots arrive every interval ms, give or take 20%.  Each one
+ * sets all four sensors ringing with an envelope that dies away
+ * as exp(-t/tau).  Every sensor has its own tau, which drifts a
+ * little from shot to shot.  While the counters are armed a
+ * sensor latches RUN_XX_LO when its envelope is above VREF_LO
+ * and RUN_XX_HI when it is above VREF_HI.
+ *
+ * The same shots are run through
+ *
+ *   fixed   - hold the counters stopped for min_ring_time
+ *   learned - ring_down_tick(), as timer.c does with RING_ADAPT
+ *
+ * and for each the program counts the shots read, the shots that
+ * arrived while the counters were stopped (lost), and the times
+ * the counters were armed while a sensor was still ringing
+ * hard enough to look like a shot.  Ringing from a shot that was
+ * read counts as false.  Ringing from a shot that was lost counts
+ * as late, because any scheme would pick up the tail of a shot it
+ * did not hear.  The re-arm latency is the time from a shot being
+ * read to the counters being armed for good.
+ *
+ * The program returns non zero if the learned ring down reads a
+ * false shot.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "freETarget.h"
+#include "gpio.h"
+#include "ring_down.h"
+
+#define VREF_LO     1.25                // Volts
+#define VREF_HI     2.00
+#define AMPLITUDE   6.0                 // Peak of the ringing
+#define MAX_WAIT    10                  // Ticks to wait for all of the sensors
+
+static const unsigned int lo_bit[RING_SENSORS] = {BIT_NORTH_LO, BIT_EAST_LO, BIT_SOUTH_LO, BIT_WEST_LO};
+static const unsigned int hi_bit[RING_SENSORS] = {BIT_NORTH_HI, BIT_EAST_HI, BIT_SOUTH_HI, BIT_WEST_HI};
+
+typedef struct result
+{
+  const char*   name;
+  unsigned long read;                   // Shots captured
+  unsigned long lost;                   // Shots that arrived while deaf
+  unsigned long false_shots;            // Ringing after a shot that was read, taken as a new shot
+  unsigned long late;                   // Ringing after a lost shot, taken as a new shot
+  unsigned long rearms;
+  double        rearm_total;            // Sum of the re-arm latency (ms)
+  unsigned int  rearm_max;
+} result_t;
+
+static long   shot_count = 2000;        // Shots to fire
+static int    interval   = 150;         // ms between shots
+static int    min_ring   = 500;         // json_min_ring_time (ms)
+static double tau[RING_SENSORS];        // Ring down time constant of each sensor (ms)
+
+/*----------------------------------------------------------------
+ *
+ * @function: sensors
+ *
+ * @brief:    RUN lines that would latch at this time
+ *
+ *--------------------------------------------------------------*/
+static unsigned int sensors
+(
+  long  now,                            // Current tick
+  long  last_shot                       // Tick of the last shot fired
+)
+{
+  unsigned int pin;
+  double       level;
+  int          i;
+
+  pin = 0;
+  if ( last_shot < 0 )
+  {
+    return 0;
+  }
+  for (i=0; i != RING_SENSORS; i++)
+  {
+    level = AMPLITUDE * exp(-(double)(now - last_shot) / tau[i]);
+    if ( level > VREF_LO )
+    {
+      pin |= lo_bit[i];
+    }
+    if ( level > VREF_HI )
+    {
+      pin |= hi_bit[i];
+    }
+  }
+
+  return pin;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: run
+ *
+ * @brief:    Fire the shots at one of the ring down schemes
+ *
+ *--------------------------------------------------------------*/
+static void run
+(
+  result_t* r,
+  int       learned                     // TRUE to use ring_down_tick()
+)
+{
+  ring_down_t  ring;
+  long         now, next_shot, last_shot, fired;
+  int          armed;                   // Counters are running
+  int          state;                   // 0 idle, 1 wait, 2 done
+  int          timer;
+  int          shot_is_real;
+  int          last_lost;               // TRUE if the last shot fired was lost
+  unsigned int pin;
+  int          i;
+
+  srand(7);
+  for (i=0; i != RING_SENSORS; i++)
+  {
+    tau[i] = 10.0 + 40.0 * i / (RING_SENSORS - 1);       // 10 to 50 ms
+  }
+  ring_down_init(&ring, min_ring);
+
+  armed = 1;
+  state = 0;
+  timer = 0;
+  fired = 0;
+  last_shot = -1;
+  shot_is_real = 0;
+  last_lost = 0;
+  next_shot = interval;
+  for (now=0; fired != shot_count || state != 0; now++)
+  {
+/*
+ * Fire the next shot
+ */
+    if ( (now == next_shot) && (fired != shot_count) )
+    {
+      fired++;
+      for (i=0; i != RING_SENSORS; i++)                  // Sensors drift a little
+      {
+        tau[i] *= 1.0 + ((rand() % 201) - 100) / 2000.0; // +/- 5%
+        if ( tau[i] < 5.0 )  tau[i] = 5.0;
+        if ( tau[i] > 80.0 ) tau[i] = 80.0;
+      }
+      last_lost = (armed == 0);
+      if ( last_lost )
+      {
+        r->lost++;                                       // Deaf
+      }
+      else
+      {
+        shot_is_real = 1;
+      }
+      last_shot = now;
+      next_shot = now + interval + ((rand() % (2 * interval / 5 + 1)) - interval / 5);
+    }
+
+    pin = armed ? sensors(now, last_shot) : 0;
+
+/*
+ * Same states as freeETarget_timer_isr_callback()
+ */
+    switch (state)
+    {
+      case 0:                                            // IDLE
+        if ( pin != 0 )
+        {
+          if ( shot_is_real == 0 )                       // Only ringing
+          {
+            if ( last_lost ) r->late++; else r->false_shots++;
+          }
+          timer = MAX_WAIT;
+          state = 1;
+        }
+        break;
+
+      case 1:                                            // WAIT
+        if ( timer > 0 )
+        {
+          timer--;
+        }
+        if ( ((pin & 0x0f) == 0x0f) || (timer == 0) )
+        {
+          if ( shot_is_real )
+          {
+            r->read++;
+          }
+          shot_is_real = 0;
+          armed = 0;                                     // Counters latched
+          timer = 0;
+          state = 2;
+          ring_down_start(&ring, min_ring);
+        }
+        break;
+
+      case 2:                                            // DONE
+        timer++;
+        if ( learned )
+        {
+          switch ( ring_down_tick(&ring, pin) )
+          {
+            case RING_HOLD:
+            case RING_STOP:
+              armed = 0;
+              break;
+            case RING_ARM:
+              armed = 1;
+              break;
+            case RING_DONE:
+              state = 0;
+              break;
+            case RING_SHOT:
+              if ( shot_is_real == 0 )
+              {
+                if ( last_lost ) r->late++; else r->false_shots++;
+              }
+              timer = MAX_WAIT;
+              state = 1;
+              break;
+          }
+          if ( state != 2 )
+          {
+            r->rearms++;
+            r->rearm_total += ring.rearm;
+            if ( ring.rearm > r->rearm_max )
+            {
+              r->rearm_max = ring.rearm;
+            }
+          }
+        }
+        else if ( timer >= min_ring )
+        {
+          armed = 1;
+          state = 0;
+          r->rearms++;
+          r->rearm_total += timer;
+          if ( (unsigned int)timer > r->rearm_max )
+          {
+            r->rearm_max = timer;
+          }
+        }
+        break;
+    }
+  }
+
+  return;
+}
+
+static void report
+(
+  result_t* r
+)
+{
+  printf("%-8s  read %5lu  lost %5lu  false %4lu  late %4lu  re-arm %6.1f ms avg %4u ms max\n",
+         r->name, r->read, r->lost, r->false_shots, r->late,
+         r->rearms ? r->rearm_total / r->rearms : 0.0, r->rearm_max);
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  result_t fixed   = { "fixed" };
+  result_t learned = { "learned" };
+  int      i;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-n") == 0) && (i+1 < argc) )
+    {
+      shot_count = atol(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-i") == 0) && (i+1 < argc) )
+    {
+      interval = atoi(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-r") == 0) && (i+1 < argc) )
+    {
+      min_ring = atoi(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-n shots] [-i interval_ms] [-r min_ring_time_ms]\n", argv[0]);
+      return 2;
+    }
+  }
+  if ( interval < 2 )
+  {
+    interval = 2;
+  }
+
+  run(&fixed, 0);
+  run(&learned, 1);
+
+  printf("shots:    %ld every %d ms +/- 20%%, ring time %d ms\n", shot_count, interval, min_ring);
+  report(&fixed);
+  report(&learned);
+
+  if ( learned.false_shots != 0 )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
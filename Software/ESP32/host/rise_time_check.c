@@ -0,0 +1,214 @@
+/*----------------------------------------------------------------
+ *
+ * rise_time_check.c
+ *
+ * Check the rise time compensation now done in task context
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   rise_time_check [-n samples]
+ *
+ * read_timers() used to correct the counts inside the timer
+ * interrupt.  The correction now lives in compensate_rise_time()
+ * and is applied by reduce().
+ *
+ * Random sets of raw counts, latencies and VREF settings are put
+ * through a copy of the old code and through the new function.
+ * The results must be identical, including the cases where the
+ * latency is not set, the references are out of order, or the
+ * high counter was not triggered.  The time taken by each is
+ * reported.
+ *
+ * The program returns non zero if any result is different.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freETarget.h"
+#include "compute_hit.h"
+#include "pcnt.h"
+
+#define MAX_SAMPLES 100000
+
+typedef struct sample
+{
+  int    timer[8];
+  int    latency;
+  double vref_lo;
+  double vref_hi;
+} sample_t;
+
+static sample_t samples[MAX_SAMPLES];
+
+/*
+ * The correction as it was done in read_timers()
+ */
+static void old_compensation
+(
+  int    timer[],
+  int    json_pcnt_latency,
+  double json_vref_lo,
+  double json_vref_hi
+)
+{
+  unsigned int i;
+  double pcnt_hi;                               // Reading from high counter 
+
+  if ( (json_pcnt_latency != 0)                   // Latecy has a valid setting
+          && ((json_vref_hi - json_vref_lo) > 0 ) ) // The voltage references are good
+  {
+    for (i=N; i <= W; i++)                        // Add the rise time to the signal to get a better estimate
+    {
+      pcnt_hi = timer[i+4] - json_pcnt_latency;   // PCNT HI   (reading - latentcy)
+      if ( pcnt_hi > PCNT_NOT_TRIGGERED )         // Check to make sure the high timer was triggered by a shot
+      {                                           // and not dinged from the pellet trap
+        pcnt_hi = 0;                              // Not triggered by a shot
+      }
+      if ( pcnt_hi > 0 )
+      {
+        timer[i] = timer[i] + pcnt_hi * (json_vref_lo / (json_vref_hi - json_vref_lo));
+      }
+    }
+  }
+
+  return;
+}
+
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: make_samples
+ *
+ * @brief:    Fill the table with random raw readings
+ *
+ *--------------------------------------------------------------*/
+static void make_samples
+(
+  int count
+)
+{
+  int       i, j;
+  sample_t* p;
+
+  srand(1);
+  for (i=0; i != count; i++)
+  {
+    p = &samples[i];
+    for (j=N; j <= W; j++)
+    {
+      p->timer[j]   = rand() % 32768;
+      p->timer[j+4] = rand() % (PCNT_NOT_TRIGGERED * 2);   // Some not triggered
+    }
+    p->latency = ((i % 16) == 0) ? 0 : rand() % 60;       // Some not set
+    p->vref_lo = (double)(rand() % 3000) / 1000.0;
+    p->vref_hi = (double)(rand() % 3000) / 1000.0;        // Some out of order
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  int       count = 10000;
+  int       i, bad;
+  int       expected[8];
+  int       actual[8];
+  double    start, old_time, new_time;
+  volatile int sink;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-n") == 0) && (i+1 < argc) )
+    {
+      count = atoi(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-n samples]\n", argv[0]);
+      return 2;
+    }
+  }
+  if ( (count <= 0) || (count > MAX_SAMPLES) )
+  {
+    count = MAX_SAMPLES;
+  }
+
+  make_samples(count);
+
+/*
+ * Both must give the same counts
+ */
+  bad = 0;
+  for (i=0; i != count; i++)
+  {
+    memcpy(expected, samples[i].timer, sizeof(expected));
+    memcpy(actual,   samples[i].timer, sizeof(actual));
+    old_compensation(expected, samples[i].latency, samples[i].vref_lo, samples[i].vref_hi);
+    compensate_rise_time(actual, samples[i].latency, samples[i].vref_lo, samples[i].vref_hi);
+    if ( memcmp(expected, actual, sizeof(expected)) != 0 )
+    {
+      if ( bad == 0 )
+      {
+        printf("mismatch at %d: N %d/%d E %d/%d S %d/%d W %d/%d\n", i,
+               expected[N], actual[N], expected[E], actual[E], expected[S], actual[S], expected[W], actual[W]);
+      }
+      bad++;
+    }
+  }
+  printf("checked:      %d samples, %d different\n", count, bad);
+
+/*
+ * Time each one
+ */
+  start = now_ns();
+  for (i=0; i != count; i++)
+  {
+    memcpy(actual, samples[i].timer, sizeof(actual));
+    old_compensation(actual, samples[i].latency, samples[i].vref_lo, samples[i].vref_hi);
+    sink = actual[N];
+  }
+  old_time = (now_ns() - start) / count;
+
+  start = now_ns();
+  for (i=0; i != count; i++)
+  {
+    memcpy(actual, samples[i].timer, sizeof(actual));
+    compensate_rise_time(actual, samples[i].latency, samples[i].vref_lo, samples[i].vref_hi);
+    sink = actual[N];
+  }
+  new_time = (now_ns() - start) / count;
+  (void)sink;
+
+  printf("read_timers:  %6.1f ns/shot (was in the ISR)\n", old_time);
+  printf("task:         %6.1f ns/shot\n", new_time);
+
+  if ( bad != 0 )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,344 @@
+/*----------------------------------------------------------------
+ *
+ * score_bench.c
+ *
+ * Compare the score message writers
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   score_bench [-n messages] [-r repeats] [-S solver] [-f fields]
+ *
+ * A set of random scores (and every 8th one a miss) is formatted
+ * two ways:
+ *
+ *   sprintf  - the SEND(sprintf(_xs, ...)) chain that send_score()
+ *              used before, one serial_to_all() per fragment
+ *   writer   - format_score() / format_miss() and one
+ *              serial_write_all() per message
+ *
+ * First every message is checked to make sure both give the same
+ * text, then each is timed.  -f sets SCORE_FIELDS for the writer,
+ * and as the sprintf chain only knows the default fields the check
+ * is skipped for anything else.  The time is reported in nanoseconds
+ * and, on x86, in TSC cycles per message.
+ *
+ * The program returns non zero if the messages do not match.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#else
+#define CYCLES() 0
+#endif
+
+#include "freETarget.h"
+#include "json.h"
+#include "compute_hit.h"
+#include "serial_io.h"
+#include "token.h"
+#include "host_stubs.h"
+
+#define MAX_SCORES  100000          // Largest set of scores
+
+static score_t scores[MAX_SCORES];
+static char*   capture;             // Where the sprintf path copies its output
+
+/*
+ * The path being replaced, copied from send_score() and send_miss()
+ */
+#define OLD_SEND(message) {message if ( capture != NULL ) strcat(capture, _xs); serial_to_all(_xs, ALL);}
+
+static void old_score
+(
+  score_t* shot
+)
+{
+  double x, y;
+  double real_x, real_y;
+  double radius;
+  double angle;
+
+  x = shot->x * shot->s_of_sound * CLOCK_PERIOD;
+  y = shot->y * shot->s_of_sound * CLOCK_PERIOD;
+  radius = sqrt(sq(x) + sq(y));
+  angle = atan2(shot->y, shot->x) / PI * 180.0d;
+
+  angle += json_sensor_angle;
+  x = radius * cos(PI * angle / 180.0d);
+  y = radius * sin(PI * angle / 180.0d);
+  real_x = x;
+  real_y = y;
+
+  OLD_SEND(sprintf(_xs, "\r\n{");)
+  OLD_SEND(sprintf(_xs, "\"shot\":%d, \"miss\":0, \"name\":\"%s\"", shot->shot_number,  names[json_name_id]);)
+  OLD_SEND(sprintf(_xs, ", \"time\":%4.2f ", (float)shot->shot_time/(float)(ONE_SECOND));)
+  OLD_SEND(sprintf(_xs, ",\"x\":%4.2f, \"y\":%4.2f ", x, y);)
+  if ( json_target_type > 1 )
+  {
+    OLD_SEND(sprintf(_xs, ",\"real_x\":%4.2f, \"real_y\":%4.2f ", real_x, real_y);)
+  }
+  OLD_SEND(sprintf(_xs, ", \"n\":%d, \"e\":%d, \"s\":%d, \"w\":%d ", shot->count[N], shot->count[E], shot->count[S], shot->count[W]);)
+  OLD_SEND(sprintf(_xs, ", \"N\":%d, \"E\":%d, \"S\":%d, \"W\":%d ", (int)shot->timer_count[N+4], (int)shot->timer_count[E+4], (int)shot->timer_count[S+4], (int)shot->timer_count[W+4]);)
+  if ( json_solver == SOLVER_TDOA )
+  {
+    OLD_SEND(sprintf(_xs, ", \"res\":%4.2f ", shot->residual * shot->s_of_sound * CLOCK_PERIOD);)
+  }
+  OLD_SEND(sprintf(_xs, "}\r\n");)
+
+  return;
+}
+
+static void old_miss
+(
+  score_t* shot
+)
+{
+  OLD_SEND(sprintf(_xs, "\r\n{");)
+  OLD_SEND(sprintf(_xs, "\"shot\":%d, \"miss\":0, \"name\":\"%s\"", shot->shot_number,  names[json_name_id]);)
+  OLD_SEND(sprintf(_xs, ", \"time\":%4.2f ", (float)shot->shot_time/(float)(ONE_SECOND));)
+  OLD_SEND(sprintf(_xs, ", \"x\":0, \"y\":0 ");)
+  OLD_SEND(sprintf(_xs, ", \"N\":%d, \"E\":%d, \"S\":%d, \"W\":%d ", (int)shot->timer_count[N], (int)shot->timer_count[E], (int)shot->timer_count[S], (int)shot->timer_count[W]);)
+  OLD_SEND(sprintf(_xs, ", \"face\":%d ", shot->face_strike);)
+  OLD_SEND(sprintf(_xs, "}\n\r");)
+
+  return;
+}
+
+/*
+ * The new path, as used by send_score() and send_miss()
+ */
+static unsigned int new_message
+(
+  score_t* shot,
+  char*    message,
+  unsigned int size
+)
+{
+  unsigned int length;
+
+  if ( shot->is_miss )
+  {
+    length = format_miss(message, size, shot);
+  }
+  else
+  {
+    length = format_score(message, size, shot);
+  }
+  serial_write_all(message, length, ALL);
+
+  return length;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: now_ns
+ *
+ * @brief:    Monotonic time in nanoseconds
+ *
+ *--------------------------------------------------------------*/
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: make_scores
+ *
+ * @brief:    Fill the table with random scores
+ *
+ *--------------------------------------------------------------*/
+static void make_scores
+(
+  int count
+)
+{
+  int      i, j;
+  score_t* shot;
+
+  srand(1);
+  for (i=0; i != count; i++)
+  {
+    shot = &scores[i];
+    shot->shot_number = i;
+    shot->shot_time   = rand() % 1000000;
+    shot->x           = (float)((rand() % 200000) - 100000) / 100.0f;  // +/- 1000 clocks
+    shot->y           = (float)((rand() % 200000) - 100000) / 100.0f;
+    shot->s_of_sound  = (float)s_of_sound;
+    shot->residual    = (float)(rand() % 10000) / 1000.0f;
+    shot->face_strike = rand() % 100;
+    shot->is_miss     = (i % 8) == 7;
+    for (j=N; j <= W; j++)
+    {
+      shot->count[j] = rand() % 10000;
+    }
+    for (j=0; j != 8; j++)
+    {
+      shot->timer_count[j] = rand() % 32768;
+    }
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  int           count   = 10000;    // Number of messages
+  int           repeats = 100;      // Times through the set
+  int           i, r, bad;
+  char          expected[1024];
+  char          message[SCORE_SIZE];
+  unsigned int  length;
+  double        start, stop;
+  unsigned long long c_start, c_stop;
+  unsigned long tx_bytes, tx_calls;
+  double        messages;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-n") == 0) && (i+1 < argc) )
+    {
+      count = atoi(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-r") == 0) && (i+1 < argc) )
+    {
+      repeats = atoi(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-S") == 0) && (i+1 < argc) )
+    {
+      json_solver = atoi(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-f") == 0) && (i+1 < argc) )
+    {
+      json_score_fields = strtol(argv[++i], NULL, 0);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-n messages] [-r repeats] [-S solver] [-f fields]\n", argv[0]);
+      return 2;
+    }
+  }
+  if ( (count <= 0) || (count > MAX_SCORES) )
+  {
+    count = MAX_SCORES;
+  }
+
+  s_of_sound = speed_of_sound(host_temperature, host_humidity);
+  make_scores(count);
+
+/*
+ * Both paths must say the same thing
+ */
+  bad = 0;
+  capture = expected;
+  for (i=0; (json_score_fields == S_DEFAULT) && (i != count); i++)
+  {
+    expected[0] = 0;
+    if ( scores[i].is_miss )
+    {
+      old_miss(&scores[i]);
+    }
+    else
+    {
+      old_score(&scores[i]);
+    }
+    new_message(&scores[i], message, sizeof(message));
+    if ( strcmp(expected, message) != 0 )
+    {
+      if ( bad == 0 )
+      {
+        printf("mismatch at %d\n  sprintf: %s\n  writer:  %s\n", i, expected, message);
+      }
+      bad++;
+    }
+  }
+  capture = NULL;
+  if ( json_score_fields == S_DEFAULT )
+  {
+    printf("checked:      %d messages, %d different\n", count, bad);
+  }
+  else
+  {
+    printf("fields:       0x%02x, not checked\n", json_score_fields);
+  }
+
+/*
+ * Time the sprintf chain
+ */
+  messages = (double)count * repeats;
+  tx_bytes = host_tx_bytes;
+  tx_calls = host_tx_calls;
+  start = now_ns();
+  c_start = CYCLES();
+  for (r=0; r != repeats; r++)
+  {
+    for (i=0; i != count; i++)
+    {
+      if ( scores[i].is_miss )
+      {
+        old_miss(&scores[i]);
+      }
+      else
+      {
+        old_score(&scores[i]);
+      }
+    }
+  }
+  c_stop = CYCLES();
+  stop = now_ns();
+  printf("sprintf:      %7.1f ns/msg  %7.0f cycles/msg  %6.1f MB/s  %4.1f writes/msg\n",
+         (stop - start) / messages, (double)(c_stop - c_start) / messages,
+         (double)(host_tx_bytes - tx_bytes) / (stop - start) * 1.0e3,
+         (double)(host_tx_calls - tx_calls) / messages);
+
+/*
+ * Time the writer
+ */
+  tx_bytes = host_tx_bytes;
+  tx_calls = host_tx_calls;
+  start = now_ns();
+  c_start = CYCLES();
+  for (r=0; r != repeats; r++)
+  {
+    for (i=0; i != count; i++)
+    {
+      length = new_message(&scores[i], message, sizeof(message));
+    }
+  }
+  c_stop = CYCLES();
+  stop = now_ns();
+  printf("writer:       %7.1f ns/msg  %7.0f cycles/msg  %6.1f MB/s  %4.1f writes/msg\n",
+         (stop - start) / messages, (double)(c_stop - c_start) / messages,
+         (double)(host_tx_bytes - tx_bytes) / (stop - start) * 1.0e3,
+         (double)(host_tx_calls - tx_calls) / messages);
+  (void)length;
+
+  if ( bad != 0 )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
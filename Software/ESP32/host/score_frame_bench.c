@@ -0,0 +1,581 @@
+/*----------------------------------------------------------------
+ *
+ * score_frame_bench.c
+ *
+ * Compare JSON and binary scores and send both over a pty
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   score_frame_bench [-n scores] [-b baud] [-S solver] [-T type]
+ *
+ * A set of random scores (and every 8th one a miss) is built with
+ * format_score() / format_miss() and frame_score() / frame_miss()
+ * from compute_hit.c.  The program then:
+ *
+ *   - decodes every frame and checks it against the JSON text
+ *   - damages one frame in ten in a stream mixed with JSON text
+ *     and checks that the decoder throws the damaged ones away,
+ *     never passes on a wrong score, and finds the next good one
+ *   - writes all of the scores through a pseudo-terminal pair,
+ *     first as JSON and then as frames, and reads them back
+ *
+ * The report shows the bytes per score, the wire time at the baud
+ * rate given, the time to encode and decode, and the scores a
+ * second through the pty.
+ *
+ * The program returns non zero if any check fails.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <pty.h>
+
+#include "freETarget.h"
+#include "json.h"
+#include "compute_hit.h"
+#include "score_frame.h"
+#include "host_stubs.h"
+
+#define MAX_SCORES  65536                   // Largest set of scores
+
+static score_t       scores[MAX_SCORES];
+static char*         json_stream;           // Every score as JSON
+static unsigned long json_bytes;
+static char*         frame_stream;          // Every score as a frame
+static unsigned long frame_bytes;
+static int           failures;
+
+/*
+ * What the pty writer sends
+ */
+typedef struct pty_job
+{
+  int           fd;
+  const char*   data;
+  unsigned long length;
+} pty_job_t;
+
+/*----------------------------------------------------------------
+ *
+ * @function: now_ns
+ *
+ * @brief:    Monotonic time in nanoseconds
+ *
+ *--------------------------------------------------------------*/
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+}
+
+static void check
+(
+  int         ok,
+  const char* what
+)
+{
+  printf("%-48s %s\n", what, ok ? "pass" : "FAIL");
+  if ( !ok )
+  {
+    failures++;
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: make_scores
+ *
+ * @brief:    Fill the table with random scores
+ *
+ *--------------------------------------------------------------*/
+static void make_scores
+(
+  int count
+)
+{
+  int      i, j;
+  score_t* shot;
+
+  srand(1);
+  for (i=0; i != count; i++)
+  {
+    shot = &scores[i];
+    shot->shot_number = i % 65536;
+    shot->shot_time   = rand() % 1000000;
+    shot->x           = (float)((rand() % 200000) - 100000) / 100.0f;  // +/- 1000 clocks
+    shot->y           = (float)((rand() % 200000) - 100000) / 100.0f;
+    shot->s_of_sound  = (float)s_of_sound;
+    shot->residual    = (float)(rand() % 10000) / 1000.0f;
+    shot->face_strike = rand() % 100;
+    shot->is_miss     = (i % 8) == 7;
+    for (j=N; j <= W; j++)
+    {
+      shot->count[j] = rand() % 10000;
+    }
+    for (j=0; j != 8; j++)
+    {
+      shot->timer_count[j] = rand() % 32768;
+    }
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: json_number
+ *
+ * @brief:    Pull a number out of the JSON text
+ *
+ *--------------------------------------------------------------*/
+static double json_number
+(
+  const char* json,
+  const char* key
+)
+{
+  const char* s;
+
+  s = strstr(json, key);
+  if ( s == NULL )
+  {
+    return NAN;
+  }
+
+  return strtod(s + strlen(key), NULL);
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: same_score
+ *
+ * @brief:    Check a decoded record against the JSON text
+ *
+ *--------------------------------------------------------------*/
+static int same_score
+(
+  const char*           json,
+  unsigned int          type,
+  const score_record_t* r
+)
+{
+  static const char* timer_keys[] = { "\"N\":", "\"E\":", "\"S\":", "\"W\":" };
+  static const char* count_keys[] = { "\"n\":", "\"e\":", "\"s\":", "\"w\":" };
+  int i;
+
+  if ( (r->shot != (unsigned int)json_number(json, "\"shot\":"))
+      || (fabs(r->time - json_number(json, "\"time\":") * 100.0) > 0.5) )
+  {
+    return 0;
+  }
+
+  if ( type == SCORE_FRAME_MISS )
+  {
+    for (i=0; i != 4; i++)
+    {
+      if ( r->timer[i] != (unsigned int)json_number(json, timer_keys[i]) )
+      {
+        return 0;
+      }
+    }
+    return r->count[0] == (unsigned int)json_number(json, "\"face\":");
+  }
+
+  if ( (fabs(r->x - json_number(json, "\"x\":") * 100.0) > 0.5)
+      || (fabs(r->y - json_number(json, "\"y\":") * 100.0) > 0.5) )
+  {
+    return 0;
+  }
+  if ( (r->flags & RECORD_REAL)
+      && ((fabs(r->real_x - json_number(json, "\"real_x\":") * 100.0) > 0.5)
+        || (fabs(r->real_y - json_number(json, "\"real_y\":") * 100.0) > 0.5)) )
+  {
+    return 0;
+  }
+  if ( (r->flags & RECORD_RESIDUAL)
+      && (fabs(r->residual - json_number(json, "\"res\":") * 100.0) > 0.5) )
+  {
+    return 0;
+  }
+  for (i=0; (r->flags & RECORD_TIMERS) && (i != 4); i++)
+  {
+    if ( (r->count[i] != (unsigned int)json_number(json, count_keys[i]))
+        || (r->timer[i] != (unsigned int)json_number(json, timer_keys[i])) )
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: pty_writer
+ *
+ * @brief:    Write a stream into the pty
+ *
+ *--------------------------------------------------------------*/
+static void* pty_writer
+(
+  void* arg
+)
+{
+  pty_job_t*    job = arg;
+  unsigned long sent;
+  long          n;
+
+  sent = 0;
+  while ( sent < job->length )
+  {
+    n = write(job->fd, job->data + sent, job->length - sent);
+    if ( n <= 0 )
+    {
+      break;
+    }
+    sent += n;
+  }
+
+  return NULL;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: pty_run
+ *
+ * @brief:    Send a stream through the pty and count what arrives
+ *
+ * @return:   Time taken (ns)
+ *
+ *--------------------------------------------------------------*/
+static double pty_run
+(
+  int             master,
+  int             slave,
+  const char*     data,
+  unsigned long   length,
+  int             binary,               // TRUE to decode frames
+  unsigned long*  got                   // Scores received
+)
+{
+  pthread_t       writer;
+  pty_job_t       job;
+  struct pollfd   p;
+  score_decoder_t d;
+  char            buffer[4096];
+  unsigned long   received;
+  long            n;
+  int             i;
+  double          start;
+
+  score_frame_reset(&d);
+  job.fd = master;
+  job.data = data;
+  job.length = length;
+  *got = 0;
+  received = 0;
+
+  start = now_ns();
+  pthread_create(&writer, NULL, pty_writer, &job);
+
+  p.fd = slave;
+  p.events = POLLIN;
+  while ( (received < length) && (poll(&p, 1, 1000) > 0) )
+  {
+    n = read(slave, buffer, sizeof(buffer));
+    if ( n <= 0 )
+    {
+      break;
+    }
+    received += n;
+    for (i=0; i != n; i++)
+    {
+      if ( binary )
+      {
+        if ( score_frame_decode(&d, buffer[i]) != 0 )
+        {
+          (*got)++;
+        }
+      }
+      else if ( buffer[i] == '}' )
+      {
+        (*got)++;
+      }
+    }
+  }
+  pthread_join(writer, NULL);
+
+  return now_ns() - start;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  int             count = 20000;            // Number of scores, at most 65536
+  long            baud = 115200;
+  char            message[SCORE_SIZE];
+  char            frame[SCORE_FRAME_SIZE];
+  unsigned int    length, frame_length, type;
+  score_decoder_t d;
+  struct termios  raw;
+  int             master, slave;
+  int             i, j, bad;
+  unsigned long   at, got, wrong, damaged, kept, passed;
+  unsigned int*   frame_start;
+  char*           mixed;
+  double          start, encode_ns, json_ns, decode_ns, json_pty, frame_pty;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-n") == 0) && (i+1 < argc) )
+    {
+      count = atoi(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-b") == 0) && (i+1 < argc) )
+    {
+      baud = atol(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-S") == 0) && (i+1 < argc) )
+    {
+      json_solver = atoi(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-T") == 0) && (i+1 < argc) )
+    {
+      json_target_type = atoi(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-n scores] [-b baud] [-S solver] [-T type]\n", argv[0]);
+      return 2;
+    }
+  }
+  if ( (count <= 0) || (count > 65536) )
+  {
+    count = 65536;                          // The shot number is 16 bits
+  }
+  if ( baud <= 0 )
+  {
+    baud = 115200;
+  }
+
+  s_of_sound = speed_of_sound(host_temperature, host_humidity);
+  make_scores(count);
+  json_stream  = malloc((unsigned long)count * SCORE_SIZE);
+  frame_stream = malloc((unsigned long)count * SCORE_FRAME_SIZE);
+  frame_start  = malloc((count + 1) * sizeof(unsigned int));
+
+/*
+ * Build both and check that every frame says what the JSON says
+ */
+  score_frame_reset(&d);
+  bad = 0;
+  json_bytes = 0;
+  frame_bytes = 0;
+  for (i=0; i != count; i++)
+  {
+    if ( scores[i].is_miss )
+    {
+      length = format_miss(message, sizeof(message), &scores[i]);
+      frame_length = frame_miss(frame, sizeof(frame), &scores[i]);
+    }
+    else
+    {
+      length = format_score(message, sizeof(message), &scores[i]);
+      frame_length = frame_score(frame, sizeof(frame), &scores[i]);
+    }
+    memcpy(&json_stream[json_bytes], message, length);
+    json_bytes += length;
+    frame_start[i] = frame_bytes;
+    memcpy(&frame_stream[frame_bytes], frame, frame_length);
+    frame_bytes += frame_length;
+
+    type = 0;
+    for (j=0; j != (int)frame_length; j++)
+    {
+      type = score_frame_decode(&d, frame[j]);
+    }
+    if ( (type != (scores[i].is_miss ? SCORE_FRAME_MISS : SCORE_FRAME_SCORE))
+        || !same_score(message, type, &d.record) )
+    {
+      if ( bad++ == 0 )
+      {
+        printf("first mismatch: %s", message);
+      }
+    }
+  }
+  frame_start[count] = frame_bytes;
+  check(bad == 0, "every frame matches its JSON");
+  check(d.errors == 0, "no CRC or length errors");
+
+/*
+ * Events
+ */
+  frame_length = score_frame_event(frame, sizeof(frame), EVENT_TABATA_WARN, -7);
+  type = 0;
+  for (j=0; j != (int)frame_length; j++)
+  {
+    type = score_frame_decode(&d, frame[j]);
+  }
+  check((type == SCORE_FRAME_EVENT) && (d.event.event == EVENT_TABATA_WARN) && (d.event.value == -7)
+        && (strcmp(score_event_name(EVENT_TABATA_WARN), "TABATA_WARN") == 0), "events round trip");
+
+/*
+ * Damage one frame in ten in a stream with JSON text in between
+ */
+  mixed = malloc(frame_bytes * 2 + (unsigned long)count * 32);
+  srand(3);
+  at = 0;
+  damaged = 0;
+  for (i=0; i != count; i++)
+  {
+    if ( (i % 5) == 0 )
+    {
+      at += sprintf(&mixed[at], "{\"VERSION\":5, \"x\":%d}\r\n", i);
+    }
+    length = frame_start[i+1] - frame_start[i];
+    memcpy(&mixed[at], &frame_stream[frame_start[i]], length);
+    if ( (i % 10) == 3 )
+    {
+      mixed[at + 1 + rand() % (length - 1)] ^= 1 << (rand() % 8);
+      damaged++;
+    }
+    at += length;
+  }
+
+  score_frame_reset(&d);
+  got = 0;
+  wrong = 0;
+  kept = 0;
+  for (j=0; j != (long)at; j++)
+  {
+    type = score_frame_decode(&d, mixed[j]);
+    if ( type == 0 )
+    {
+      continue;
+    }
+    got++;
+    i = d.record.shot;                      // Shot numbers are the index
+    if ( (i >= count) || (scores[i].shot_time * 100 / ONE_SECOND != d.record.time) )
+    {
+      i = count;
+    }
+    frame_length = (i == count) ? 0
+                 : (scores[i].is_miss ? frame_miss(frame, sizeof(frame), &scores[i])
+                                      : frame_score(frame, sizeof(frame), &scores[i]));
+    if ( (i == count) || ((i % 10) == 3)
+        || (memcmp(frame, &frame_stream[frame_start[i]], frame_length) != 0) )
+    {
+      wrong++;
+    }
+    else
+    {
+      kept++;
+    }
+  }
+  passed = count - damaged;
+  printf("damaged %lu of %d frames, decoded %lu good, %lu wrong, %lu thrown away\n",
+         damaged, count, kept, wrong, d.errors);
+  check(wrong == 0, "no damaged frame is passed on");
+  check(kept >= passed - passed / 20, "the frames after the damage are found");
+  free(mixed);
+
+/*
+ * Time the encoders and the decoder
+ */
+  start = now_ns();
+  for (i=0; i != count; i++)
+  {
+    if ( scores[i].is_miss )
+    {
+      format_miss(message, sizeof(message), &scores[i]);
+    }
+    else
+    {
+      format_score(message, sizeof(message), &scores[i]);
+    }
+  }
+  json_ns = (now_ns() - start) / count;
+
+  start = now_ns();
+  for (i=0; i != count; i++)
+  {
+    if ( scores[i].is_miss )
+    {
+      frame_miss(frame, sizeof(frame), &scores[i]);
+    }
+    else
+    {
+      frame_score(frame, sizeof(frame), &scores[i]);
+    }
+  }
+  encode_ns = (now_ns() - start) / count;
+
+  score_frame_reset(&d);
+  start = now_ns();
+  for (at=0; at != frame_bytes; at++)
+  {
+    score_frame_decode(&d, frame_stream[at]);
+  }
+  decode_ns = (now_ns() - start) / count;
+
+/*
+ * Through a pseudo-terminal
+ */
+  if ( openpty(&master, &slave, NULL, NULL, NULL) != 0 )
+  {
+    perror("openpty");
+    return 1;
+  }
+  tcgetattr(slave, &raw);
+  cfmakeraw(&raw);
+  tcsetattr(slave, TCSANOW, &raw);
+  tcgetattr(master, &raw);
+  cfmakeraw(&raw);
+  tcsetattr(master, TCSANOW, &raw);
+
+  json_pty = pty_run(master, slave, json_stream, json_bytes, 0, &got);
+  check(got == (unsigned long)count, "every JSON score came through the pty");
+  frame_pty = pty_run(master, slave, frame_stream, frame_bytes, 1, &got);
+  check(got == (unsigned long)count, "every frame came through the pty");
+  close(master);
+  close(slave);
+
+  printf("\n%-8s %8s %12s %10s %10s %12s\n", "", "bytes", "wire (ms)", "encode", "decode", "pty");
+  printf("%-8s %8.1f %12.2f %7.0f ns %10s %8.0f k/s\n", "JSON",
+         (double)json_bytes / count, (double)json_bytes * 10 * 1000 / baud / count,
+         json_ns, "-", count / json_pty * 1.0e6);
+  printf("%-8s %8.1f %12.2f %7.0f ns %7.0f ns %8.0f k/s\n", "binary",
+         (double)frame_bytes / count, (double)frame_bytes * 10 * 1000 / baud / count,
+         encode_ns, decode_ns, count / frame_pty * 1.0e6);
+  printf("wire time per score at %ld baud\n", baud);
+
+  if ( failures != 0 )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
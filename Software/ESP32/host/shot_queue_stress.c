@@ -0,0 +1,234 @@
+/*----------------------------------------------------------------
+ *
+ * shot_queue_stress.c
+ *
+ * Hammer the shot queue from two threads
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   shot_queue_stress [-n shots] [-d consumer_delay_ns] [-o]
+ *
+ * One thread stands in for aquire() and pushes shots as fast as
+ * it can.  The other stands in for reduce() and takes them off.
+ * The producer waits for space so that every shot goes through
+ * the queue.
+ *
+ * Every timer_count[] is filled with a pattern made from the
+ * sequence number, so the consumer can tell if it has read a
+ * record that was only partly written (torn).  The sequence
+ * numbers must always increase.  Any gap must be matched by
+ * the overflow counter, and by what shot_queue_lost() reports.
+ *
+ * -o lets the producer drop shots when the queue is full, the
+ * way aquire() does, and -d slows the consumer down so that the
+ * overflow path is exercised.
+ *
+ * The program returns non zero if a shot was torn, seen twice,
+ * or lost without being counted.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "freETarget.h"
+#include "shot_queue.h"
+
+static shot_queue_t  queue;
+static unsigned long shot_count = 1000000;  // Shots to push
+static long          delay_ns;              // Extra consumer time per shot
+static int           allow_overflow;        // TRUE to drop shots like aquire()
+static volatile int  producer_done;
+
+static unsigned long received;              // Shots taken off the queue
+static unsigned long torn;                  // Records with mixed contents
+static unsigned long repeated;              // Sequence went backwards or repeated
+static unsigned long gaps;                  // Shots missing from the sequence
+static unsigned long reported;              // Shots shot_queue_lost() said were dropped
+
+static double now_s(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1.0e9;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: producer
+ *
+ * @brief:    Play the part of aquire()
+ *
+ *--------------------------------------------------------------*/
+static void* producer
+(
+  void* arg
+)
+{
+  unsigned long  i;
+  int            j;
+  shot_record_t* record;
+
+  for (i=0; i != shot_count; i++)
+  {
+    while ( (allow_overflow == 0)
+         && (shot_queue_count(&queue) == (SHOT_STRING - 1)) )
+    {
+      sched_yield();                        // Wait for space
+    }
+    record = shot_queue_claim(&queue);
+    if ( record == NULL )
+    {
+      continue;                             // Dropped and counted
+    }
+    for (j=0; j != 8; j++)
+    {
+      record->timer_count[j] = (int)(record->sequence * 8 + j);
+    }
+    record->shot_number = record->sequence;
+    shot_queue_publish(&queue);
+  }
+
+  producer_done = 1;
+  return NULL;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: consumer
+ *
+ * @brief:    Play the part of reduce()
+ *
+ *--------------------------------------------------------------*/
+static void* consumer
+(
+  void* arg
+)
+{
+  shot_record_t*  record;
+  unsigned int    expected;
+  int             j;
+  struct timespec pause;
+
+  expected = 0;
+  pause.tv_sec  = 0;
+  pause.tv_nsec = delay_ns;
+
+  while ( 1 )
+  {
+    record = shot_queue_peek(&queue);
+    if ( record == NULL )
+    {
+      if ( producer_done && (shot_queue_count(&queue) == 0) )
+      {
+        break;
+      }
+      sched_yield();                        // Wait for a shot
+      continue;
+    }
+
+    for (j=0; j != 8; j++)
+    {
+      if ( record->timer_count[j] != (int)(record->sequence * 8 + j) )
+      {
+        torn++;
+        break;
+      }
+    }
+    if ( record->shot_number != record->sequence )
+    {
+      torn++;
+    }
+
+    if ( record->sequence < expected )
+    {
+      repeated++;
+    }
+    else
+    {
+      gaps += record->sequence - expected;
+      expected = record->sequence + 1;
+    }
+
+    if ( delay_ns != 0 )
+    {
+      nanosleep(&pause, NULL);
+    }
+
+    shot_queue_release(&queue);
+    received++;
+    reported += shot_queue_lost(&queue);
+  }
+
+  gaps += queue.sequence - expected;        // Dropped off the end
+  reported += shot_queue_lost(&queue);
+  return NULL;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  pthread_t p, c;
+  double    start, stop;
+  int       i;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-n") == 0) && (i+1 < argc) )
+    {
+      shot_count = strtoul(argv[++i], NULL, 0);
+    }
+    else if ( (strcmp(argv[i], "-d") == 0) && (i+1 < argc) )
+    {
+      delay_ns = atol(argv[++i]);
+    }
+    else if ( strcmp(argv[i], "-o") == 0 )
+    {
+      allow_overflow = 1;
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-n shots] [-d consumer_delay_ns] [-o]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  shot_queue_init(&queue);
+
+  start = now_s();
+  pthread_create(&c, NULL, consumer, NULL);
+  pthread_create(&p, NULL, producer, NULL);
+  pthread_join(p, NULL);
+  pthread_join(c, NULL);
+  stop = now_s();
+
+  printf("shots:        %lu pushed, %lu received, %u overflow\n", shot_count, received, queue.overflow);
+  printf("throughput:   %.0f shots/s\n", (double)received / (stop - start));
+  printf("torn:         %lu\n", torn);
+  printf("repeated:     %lu\n", repeated);
+  printf("lost:         %lu (%lu not counted as overflow, %lu reported)\n", gaps, gaps - queue.overflow, reported);
+
+  if ( (torn != 0) || (repeated != 0) || (gaps != queue.overflow) || (reported != queue.overflow)
+      || (received + queue.overflow != shot_count) )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
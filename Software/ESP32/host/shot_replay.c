@@ -0,0 +1,385 @@
+/*----------------------------------------------------------------
+ *
+ * shot_replay.c
+ *
+ * Replay captured counter values through the scoring pipeline
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   shot_replay [-r repeats] [-S solver] [-s] [-v] shots.txt
+ *   shot_replay -g count [seed] > shots.txt
+ *
+ * Each line of the shot file holds the eight timer_count[] values
+ * as reported by the target
+ *
+ *   N E S W n e s w [x_mm y_mm]
+ *
+ * The optional x_mm and y_mm are the true location of the shot
+ * in the sensor frame.  If present the position error is reported.
+ * Lines starting with # are ignored.
+ *
+ * -g synthesises a shot file using the current geometry.  The
+ * sound path includes the slant range to the sensor plane.
+ *
+ * -S selects the compute_hit() algorithm (json_solver).
+ * 
+ * -s includes build_score() and send_score() in the timed section.
+ *
+ * The program reports the throughput, the latency percentiles
+ * and the number of passes through the compute_hit() loop.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "freETarget.h"
+#include "json.h"
+#include "compute_hit.h"
+#include "host_stubs.h"
+
+#define MAX_SHOTS     100000      // Largest shot file accepted
+#define MAX_PASS      32          // Size of the iteration histogram
+#define READ_DELAY    100.0       // us from last arrival to reading the counters
+
+typedef struct
+{
+  int    timer_count[8];          // Captured counter values
+  int    has_truth;               // TRUE if the true location is known
+  double x, y;                    // True location (mm)
+} replay_t;
+
+static replay_t shots[MAX_SHOTS];
+
+/*----------------------------------------------------------------
+ *
+ * @function: now_ns
+ *
+ * @brief:    Monotonic time in nanoseconds
+ *
+ *--------------------------------------------------------------*/
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+}
+
+static int compare_double
+(
+  const void* a,
+  const void* b
+)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+
+  return (x > y) - (x < y);
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: generate
+ *
+ * @brief:    Write synthetic shots to stdout
+ *
+ *----------------------------------------------------------------
+ *
+ * The sensors are placed where init_sensors() expects them.  The
+ * arrival time at each sensor is the slant range divided by the
+ * speed of sound, and the counters are read READ_DELAY us after
+ * the last arrival.  The high counters carry a small rise time.
+ *
+ *--------------------------------------------------------------*/
+static void generate
+(
+  int          count,             // How many shots to generate
+  unsigned int seed               // Random number seed
+)
+{
+  int    i, j;
+  double sx[4], sy[4];            // Sensor location (mm)
+  double x, y, r, a;              // Shot location
+  double t[4], t_last;            // Arrival times (us)
+
+  srand(seed);
+  s_of_sound = speed_of_sound(host_temperature, host_humidity);
+
+  sx[N] = json_north_x;                          sy[N] = json_sensor_dia / 2.0 + json_north_y;
+  sx[E] = json_sensor_dia / 2.0 + json_east_x;   sy[E] = json_east_y;
+  sx[S] = json_south_x;                          sy[S] = -(json_sensor_dia / 2.0 + json_south_y);
+  sx[W] = -(json_sensor_dia / 2.0 + json_west_x);sy[W] = json_west_y;
+
+  printf("# N E S W n e s w x_mm y_mm  (%d shots, seed %u, z_offset %d mm)\n", count, seed, json_z_offset);
+
+  for (i=0; i != count; i++)
+  {
+    r = (json_sensor_dia / 2.0) * 0.7 * sqrt((double)rand() / RAND_MAX);
+    a = 2.0 * PI * (double)rand() / RAND_MAX;
+    x = r * cos(a);
+    y = r * sin(a);
+
+    t_last = 0;
+    for (j=N; j <= W; j++)
+    {
+      t[j] = sqrt(sq(sx[j] - x) + sq(sy[j] - y) + sq(json_z_offset)) / s_of_sound;
+      if ( t[j] > t_last )
+      {
+        t_last = t[j];
+      }
+    }
+
+    for (j=N; j <= W; j++)
+    {
+      printf("%d ", (int)((t_last + READ_DELAY - t[j]) * OSCILLATOR_MHZ + 0.5));
+    }
+    for (j=N; j <= W; j++)
+    {
+      printf("%d ", 40 + (rand() % 20));
+    }
+    printf("%.3f %.3f\n", x, y);
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: load
+ *
+ * @brief:    Read the shot file
+ *
+ * @return:   Number of shots read
+ *
+ *--------------------------------------------------------------*/
+static int load
+(
+  char* file_name
+)
+{
+  FILE* f;
+  char  line[256];
+  int   n, count;
+  replay_t* r;
+
+  f = fopen(file_name, "r");
+  if ( f == NULL )
+  {
+    perror(file_name);
+    return -1;
+  }
+
+  count = 0;
+  while ( (count < MAX_SHOTS) && (fgets(line, sizeof(line), f) != NULL) )
+  {
+    if ( (line[0] == '#') || (line[0] == '\n') )
+    {
+      continue;
+    }
+    r = &shots[count];
+    n = sscanf(line, "%d %d %d %d %d %d %d %d %lf %lf",
+               &r->timer_count[0], &r->timer_count[1], &r->timer_count[2], &r->timer_count[3],
+               &r->timer_count[4], &r->timer_count[5], &r->timer_count[6], &r->timer_count[7],
+               &r->x, &r->y);
+    if ( n < 8 )
+    {
+      continue;
+    }
+    r->has_truth = (n == 10);
+    count++;
+  }
+
+  fclose(f);
+  return count;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  int            i, j, n, shot_count, repeats, with_score;
+  char*          file_name;
+  shot_record_t  shot;
+  score_t        score;
+  double*        latency;
+  double         start, stop, total;
+  unsigned int   pass_min, pass_max, histogram[MAX_PASS];
+  double         pass_sum;
+  double         error, err_sum, err_max;
+  double         residual, res_sum, res_max;
+  int            err_count, res_count, misses;
+
+  repeats    = 1;
+  with_score = 0;
+  file_name  = NULL;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-g") == 0) && (i+1 < argc) )
+    {
+      n = atoi(argv[i+1]);
+      generate(n, (i+2 < argc) ? (unsigned int)atoi(argv[i+2]) : 1);
+      return 0;
+    }
+    else if ( (strcmp(argv[i], "-r") == 0) && (i+1 < argc) )
+    {
+      repeats = atoi(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-S") == 0) && (i+1 < argc) )
+    {
+      json_solver = atoi(argv[++i]);
+    }
+    else if ( strcmp(argv[i], "-s") == 0 )
+    {
+      with_score = 1;
+    }
+    else if ( strcmp(argv[i], "-v") == 0 )
+    {
+      host_echo = true;
+    }
+    else
+    {
+      file_name = argv[i];
+    }
+  }
+
+  if ( (file_name == NULL) || (repeats < 1) )
+  {
+    fprintf(stderr, "Usage: %s [-r repeats] [-S solver] [-s] [-v] shots.txt\n       %s -g count [seed]\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  shot_count = load(file_name);
+  if ( shot_count <= 0 )
+  {
+    fprintf(stderr, "No shots in %s\n", file_name);
+    return 1;
+  }
+
+  latency = malloc(sizeof(double) * shot_count * repeats);
+  if ( latency == NULL )
+  {
+    return 1;
+  }
+
+/*
+ * Run the shots through the pipeline
+ */
+  memset(histogram, 0, sizeof(histogram));
+  pass_min = 0xffffffff;
+  pass_max = 0;
+  pass_sum = 0;
+  err_sum  = 0;
+  err_max  = 0;
+  res_sum  = 0;
+  res_max  = 0;
+  res_count = 0;
+  err_count = 0;
+  misses    = 0;
+  n = 0;
+  total = 0;
+
+  for (j=0; j != repeats; j++)
+  {
+    for (i=0; i != shot_count; i++)
+    {
+      memset(&shot, 0, sizeof(shot));
+      memcpy(shot.timer_count, shots[i].timer_count, sizeof(shot.timer_count));
+      shot.shot_number = i;
+
+      start = now_ns();
+      if ( compute_hit(&shot) == MISS )
+      {
+        if ( with_score )
+        {
+          build_score(&score, &shot, true);
+          send_miss(&score);
+        }
+        stop = now_ns();
+        misses++;
+      }
+      else
+      {
+        if ( with_score )
+        {
+          build_score(&score, &shot, false);
+          send_score(&score);
+        }
+        stop = now_ns();
+
+        if ( solver_iterations < pass_min ) pass_min = solver_iterations;
+        if ( solver_iterations > pass_max ) pass_max = solver_iterations;
+        pass_sum += solver_iterations;
+        histogram[(solver_iterations < MAX_PASS) ? solver_iterations : (MAX_PASS-1)]++;
+
+        if ( j == 0 )
+        {
+          residual = solver_residual * s_of_sound / OSCILLATOR_MHZ;
+          res_sum += residual;
+          if ( residual > res_max ) res_max = residual;
+          res_count++;
+        }
+
+        if ( (j == 0) && shots[i].has_truth )
+        {
+          error = sqrt(sq(shot.x * s_of_sound / OSCILLATOR_MHZ - shots[i].x)
+                     + sq(shot.y * s_of_sound / OSCILLATOR_MHZ - shots[i].y));
+          err_sum += error;
+          if ( error > err_max ) err_max = error;
+          err_count++;
+        }
+      }
+
+      latency[n++] = stop - start;
+      total += stop - start;
+    }
+  }
+
+/*
+ * Report the results
+ */
+  qsort(latency, n, sizeof(double), compare_double);
+
+  printf("shots:        %d x %d repeats (%d misses)\n", shot_count, repeats, misses);
+  printf("throughput:   %.0f shots/s\n", (double)n / (total / 1.0e9));
+  printf("latency (us): p50 %.2f  p99 %.2f  max %.2f\n",
+         latency[n / 2] / 1000.0, latency[(n * 99) / 100] / 1000.0, latency[n - 1] / 1000.0);
+  if ( n != misses )
+  {
+    printf("iterations:   min %u  avg %.2f  max %u\n", pass_min, pass_sum / (n - misses), pass_max);
+    for (i=0; i != MAX_PASS; i++)
+    {
+      if ( histogram[i] != 0 )
+      {
+        printf("  %2d%s: %u\n", i, (i == MAX_PASS-1) ? "+" : " ", histogram[i]);
+      }
+    }
+  }
+  if ( (json_solver != SOLVER_ITERATE) && (res_count != 0) )
+  {
+    printf("residual (mm): avg %.3f  max %.3f\n", res_sum / res_count, res_max);
+  }
+  if ( err_count != 0 )
+  {
+    printf("error (mm):   avg %.3f  max %.3f\n", err_sum / err_count, err_max);
+  }
+  if ( with_score )
+  {
+    printf("output:       %lu bytes in %lu writes\n", host_tx_bytes, host_tx_calls);
+  }
+
+  free(latency);
+  return 0;
+}
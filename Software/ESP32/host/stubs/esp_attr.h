@@ -0,0 +1,14 @@
+/*----------------------------------------------------------------
+ *
+ * esp_attr.h
+ *
+ * Host stand-in for the ESP-IDF memory placement attributes
+ *
+ *---------------------------------------------------------------*/
+#ifndef _HOST_ESP_ATTR_H_
+#define _HOST_ESP_ATTR_H_
+
+#define IRAM_ATTR                     // Everything is in RAM on the host
+#define DRAM_ATTR
+
+#endif
@@ -0,0 +1,15 @@
+/*----------------------------------------------------------------
+ *
+ * esp_timer.h
+ *
+ * Host stand-in for the ESP-IDF high resolution timer
+ *
+ *---------------------------------------------------------------*/
+#ifndef _HOST_ESP_TIMER_H_
+#define _HOST_ESP_TIMER_H_
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);             // Microseconds since start
+
+#endif
@@ -0,0 +1,29 @@
+/*----------------------------------------------------------------
+ *
+ * freertos/FreeRTOS.h
+ *
+ * Host stand-in for the FreeRTOS kernel definitions
+ *
+ *----------------------------------------------------------------
+ *
+ * Only the types and constants used by the scoring sources are
+ * provided.  This file is never seen by the ESP-IDF build.
+ *
+ *---------------------------------------------------------------*/
+#ifndef _HOST_FREERTOS_H_
+#define _HOST_FREERTOS_H_
+
+#include <stdint.h>
+#include <stdbool.h>                 // The IDF headers pull this in
+
+typedef int          BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t     TickType_t;
+
+#define pdFALSE       0
+#define pdTRUE        1
+#define pdPASS        pdTRUE
+#define pdFAIL        pdFALSE
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+
+#endif
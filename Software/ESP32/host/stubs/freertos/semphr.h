@@ -0,0 +1,24 @@
+/*----------------------------------------------------------------
+ *
+ * freertos/semphr.h
+ *
+ * Host stand-in for the FreeRTOS semaphore API
+ *
+ *----------------------------------------------------------------
+ *
+ * The host programs that use it are single threaded, so a mutex
+ * is always free.
+ *
+ *---------------------------------------------------------------*/
+#ifndef _HOST_SEMPHR_H_
+#define _HOST_SEMPHR_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef void* SemaphoreHandle_t;
+
+#define xSemaphoreCreateMutex()       ((SemaphoreHandle_t)1)
+#define xSemaphoreTake(sem, ticks)    ((void)(sem), (void)(ticks), pdTRUE)
+#define xSemaphoreGive(sem)           ((void)(sem), pdTRUE)
+
+#endif
@@ -0,0 +1,15 @@
+/*----------------------------------------------------------------
+ *
+ * freertos/task.h
+ *
+ * Host stand-in for the FreeRTOS task API
+ *
+ *---------------------------------------------------------------*/
+#ifndef _HOST_TASK_H_
+#define _HOST_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+#define vTaskDelay(ticks) ((void)(ticks))     // Nothing to wait for on the host
+
+#endif
@@ -0,0 +1,21 @@
+/*----------------------------------------------------------------
+ *
+ * lwip/sockets.h
+ *
+ * Host stand-in for the lwIP BSD socket API
+ *
+ *---------------------------------------------------------------*/
+#ifndef _HOST_LWIP_SOCKETS_H_
+#define _HOST_LWIP_SOCKETS_H_
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#endif
@@ -0,0 +1,40 @@
+/*----------------------------------------------------------------
+ *
+ * nvs.h
+ *
+ * Host stand-in for the ESP-IDF non volatile storage API
+ *
+ *----------------------------------------------------------------
+ *
+ * The functions are provided by host_nvs.c, which keeps the
+ * values in RAM and counts the writes and commits.
+ *
+ *---------------------------------------------------------------*/
+#ifndef _HOST_NVS_H_
+#define _HOST_NVS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>                 // The IDF headers pull this in
+
+typedef int      esp_err_t;
+typedef uint32_t nvs_handle_t;
+
+typedef enum
+{
+  NVS_READONLY,
+  NVS_READWRITE
+} nvs_open_mode_t;
+
+#define ESP_OK                     0
+#define ESP_FAIL                  -1
+#define ESP_ERR_NVS_NOT_FOUND      0x1102
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle);
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char* key, int32_t value);
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char* key, int32_t* out_value);
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value);
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length);
+esp_err_t nvs_commit(nvs_handle_t handle);
+
+#endif
@@ -0,0 +1,13 @@
+/*----------------------------------------------------------------
+ *
+ * nvs_flash.h
+ *
+ * Host stand-in for the ESP-IDF NVS flash initialization
+ *
+ *---------------------------------------------------------------*/
+#ifndef _HOST_NVS_FLASH_H_
+#define _HOST_NVS_FLASH_H_
+
+#include "nvs.h"
+
+#endif
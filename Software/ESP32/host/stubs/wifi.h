@@ -0,0 +1,9 @@
+/*----------------------------------------------------------------
+ *
+ * wifi.h
+ *
+ * json.c includes "wifi.h", which only finds WiFi.h on a file
+ * system that ignores case.
+ *
+ *---------------------------------------------------------------*/
+#include "WiFi.h"
@@ -0,0 +1,625 @@
+/*----------------------------------------------------------------
+ *
+ * tcp_server_test.c
+ *
+ * Run the TCP server on the host and talk to it
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   tcp_server_test [-p port] [-c clients] [-n messages]
+ *
+ * tcpip_server() is started in its own thread with the host
+ * sockets underneath.  This program then:
+ *
+ *   - connects the allowed number of clients and checks that
+ *     each one is greeted
+ *   - connects one more and checks that it is turned away
+ *   - sends from every client and checks that the bytes arrive
+ *     in the input queue
+ *   - queues output the way tcpip_app_2_queue() does and times
+ *     how long it takes to reach every client
+ *   - queues a score as JSON and as a binary frame and checks that
+ *     only the client on slot 0, which asked for binary, gets it
+ *   - changes a reader's format part way through a score and checks
+ *     that the score is finished in the old format
+ *   - stops reading one client and checks that the others still
+ *     get every score on time, and that the stalled one is dropped
+ *   - drops a client and checks that its slot is freed
+ *
+ * The output queue is the tcpip_ring.c used by serial_io.c, behind
+ * a mutex instead of a spin lock.  The input queue is a simple
+ * locked ring so that no UART code is needed.
+ *
+ * The program returns non zero if any of the checks fail.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <poll.h>
+
+#include "lwip/sockets.h"
+
+#include "freETarget.h"
+#include "serial_io.h"
+#include "tcpip_server.h"
+#include "tcpip_ring.h"
+
+#define RING_SIZE     4096                  // Bytes in each queue
+#define PAYLOAD       "{\"shot\":1, \"miss\":0}\r\n"
+#define STALL_SHOTS   100000                // Most scores sent while one client is stalled
+#define FRAME         "\xA5\x01\x04\x00\x01\x00\x02\x34\x12" // Binary, with a 0 in it
+
+typedef struct ring
+{
+  pthread_mutex_t lock;
+  char            data[RING_SIZE];
+  unsigned int    in;
+  unsigned int    out;
+} ring_t;
+
+static tcpip_ring_t  to_socket;             // Application to clients
+static pthread_mutex_t to_lock = PTHREAD_MUTEX_INITIALIZER;
+static ring_t        from_socket = { PTHREAD_MUTEX_INITIALIZER };// Clients to application
+static int           port = 10900;          // Port used for the test
+static int           max_clients = 4;       // Clients the server allows
+static int           failures;              // Checks that did not pass
+
+/*----------------------------------------------------------------
+ *
+ * @function: ring_put
+ *            ring_get
+ *
+ * @brief:    Move bytes in and out of a ring
+ *
+ * @return:   Number of bytes moved
+ *
+ *--------------------------------------------------------------*/
+static int ring_put
+(
+  ring_t* r,
+  char*   buffer,
+  int     length
+)
+{
+  int moved;
+
+  pthread_mutex_lock(&r->lock);
+  for (moved = 0; moved != length; moved++)
+  {
+    if ( ((r->in + 1) % RING_SIZE) == r->out )
+    {
+      break;                                // Full
+    }
+    r->data[r->in] = buffer[moved];
+    r->in = (r->in + 1) % RING_SIZE;
+  }
+  pthread_mutex_unlock(&r->lock);
+
+  return moved;
+}
+
+static int ring_get
+(
+  ring_t* r,
+  char*   buffer,
+  int     length
+)
+{
+  int moved;
+
+  pthread_mutex_lock(&r->lock);
+  for (moved = 0; (moved != length) && (r->out != r->in); moved++)
+  {
+    buffer[moved] = r->data[r->out];
+    r->out = (r->out + 1) % RING_SIZE;
+  }
+  pthread_mutex_unlock(&r->lock);
+
+  return moved;
+}
+
+/*
+ * The queue functions used by tcpip_server(), as in serial_io.c
+ */
+int tcpip_queue_2_socket(int client, char* buffer, int length)
+{
+  pthread_mutex_lock(&to_lock);
+  length = tcpip_ring_peek(&to_socket, client, buffer, length);
+  pthread_mutex_unlock(&to_lock);
+  return length;
+}
+
+void tcpip_queue_sent(int client, int length)
+{
+  pthread_mutex_lock(&to_lock);
+  tcpip_ring_advance(&to_socket, client, length);
+  pthread_mutex_unlock(&to_lock);
+}
+
+void tcpip_queue_open(int client)
+{
+  pthread_mutex_lock(&to_lock);
+  tcpip_ring_open(&to_socket, client);
+  pthread_mutex_unlock(&to_lock);
+}
+
+void tcpip_queue_close(int client)
+{
+  pthread_mutex_lock(&to_lock);
+  tcpip_ring_close(&to_socket, client);
+  pthread_mutex_unlock(&to_lock);
+}
+
+bool tcpip_queue_overrun(int client)
+{
+  return tcpip_ring_overrun(&to_socket, client);
+}
+
+int tcpip_socket_2_queue(int client, char* buffer, int length)
+{
+  return ring_put(&from_socket, buffer, length);
+}
+
+static int pair_2_queue(char* json, int json_length, char* frame, int frame_length)
+{
+  pthread_mutex_lock(&to_lock);
+  json_length = tcpip_ring_put_pair(&to_socket, json, json_length, frame, frame_length);
+  pthread_mutex_unlock(&to_lock);
+  tcpip_server_wake();
+  return json_length;
+}
+
+static int app_2_queue(char* buffer, int length)
+{
+  pthread_mutex_lock(&to_lock);
+  length = tcpip_ring_put(&to_socket, buffer, length);
+  pthread_mutex_unlock(&to_lock);
+  tcpip_server_wake();
+  return length;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: now_us
+ *
+ * @brief:    Monotonic time in microseconds
+ *
+ *--------------------------------------------------------------*/
+static double now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1.0e6 + (double)ts.tv_nsec / 1.0e3;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: check
+ *
+ * @brief:    Report the result of a test
+ *
+ *--------------------------------------------------------------*/
+static void check
+(
+  int         ok,
+  const char* what
+)
+{
+  printf("%-44s %s\n", what, ok ? "pass" : "FAIL");
+  if ( !ok )
+  {
+    failures++;
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: form_switch
+ *
+ * @brief:    Change the format while a score is half sent
+ *
+ * @return:   TRUE if the score is finished in the old format and
+ *            the next one comes in the new format
+ *
+ *----------------------------------------------------------------
+ *
+ * This is what the server sees when a send() only takes part of a
+ * score and the client sends {"SCORE_FORMAT":1} before the rest.
+ * It is done on a ring of its own so that the split is exact.
+ *
+ *--------------------------------------------------------------*/
+static int form_switch(void)
+{
+  static tcpip_ring_t ring;
+  char                got[256];
+  int                 length, n;
+
+  tcpip_ring_init(&ring);
+  tcpip_ring_open(&ring, 0);
+  tcpip_ring_put_pair(&ring, PAYLOAD, sizeof(PAYLOAD) - 1, FRAME, sizeof(FRAME) - 1);
+  tcpip_ring_put_pair(&ring, PAYLOAD, sizeof(PAYLOAD) - 1, FRAME, sizeof(FRAME) - 1);
+
+  length = tcpip_ring_peek(&ring, 0, got, 5);           // A partial send()
+  tcpip_ring_advance(&ring, 0, length);
+  tcpip_ring_form(&ring, 0, 1);                         // Binary from now on
+  while ( (n = tcpip_ring_peek(&ring, 0, &got[length], sizeof(got) - length)) != 0 )
+  {
+    tcpip_ring_advance(&ring, 0, n);
+    length += n;
+  }
+
+  return (length == sizeof(PAYLOAD) - 1 + sizeof(FRAME) - 1)
+      && (memcmp(got, PAYLOAD, sizeof(PAYLOAD) - 1) == 0)
+      && (memcmp(&got[sizeof(PAYLOAD) - 1], FRAME, sizeof(FRAME) - 1) == 0);
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: read_all
+ *
+ * @brief:    Read exactly length bytes, or give up after timeout
+ *
+ * @return:   Bytes read, 0 if the server closed the connection
+ *
+ *--------------------------------------------------------------*/
+static int read_all
+(
+  int   sock,
+  char* buffer,
+  int   length,
+  int   timeout_ms
+)
+{
+  struct pollfd p;
+  int           got, n;
+
+  got = 0;
+  p.fd = sock;
+  p.events = POLLIN;
+  while ( got < length )
+  {
+    if ( poll(&p, 1, timeout_ms) <= 0 )
+    {
+      break;
+    }
+    n = recv(sock, buffer + got, length - got, 0);
+    if ( n <= 0 )
+    {
+      break;
+    }
+    got += n;
+  }
+
+  return got;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: connect_client
+ *            connect_small
+ *
+ * @brief:    Open a connection to the server
+ *
+ *--------------------------------------------------------------*/
+static int connect_small(int window);
+
+static int connect_client(void)
+{
+  return connect_small(0);
+}
+
+static int connect_small
+(
+  int window                                // Receive buffer, 0 for the default
+)
+{
+  struct sockaddr_in addr;
+  int                sock;
+  int                option = 1;
+
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  if ( window != 0 )
+  {
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &window, sizeof(window));
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ( connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 )
+  {
+    close(sock);
+    return -1;
+  }
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &option, sizeof(option));
+
+  return sock;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: wait_for_clients
+ *
+ * @brief:    Wait for the server to see the expected client count
+ *
+ *--------------------------------------------------------------*/
+static int wait_for_clients
+(
+  int count
+)
+{
+  double start;
+
+  start = now_us();
+  while ( tcpip_server_clients() != count )
+  {
+    if ( now_us() - start > 2.0e6 )
+    {
+      return 0;
+    }
+    sched_yield();
+  }
+
+  return 1;
+}
+
+static void* server_thread
+(
+  void* arg
+)
+{
+  *(int*)arg = tcpip_server(port, max_clients);
+  return NULL;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  pthread_t    server;
+  int          server_result = 0;
+  int          sock[TCPIP_MAX_CLIENTS];
+  int          extra;
+  int          messages = 1000;
+  int          i, j, length, ok;
+  char         buffer[256];
+  char         message[160];
+  char         greeting[] = "{\"CONNECTED\"}";
+  double       start, total, worst, latency;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-p") == 0) && (i+1 < argc) )
+    {
+      port = atoi(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-c") == 0) && (i+1 < argc) )
+    {
+      max_clients = atoi(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-n") == 0) && (i+1 < argc) )
+    {
+      messages = atoi(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-p port] [-c clients] [-n messages]\n", argv[0]);
+      return 2;
+    }
+  }
+  if ( (max_clients <= 0) || (max_clients > TCPIP_MAX_CLIENTS) )
+  {
+    max_clients = TCPIP_MAX_CLIENTS;
+  }
+
+  tcpip_ring_init(&to_socket);
+  pthread_create(&server, NULL, server_thread, &server_result);
+
+/*
+ * Fill every slot
+ */
+  ok = 1;
+  for (i=0; i != max_clients; i++)
+  {
+    for (j=0; j != 100; j++)                // Give the server time to listen
+    {
+      sock[i] = connect_client();
+      if ( sock[i] >= 0 )
+      {
+        break;
+      }
+      usleep(10000);
+    }
+    if ( (sock[i] < 0)
+      || (read_all(sock[i], buffer, sizeof(greeting), 1000) != sizeof(greeting))
+      || (memcmp(buffer, greeting, sizeof(greeting)) != 0) )
+    {
+      ok = 0;
+    }
+  }
+  check(ok && wait_for_clients(max_clients), "every client greeted");
+
+/*
+ * One too many
+ */
+  extra = connect_client();
+  check((extra >= 0) && (read_all(extra, buffer, sizeof(buffer), 1000) == 0)
+        && (tcpip_server_clients() == max_clients), "extra client turned away");
+  if ( extra >= 0 )
+  {
+    close(extra);
+  }
+
+/*
+ * Input from every client ends up in the queue
+ */
+  for (i=0; i != max_clients; i++)
+  {
+    send(sock[i], "{\"ECHO\":0}", 10, 0);
+  }
+  length = 0;
+  start = now_us();
+  while ( (length < max_clients * 10) && (now_us() - start < 1.0e6) )
+  {
+    length += ring_get(&from_socket, buffer + length, sizeof(buffer) - length);
+    sched_yield();
+  }
+  check(length == max_clients * 10, "input from every client queued");
+
+/*
+ * Output reaches every client
+ */
+  ok = 1;
+  total = 0;
+  worst = 0;
+  for (j=0; j != messages; j++)
+  {
+    start = now_us();
+    app_2_queue(PAYLOAD, sizeof(PAYLOAD) - 1);
+    for (i=0; i != max_clients; i++)
+    {
+      if ( (read_all(sock[i], buffer, sizeof(PAYLOAD) - 1, 1000) != sizeof(PAYLOAD) - 1)
+        || (memcmp(buffer, PAYLOAD, sizeof(PAYLOAD) - 1) != 0) )
+      {
+        ok = 0;
+      }
+    }
+    latency = now_us() - start;
+    total += latency;
+    if ( latency > worst )
+    {
+      worst = latency;
+    }
+    if ( ok == 0 )
+    {
+      break;
+    }
+  }
+  check(ok, "output sent to every client");
+  printf("output:       %d messages to %d clients, %.1f us average, %.1f us worst\n",
+         j, max_clients, total / (j ? j : 1), worst);
+
+/*
+ * Slot 0 asks for binary scores, the rest stay with JSON.  Text queued
+ * after the score goes to everybody.
+ */
+  pthread_mutex_lock(&to_lock);
+  tcpip_ring_form(&to_socket, 0, 1);
+  pthread_mutex_unlock(&to_lock);
+  pair_2_queue(PAYLOAD, sizeof(PAYLOAD) - 1, FRAME, sizeof(FRAME) - 1);
+  app_2_queue(PAYLOAD, sizeof(PAYLOAD) - 1);
+  ok = 0;
+  for (i=0; i != max_clients; i++)
+  {
+    length = read_all(sock[i], buffer, 2 * (sizeof(PAYLOAD) - 1), 200);    // The binary client has less
+    if ( (length == sizeof(FRAME) - 1 + sizeof(PAYLOAD) - 1)
+      && (memcmp(buffer, FRAME, sizeof(FRAME) - 1) == 0)
+      && (memcmp(buffer + sizeof(FRAME) - 1, PAYLOAD, sizeof(PAYLOAD) - 1) == 0) )
+    {
+      ok++;                                 // The binary client
+    }
+    else if ( (length == 2 * (sizeof(PAYLOAD) - 1))
+      && (memcmp(buffer, PAYLOAD, sizeof(PAYLOAD) - 1) == 0)
+      && (memcmp(buffer + sizeof(PAYLOAD) - 1, PAYLOAD, sizeof(PAYLOAD) - 1) == 0) )
+    {
+      continue;                             // A JSON client
+    }
+    else
+    {
+      ok = -max_clients;
+    }
+  }
+  check(ok == 1, "each client gets the score in its own format");
+  check(form_switch(), "format change waits for the score being sent");
+  pthread_mutex_lock(&to_lock);
+  tcpip_ring_form(&to_socket, 0, 0);
+  pthread_mutex_unlock(&to_lock);
+
+/*
+ * Stop reading the last client, the way a laptop does when its lid is
+ * shut, and keep sending.  The others must not notice.
+ */
+  close(sock[max_clients-1]);
+  wait_for_clients(max_clients - 1);
+  sock[max_clients-1] = connect_small(2048);
+  ok = (sock[max_clients-1] >= 0) && wait_for_clients(max_clients);
+  total = 0;
+  worst = 0;
+  for (j=0; (j != STALL_SHOTS) && ok && (tcpip_server_dropped() == 0); j++)
+  {
+    length = sprintf(message, "{\"shot\":%d, \"miss\":0, \"name\":\"1\", \"time\":0.00, \"x\":12.34, \"y\":-5.67, \"r\":13.58, \"a\":335.3}\r\n", j);
+    start = now_us();
+    app_2_queue(message, length);
+    for (i=0; i != max_clients - 1; i++)
+    {
+      if ( (read_all(sock[i], buffer, length, 1000) != length)
+        || (memcmp(buffer, message, length) != 0) )
+      {
+        ok = 0;
+      }
+    }
+    latency = now_us() - start;
+    total += latency;
+    if ( latency > worst )
+    {
+      worst = latency;
+    }
+  }
+  printf("stalled:      %d messages to %d clients, %.1f us average, %.1f us worst, %d dropped\n",
+         j, max_clients - 1, total / (j ? j : 1), worst, tcpip_server_dropped());
+  check(ok, "others get every score with one stalled");
+  check(worst < 100000.0, "others not held up by the stalled client");
+  check(wait_for_clients(max_clients - 1) && (tcpip_server_dropped() == 1), "stalled client dropped");
+  close(sock[max_clients-1]);
+  sock[max_clients-1] = connect_client();
+  check((sock[max_clients-1] >= 0) && (read_all(sock[max_clients-1], buffer, sizeof(greeting), 1000) == sizeof(greeting))
+        && wait_for_clients(max_clients), "stalled slot reused");
+
+/*
+ * Drop one and take its place
+ */
+  close(sock[0]);
+  check(wait_for_clients(max_clients - 1), "closed client removed");
+  sock[0] = connect_client();
+  check((sock[0] >= 0) && (read_all(sock[0], buffer, sizeof(greeting), 1000) == sizeof(greeting))
+        && wait_for_clients(max_clients), "slot reused");
+
+/*
+ * All done
+ */
+  tcpip_server_stop();
+  pthread_join(server, NULL);
+  check(server_result == 0, "server stopped");
+  for (i=0; i != max_clients; i++)
+  {
+    if ( sock[i] >= 0 )
+    {
+      close(sock[i]);
+    }
+  }
+
+  if ( failures != 0 )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,430 @@
+/*----------------------------------------------------------------
+ *
+ * timer_wheel_test.c
+ *
+ * Check and time the timer wheel
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   timer_wheel_test [-n ms] [-t timers]
+ *
+ * The wheel is moved on one ms at a time, the way timer_service()
+ * does, and checked for:
+ *
+ *   - one shot, periodic, restarted and cancelled timers
+ *   - delays longer than the wheel
+ *   - callbacks that arm and cancel timers
+ *   - ms missed by the service being counted in overrun
+ *   - the ms counter wrapping
+ *   - a random mix of arms and cancels compared against a
+ *     simple list of deadlines
+ *
+ * Then arm and cancel are timed with a growing number of timers
+ * running to show that the time does not depend on the count.
+ *
+ * The program returns non zero if any of the checks fail.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+
+#include "timer_wheel.h"
+
+#define MAX_TIMERS  10000               // Most timers used in one test
+
+typedef struct probe
+{
+  wheel_timer_t timer;
+  unsigned long deadline;               // When it should be called next, 0 if not armed
+  unsigned long period;
+  unsigned long calls;
+  unsigned long wrong;                  // Calls at the wrong time
+} probe_t;
+
+static timer_wheel_t  wheel;
+static unsigned long  now;              // Current time of the test (ms)
+static probe_t        probe[MAX_TIMERS];
+static int            failures;
+
+/*----------------------------------------------------------------
+ *
+ * @function: check
+ *
+ * @brief:    Report the result of a test
+ *
+ *--------------------------------------------------------------*/
+static void check
+(
+  int         ok,
+  const char* what
+)
+{
+  printf("%-44s %s\n", what, ok ? "pass" : "FAIL");
+  if ( !ok )
+  {
+    failures++;
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: on_time
+ *
+ * @brief:    Callback that checks it was called at its deadline
+ *
+ *--------------------------------------------------------------*/
+static void on_time
+(
+  void* arg
+)
+{
+  probe_t* p = (probe_t*)arg;
+
+  p->calls++;
+  if ( (p->deadline == 0) || (p->deadline != now) )
+  {
+    p->wrong++;
+  }
+  p->deadline = (p->period != 0) ? p->deadline + p->period : 0;
+
+  return;
+}
+
+static void start
+(
+  probe_t*      p,
+  unsigned long delay,
+  unsigned long period
+)
+{
+  timer_wheel_set(&p->timer, on_time, p);
+  p->deadline = now + delay;
+  p->period   = period;
+  p->calls    = 0;
+  p->wrong    = 0;
+  timer_wheel_arm(&wheel, &p->timer, now, delay, period);
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: run_for
+ *
+ * @brief:    Move the wheel on one ms at a time
+ *
+ *--------------------------------------------------------------*/
+static void run_for
+(
+  unsigned long ms
+)
+{
+  while ( ms-- != 0 )
+  {
+    now++;
+    timer_wheel_run(&wheel, now);
+  }
+
+  return;
+}
+
+/*
+ * Callbacks used to arm and cancel from inside the wheel
+ */
+static void cancel_other(void* arg)
+{
+  timer_wheel_cancel(&wheel, &((probe_t*)arg)->timer);
+  probe[0].calls++;
+}
+
+static void rearm_self(void* arg)
+{
+  probe_t* p = (probe_t*)arg;
+
+  p->calls++;
+  if ( p->calls < 5 )
+  {
+    timer_wheel_arm(&wheel, &p->timer, now, p->calls, 0);   // 1, 2, 3, 4 ms
+  }
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: basic_tests
+ *
+ * @brief:    One of each
+ *
+ *--------------------------------------------------------------*/
+static void basic_tests(void)
+{
+  now = 1000;
+  timer_wheel_init(&wheel, now);
+
+  start(&probe[0], 5, 0);
+  run_for(4);
+  check(probe[0].calls == 0, "one shot not early");
+  run_for(1);
+  check((probe[0].calls == 1) && (probe[0].wrong == 0) && !timer_wheel_pending(&probe[0].timer), "one shot on time");
+  run_for(100);
+  check(probe[0].calls == 1, "one shot only once");
+
+  start(&probe[0], 0, 0);
+  timer_wheel_run(&wheel, now);
+  check(probe[0].calls == 0, "zero delay waits for this ms to finish");
+  probe[0].deadline = now + 1;
+  run_for(1);
+  check((probe[0].calls == 1) && (probe[0].wrong == 0), "zero delay runs on the next ms");
+
+  start(&probe[1], 10, 10);
+  run_for(1000);
+  check((probe[1].calls == 100) && (probe[1].wrong == 0), "periodic every 10 ms");
+  timer_wheel_cancel(&wheel, &probe[1].timer);
+  run_for(100);
+  check((probe[1].calls == 100) && (wheel.active == 0), "periodic cancelled");
+
+  start(&probe[2], 50, 0);
+  run_for(40);
+  probe[2].deadline = now + 50;
+  timer_wheel_arm(&wheel, &probe[2].timer, now, 50, 0);
+  run_for(60);
+  check((probe[2].calls == 1) && (probe[2].wrong == 0) && (wheel.active == 0), "restart moves the deadline");
+
+  start(&probe[3], 3 * WHEEL_SLOTS + 17, 0);
+  start(&probe[4], 17, 0);
+  start(&probe[5], 70000, 0);
+  run_for(70000);
+  check((probe[3].calls == 1) && (probe[3].wrong == 0), "delay longer than the wheel");
+  check((probe[4].calls == 1) && (probe[4].wrong == 0), "near timer in the same slot");
+  check((probe[5].calls == 1) && (probe[5].wrong == 0), "70 s delay");
+
+  memset(probe, 0, 3 * sizeof(probe_t));
+  timer_wheel_set(&probe[1].timer, cancel_other, &probe[2]);
+  timer_wheel_arm(&wheel, &probe[1].timer, now, 5, 0);
+  start(&probe[2], 5, 0);                                   // Same ms, after probe[1]
+  run_for(10);
+  check((probe[0].calls == 1) && (probe[2].calls == 0) && (wheel.active == 0), "callback cancels a due timer");
+
+  probe[3].calls = 0;
+  timer_wheel_set(&probe[3].timer, rearm_self, &probe[3]);
+  timer_wheel_arm(&wheel, &probe[3].timer, now, 0, 0);
+  run_for(20);
+  check((probe[3].calls == 5) && (wheel.active == 0), "callback re-arms itself");
+
+  wheel.overrun = 0;
+  start(&probe[6], 10, 10);
+  now += 50;                                                // Service held up
+  timer_wheel_run(&wheel, now);
+  check((probe[6].calls == 5) && (wheel.overrun == 4), "late service catches up and counts overrun");
+  probe[6].wrong = 0;
+  probe[6].deadline = now + 10;
+  run_for(100);
+  check((probe[6].calls == 15) && (probe[6].wrong == 0) && (wheel.overrun == 4), "back on time after overrun");
+  timer_wheel_cancel(&wheel, &probe[6].timer);
+
+  now = ULONG_MAX - 100;                                    // 49 days on, on the target
+  timer_wheel_init(&wheel, now);
+  start(&probe[7], 150, 0);
+  start(&probe[8], 30, 30);
+  run_for(200);
+  check((probe[7].calls == 1) && (probe[7].wrong == 0), "one shot across the ms wrap");
+  check((probe[8].calls == 6) && (probe[8].wrong == 0), "periodic across the ms wrap");
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: random_test
+ *
+ * @brief:    Random arms and cancels against a list of deadlines
+ *
+ *--------------------------------------------------------------*/
+static void random_test
+(
+  unsigned long duration,               // ms to run for
+  int           count                   // Timers to use
+)
+{
+  unsigned long ms;
+  unsigned long calls, wrong, missed;
+  int           i, j;
+
+  srand(3);
+  now = 12345;
+  timer_wheel_init(&wheel, now);
+  for (i=0; i != count; i++)
+  {
+    timer_wheel_set(&probe[i].timer, on_time, &probe[i]);
+    probe[i].deadline = 0;
+    probe[i].calls = 0;
+    probe[i].wrong = 0;
+  }
+
+  missed = 0;
+  for (ms=0; ms != duration; ms++)
+  {
+    for (j=0; j != 4; j++)                                  // A few changes every ms
+    {
+      i = rand() % count;
+      switch ( rand() % 4 )
+      {
+        case 0:
+          timer_wheel_cancel(&wheel, &probe[i].timer);
+          probe[i].deadline = 0;
+          break;
+
+        case 1:                                             // Periodic
+          probe[i].period = 1 + rand() % 300;
+          probe[i].deadline = now + probe[i].period;
+          timer_wheel_arm(&wheel, &probe[i].timer, now, probe[i].period, probe[i].period);
+          break;
+
+        default:                                            // One shot, some past the wheel
+          probe[i].period = 0;
+          probe[i].deadline = now + 1 + rand() % 1000;
+          timer_wheel_arm(&wheel, &probe[i].timer, now, probe[i].deadline - now, 0);
+          break;
+      }
+    }
+    now++;
+    timer_wheel_run(&wheel, now);
+    for (i=0; i != count; i++)                              // Nothing left behind
+    {
+      if ( (probe[i].deadline != 0) && ((long)(probe[i].deadline - now) <= 0) )
+      {
+        missed++;
+        probe[i].deadline = 0;
+      }
+    }
+  }
+
+  calls = 0;
+  wrong = 0;
+  j = 0;
+  for (i=0; i != count; i++)
+  {
+    calls += probe[i].calls;
+    wrong += probe[i].wrong;
+    j += (probe[i].deadline != 0);
+  }
+  printf("random:       %lu ms, %d timers, %lu calls, %lu wrong, %lu missed\n", duration, count, calls, wrong, missed);
+  check((wrong == 0) && (missed == 0) && (calls != 0) && (wheel.overrun == 0) && ((int)wheel.active == j), "random arms and cancels");
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: now_ns
+ *
+ * @brief:    Monotonic time in nanoseconds
+ *
+ *--------------------------------------------------------------*/
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: bench
+ *
+ * @brief:    Time arm and cancel with count timers running
+ *
+ *--------------------------------------------------------------*/
+static double bench
+(
+  int count
+)
+{
+  const unsigned int loops = 2000000;
+  double       start, stop;
+  int          i;
+  unsigned int k;                             // k * 7919 does not fit in an int
+
+  now = 0;
+  timer_wheel_init(&wheel, now);
+  for (i=0; i != count; i++)
+  {
+    timer_wheel_set(&probe[i].timer, on_time, &probe[i]);
+    timer_wheel_arm(&wheel, &probe[i].timer, now, 1 + (i * 7919) % 5000, 0);
+  }
+
+  start = now_ns();
+  for (k=0; k != loops; k++)
+  {
+    i = k % count;
+    timer_wheel_arm(&wheel, &probe[i].timer, now, 1 + (k * 7919) % 5000, 0);
+    if ( (k & 1) == 0 )
+    {
+      timer_wheel_cancel(&wheel, &probe[i].timer);
+    }
+  }
+  stop = now_ns();
+
+  return (stop - start) / loops;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  unsigned long duration = 200000;      // ms for the random test
+  int           count = 64;             // Timers for the random test
+  double        t_small, t_large;
+  int           i;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-n") == 0) && (i+1 < argc) )
+    {
+      duration = strtoul(argv[++i], NULL, 0);
+    }
+    else if ( (strcmp(argv[i], "-t") == 0) && (i+1 < argc) )
+    {
+      count = atoi(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-n ms] [-t timers]\n", argv[0]);
+      return 2;
+    }
+  }
+  if ( (count <= 0) || (count > MAX_TIMERS) )
+  {
+    count = MAX_TIMERS;
+  }
+
+  basic_tests();
+  random_test(duration, count);
+
+  t_small = bench(10);
+  t_large = bench(MAX_TIMERS);
+  printf("arm/cancel:   %5.1f ns with %d timers, %5.1f ns with %d\n", t_small, 10, t_large, MAX_TIMERS);
+
+  if ( failures != 0 )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
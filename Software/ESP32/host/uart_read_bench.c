@@ -0,0 +1,475 @@
+/*----------------------------------------------------------------
+ *
+ * uart_read_bench.c
+ *
+ * Feed a pseudo-UART at 921600 baud and compare the two readers
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   uart_read_bench [-n bytes] [-b baud]
+ *
+ * A stream of {...} commands, with the odd * between them, is
+ * clocked into a model of the UART driver one byte time at a
+ * time.  Like the ESP-IDF driver, the model keeps a 2K buffer
+ * behind a lock and posts a UART_DATA event when 120 bytes are
+ * waiting or the line has been quiet for 10 byte times.
+ *
+ * The old reader wakes every 10 ms and takes the input one byte
+ * at a time with serial_available() and serial_getch(), which is
+ * two driver calls for every byte.
+ *
+ * The new reader sleeps until the event, moves the whole chunk
+ * into a serial_ring_t the way serial_uart_drain() does, and the
+ * JSON task then takes it out a frame at a time with
+ * serial_ring_frame().
+ *
+ * Both readers must give back exactly what was sent, and every
+ * frame from the new reader must be whole.  The report shows the
+ * CPU time and driver calls per byte, and the time from the } of
+ * each command arriving to it reaching the parser.
+ *
+ * The program returns non zero if anything was lost or broken up.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "serial_ring.h"
+
+#define DRIVER_SIZE   (1024 * 2)        // uart_console_size
+#define RX_FULL       120               // Bytes before UART_DATA is posted
+#define RX_TIMEOUT    10                // Quiet byte times before UART_DATA is posted
+#define POLL_US       10000             // Old reader: once a tick
+#define UART_CHUNK    256               // As in serial_io.c
+#define FRAME_SIZE    256               // sizeof(input_JSON)
+
+/*
+ * Model of the UART driver
+ */
+static pthread_mutex_t driver_lock = PTHREAD_MUTEX_INITIALIZER;
+static char            driver_buffer[DRIVER_SIZE];
+static unsigned int    driver_in, driver_out;
+static unsigned long   driver_calls;
+static unsigned long   driver_overflow;
+
+/*
+ * What was sent
+ */
+static char*           stream;
+static double*         close_time;      // When the byte arrived if it ends a frame (us)
+static unsigned long   stream_length;
+
+/*
+ * What the reader saw
+ */
+typedef struct result
+{
+  const char*   name;
+  unsigned long got;                    // Bytes given back
+  unsigned long wrong;                  // Bytes not the same as sent
+  unsigned long frames;                 // Commands seen
+  unsigned long split;                  // Commands given back in pieces
+  unsigned long driver_calls;
+  double        cpu_ns;                 // Time spent reading
+  double        latency_sum;            // } arriving to } parsed (us)
+  double        latency_max;
+} result_t;
+
+static int failures;
+
+/*----------------------------------------------------------------
+ *
+ * @function: now_ns
+ *
+ * @brief:    Monotonic time in nanoseconds
+ *
+ *--------------------------------------------------------------*/
+static double now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: make_stream
+ *
+ * @brief:    Build the commands to be sent
+ *
+ *--------------------------------------------------------------*/
+static void make_stream
+(
+  unsigned long length
+)
+{
+  static const char* names[] = { "\"ECHO\":", "\"NAME_ID\":", "\"SENSOR\":", "\"Z_OFFSET\":", "\"TARGET_TYPE\":" };
+  unsigned long      at;
+  int                n, i;
+
+  stream     = malloc(length + FRAME_SIZE);
+  close_time = calloc(length + FRAME_SIZE, sizeof(double));
+
+  srand(7);
+  at = 0;
+  while ( at < length )
+  {
+    if ( (rand() % 16) == 0 )
+    {
+      stream[at++] = '*';               // PC client asking for an echo
+    }
+    stream[at++] = '{';
+    n = 1 + rand() % 8;                 // 20 to 200 bytes
+    for (i=0; i != n; i++)
+    {
+      at += sprintf(&stream[at], "%s%s %d", (i != 0) ? ", " : "", names[rand() % 5], rand() % 100000);
+    }
+    stream[at++] = '}';
+  }
+  stream_length = at;
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: driver_rx
+ *            driver_len
+ *            driver_read
+ *
+ * @brief:    The UART side and the uart_* calls
+ *
+ *--------------------------------------------------------------*/
+static void driver_rx
+(
+  char ch
+)
+{
+  pthread_mutex_lock(&driver_lock);
+  if ( (driver_in - driver_out) == DRIVER_SIZE )
+  {
+    driver_overflow++;
+  }
+  else
+  {
+    driver_buffer[driver_in++ % DRIVER_SIZE] = ch;
+  }
+  pthread_mutex_unlock(&driver_lock);
+
+  return;
+}
+
+static unsigned int driver_len(void)                 // uart_get_buffered_data_len()
+{
+  unsigned int length;
+
+  pthread_mutex_lock(&driver_lock);
+  driver_calls++;
+  length = driver_in - driver_out;
+  pthread_mutex_unlock(&driver_lock);
+
+  return length;
+}
+
+static unsigned int driver_read                      // uart_read_bytes()
+(
+  char*        data,
+  unsigned int length
+)
+{
+  unsigned int i;
+
+  pthread_mutex_lock(&driver_lock);
+  driver_calls++;
+  for (i=0; (i != length) && (driver_out != driver_in); i++)
+  {
+    data[i] = driver_buffer[driver_out++ % DRIVER_SIZE];
+  }
+  pthread_mutex_unlock(&driver_lock);
+
+  return i;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: deliver
+ *
+ * @brief:    Check what the reader gave back against the stream
+ *
+ *--------------------------------------------------------------*/
+static void deliver
+(
+  result_t*   r,
+  const char* data,
+  unsigned int length,
+  double      now                       // Simulated time (us)
+)
+{
+  unsigned int i;
+  double       latency;
+
+  for (i=0; i != length; i++)
+  {
+    if ( (r->got >= stream_length) || (data[i] != stream[r->got]) )
+    {
+      r->wrong++;
+    }
+    else if ( data[i] == '}' )
+    {
+      r->frames++;
+      latency = now - close_time[r->got];
+      r->latency_sum += latency;
+      if ( latency > r->latency_max )
+      {
+        r->latency_max = latency;
+      }
+    }
+    r->got++;
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: old_reader
+ *
+ * @brief:    serial_available() / serial_getch() once a tick
+ *
+ *--------------------------------------------------------------*/
+static void old_reader
+(
+  result_t* r,
+  double    now
+)
+{
+  char   ch;
+  double start;
+
+  start = now_ns();
+  while ( driver_len() != 0 )
+  {
+    driver_read(&ch, 1);
+    deliver(r, &ch, 1, now);
+  }
+  r->cpu_ns += now_ns() - start;
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: new_reader
+ *
+ * @brief:    serial_uart_drain() then serial_frame()
+ *
+ *--------------------------------------------------------------*/
+static serial_ring_t ring;
+
+static void new_reader
+(
+  result_t* r,
+  double    now
+)
+{
+  char         chunk[UART_CHUNK];
+  char         frame[FRAME_SIZE];
+  unsigned int waiting;
+  unsigned int length;
+  double       start;
+
+  start = now_ns();
+  while ( (waiting = driver_len()) != 0 )             // Reader task
+  {
+    if ( waiting > sizeof(chunk) )
+    {
+      waiting = sizeof(chunk);
+    }
+    length = driver_read(chunk, waiting);
+    serial_ring_put(&ring, chunk, length);
+  }
+
+  while ( (length = serial_ring_frame(&ring, frame, sizeof(frame))) != 0 )  // JSON task
+  {
+    if ( (frame[length-1] != '}') && (frame[length-1] != '*') )
+    {
+      r->split++;                                     // Should not have been let go
+    }
+    deliver(r, frame, length, now);
+  }
+  r->cpu_ns += now_ns() - start;
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: run
+ *
+ * @brief:    Clock the stream into the driver and read it
+ *
+ *--------------------------------------------------------------*/
+static void run
+(
+  result_t* r,
+  int       use_events,                 // TRUE for the new reader
+  long      baud
+)
+{
+  double        byte_us;                // 10 bits a byte
+  double        now, next_poll;
+  unsigned long sent;
+  unsigned int  pending, quiet;
+  unsigned int  gap;                    // Byte times left with nothing sent
+
+  byte_us = 10.0e6 / baud;
+  driver_in = driver_out = 0;
+  driver_calls = 0;
+  driver_overflow = 0;
+  serial_ring_init(&ring);
+
+  now = 0;
+  next_poll = POLL_US;
+  sent = 0;
+  pending = 0;
+  quiet = 0;
+  gap = 0;
+  while ( r->got < stream_length )
+  {
+    now += byte_us;
+    if ( (sent < stream_length) && (gap == 0) )
+    {
+      driver_rx(stream[sent]);
+      close_time[sent] = now;
+      sent++;
+      pending++;
+      quiet = 0;
+      if ( (sent % 997) == 0 )          // Gaps between some commands
+      {
+        gap = (unsigned int)(2000 / byte_us);
+      }
+    }
+    else
+    {
+      quiet++;
+      if ( gap != 0 )
+      {
+        gap--;
+      }
+    }
+
+    if ( use_events )
+    {
+      if ( (pending >= RX_FULL) || ((pending != 0) && (quiet >= RX_TIMEOUT)) )
+      {
+        pending = 0;                    // UART_DATA
+        new_reader(r, now);
+      }
+    }
+    else if ( now >= next_poll )
+    {
+      next_poll += POLL_US;
+      old_reader(r, now);
+    }
+  }
+  r->driver_calls = driver_calls;
+
+  if ( driver_overflow != 0 )
+  {
+    printf("%s: the driver dropped %lu bytes\n", r->name, driver_overflow);
+    failures++;
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: report
+ *
+ *--------------------------------------------------------------*/
+static void report
+(
+  result_t* r
+)
+{
+  printf("%-8s %8.1f ns/byte %6.3f calls/byte  latency avg %7.1f us  max %7.1f us  %lu frames\n",
+         r->name, r->cpu_ns / r->got, (double)r->driver_calls / r->got,
+         r->latency_sum / r->frames, r->latency_max, r->frames);
+
+  if ( (r->got != stream_length) || (r->wrong != 0) || (r->split != 0) )
+  {
+    printf("%-8s %lu of %lu bytes, %lu wrong, %lu split  FAIL\n", r->name, r->got, stream_length, r->wrong, r->split);
+    failures++;
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  result_t      old_result = { "polled" };
+  result_t      new_result = { "events" };
+  unsigned long length = 2000000;       // Bytes to send
+  long          baud = 921600;
+  int           i;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-n") == 0) && (i+1 < argc) )
+    {
+      length = strtoul(argv[++i], NULL, 0);
+    }
+    else if ( (strcmp(argv[i], "-b") == 0) && (i+1 < argc) )
+    {
+      baud = atol(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-n bytes] [-b baud]\n", argv[0]);
+      return 2;
+    }
+  }
+  if ( baud <= 0 )
+  {
+    baud = 921600;
+  }
+
+  make_stream(length);
+  printf("%lu bytes at %ld baud\n", stream_length, baud);
+
+  run(&old_result, 0, baud);
+  report(&old_result);
+  run(&new_result, 1, baud);
+  report(&new_result);
+
+  if ( new_result.frames != old_result.frames )
+  {
+    printf("frame counts differ  FAIL\n");
+    failures++;
+  }
+
+  if ( failures != 0 )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
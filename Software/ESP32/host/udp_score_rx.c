@@ -0,0 +1,466 @@
+/*----------------------------------------------------------------
+ *
+ * udp_score_rx.c
+ *
+ * Listen to the UDP scores and count what is lost
+ *
+ *----------------------------------------------------------------
+ *
+ * Usage:
+ *
+ *   udp_score_rx [-a address] [-p port] [-t scores] [-r rate]
+ *
+ * Without -t the program joins the group (or listens on the port
+ * for broadcast and unicast scores) and prints every datagram as
+ * it arrives.  Each lane is followed by its sequence numbers, and
+ * Ctrl-C prints how many were received, lost, late and how often
+ * the lane restarted.
+ *
+ * With -t the program also publishes that many scores through
+ * udp_score.c at rate scores a second, from a second thread, and
+ * times each one from udp_score_send() to it being received.  It
+ * returns non zero if anything was lost, out of order or not as
+ * it was sent.
+ *
+ *---------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+
+#include "lwip/sockets.h"
+
+#include "udp_score.h"
+
+#define MAX_LANES     32                    // Lanes followed
+#define NAME_SIZE     32                    // Longest lane name kept
+#define SCORE_TEXT    "\r\n{\"shot\":%d, \"miss\":0, \"name\":\"LANE\", \"time\":1.23 ,\"x\":-12.34, \"y\":5.67 , \"r\":13.58,  \"a\":155.32, }\r\n"
+
+typedef struct lane
+{
+  char          name[NAME_SIZE];
+  unsigned int  next;                       // Sequence number expected
+  unsigned long received;
+  unsigned long lost;
+  unsigned long late;                       // Came after a later one
+  unsigned long restarts;                   // Sequence went back to 1
+} lane_t;
+
+static lane_t        lanes[MAX_LANES];
+static int           lane_count;
+static unsigned long malformed;             // Datagrams without seq or lane
+static volatile int  stop;                  // Set by Ctrl-C
+
+/*
+ * Self test
+ */
+static int           test_scores;           // Scores to publish, 0 to only listen
+static int           test_rate = 1000;      // Scores a second
+static double*       sent_us;               // When each sequence number was sent
+static const char*   address = UDP_SCORE_GROUP;
+static int           port = UDP_SCORE_PORT;
+static volatile int  sender_done;
+
+/*----------------------------------------------------------------
+ *
+ * @function: now_us
+ *
+ * @brief:    Monotonic time in microseconds
+ *
+ *--------------------------------------------------------------*/
+static double now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1.0e6 + (double)ts.tv_nsec / 1.0e3;
+}
+
+static void on_interrupt(int sig)
+{
+  stop = 1;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: open_listener
+ *
+ * @brief:    Bind to the port and join the group if there is one
+ *
+ * @return:   Socket, or -1 on error
+ *
+ *--------------------------------------------------------------*/
+static int open_listener(void)
+{
+  struct sockaddr_in addr;
+  struct ip_mreq     join;
+  struct in_addr     group;
+  int                sock;
+  int                option;
+
+  if ( inet_aton(address, &group) == 0 )
+  {
+    fprintf(stderr, "%s is not an address\n", address);
+    return -1;
+  }
+
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+  if ( sock < 0 )
+  {
+    perror("socket");
+    return -1;
+  }
+
+  option = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+  option = 1024 * 1024;
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &option, sizeof(option));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if ( bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 )
+  {
+    perror("bind");
+    close(sock);
+    return -1;
+  }
+
+  if ( IN_MULTICAST(ntohl(group.s_addr)) )
+  {
+    join.imr_multiaddr = group;
+    join.imr_interface.s_addr = htonl(INADDR_ANY);
+    if ( setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &join, sizeof(join)) != 0 )
+    {
+      perror("IP_ADD_MEMBERSHIP");
+      close(sock);
+      return -1;
+    }
+  }
+
+  return sock;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: find_lane
+ *
+ * @brief:    Look up a lane by name, adding it if it is new
+ *
+ *--------------------------------------------------------------*/
+static lane_t* find_lane
+(
+  const char* name,
+  int         length
+)
+{
+  int i;
+
+  if ( length >= NAME_SIZE )
+  {
+    length = NAME_SIZE - 1;
+  }
+
+  for (i=0; i != lane_count; i++)
+  {
+    if ( (strncmp(lanes[i].name, name, length) == 0) && (lanes[i].name[length] == 0) )
+    {
+      return &lanes[i];
+    }
+  }
+
+  if ( lane_count == MAX_LANES )
+  {
+    return NULL;
+  }
+  memcpy(lanes[lane_count].name, name, length);
+  lanes[lane_count].name[length] = 0;
+  lanes[lane_count].next = 1;
+
+  return &lanes[lane_count++];
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: take_datagram
+ *
+ * @brief:    Follow the lane's sequence numbers
+ *
+ * @return:   Sequence number, 0 if the datagram was not a score
+ *
+ *--------------------------------------------------------------*/
+static unsigned int take_datagram
+(
+  const char* datagram
+)
+{
+  const char*  s;
+  const char*  name;
+  lane_t*      lane;
+  unsigned int seq;
+
+  s = strstr(datagram, "\"seq\":");
+  name = strstr(datagram, "\"lane\":\"");
+  if ( (datagram[0] != '{') || (s == NULL) || (name == NULL) )
+  {
+    malformed++;
+    return 0;
+  }
+  seq = strtoul(s + 6, NULL, 10);
+  name += 8;
+  s = strchr(name, '"');
+  if ( (seq == 0) || (s == NULL) || ((lane = find_lane(name, s - name)) == NULL) )
+  {
+    malformed++;
+    return 0;
+  }
+
+  lane->received++;
+  if ( seq == lane->next )
+  {
+    lane->next++;
+  }
+  else if ( seq > lane->next )
+  {
+    lane->lost += seq - lane->next;       // Some went missing
+    lane->next = seq + 1;
+  }
+  else if ( seq == 1 )
+  {
+    lane->restarts++;                     // Target was restarted
+    lane->next = 2;
+  }
+  else
+  {
+    lane->late++;                         // Counted as lost when it was skipped
+    if ( lane->lost != 0 )
+    {
+      lane->lost--;
+    }
+  }
+
+  return seq;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: sender
+ *
+ * @brief:    Publish test_scores through udp_score.c
+ *
+ *--------------------------------------------------------------*/
+static void* sender
+(
+  void* arg
+)
+{
+  char   score[256];
+  double next;
+  int    i;
+
+  if ( udp_score_open(address, port) != 0 )
+  {
+    sender_done = 1;
+    return NULL;
+  }
+
+  next = now_us();
+  for (i=1; i <= test_scores; i++)
+  {
+    if ( next > now_us() )
+    {
+      usleep((useconds_t)(next - now_us()));
+    }
+    next += 1.0e6 / test_rate;
+    sprintf(score, SCORE_TEXT, i);
+    sent_us[udp_score_sequence() + 1] = now_us();
+    udp_score_send("LANE_1", score);
+  }
+
+  sender_done = 1;
+  return NULL;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: report
+ *
+ *--------------------------------------------------------------*/
+static void report(void)
+{
+  int i;
+
+  printf("\n%-16s %10s %8s %8s %8s\n", "lane", "received", "lost", "late", "restarts");
+  for (i=0; i != lane_count; i++)
+  {
+    printf("%-16s %10lu %8lu %8lu %8lu\n", lanes[i].name, lanes[i].received, lanes[i].lost, lanes[i].late, lanes[i].restarts);
+  }
+  if ( malformed != 0 )
+  {
+    printf("%lu datagrams were not scores\n", malformed);
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: main
+ *
+ *--------------------------------------------------------------*/
+int main
+(
+  int   argc,
+  char* argv[]
+)
+{
+  pthread_t     thread;
+  struct pollfd p;
+  char          datagram[1024];
+  char          expect[256];
+  unsigned int  seq;
+  unsigned long different;
+  int           sock, length, i;
+  double        latency, latency_sum, latency_max;
+  int           failures;
+
+  for (i=1; i < argc; i++)
+  {
+    if ( (strcmp(argv[i], "-a") == 0) && (i+1 < argc) )
+    {
+      address = argv[++i];
+    }
+    else if ( (strcmp(argv[i], "-p") == 0) && (i+1 < argc) )
+    {
+      port = atoi(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-t") == 0) && (i+1 < argc) )
+    {
+      test_scores = atoi(argv[++i]);
+    }
+    else if ( (strcmp(argv[i], "-r") == 0) && (i+1 < argc) )
+    {
+      test_rate = atoi(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [-a address] [-p port] [-t scores] [-r rate]\n", argv[0]);
+      return 2;
+    }
+  }
+  if ( test_rate <= 0 )
+  {
+    test_rate = 1000;
+  }
+
+  sock = open_listener();
+  if ( sock < 0 )
+  {
+    return 1;
+  }
+  printf("Listening for scores on %s:%d\n", address, port);
+
+/*
+ * Just listen
+ */
+  if ( test_scores <= 0 )
+  {
+    signal(SIGINT, on_interrupt);
+    while ( stop == 0 )
+    {
+      length = recv(sock, datagram, sizeof(datagram) - 1, 0);
+      if ( length > 0 )
+      {
+        datagram[length] = 0;
+        take_datagram(datagram);
+        printf("%s\n", datagram);
+      }
+    }
+    report();
+    return 0;
+  }
+
+/*
+ * Publish and listen
+ */
+  sent_us = calloc(test_scores + 2, sizeof(double));
+  pthread_create(&thread, NULL, sender, NULL);
+
+  p.fd = sock;
+  p.events = POLLIN;
+  latency_sum = 0;
+  latency_max = 0;
+  different = 0;
+  while ( 1 )
+  {
+    if ( poll(&p, 1, sender_done ? 500 : 100) <= 0 )
+    {
+      if ( sender_done )
+      {
+        break;                                // Nothing more on its way
+      }
+      continue;
+    }
+    length = recv(sock, datagram, sizeof(datagram) - 1, 0);
+    if ( length <= 0 )
+    {
+      continue;
+    }
+    datagram[length] = 0;
+    seq = take_datagram(datagram);
+    if ( (seq == 0) || (seq > (unsigned int)test_scores) )
+    {
+      continue;
+    }
+
+    latency = now_us() - sent_us[seq];
+    latency_sum += latency;
+    if ( latency > latency_max )
+    {
+      latency_max = latency;
+    }
+
+    sprintf(expect, "{\"seq\":%u, \"lane\":\"LANE_1\", \"shot\":%u, \"miss\":0", seq, seq);
+    if ( strncmp(datagram, expect, strlen(expect)) != 0 )
+    {
+      different++;
+    }
+  }
+  pthread_join(thread, NULL);
+  report();
+
+  failures = 0;
+  if ( lane_count == 0 )
+  {
+    printf("nothing was received  FAIL\n");
+    failures++;
+  }
+  else
+  {
+    printf("%d scores at %d a second, latency avg %.1f us  max %.1f us, %u not taken by the stack\n",
+           test_scores, test_rate, latency_sum / lanes[0].received, latency_max, udp_score_dropped());
+    if ( (lanes[0].received != (unsigned long)test_scores) || (lanes[0].lost != 0) || (lanes[0].late != 0)
+        || (malformed != 0) || (different != 0) || (udp_score_dropped() != 0) )
+    {
+      printf("%lu received, %lu lost, %lu late, %lu not as sent  FAIL\n",
+             lanes[0].received, lanes[0].lost, lanes[0].late, different);
+      failures++;
+    }
+  }
+
+  udp_score_close();
+  close(sock);
+
+  if ( failures != 0 )
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+
+  printf("OK\n");
+  return 0;
+}
@@ -41,12 +41,8 @@
 #include "json.h"
 #include "diag_tools.h"
 #include "WiFi.h"
-
-#define PORT                        1090
-#define KEEPALIVE_IDLE              true
-#define KEEPALIVE_INTERVAL          100
-#define KEEPALIVE_COUNT             50
-#define MAX_SOCKETS                 4     // Allow for four sockets
+#include "tcpip_server.h"
+#include "udp_score.h"
 
 /*
  * Macros
@@ -64,14 +60,12 @@ static EventGroupHandle_t s_wifi_event_group;
 static esp_event_handler_instance_t instance_any_id;
 static esp_event_handler_instance_t instance_got_ip;
 static int s_retry_num = 0;
-static int socket_list[MAX_SOCKETS];       // Space to remember four sockets
 static esp_netif_ip_info_t ipInfo;         // IP Address of the access point
 
 /*
  * Private Functions
  */
 void WiFi_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
-static void tcpip_server_io(void);        // Manage TCPIP traffic
 
 esp_err_t esp_base_mac_addr_get(uint8_t *mac);
 
@@ -90,6 +84,8 @@ esp_err_t esp_base_mac_addr_get(uint8_t *mac);
  * 
  * Once that is done the appropriate configuration is made and the target enabled.
  * 
+ * If UDP_ADDRESS is set, the scores are also published there as UDP datagrams.
+ * 
  *******************************************************************************/
 void WiFi_init(void)
 {
@@ -107,6 +103,11 @@ void WiFi_init(void)
       WiFi_station_init();
    }
 
+/*
+ * Publish the scores to the range if asked to
+ */
+   udp_score_open(json_udp_address, json_udp_port);
+
 /*
  *  All done
  */
@@ -360,294 +361,32 @@ void WiFi_event_handler
  *
  * @function: WiFi_tcp_server_task()
  *
- * @brief: Synchorous task to manage the TCPIP Stack
+ * @brief: Task to manage the TCPIP clients
  * 
  * @return: Never
  *
  ******************************************************************************
  *
- * Synchronous task called from freeRTOS to interrogate the TCPIP stack and 
- * accept calls from clients.
+ * Task started from freeRTOS to accept calls from clients and move data
+ * in and out of the TCPIP queues.
  * 
- * Once a socket has been connected, the input and outut queues are managed
- * to send and receive data
+ * All of the sockets are looked after by tcpip_server() in this one task.
  * 
  *******************************************************************************/
-static char greeting[] = "{\"CONNECTED\"}";
-
 void WiFi_tcp_server_task(void *pvParameters)
 {
    DLT(DLT_CRITICAL, printf("WiFi_tcp_server_task()");)
 
-/*
- *  Move data in and out of the TCP queues
- */
     while (1)
     {
-        tcpip_server_io();
+        tcpip_server(TCPIP_PORT, json_tcp_clients);
 /*
- *  Time out till the next time
+ *  Only returns if the server could not be started.  Try again later
  */
-        vTaskDelay(ONE_SECOND/2);
-    }
-}
-
-/*****************************************************************************
- *
- * @function: tcpip_server_io()
- *
- * @brief: Transmit data in and out of the target
- * 
- * @return: None
- *
- ******************************************************************************
- *
- * If there is any data in the tcpip_queue_2_socket queue, this function 
- * extracts the data and then loops through the active sockets to put the data
- * out to the client.
- * 
- *******************************************************************************/
-static void tcpip_server_io(void)
-{
-    int length;
-    char rx_buffer[128];
-    int  to_write;
-    int  i;
-    int  buffer_offset;
-
-/*
- * Out to TCPIP
- */      
-    to_write = tcpip_queue_2_socket(rx_buffer,  sizeof(rx_buffer));
-    if ( to_write > 0 )
-    {
-        for (i=0; i != MAX_SOCKETS; i++)
-        {
-            if (socket_list[i] > 0 )
-            {      
-                buffer_offset = 0;
-                while (  buffer_offset < to_write)
-                {
-                    length = send(socket_list[i], rx_buffer + buffer_offset, to_write-buffer_offset, 0);
-                    buffer_offset += length;
-                }
-            }
-        }
-    }
-
-/*
- *  All done
- */
-    return;
-}
-
-/*****************************************************************************
- *
- * @function: tcpip_socket_poll()  0-3
- *
- * @brief:    Tasks to poll the sockets
- * 
- * @return:   None
- *
- ******************************************************************************
- *
- * There are four identical functions that wait for a TCPIP message to arrive.
- * On receipt of the message, the bytes are copied from TCPIP into a circular
- * queue that holds everything until needed.
- * 
- * IMPORTANT
- * 
- * The recv function is a blocking call that waits for something to 
- * appear in the TCPIP channel. Meaning that these functions will be suspended
- * indefinitly until something arrives and then be woken up until the next
- * recv() call is made.  For this reason, the functions are separated out, one
- * for each possible socket.
- *
- *******************************************************************************/
-void tcpip_socket_poll_0(void* parameters)
-{
-    int length;
-    char rx_buffer[256];
-
-    DLT(DLT_CRITICAL, printf("tcp_socket_poll_0()");)
-
-    while (1)
-    {
-        if (socket_list[0] > 0 )
-        {
-            length = recv(socket_list[0], rx_buffer, sizeof(rx_buffer), 0 );
-            if ( length > 0 )
-            {
-                tcpip_socket_2_queue(rx_buffer, length);
-            }
-        }
-        vTaskDelay(10);
-    }
-}
-
-void tcpip_socket_poll_1(void* parameters)
-{
-    int length;
-    char rx_buffer[256];
-
-    DLT(DLT_CRITICAL, printf("tcp_socket_poll_1()");)
-
-    while (1)
-    {
-        if (socket_list[1] > 0 )
-        {
-            length = recv(socket_list[1], rx_buffer, sizeof(rx_buffer), 0 );
-            if ( length > 0 )
-            {
-                tcpip_socket_2_queue(rx_buffer, length);
-            }
-        }
-        vTaskDelay(10);
-    }
-}
-
-void tcpip_socket_poll_2(void* parameters)
-{
-    int length;
-    char rx_buffer[256];
-
-    DLT(DLT_CRITICAL, printf("tcp_socket_poll_2()");)
-
-    while (1)
-    {
-        if (socket_list[2] > 0 )
-        {
-            length = recv(socket_list[2], rx_buffer, sizeof(rx_buffer), 0 );
-            if ( length > 0 )
-            {
-                tcpip_socket_2_queue(rx_buffer, length);
-            }
-        }
-        vTaskDelay(10);
+        vTaskDelay(ONE_SECOND);
     }
 }
 
-void tcpip_socket_poll_3(void* parameters)
-{
-    int length;
-    char rx_buffer[256];
-
-    DLT(DLT_CRITICAL, printf("tcp_socket_poll_0()");)
-
-    while (1)
-    {
-        if (socket_list[3] > 0 )
-        {
-            length = recv(socket_list[3], rx_buffer, sizeof(rx_buffer), 0 );
-            if ( length > 0 )
-            {
-                tcpip_socket_2_queue(rx_buffer, length);
-            }
-        }
-        vTaskDelay(10);
-    }
-}
-
-/*****************************************************************************
- *
- * @function: tcpip_accept_poll()
- *
- * @brief:    Tasks to poll waiting for an incoming connection
- * 
- * @return:   None
- *
- ******************************************************************************
- *
- * Once the WiFi has been set up, the target waits here for an incoming
- * connection.
- * 
- * Once the connection has been made, the function determines the socket address
- * and then looks for an empty entry in the socket list. The new socket is now
- * added to the socket list and polled via the functions above.
- *
- *******************************************************************************/
-void tcpip_accept_poll(void* parameters)
-{
-   char addr_str[128];
-   int ip_protocol = 0;
-   int keepAlive = 1;
-   int keepIdle = KEEPALIVE_IDLE;
-   int keepInterval = KEEPALIVE_INTERVAL;
-   int keepCount = KEEPALIVE_COUNT;
-   struct sockaddr_storage dest_addr;
-   int listen_sock;
-   int option = 1;
-   struct sockaddr_storage source_addr; // Large enough for both IPv4 or IPv6
-   socklen_t addr_len = sizeof(source_addr);
-   int sock;
-   int i;
-
-   DLT(DLT_CRITICAL, printf("tcp_accept_poll()");)
-   
-/*
- * Start the server
- */
-   for (i=0; i != MAX_SOCKETS; i++)
-   {
-      socket_list[i] = -1;
-   }
-
-   struct sockaddr_in *dest_addr_ip4 = (struct sockaddr_in *)&dest_addr;
-   dest_addr_ip4->sin_addr.s_addr = htonl(INADDR_ANY);
-   dest_addr_ip4->sin_family = AF_INET;
-   dest_addr_ip4->sin_port = htons(PORT);
-   ip_protocol = IPPROTO_IP;
-
-   listen_sock = socket(AF_INET, SOCK_STREAM, ip_protocol);
-   if (listen_sock < 0) 
-   {
-      DLT(DLT_CRITICAL, printf("Unable to create socket: errno %d\r\n", errno);)
-      vTaskDelete(NULL);
-      return;
-   }
-
-   option = 1;
-   setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
-   bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-   listen(listen_sock, 1);
-
-    while (1)
-    {
-        sock = accept(listen_sock, (struct sockaddr *)&source_addr, &addr_len);
-        if (sock > 0)
-        {
-            for (i= 0; i != MAX_SOCKETS; i++ )
-            {
-                if  (socket_list[i] == -1 )
-                {
-                    socket_list[i] = sock;
-                    send(sock, greeting, sizeof(greeting), 0);
-                    break;
-                }
-            }
-
-/*
- * Set tcp keepalive option
- */
-            setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(int));
-            setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
-            setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
-            setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
-
-            DLT(DLT_CRITICAL, 
-            {         
-                inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr, addr_str, sizeof(addr_str) - 1);
-                printf("Socket accepted ip address: %s\r\n", addr_str);
-            }
-            )
-        }
-    }
-
-/*
- *  Never get here
- */
-    return;
-}
 /*****************************************************************************
  *
  * @function: WiFi_loopback_test
@@ -691,7 +430,7 @@ void WiFi_loopback_task(void* parameters)
             }
             tcpip_app_2_queue(buffer, length);
         }
-    vTaskDelay(ONE_SECOND);
+    serial_wait(ONE_SECOND);                        // Sleep until something arrives
     }
 /*
  *  Never get here
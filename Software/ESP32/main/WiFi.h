@@ -18,12 +18,6 @@ void WiFi_tcp_server_task(void *pvParameters);// TCP Server task
 void WiFi_loopback_test(void);                // Loopback the TCPIP channel
 void WiFi_my_ip_address(char* s);             // Return the current IP address 
 void WiFi_MAC_address(char* mac);             // Read the MAC address 
-   
-void tcpip_accept_poll(void* parameters);     // Wait for a socket connection
-void tcpip_socket_poll_0(void* parameters);   // Listen to TCPIP recv calls
-void tcpip_socket_poll_1(void* parameters);   // Listen to TCPIP recv calls
-void tcpip_socket_poll_2(void* parameters);   // Listen to TCPIP recv calls
-void tcpip_socket_poll_3(void* parameters);   // Listen to TCPIP recv calls
 
 /*
  * #defines
@@ -18,8 +18,14 @@
 #include "diag_tools.h"
 #include "token.h"
 #include "timer.h"
+#include "json_writer.h"
+#include "pcnt.h"
+#include "udp_score.h"
+#include "score_frame.h"
+#include "string.h"
 
 #define THRESHOLD (0.001)
+#define TDOA_STEPS 3                  // Gauss-Newton refinements after the closed form guess
 
 #define R(x)  (((x)+location) % 4)    // Rotate the target by location points
 
@@ -28,17 +34,21 @@
  */
 sensor_t s[4];
 unsigned int  pellet_calibre;     // Time offset to compensate for pellet diameter
+static double z_offset_clock;      // Time offset between paper and sensor plane
+unsigned int  solver_iterations;  // Passes taken by the last call to compute_hit()
+double        solver_residual;    // RMS range error of the last TDOA solution (clocks)
 static volatile unsigned long wdt; // Warchdog  timer
 
-static void remap_target(double* x, double* y);  // Map a club target if used
+static void   remap_target(double* x, double* y);  // Map a club target if used
+static double solve_tdoa(double z_offset_clock, double* x, double* y); // Hyperbolic solution
 
 /*----------------------------------------------------------------
  *
- * @function: init_sensors()
+ * @function: update_geometry()
  *
- * @brief: Setup the constants in the strucure
+ * @brief: Sample the environment and publish the sensor geometry
  * 
- * @return: Sensor array updated with current geometry
+ * @return: New geometry snapshot available to compute_hit()
  *
  *----------------------------------------------------------------
  *
@@ -55,35 +65,116 @@ static void remap_target(double* x, double* y);  // Map a club target if used
  * 
  * This function takes the physical location of the sensors (mm)
  * and generates the sensor array based on time. (ex us / mm)
+ * 
+ * Reading the temperature and humidity takes two I2C transactions
+ * so this is called once a second from the synchronous scheduler
+ * and not while a shot is being reduced.
+ * 
+ * The snapshot is double buffered.  The new geometry is written
+ * into the buffer that is not in use and then the version is
+ * incremented to make it visible.  The low bit of the version
+ * selects the active buffer.
  *--------------------------------------------------------------*/
-void init_sensors(void)
+static geometry_t            geometry[2];   // Published sensor geometry
+static volatile unsigned int geometry_version; // Incremented on every update
+
+void update_geometry(void)
 {
-  DLT(DLT_DIAG, printf("init_sensors()");)
+  geometry_t* g;
+  double      sound;                          // Speed of sound mm/us
+  int         i;
+
+  DLT(DLT_DIAG, printf("update_geometry()");)
   
 /*
  * Determine the speed of sound and ajust
  */
-  s_of_sound = speed_of_sound(temperature_C(), humidity_RH());
-  pellet_calibre = ((double)json_calibre_x10 / s_of_sound / 2.0d / 10.0d) * OSCILLATOR_MHZ; // Clock adjustement
+  sound = speed_of_sound(temperature_C(), humidity_RH());
+
+  g = &geometry[(geometry_version + 1) & 1];  // Work on the one not in use
+  g->version = geometry_version + 1;
+  g->s_of_sound = sound;
+  g->pellet_calibre = ((double)json_calibre_x10 / sound / 2.0d / 10.0d) * OSCILLATOR_MHZ; // Clock adjustement
+  g->z_offset_clock = (double)json_z_offset  * OSCILLATOR_MHZ / sound; // Clock adjustement for paper to sensor difference
   
  /*
   * Work out the geometry of the sensors
   */
-  s[N].index = N;
-  s[N].x = json_north_x / s_of_sound * OSCILLATOR_MHZ;
-  s[N].y = (json_sensor_dia /2.0d + json_north_y) / s_of_sound * OSCILLATOR_MHZ;
+  g->x[N] = json_north_x / sound * OSCILLATOR_MHZ;
+  g->y[N] = (json_sensor_dia /2.0d + json_north_y) / sound * OSCILLATOR_MHZ;
 
-  s[E].index = E;
-  s[E].x = (json_sensor_dia /2.0d + json_east_x) / s_of_sound * OSCILLATOR_MHZ;
-  s[E].y = (0.0d + json_east_y) / s_of_sound * OSCILLATOR_MHZ;
+  g->x[E] = (json_sensor_dia /2.0d + json_east_x) / sound * OSCILLATOR_MHZ;
+  g->y[E] = (0.0d + json_east_y) / sound * OSCILLATOR_MHZ;
 
-  s[S].index = S;
-  s[S].x = 0.0d + json_south_x / s_of_sound * OSCILLATOR_MHZ;
-  s[S].y = -(json_sensor_dia/ 2.0d + json_south_y) / s_of_sound * OSCILLATOR_MHZ;
+  g->x[S] = 0.0d + json_south_x / sound * OSCILLATOR_MHZ;
+  g->y[S] = -(json_sensor_dia/ 2.0d + json_south_y) / sound * OSCILLATOR_MHZ;
+
+  g->x[W] = -(json_sensor_dia / 2.0d  + json_west_x) / sound * OSCILLATOR_MHZ;
+  g->y[W] = json_west_y / sound * OSCILLATOR_MHZ;
+
+  for (i=N; i <= W; i++)
+  {
+    g->c[i] = sqrt(sq(g->x[i] - g->x[(i+1) % 4]) + sq(g->y[i] - g->y[(i+1) % 4]));
+  }
 
-  s[W].index = W;
-  s[W].x = -(json_sensor_dia / 2.0d  + json_west_x) / s_of_sound * OSCILLATOR_MHZ;
-  s[W].y = json_west_y / s_of_sound * OSCILLATOR_MHZ;
+/*
+ * Make it visible
+ */
+  __sync_synchronize();
+  geometry_version = g->version;
+  
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: init_sensors()
+ *
+ * @brief: Setup the constants in the strucure
+ * 
+ * @return: Sensor array updated with current geometry
+ *
+ *----------------------------------------------------------------
+ *
+ * Copy the last published geometry into the sensor array.  There
+ * is no I/O here.  If the geometry has never been published (ex
+ * first shot after reset) then it is created now.
+ * 
+ * The version is checked after the copy in case the geometry
+ * was updated while it was being read.
+ *--------------------------------------------------------------*/
+void init_sensors(void)
+{
+  geometry_t   g;                  // Local copy of the geometry
+  unsigned int version;
+  int          i;
+
+  DLT(DLT_DIAG, printf("init_sensors()");)
+
+  if ( geometry_version == 0 )
+  {
+    update_geometry();
+  }
+
+  do
+  {
+    version = geometry_version;
+    __sync_synchronize();
+    g = geometry[version & 1];
+    __sync_synchronize();
+  } while ( version != geometry_version );
+
+  s_of_sound = g.s_of_sound;
+  pellet_calibre = g.pellet_calibre;
+  z_offset_clock = g.z_offset_clock;
+  
+  for (i=N; i <= W; i++)
+  {
+    s[i].index = i;
+    s[i].x = g.x[i];
+    s[i].y = g.y[i];
+    s[i].c = g.c[i];
+  }
   
  /* 
   *  All done, return
@@ -91,6 +182,75 @@ void init_sensors(void)
   return;
 }
 
+/*-----------------------------------------------------
+ * 
+ * @function: compensate_rise_time
+ * 
+ * @brief:   Correct the raw counts for the sensor rise time
+ * 
+ * @return:  timer[N..W] moved back to the start of the signal
+ * 
+ *-----------------------------------------------------
+ *
+ * aquire() saves the raw counts at interrupt level and
+ * the correction is applied here, in the target task,
+ * before the shot is reduced.
+ * 
+ *                   *
+ *    vref_hi      * +   
+ *               *   + vref_hi - vref_lo
+ *             *     +
+ *    vref_lo *      +
+ *           *++++++++
+ *         *   pcnt_hi3
+ *        *
+ *       * origin
+ * 
+ *                         vref_lo
+ * origin = pcnt_lo - ----------------  * pcnt_hi
+ *                    vref_hi - vref_lo
+ * 
+ * IMPORTANT
+ * 
+ * pcnt_hi is the time from the start of pcnt_lo starting
+ * until vref_hi is triggered
+ * 
+ *-----------------------------------------------------*/
+void compensate_rise_time
+(
+  int    timer[],                                 // Raw counts, updated in place
+  int    latency,                                 // json_pcnt_latency
+  double vref_lo,                                 // json_vref_lo
+  double vref_hi                                  // json_vref_hi
+)
+{
+  unsigned int i;
+  double pcnt_hi;                                 // Reading from high counter 
+  double ratio;                                   // vref_lo / (vref_hi - vref_lo)
+
+  if ( (latency == 0)                             // Latency does not have a valid setting
+          || ((vref_hi - vref_lo) <= 0 ) )        // The voltage references are bad
+  {
+    return;
+  }
+
+  ratio = vref_lo / (vref_hi - vref_lo);
+  for (i=N; i <= W; i++)                          // Add the rise time to the signal to get a better estimate
+  {
+    pcnt_hi = timer[i+4] - latency;               // PCNT HI   (reading - latentcy)
+    if ( pcnt_hi > PCNT_NOT_TRIGGERED )           // Check to make sure the high timer was triggered by a shot
+    {                                             // and not dinged from the pellet trap
+      pcnt_hi = 0;                                // Not triggered by a shot
+    }
+    if ( pcnt_hi > 0 )
+    {
+      timer[i] = timer[i] + pcnt_hi * ratio;
+    }
+  }
+
+  return;
+}
+
 /*----------------------------------------------------------------
  *
  * @funtion: compute_hit
@@ -117,10 +277,11 @@ unsigned int compute_hit
   double        last_estimate, error; // Location error
   double        x_avg, y_avg;      // Running average location
   double        smallest;          // Smallest non-zero value measured
-  double        z_offset_clock;    // Time offset between paper and sensor plane
 
   x_avg = 0;
   y_avg = 0;
+  solver_iterations = 0;
+  solver_residual = 0;
   
   timer_new(&wdt, 20);
       
@@ -139,7 +300,6 @@ unsigned int compute_hit
  *  Compute the current geometry based on the speed of sound
  */
   init_sensors();
-  z_offset_clock = (double)json_z_offset  * OSCILLATOR_MHZ / s_of_sound; // Clock adjustement for paper to sensor difference
   DLT(DLT_DIAG, printf("z_offset_clock: %4.2f", z_offset_clock);)
   
  /* 
@@ -193,8 +353,7 @@ unsigned int compute_hit
   for (i=N; i <= W; i++)
   {
     s[i].b = s[i].count;
-    s[i].c = sqrt(sq(s[(i) % 4].x - s[(i+1) % 4].x) + sq(s[(i) % 4].y - s[(i+1) % 4].y));
-   }
+  }
   
   for (i=N; i <= W; i++)
   {
@@ -216,6 +375,18 @@ unsigned int compute_hit
     }
   }
 
+/*
+ * Use the time difference of arrival solver if selected
+ */
+  if ( json_solver == SOLVER_TDOA )
+  {
+    solver_residual = solve_tdoa(z_offset_clock, &x_avg, &y_avg);
+    DLT(DLT_DIAG, printf("TDOA x: %4.2f  y: %4.2f  residual: %4.2f  steps: %d", x_avg, y_avg, solver_residual, solver_iterations);)
+    shot->x = x_avg;
+    shot->y = y_avg;
+    return location;
+  }
+
 /*  
  *  Loop and calculate the unknown radius (estimate)
  */
@@ -261,6 +432,7 @@ unsigned int compute_hit
  /*
   * All done return
   */
+  solver_iterations = count;
   shot->x = x_avg;             
   shot->y = y_avg;
 
@@ -268,6 +440,181 @@ unsigned int compute_hit
 }
 
 
+/*----------------------------------------------------------------
+ *
+ * @function: solve_tdoa
+ *
+ * @brief: Locate the shot from the time differences of arrival
+ * 
+ * @return: RMS range error of the solution in clock ticks
+ *
+ *----------------------------------------------------------------
+ *
+ * Each sensor hears the shot at a slant range
+ * 
+ *   r[i] = sqrt((x - s[i].x)^2 + (y - s[i].y)^2 + z_offset^2)
+ *        = d0 + s[i].count
+ *
+ * where d0 is the unknown range to the first sensor to trigger.
+ * 
+ * Squaring both sides and subtracting the North equation from the
+ * other three removes x^2 + y^2 + z^2 and leaves three equations
+ * that are linear in x, y and d0.  Solving them gives a closed form
+ * starting point.  When the shot is close to the centre the counts
+ * are nearly equal, the system is singular, and the centre of the
+ * target is used to start instead.
+ * 
+ * The starting point is refined by a few Gauss-Newton steps over
+ * all four sensors which includes the slant range properly.
+ * 
+ * The residual is what is left over after the last step.  A large
+ * residual shows that the four times do not agree with each other.
+ *               
+ *--------------------------------------------------------------*/
+static double det_3x3
+  (
+  double a[3][3]
+  )
+{
+  return  a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+        - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+        + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+}
+
+static bool solve_3x3               // Solve a.p = b by Cramer's rule
+  (
+  double a[3][3],                   // Coefficients
+  double b[3],                      // Right hand side
+  double p[3]                       // Solution (returned)
+  )
+{
+  double det, m[3][3];
+  int    i, j, k;
+
+  det = det_3x3(a);
+  if ( fabs(det) < 1.0e-9 )
+  {
+    return false;                   // Singular
+  }
+
+  for (k=0; k != 3; k++)
+  {
+    for (i=0; i != 3; i++)
+    {
+      for (j=0; j != 3; j++)
+      {
+        m[i][j] = (j == k) ? b[i] : a[i][j];
+      }
+    }
+    p[k] = det_3x3(m) / det;
+  }
+
+  return true;
+}
+
+static double solve_tdoa
+  (
+  double  z_offset_clock,           // Time offset between paper and sensor plane
+  double* x,                        // Computed X location (returned)
+  double* y                         // Computed Y location (returned)
+  )
+{
+  double a[3][3], b[3];             // Linear system
+  double p[3], delta[3];            // Solution x, y, d0 and correction
+  double dx, dy, range, f;          // Working values for one sensor
+  double j[3];                      // Row of the Jacobian
+  double residual;
+  int    i, m, n, step;
+
+/*
+ * Closed form starting point
+ */
+  for (i=E; i <= W; i++)
+  {
+    a[i-1][0] = 2.0d * (s[i].x - s[N].x);
+    a[i-1][1] = 2.0d * (s[i].y - s[N].y);
+    a[i-1][2] = 2.0d * (s[i].count - s[N].count);
+    b[i-1]    = sq(s[i].x) + sq(s[i].y) - sq(s[N].x) - sq(s[N].y) - sq(s[i].count) + sq(s[N].count);
+  }
+
+  if ( (solve_3x3(a, b, p) == false)
+      || (p[2] < 0)                                     // Negative range
+      || ((sq(p[0]) + sq(p[1])) > sq(s[E].x - s[W].x)) ) // Off the target
+  {
+    DLT(DLT_DIAG, printf("TDOA starting from the centre");)
+    p[0] = 0;
+    p[1] = 0;
+    p[2] = 0;
+    for (i=N; i <= W; i++)
+    {
+      p[2] += sqrt(sq(s[i].x) + sq(s[i].y) + sq(z_offset_clock)) - s[i].count;
+    }
+    p[2] /= 4.0d;
+  }
+
+/*
+ * Refine using all four sensors
+ */
+  for (step=0; step != TDOA_STEPS; step++)
+  {
+    for (m=0; m != 3; m++)
+    {
+      b[m] = 0;
+      for (n=0; n != 3; n++)
+      {
+        a[m][n] = 0;
+      }
+    }
+
+    for (i=N; i <= W; i++)
+    {
+      dx = p[0] - s[i].x;
+      dy = p[1] - s[i].y;
+      range = sqrt(sq(dx) + sq(dy) + sq(z_offset_clock));
+      f = range - p[2] - s[i].count;
+      j[0] = dx / range;
+      j[1] = dy / range;
+      j[2] = -1.0d;
+      for (m=0; m != 3; m++)        // Accumulate the normal equations
+      {
+        b[m] -= j[m] * f;
+        for (n=0; n != 3; n++)
+        {
+          a[m][n] += j[m] * j[n];
+        }
+      }
+    }
+
+    if ( solve_3x3(a, b, delta) == false )
+    {
+      break;
+    }
+    p[0] += delta[0];
+    p[1] += delta[1];
+    p[2] += delta[2];
+    solver_iterations++;
+
+    if ( (fabs(delta[0]) + fabs(delta[1])) < THRESHOLD )
+    {
+      break;
+    }
+  }
+
+/*
+ * Work out how well the times agree
+ */
+  residual = 0;
+  for (i=N; i <= W; i++)
+  {
+    range = sqrt(sq(p[0] - s[i].x) + sq(p[1] - s[i].y) + sq(z_offset_clock));
+    residual += sq(range - p[2] - s[i].count);
+  }
+
+  *x = p[0];
+  *y = p[1];
+  return sqrt(residual / 4.0d);
+}
+
 /*----------------------------------------------------------------
  *
  * @function: find_xy_3D
@@ -426,6 +773,52 @@ bool find_xy_3D
 }
 
   
+/*----------------------------------------------------------------
+ *
+ * @function: build_score
+ *
+ * @brief: Capture everything needed to send the score
+ * 
+ * @return: score filled in
+ *
+ *----------------------------------------------------------------
+ * 
+ * The score is formatted and sent by a different task, by which
+ * time compute_hit() may have moved on to the next shot.  The
+ * working values in s[] and the speed of sound are copied into
+ * the score so that the message matches the shot.
+ *    
+ *--------------------------------------------------------------*/
+void build_score
+  (
+  score_t*       score,           // Score to be filled in
+  shot_record_t* shot,            // Shot that was reduced
+  bool           is_miss          // TRUE if the shot was a miss
+  )
+{
+  int i;
+
+  score->shot_number = shot->shot_number;
+  score->shot_time   = shot->shot_time;
+  score->x           = shot->x;
+  score->y           = shot->y;
+  score->s_of_sound  = s_of_sound;
+  score->residual    = solver_residual;
+  score->face_strike = shot->face_strike;
+  score->is_miss     = is_miss;
+
+  for (i=N; i <= W; i++)
+  {
+    score->count[i] = (int)s[i].count;
+  }
+  for (i=0; i != 8; i++)
+  {
+    score->timer_count[i] = shot->timer_count[i];
+  }
+
+  return;
+}
+
 /*----------------------------------------------------------------
  *
  * @function: send_score
@@ -447,13 +840,13 @@ bool find_xy_3D
 
 void send_score
   (
-  shot_record_t* shot             //  record
+  score_t* shot                   //  Score from build_score()
   )
 {
-  double x, y;                    // Shot location in mm X, Y
-  double real_x, real_y;          // Shot location in mm X, Y before remap
-  double radius;
-  double angle;
+  char         message[SCORE_SIZE];  // Score to be sent
+  char         frame[SCORE_FRAME_SIZE]; // Same score for binary links
+  unsigned int length;
+  unsigned int frame_length;
   
   DLT(DLT_DIAG, printf("Sending the score");)
 
@@ -473,77 +866,356 @@ void send_score
       }
     }
   }
+
+/* 
+ *  Display the results
+ */
+  length = format_score(message, sizeof(message), shot);
+  frame_length = frame_score(frame, sizeof(frame), shot);
+  serial_write_score(message, length, frame, frame_length, ALL);
+  udp_score_send(names[json_name_id], message);
   
+/*
+ * All done, return
+ */
+  if ( json_token != TOKEN_NONE )
+  {
+    token_give();                            // Give up the token ring
+    set_status_LED(LED_READY);
+  }
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: locate_score
+ *
+ * @brief: Work out where the shot is on the target face
+ * 
+ * @return: Location in mm and degrees
+ *
+ *--------------------------------------------------------------*/
+static void locate_score
+  (
+  score_t*      shot,             // Score from build_score()
+  double*       x,                // Location after remap_target()
+  double*       y,
+  double*       real_x,           // Location before remap_target()
+  double*       real_y,
+  double*       radius,           // Distance from the centre
+  double*       angle             // Angle on the target face
+  )
+{
  /* 
   *  Work out the hole in perfect coordinates
   */
-  x = shot->x * s_of_sound * CLOCK_PERIOD;        // Distance in mm
-  y = shot->y * s_of_sound * CLOCK_PERIOD;        // Distance in mm
-  radius = sqrt(sq(x) + sq(y));
-  angle = atan2(shot->y, shot->x) / PI * 180.0d;
+  *x = shot->x * shot->s_of_sound * CLOCK_PERIOD;  // Distance in mm
+  *y = shot->y * shot->s_of_sound * CLOCK_PERIOD;  // Distance in mm
+  *radius = sqrt(sq(*x) + sq(*y));
+  *angle = atan2(shot->y, shot->x) / PI * 180.0d;
 
 /*
  * Rotate the result based on the construction, and recompute the hit
  */
-  angle += json_sensor_angle;
-  x = radius * cos(PI * angle / 180.0d);          // Rotate onto the target face
-  y = radius * sin(PI * angle / 180.0d);
-  real_x = x;
-  real_y = y;                                     // Remember the original target value
-  remap_target(&x, &y);                           // Change the target if needed
-/* 
- *  Display the results
- */
-  SEND(sprintf(_xs, "\r\n{");)
-  
-#if ( S_SHOT )
-  if ( (json_token == TOKEN_NONE) || (my_ring == TOKEN_UNDEF))
+  *angle += json_sensor_angle;
+  *x = *radius * cos(PI * *angle / 180.0d);       // Rotate onto the target face
+  *y = *radius * sin(PI * *angle / 180.0d);
+  *real_x = *x;
+  *real_y = *y;                                   // Remember the original target value
+  remap_target(x, y);                             // Change the target if needed
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: score_plan
+ *
+ * @brief: Work out which fields go into the score messages
+ * 
+ * @return: The plan for the current settings
+ *
+ *----------------------------------------------------------------
+ * 
+ * SCORE_FIELDS picks the fields, and the token ring, target
+ * type and solver decide some of them as well.  Rather than test
+ * all of that on every shot, the answer is kept as a list of
+ * steps and only worked out again when one of them changes.
+ * A field that is not wanted costs nothing, and the location is
+ * not even computed if no field needs it.
+ *    
+ *--------------------------------------------------------------*/
+#define STEP_END          0       // End of the list
+#define STEP_NAME         1       // "shot", "miss":0, "name", "time"
+#define STEP_RING         2       // "shot", "name" (ring number), "time"
+#define STEP_MISS_RING    3       // "shot", "miss":1, "name" (ring number), "time"
+#define STEP_XY           4       // "x", "y"
+#define STEP_REAL_XY      5       // "real_x", "real_y"
+#define STEP_POLAR        6       // "r", "a"
+#define STEP_TIMERS       7       // "n".."w", "N".."W"
+#define STEP_RESIDUAL     8       // "res"
+#define STEP_MISS_XY      9       // "x":0, "y":0
+#define STEP_MISS_TIMERS 10       // "N".."W", "face"
+#define PLAN_STEPS        8       // Longest list, with the STEP_END
+
+typedef struct score_plan
+{
+  unsigned int  key;                  // Settings the plan was made for
+  bool          locate;               // TRUE if the score needs the location
+  unsigned int  score_flags;          // RECORD_* for a score frame
+  unsigned int  miss_flags;           // RECORD_* for a miss frame
+  unsigned char score[PLAN_STEPS];    // Steps for a score
+  unsigned char miss[PLAN_STEPS];     // Steps for a miss
+} score_plan_t;
+
+static score_plan_t plan = { ~0u };   // Made on the first shot
+
+static const score_plan_t* score_plan(void)
+{
+  unsigned int key;
+  bool         token;                 // TRUE if on the token ring
+  int          n, m;
+
+  token = (json_token != TOKEN_NONE);
+  key = (json_score_fields & S_ALL)
+      | (token                             ? 0x100 : 0)
+      | ((my_ring == TOKEN_UNDEF)          ? 0x200 : 0)
+      | ((json_target_type > 1)            ? 0x400 : 0)
+      | ((json_solver == SOLVER_TDOA)      ? 0x800 : 0);
+  if ( key == plan.key )
   {
-    SEND(sprintf(_xs, "\"shot\":%d, \"miss\":0, \"name\":\"%s\"", shot->shot_number,  names[json_name_id]);)
+    return &plan;                     // Nothing has changed
   }
-  else
+
+  memset(&plan, 0, sizeof(plan));
+  plan.key = key;
+  n = 0;
+  m = 0;
+
+  if ( json_score_fields & S_SHOT )
   {
-    printf("five");
-    SEND(sprintf(_xs, "\"shot\":%d, \"name\":\"%d\"", shot->shot_number,  my_ring);)
+    if ( (token == false) || (my_ring == TOKEN_UNDEF) )
+    {
+      plan.score[n++] = STEP_NAME;
+      plan.miss[m++] = STEP_NAME;
+    }
+    else
+    {
+      plan.score[n++] = STEP_RING;
+      plan.miss[m++] = STEP_MISS_RING;
+    }
   }
-  SEND(sprintf(_xs, ", \"time\":%4.2f ", (float)shot->shot_time/(float)(ONE_SECOND));)
-#endif
 
-#if ( S_XY )
-  SEND(sprintf(_xs, ",\"x\":%4.2f, \"y\":%4.2f ", x, y);)
-  
-  if ( json_target_type > 1 )
+  if ( json_score_fields & S_XY )
+  {
+    plan.score[n++] = STEP_XY;
+    plan.locate = true;
+    if ( json_target_type > 1 )
+    {
+      plan.score[n++] = STEP_REAL_XY;
+      plan.score_flags |= RECORD_REAL;
+    }
+    if ( token == false )
+    {
+      plan.miss[m++] = STEP_MISS_XY;
+    }
+  }
+
+  if ( (json_score_fields & S_POLAR) && (token == false) )
+  {
+    plan.score[n++] = STEP_POLAR;
+    plan.score_flags |= RECORD_POLAR;
+    plan.locate = true;
+  }
+
+  if ( (json_score_fields & S_TIMERS) && (token == false) )
   {
-    SEND(sprintf(_xs, ",\"real_x\":%4.2f, \"real_y\":%4.2f ", real_x, real_y);)
+    plan.score[n++] = STEP_TIMERS;
+    plan.score_flags |= RECORD_TIMERS;
+    plan.miss[m++] = STEP_MISS_TIMERS;
+    plan.miss_flags |= RECORD_TIMERS;
   }
-#endif
 
-#if ( S_POLAR )
-  if ( json_token == TOKEN_NONE )
+  if ( (json_score_fields & S_MISC) && (json_solver == SOLVER_TDOA) )
   {
-    SEND(sprintf(_xs, ", \"r\":%4.2f,  \"a\":%s, ", radius, angle``);)
+    plan.score[n++] = STEP_RESIDUAL;
+    plan.score_flags |= RECORD_RESIDUAL;
+  }
+
+  plan.score[n] = STEP_END;
+  plan.miss[m] = STEP_END;
+
+  DLT(DLT_DIAG, printf("Score fields 0x%02x, %d steps", json_score_fields, n);)
+
+  return &plan;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: put_steps
+ *
+ * @brief: Write the fields in a plan
+ * 
+ * @return: None
+ *
+ *--------------------------------------------------------------*/
+static void put_steps
+  (
+  json_writer_t*       w,         // Message being built
+  const unsigned char* step,      // Steps from the plan
+  score_t*             shot,      // Score from build_score()
+  double               x,         // Location from locate_score()
+  double               y,
+  double               real_x,
+  double               real_y,
+  double               radius,
+  double               angle
+  )
+{
+  for (; *step != STEP_END; step++)
+  {
+    switch ( *step )
+    {
+      case STEP_NAME:
+      case STEP_RING:
+      case STEP_MISS_RING:
+        json_put_text(w, "\"shot\":");
+        json_put_int(w, shot->shot_number);
+        if ( *step == STEP_NAME )
+        {
+          json_put_text(w, ", \"miss\":0, \"name\":\"");
+          json_put_text(w, names[json_name_id]);
+        }
+        else
+        {
+          json_put_text(w, (*step == STEP_RING) ? ", \"name\":\"" : ", \"miss\":1, \"name\":\"");
+          json_put_int(w, my_ring);
+        }
+        json_put_text(w, "\", \"time\":");
+        json_put_fixed(w, shot->shot_time * 100 / ONE_SECOND, 2);
+        json_put_text(w, " ");
+        break;
+
+      case STEP_XY:
+        json_put_text(w, ",\"x\":");
+        json_put_float(w, x, 2);
+        json_put_text(w, ", \"y\":");
+        json_put_float(w, y, 2);
+        json_put_text(w, " ");
+        break;
+
+      case STEP_REAL_XY:
+        json_put_text(w, ",\"real_x\":");
+        json_put_float(w, real_x, 2);
+        json_put_text(w, ", \"real_y\":");
+        json_put_float(w, real_y, 2);
+        json_put_text(w, " ");
+        break;
+
+      case STEP_POLAR:
+        json_put_text(w, ", \"r\":");
+        json_put_float(w, radius, 2);
+        json_put_text(w, ",  \"a\":");
+        json_put_float(w, angle, 2);
+        json_put_text(w, ", ");
+        break;
+
+      case STEP_TIMERS:
+        json_put_text(w, ", \"n\":");
+        json_put_int(w, shot->count[N]);
+        json_put_text(w, ", \"e\":");
+        json_put_int(w, shot->count[E]);
+        json_put_text(w, ", \"s\":");
+        json_put_int(w, shot->count[S]);
+        json_put_text(w, ", \"w\":");
+        json_put_int(w, shot->count[W]);
+        json_put_text(w, " , \"N\":");
+        json_put_int(w, shot->timer_count[N+4]);
+        json_put_text(w, ", \"E\":");
+        json_put_int(w, shot->timer_count[E+4]);
+        json_put_text(w, ", \"S\":");
+        json_put_int(w, shot->timer_count[S+4]);
+        json_put_text(w, ", \"W\":");
+        json_put_int(w, shot->timer_count[W+4]);
+        json_put_text(w, " ");
+        break;
+
+      case STEP_RESIDUAL:
+        json_put_text(w, ", \"res\":");
+        json_put_float(w, shot->residual * shot->s_of_sound * CLOCK_PERIOD, 2);
+        json_put_text(w, " ");
+        break;
+
+      case STEP_MISS_XY:
+        json_put_text(w, ", \"x\":0, \"y\":0 ");
+        break;
+
+      case STEP_MISS_TIMERS:
+        json_put_text(w, ", \"N\":");
+        json_put_int(w, shot->timer_count[N]);
+        json_put_text(w, ", \"E\":");
+        json_put_int(w, shot->timer_count[E]);
+        json_put_text(w, ", \"S\":");
+        json_put_int(w, shot->timer_count[S]);
+        json_put_text(w, ", \"W\":");
+        json_put_int(w, shot->timer_count[W]);
+        json_put_text(w, " , \"face\":");
+        json_put_int(w, shot->face_strike);
+        json_put_text(w, " ");
+        break;
+    }
   }
-#endif
 
-#if ( S_TIMERS )
-  if ( json_token == TOKEN_NONE )
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: format_score
+ *
+ * @brief: Build the score message
+ * 
+ * @return: Length of the message
+ *
+ *----------------------------------------------------------------
+ * 
+ * The message is written in one pass into the buffer supplied
+ * by the caller.  The numbers are converted by json_writer so
+ * the floating point printf() is not used.
+ *    
+ *--------------------------------------------------------------*/
+unsigned int format_score
+  (
+  char*         buffer,           // Where to put the message
+  unsigned int  size,             // sizeof(buffer)
+  score_t*      shot              // Score from build_score()
+  )
+{
+  json_writer_t       w;
+  const score_plan_t* p;
+  double x, y;                    // Shot location in mm X, Y
+  double real_x, real_y;          // Shot location in mm X, Y before remap
+  double radius;
+  double angle;
+  
+  p = score_plan();
+  if ( p->locate )
   {
-    SEND(sprintf(_xs, ", \"n\":%d, \"e\":%d, \"s\":%d, \"w\":%d ", (int)s[N].count, (int)s[E].count, (int)s[S].count, (int)s[W].count);)
-    SEND(sprintf(_xs, ", \"N\":%d, \"E\":%d, \"S\":%d, \"W\":%d ", (int)shot->timer_count[N+4], (int)shot->timer_count[E+4], (int)shot->timer_count[S+4], (int)shot->timer_count[W+4]);)
+    locate_score(shot, &x, &y, &real_x, &real_y, &radius, &angle);
   }
-#endif
 
-  SEND(sprintf(_xs, "}\r\n");)
+/* 
+ *  Build the message
+ */
+  json_writer_init(&w, buffer, size);
+  json_put_text(&w, "\r\n{");
+  put_steps(&w, p->score, shot, x, y, real_x, real_y, radius, angle);
+  json_put_text(&w, "}\r\n");
   
 /*
  * All done, return
  */
-  if ( json_token != TOKEN_NONE )
-  {
-    token_give();                            // Give up the token ring
-    set_status_LED(LED_READY);
-  }
-  return;
+  return json_writer_done(&w);
 }
  
 /*----------------------------------------------------------------
@@ -562,9 +1234,14 @@ void send_score
 
 void send_miss
   (
-  shot_record_t* shot                    // record record
+  score_t* shot                          // Score from build_score()
   )
 {
+  char         message[SCORE_SIZE];      // Miss to be sent
+  char         frame[SCORE_FRAME_SIZE];  // Same miss for binary links
+  unsigned int length;
+  unsigned int frame_length;
+
   if ( json_send_miss == 0)               // If send_miss not enabled
   {
     return;                               // Do nothing
@@ -590,43 +1267,198 @@ void send_miss
 /* 
  *  Display the results
  */
-  SEND(sprintf(_xs, "\r\n{");)
-  
- #if ( S_SHOT )
-   if ( (json_token == TOKEN_NONE) || (my_ring == TOKEN_UNDEF))
+  length = format_miss(message, sizeof(message), shot);
+  frame_length = frame_miss(frame, sizeof(frame), shot);
+  serial_write_score(message, length, frame, frame_length, ALL);
+  udp_score_send(names[json_name_id], message);
+
+/*
+ * All done, go home
+ */
+  token_give();
+  set_status_LED(LED_READY);
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: send_event
+ *
+ * @brief: Send out a Tabata or rapid fire event
+ * 
+ * @return: None
+ *
+ *----------------------------------------------------------------
+ * 
+ * The event is sent as {"TABATA_ON":30} or as a binary frame
+ * to the links that asked for one
+ *    
+ *--------------------------------------------------------------*/
+void send_event
+  (
+  unsigned int event,                     // EVENT_* from score_frame.h
+  int          value                      // Value sent with it
+  )
+{
+  char          message[64];              // Event as JSON
+  char          frame[SCORE_FRAME_SIZE];  // Event as a frame
+  json_writer_t w;
+  unsigned int  length;
+  unsigned int  frame_length;
+
+  json_writer_init(&w, message, sizeof(message));
+  json_put_text(&w, "{\"");
+  json_put_text(&w, score_event_name(event));
+  json_put_text(&w, "\":");
+  json_put_int(&w, value);
+  json_put_text(&w, "}\r\n");
+  length = json_writer_done(&w);
+
+  frame_length = score_frame_event(frame, sizeof(frame), event, value);
+  serial_write_score(message, length, frame, frame_length, ALL);
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: format_miss
+ *
+ * @brief: Build the miss message
+ * 
+ * @return: Length of the message
+ *
+ *--------------------------------------------------------------*/
+unsigned int format_miss
+  (
+  char*         buffer,           // Where to put the message
+  unsigned int  size,             // sizeof(buffer)
+  score_t*      shot              // Score from build_score()
+  )
+{
+  json_writer_t w;
+
+  json_writer_init(&w, buffer, size);
+  json_put_text(&w, "\r\n{");
+  put_steps(&w, score_plan()->miss, shot, 0, 0, 0, 0, 0, 0);
+  json_put_text(&w, "}\n\r");
+
+  return json_writer_done(&w);
+}
+
+
+/*----------------------------------------------------------------
+ *
+ * @function: frame_score
+ *            frame_miss
+ *
+ * @brief: Build the binary score or miss frame
+ * 
+ * @return: Length of the frame
+ *
+ *----------------------------------------------------------------
+ * 
+ * The frame carries the same fields as format_score() and
+ * format_miss(), in hundredths of a mm, second or degree.
+ * See score_frame.c
+ *    
+ *--------------------------------------------------------------*/
+static int hundredths(double value)
+{
+  return (int)((value * 100.0d) + ((value < 0) ? -0.5d : 0.5d));
+}
+
+static void frame_header
+  (
+  score_record_t* r,              // Record to fill in
+  score_t*        shot            // Score from build_score()
+  )
+{
+  memset(r, 0, sizeof(score_record_t));
+  r->shot = shot->shot_number;
+  r->time = shot->shot_time * 100 / ONE_SECOND;
+  if ( (json_token == TOKEN_NONE) || (my_ring == TOKEN_UNDEF))
   {
-    SEND(sprintf(_xs, "\"shot\":%d, \"miss\":0, \"name\":\"%s\"", shot->shot_number,  names[json_name_id]);)
+    r->lane = json_name_id;
   }
   else
   {
-    SEND(sprintf(_xs, "\"shot\":%d, \"miss\":1, \"name\":\"%d\"", shot->shot_number,  my_ring);)
+    r->lane = my_ring;
+    r->flags |= RECORD_RING;
+  }
+
+  return;
+}
+
+unsigned int frame_score
+  (
+  char*         buffer,           // Where to put the frame
+  unsigned int  size,             // sizeof(buffer)
+  score_t*      shot              // Score from build_score()
+  )
+{
+  score_record_t      r;
+  const score_plan_t* p;
+  double x, y;                    // Shot location in mm X, Y
+  double real_x, real_y;          // Shot location in mm X, Y before remap
+  double radius;
+  double angle;
+  int    i;
+
+  p = score_plan();
+  frame_header(&r, shot);
+  r.flags |= p->score_flags;
+  if ( p->locate )
+  {
+    locate_score(shot, &x, &y, &real_x, &real_y, &radius, &angle);
+    r.x = hundredths(x);
+    r.y = hundredths(y);
+    r.real_x = hundredths(real_x);
+    r.real_y = hundredths(real_y);
+    r.radius = hundredths(radius);
+    r.angle = hundredths(angle);
   }
-  SEND(sprintf(_xs, ", \"time\":%4.2f ", (float)shot->shot_time/(float)(ONE_SECOND));)
-#endif
 
-#if ( S_XY )
-  if ( json_token == TOKEN_NONE )
-  { 
-    SEND(sprintf(_xs, ", \"x\":0, \"y\":0 ");)
+  if ( r.flags & RECORD_TIMERS )
+  {
+    for (i=N; i <= W; i++)
+    {
+      r.count[i] = shot->count[i];
+      r.timer[i] = shot->timer_count[i+4];
+    }
   }
-#endif
 
-#if ( S_TIMERS )
-  if ( json_token == TOKEN_NONE )
+  if ( r.flags & RECORD_RESIDUAL )
   {
-    SEND(sprintf(_xs, ", \"N\":%d, \"E\":%d, \"S\":%d, \"W\":%d ", (int)shot->timer_count[N], (int)shot->timer_count[E], (int)shot->timer_count[S], (int)shot->timer_count[W]);)
-    SEND(sprintf(_xs, ", \"face\":%d ", shot->face_strike);)
+    r.residual = hundredths(shot->residual * shot->s_of_sound * CLOCK_PERIOD);
   }
-#endif
 
-  SEND(sprintf(_xs, "}\n\r");)
+  return score_frame_record(buffer, size, SCORE_FRAME_SCORE, &r);
+}
 
-/*
- * All done, go home
- */
-  token_give();
-  set_status_LED(LED_READY);
-  return;
+unsigned int frame_miss
+  (
+  char*         buffer,           // Where to put the frame
+  unsigned int  size,             // sizeof(buffer)
+  score_t*      shot              // Score from build_score()
+  )
+{
+  score_record_t r;
+  int            i;
+
+  frame_header(&r, shot);
+  r.flags |= score_plan()->miss_flags;
+
+  if ( r.flags & RECORD_TIMERS )
+  {
+    for (i=N; i <= W; i++)
+    {
+      r.timer[i] = shot->timer_count[i];
+    }
+    r.count[0] = shot->face_strike;       // Face strikes go in count[0] for a miss
+  }
+
+  return score_frame_record(buffer, size, SCORE_FRAME_MISS, &r);
 }
 
 
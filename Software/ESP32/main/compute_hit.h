@@ -4,15 +4,7 @@
 #ifndef _COMPUTE_HIT_H
 #define _COMPUTE_HIT_H
 
-/*
- * What score items will be included in the JSON
- */
-#define S_SHOT      true        // Include the shot number
-#define S_XY        true        // Include X-Y coordinates
-#define S_POLAR     false       // Include polar coordinates
-#define S_TIMERS    true        // Include counter values
-#define S_MISC      true        // Include miscelaneous diagnotics
-#define S_SCORE     false       // Include estimated score
+#define SCORE_SIZE  384         // Largest score message
 
 /*
  *  Local Structures
@@ -33,18 +25,64 @@ struct sensor
 
 typedef struct sensor sensor_t;
 
+/*
+ *  Geometry published by update_geometry()
+ */
+struct geometry
+{
+  unsigned int version;         // Incremented every time the geometry is published
+  double s_of_sound;            // Speed of sound used (mm/us)
+  double x[4];                  // Sensor location (X clocks)
+  double y[4];                  // Sensor location (Y clocks)
+  double c[4];                  // Distance to the next sensor (clocks)
+  unsigned int pellet_calibre;  // Time offset to compensate for pellet diameter
+  double z_offset_clock;        // Time offset between paper and sensor plane
+};
+
+typedef struct geometry geometry_t;
+
+/*
+ *  Score passed from reduce() to the score task
+ */
+struct score_r
+{
+  unsigned int   shot_number;   // Shot number
+  unsigned long  shot_time;     // Time into the session
+  float          x;             // X location of shot (clocks)
+  float          y;             // Y location of shot (clocks)
+  float          s_of_sound;    // Speed of sound used for the shot (mm/us)
+  float          residual;      // RMS range error of a TDOA solution (clocks)
+  int            count[4];      // Time from the reference sensor (s[].count)
+  int            timer_count[8];// Counter values as read
+  unsigned short face_strike;   // Face strike count
+  unsigned char  is_miss;       // TRUE if this is a miss
+  long long      release_time;  // esp_timer_get_time() when the score may be sent
+};
+
+typedef struct score_r score_t;
+
 extern sensor_t s[4];
+extern unsigned int solver_iterations;  // Passes taken by the last solution
+extern double       solver_residual;    // RMS range error of the last TDOA solution (clocks)
 
 
 /*
  *  Public Funcitons
  */
 void          init_sensors(void);                                       // Initialize sensor structure
+void          update_geometry(void);                                    // Sample the environment and publish the geometry
+void          compensate_rise_time(int timer[], int latency, double vref_lo, double vref_hi); // Correct the raw counts for the rise time
 unsigned int  compute_hit(shot_record_t* shot);                         // Find the location of the shot
-void          send_score(shot_record_t* shot);                          // Send the shot
+void          build_score(score_t* score, shot_record_t* shot, bool is_miss); // Capture the score for sending later
+void          send_score(score_t* score);                               // Send the shot
 void          rotate_hit(unsigned int location, shot_record_t* shot);   // Rotate the shot back into the correct quadrant 
 bool          find_xy_3D(sensor_t* s, double estimate, double z_offset_clock);  // Estimated position including slant range
-void          send_miss(shot_record_t* shot);                           // Send a miss message
+void          send_miss(score_t* score);                                // Send a miss message
+void          send_event(unsigned int event, int value);                // Send a Tabata or rapid fire event
+unsigned int  format_score(char* buffer, unsigned int size, score_t* score); // Build the score message
+unsigned int  format_miss(char* buffer, unsigned int size, score_t* score);  // Build the miss message
+unsigned int  frame_score(char* buffer, unsigned int size, score_t* score);  // Build the binary score frame
+unsigned int  frame_miss(char* buffer, unsigned int size, score_t* score);   // Build the binary miss frame
 double        speed_of_sound(double temperature, double relative_humidity);// Speed of sound in mm/us
 double        sq(double x);                                             // Square function
 #endif
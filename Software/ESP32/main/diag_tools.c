@@ -290,7 +290,6 @@ void self_test
     case T_WIFI_STATION_LOOPBACK:
       WiFi_station_init();
       xTaskCreate(WiFi_tcp_server_task,    "WiFi_tcp_server",      4096, NULL, 5, NULL);
-      xTaskCreate(tcpip_accept_poll,       "tcpip_accept_poll",    4096, NULL, 4, NULL);
       WiFi_loopback_test();
       break; 
 
@@ -300,7 +299,6 @@ void self_test
     case T_WIFI_AP_LOOPBACK:
       WiFi_AP_init();
       xTaskCreate(WiFi_tcp_server_task,    "WiFi_tcp_server",      4096, NULL, 5, NULL);
-      xTaskCreate(tcpip_accept_poll,       "tcpip_accept_poll",    4096, NULL, 4, NULL);
       WiFi_loopback_test();
       break; 
 
@@ -829,3 +827,24 @@ bool do_dlt
   return true;
 }
 
+/*----------------------------------------------------------------
+ * 
+ * @function: dlt_done
+ *
+ * @brief:    Finish off a DLT log
+ *
+ * @return:   None
+ * 
+ *----------------------------------------------------------------
+ * 
+ * stdout is buffered, so the time stamp and the message are
+ * sent to the console together when the DLT finishes.
+ *   
+ *--------------------------------------------------------------*/
+void dlt_done(void)
+{
+  serial_console_flush();
+
+  return;
+}
+
@@ -19,6 +19,7 @@ bool    POST_counters(void);                            // Verify the counter op
 void    POST_trip_point(void);                          // Display the set point
 void    set_trip_point(int x);                          // Calibrate the trip point
 bool    do_dlt(unsigned int level);                     // Diagnostics Log and Trace
+void    dlt_done(void);                                 // Send the trace out in one block
 void    zapple(unsigned int test);                      // ZAPPLE console monitor
 void    factory_test(void);                             // Test the hardware in production
 
@@ -106,7 +107,7 @@ void    factory_test(void);                             // Test the hardware in
 /*
  * Tracing 
  */
-#define DLT(level, z) if ( do_dlt(level)){z}
+#define DLT(level, z) if ( do_dlt(level)){z dlt_done();}
 #define DLT_NONE          0                       // No DLT messages displayed
 #define DLT_CRITICAL      0x80                    // Display messages that will compromise the target
 #define DLT_APPLICATION   0x01                    // Application level messages displayed
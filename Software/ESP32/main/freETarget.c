@@ -9,9 +9,11 @@
 #include "driver\gpio.h"
 #include "esp_random.h"
 #include "stdio.h"
+#include "string.h"
 #include "math.h"
 #include "nvs.h"
 #include "mpu_wrappers.h"
+#include "freertos/queue.h"
 
 #include "freETarget.h"
 #include "gpio.h"
@@ -28,6 +30,9 @@
 #include "pcnt.h"
 #include "WiFi.h"
 #include "diag_tools.h"
+#include "shot_queue.h"
+#include "score_frame.h"
+#include "json_writer.h"
 
 /*
  *  Function Prototypes
@@ -42,9 +47,10 @@ extern void gpio_init(void);
 /*
  *  Variables
  */
-shot_record_t record[SHOT_STRING];      //Array of shot records
-unsigned int this_shot;                 // Index into the shot array
-unsigned int last_shot;                 // Last shot processed.
+shot_queue_t  shot_queue;               // Shots waiting to be reduced
+static QueueHandle_t score_queue;       // Scores waiting to be sent
+static TaskHandle_t  target_task;       // freeETarget_target_loop(), woken by new shots
+unsigned int  score_overflow;           // Scores dropped because the queue was full
 
 double        s_of_sound;               // Speed of sound
 unsigned int  shot = 0;                 // Shot counter
@@ -60,7 +66,6 @@ static volatile unsigned long  keep_alive;        // Keep alive timer
 static volatile unsigned long  tabata_timer;      // Free running state timer
        volatile unsigned long  power_save;        // Power save timer
 static volatile unsigned long  rapid_timer;       // Timer used for rapid fire ecents 
-       volatile unsigned long  LED_timer;         // Timer to reset LED status 
                 
 volatile unsigned int run_state = 0;              // Current operating state 
 
@@ -102,6 +107,7 @@ void freeETarget_init(void)
   timer_delay(ONE_SECOND);
   WiFi_init();
   set_VREF();
+  update_geometry();
 
   if ( DIP_SW_D )
   {
@@ -139,8 +145,8 @@ void freeETarget_init(void)
   show_echo();
   set_LED_PWM(json_LED_PWM);
   serial_flush(ALL);                      // Get rid of everything
-  this_shot = 0;                          // Clear out any junk
-  last_shot = 0;
+  shot_queue_init(&shot_queue);           // Clear out any junk
+  score_queue = xQueueCreate(SHOT_STRING, sizeof(score_t));
   DLT(DLT_CRITICAL, printf("Initialization complete");)
 
 /*
@@ -164,16 +170,24 @@ enum
 {
   START = 0,              // Set the operating mode
   WAIT,                   // ARM the circuit and wait for a shot
-  REDUCE                  // Reduce the data and send the score
+  REDUCE,                 // Reduce the data and send the score
+  FAULT                   // A sensor is stuck on, try to arm again
 } state;
 
 unsigned int  sensor_status;          // Record which sensors contain valid data
 unsigned int  location;               // Sensor location 
+static volatile unsigned int sensor_fault;  // Sensors stuck on at the last arm(), shown by sensor_fault_task()
+static unsigned int fault_backoff;    // Ticks to wait before trying to arm again
+
+#define TARGET_IDLE  ONE_SECOND       // Look at the run state at least this often
+#define FAULT_RETRY_MIN  1            // Try to arm again after 10 ms
+#define FAULT_RETRY_MAX  (ONE_SECOND/4) // and back off to every 250 ms
 
 void freeETarget_target_loop(void* arg)
 {
 
   DLT(DLT_CRITICAL, printf("freeETarget_target_loop()");)
+  target_task = xTaskGetCurrentTaskHandle();
   set_status_LED(LED_READY);
 
   while(1)
@@ -197,8 +211,11 @@ void freeETarget_target_loop(void* arg)
         case START:                     // Start of the loop
         power_save = (unsigned long)json_power_save * (unsigned long)ONE_SECOND * 60L;  //  Reset the timer
         set_mode();
-        arm();
-        state = WAIT;
+        state = arm();
+        break;
+
+      case FAULT:                       // Stuck sensor
+        state = arm();
         break;
     
       case WAIT:  
@@ -209,10 +226,50 @@ void freeETarget_target_loop(void* arg)
         break;
     }
 /*
- * End of the loop. timeout till the next time
+ * End of the loop.  Sleep until the next shot arrives
  */
-    vTaskDelay(1);
+    if ( state == WAIT )
+    {
+      ulTaskNotifyTake(pdTRUE, TARGET_IDLE); // Woken by freeETarget_shot_ready()
+    }
+    else if ( state == FAULT )
+    {
+      vTaskDelay(fault_backoff);        // Give the sensor time to clear
+    }
+    else
+    {
+      vTaskDelay(1);
+    }
+  }
+}
+
+/*----------------------------------------------------------------
+ * 
+ * @function: freeETarget_shot_ready
+ * 
+ * @brief: Wake up the target loop
+ * 
+ * @return: woken set to pdTRUE if the caller should yield
+ * 
+ *----------------------------------------------------------------
+ *
+ * Called from the timer and sensor interrupts after aquire()
+ * has put a shot in the queue.  Shots that arrive while the 
+ * loop is busy are counted by the notification and picked
+ * up when it next waits.
+ *
+ *--------------------------------------------------------------*/
+void IRAM_ATTR freeETarget_shot_ready
+(
+  BaseType_t* woken                   // Set if a higher priority task is ready
+)
+{
+  if ( target_task != NULL )
+  {
+    vTaskNotifyGiveFromISR(target_task, woken);
   }
+
+  return;
 }
 
 /*----------------------------------------------------------------
@@ -235,14 +292,9 @@ void freeETarget_target_loop(void* arg)
  *--------------------------------------------------------------*/
  unsigned int set_mode(void)
  {
-  unsigned int i;
-
   rapid_on  = 0;                    // Turn off the timer
     
-  for (i=0; i != SHOT_STRING; i++)
-  {
-    record[i].face_strike = 100;    // Disable the shot record
-  }
+  shot_queue_flush(&shot_queue);    // Throw away any old shots
 
   if ( json_tabata_enable || json_rapid_enable ) // If the Tabata or rapid fire is enabled, 
   {
@@ -260,14 +312,46 @@ void freeETarget_target_loop(void* arg)
   return WAIT;                      // Carry on to the target
  }
     
+/*----------------------------------------------------------------
+ * 
+ * @function: send_sensor_fault()
+ * 
+ * @brief:  Tell everybody which sensors are stuck
+ * 
+ * @return: None
+ * 
+ *----------------------------------------------------------------
+ *
+ * Built in a local buffer, as _xs is shared with the other tasks.
+ *
+ *--------------------------------------------------------------*/
+static void send_sensor_fault
+  (
+  unsigned int mask                 // Sensors that are stuck, 0 if clear
+  )
+{
+  char          message[32];        // {"SENSOR_FAULT":mask}
+  json_writer_t w;
+  unsigned int  length;
+
+  json_writer_init(&w, message, sizeof(message));
+  json_put_text(&w, "{\"SENSOR_FAULT\":");
+  json_put_int(&w, mask);
+  json_put_text(&w, "}\r\n");
+  length = json_writer_done(&w);
+  serial_write_all(message, length, ALL);
+
+  return;
+}
+
 /*----------------------------------------------------------------
  * 
  * @function: arm()
  * 
  * @brief:  Arm the circuit and check for errors
  * 
- * @return: Exit to the WAIT state if the circuit is ready
- *         Stay in the ARM state if a hardware fault was detected
+ * @return: WAIT if the circuit is ready
+ *          FAULT if a sensor is stuck on
  * 
  *----------------------------------------------------------------
  *
@@ -275,6 +359,16 @@ void freeETarget_target_loop(void* arg)
  * 
  * This initializes the variables.
  * 
+ * If any of the RUN latches are set straight after arming, the
+ * sensors are faulty.  The counters are held stopped so that the
+ * stuck latch is not taken as a shot, the fault is handed to 
+ * sensor_fault_task() to show on the LEDs, and the target loop 
+ * calls arm() again after fault_backoff.  The wait doubles each 
+ * time up to FAULT_RETRY_MAX, so the target is listening again 
+ * soon after the sensor clears.
+ * 
+ * {"SENSOR_FAULT":mask} is sent whenever the set of stuck 
+ * sensors changes, with a mask of 0 when they have cleared.
  *
  *--------------------------------------------------------------*/
 unsigned int arm(void)
@@ -287,57 +381,92 @@ unsigned int arm(void)
   sensor_status = is_running();     // and immediatly read the status
   if ( sensor_status == 0 )         // After arming, the sensor status should be zero
   { 
+    if ( sensor_fault != 0 )        // Was faulty, now clear
+    {
+      sensor_fault = 0;
+      set_status_LED(LED_READY);
+      send_sensor_fault(0);
+    }
+    fault_backoff = FAULT_RETRY_MIN;
     return WAIT;                   // Fall through to WAIT
   }
 
 /*
- * The sensors are tripping, display the error
+ * The sensors are tripping, report the error and try later
  */
-  if ( sensor_status & 0x80  )
-  {
-    set_status_LED(LED_NORTH_FAILED);           // Fault code North
-    vTaskDelay(ONE_SECOND);
-  }
-  if ( sensor_status & 0x40  )
-  {
-    set_status_LED(LED_EAST_FAILED);           // Fault code East
-    vTaskDelay(ONE_SECOND);
-  }
-  if ( sensor_status & 0x20)
+  stop_timers();                    // Keep the latches out of the ISR
+  if ( sensor_status != sensor_fault )
   {
-    set_status_LED(LED_SOUTH_FAILED);         // Fault code South
-    vTaskDelay(ONE_SECOND);
+    DLT(DLT_CRITICAL, printf("Sensor fault: %02X", sensor_status);)
+    send_sensor_fault(sensor_status);
+    sensor_fault = sensor_status;   // Start showing it
+    fault_backoff = FAULT_RETRY_MIN;
   }
-  if ( sensor_status & 0x10)
+  else if ( fault_backoff < FAULT_RETRY_MAX )
   {
-    set_status_LED(LED_WEST_FAILED);         // Fault code West
-    vTaskDelay(ONE_SECOND);
-  }
-  if ( sensor_status & 0x08  )
-  {
-    set_status_LED(LED_NORTH_FAILED);           // Fault code North
-    vTaskDelay(ONE_SECOND);
+    fault_backoff *= 2;             // Still there, back off
+    if ( fault_backoff > FAULT_RETRY_MAX )
+    {
+      fault_backoff = FAULT_RETRY_MAX;
+    }
   }
-  if ( sensor_status & 0x04  )
+
+  return FAULT;
+}
+
+/*----------------------------------------------------------------
+ * 
+ * @function: sensor_fault_task()
+ * 
+ * @brief:  Show the stuck sensors on the LEDs
+ * 
+ * @return: None
+ * 
+ *----------------------------------------------------------------
+ *
+ * Called every 500 ms from the synchronous task.
+ * 
+ * Each sensor that arm() found stuck on is shown for one
+ * second in turn, HI latches (0x80-0x10) first and then the 
+ * LO latches (0x08-0x01), the same codes and order as before.
+ *
+ *--------------------------------------------------------------*/
+void sensor_fault_task(void)
+{
+  static const char* fault_LED[] = { LED_NORTH_FAILED, LED_EAST_FAILED, LED_SOUTH_FAILED, LED_WEST_FAILED };
+  static unsigned int next_bit = 7; // Next latch to show
+  static unsigned int hold = 0;     // 500 ms ticks left on this one
+  unsigned int fault;
+  unsigned int i;
+
+  fault = sensor_fault;
+  if ( fault == 0 )                 // Nothing to show
   {
-    set_status_LED(LED_EAST_FAILED);           // Fault code East
-    vTaskDelay(ONE_SECOND);
+    next_bit = 7;
+    hold = 0;
+    return;
   }
-  if ( sensor_status & 0x02)
+
+  if ( hold != 0 )
   {
-    set_status_LED(LED_SOUTH_FAILED);         // Fault code South
-    vTaskDelay(ONE_SECOND);
+    hold--;
+    return;
   }
-  if ( sensor_status & 0x01)
+
+  for (i=0; i != 8; i++)            // Find the next stuck latch
   {
-    set_status_LED(LED_WEST_FAILED);         // Fault code West
-    vTaskDelay(ONE_SECOND);
+    if ( fault & (1 << next_bit) )
+    {
+      break;
+    }
+    next_bit = (next_bit + 7) % 8;
   }
 
-/*
- * Finished displaying the error so trying again
- */
-  return WAIT;
+  set_status_LED((char*)fault_LED[3 - (next_bit % 4)]);
+  next_bit = (next_bit + 7) % 8;
+  hold = 1;                         // Show it for 1 second
+
+  return;
 }
    
 /*----------------------------------------------------------------
@@ -382,7 +511,7 @@ unsigned int wait(void)
 /*
  * See if any shots have arrived
  */
-  if ( this_shot != last_shot )
+  if ( shot_queue_count(&shot_queue) != 0 )
   {
     return REDUCE;
   }
@@ -415,38 +544,49 @@ unsigned int wait(void)
  *--------------------------------------------------------------*/
 unsigned int reduce(void)
 {
+  shot_record_t* shot;                                          // Shot being reduced
+  unsigned int   lost;                                          // Shots the queue had no room for
+
 /*
  * See if any shots are allowed to be processed
  */
   if ( discard_shot() )                                       // Tabata is on but the shot is invalid
   {
-    last_shot = this_shot;
-    send_miss(&record[last_shot]);
+    shot = shot_queue_peek(&shot_queue);
+    if ( shot != NULL )
+    {
+      post_score(shot, true);
+    }
+    shot_queue_flush(&shot_queue);
     return START;                                              // Throw out any shots while dark
   }
   
 /*
  * Loop and process the shots
  */
-  while (last_shot != this_shot )
+  while ( (shot = shot_queue_peek(&shot_queue)) != NULL )
   {   
-    DLT(DLT_APPLICATION, show_sensor_status(record[last_shot].sensor_status);)
+    DLT(DLT_APPLICATION, show_sensor_status(shot->sensor_status);)
+    lost = shot_queue_lost(&shot_queue);
+    if ( lost != 0 )
+    {
+      DLT(DLT_CRITICAL, printf("Shot queue overflow, %d shots lost", lost);)
+    }
+    DLT(DLT_APPLICATION, printf("Shot %d re-arm latency %d ms", shot->shot_number, shot->rearm_time);)
+    DLT(DLT_DIAG, printf("Shot %d reduced %lld us after capture, counter skew %d ns", shot->shot_number, esp_timer_get_time() - shot->capture_time, CYCLES_TO_NS(shot->capture_skew));)
 
-    location = compute_hit(&record[last_shot]);                 // Compute the score
+    compensate_rise_time(shot->timer_count, json_pcnt_latency, json_vref_lo, json_vref_hi);
+    location = compute_hit(shot);                               // Compute the score
     if ( location != MISS )                                     // Was it a miss or face strike?
     {
-      if ( (json_rapid_enable == 0) && (json_tabata_enable = 0))// If in a regular session, hold off for the follow through time
-      {
-        vTaskDelay(ONE_SECOND * json_follow_through);
-      }
-      send_score(&record[last_shot]);
+      post_score(shot, false);                                  // Held by the score task for the follow through
       rapid_red(0);
       rapid_green(1);                                           // Turn off the RED and turn on the GREEN
 
       if ( (json_paper_time + json_step_time) != 0 )            // Has the witness paper been enabled?
       {
         if ( ((json_paper_eco == 0)                             // ECO turned off
-            || ( sqrt(sq(record[this_shot].x) + sq(record[this_shot].y)) < json_paper_eco )) ) // Outside the black
+            || ( sqrt(sq(shot->x) + sq(shot->y)) < json_paper_eco )) ) // Outside the black
         {
           drive_paper();                                        // to follow through.
         }
@@ -456,10 +596,11 @@ unsigned int reduce(void)
     {
       DLT(DLT_APPLICATION, printf("Shot miss...\r\n");)
       set_status_LED(LED_MISS);
-      send_miss(&record[last_shot]);
+      post_score(shot, true);
       rapid_green(0);
       rapid_red(1);                                             // Show a miss
     }
+    shot_queue_release(&shot_queue);                            // Finished with this one
 
 /* 
  *  Check to see if we should stop sending scores
@@ -476,12 +617,10 @@ unsigned int reduce(void)
     {
       if ( rapid_count == 0 )                                   // And the shots used up?
       {
-        last_shot = this_shot;                                  // Stop processing
+        shot_queue_flush(&shot_queue);                          // Stop processing
         break;
       }
     }
-    
-    last_shot = (last_shot+1) % SHOT_STRING;
   }
 
 /*
@@ -497,6 +636,206 @@ unsigned int reduce(void)
   }
 }
 
+/*----------------------------------------------------------------
+ * 
+ * @function: post_score
+ * 
+ * @brief: Queue the score to be sent by the score task
+ * 
+ * @return: None
+ * 
+ *----------------------------------------------------------------
+ *
+ * The score is copied into a score_t and put into the score 
+ * queue without waiting, so that reduce() can go straight on to
+ * the next shot.  If the queue is full the score is dropped and
+ * counted.
+ * 
+ * In a regular session (not rapid fire or Tabata) a hit is not
+ * to be sent until the shooter's follow through is over.  The
+ * time is stamped on the score here and the score task holds
+ * it, so that later shots are solved straight away.
+ *
+ *--------------------------------------------------------------*/
+void post_score
+(
+  shot_record_t* shot,                  // Shot that has been reduced
+  bool           is_miss                // TRUE if the shot was a miss
+)
+{
+  score_t score;
+
+  build_score(&score, shot, is_miss);
+  score.release_time = esp_timer_get_time();
+  if ( (is_miss == false)
+      && (json_rapid_enable == 0) && (json_tabata_enable == 0) )  // Regular session
+  {
+    score.release_time += (long long)json_follow_through * 1000000LL;
+  }
+
+  if ( xQueueSend(score_queue, &score, 0) != pdTRUE )
+  {
+    score_overflow++;
+    DLT(DLT_CRITICAL, printf("Score queue full, shot %d not sent", shot->shot_number);)
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ * 
+ * @function: freeETarget_score_task
+ * 
+ * @brief: Format and send the scores
+ * 
+ * @return: None
+ * 
+ *----------------------------------------------------------------
+ *
+ * Waits on the score queue and sends each score or miss to the
+ * clients.  Waiting for the token ring and for the serial ports
+ * happens here and not in the target loop.
+ * 
+ * Scores are held until their release_time.  The task sleeps on
+ * the queue until the next score arrives or the next held score
+ * is due, whichever is first.  FOLLOW_ORDER decides whether a
+ * score that is ready can pass one that is still held.  If more
+ * than SHOT_STRING scores are held the oldest is sent early.
+ *
+ *--------------------------------------------------------------*/
+static void send_one(score_t* score);
+static unsigned int release_scores(score_t held[], unsigned int count, long long now);
+static TickType_t next_release(score_t held[], unsigned int count, long long now);
+
+void freeETarget_score_task
+(
+  void* arg
+)
+{
+  static score_t held[SHOT_STRING];     // Scores waiting for the follow through
+  unsigned int   count;                 // Number of scores in held[]
+  score_t        score;
+
+  DLT(DLT_CRITICAL, printf("freeETarget_score_task()");)
+
+  count = 0;
+  while (1)
+  {
+    if ( xQueueReceive(score_queue, &score, next_release(held, count, esp_timer_get_time())) == pdTRUE )
+    {
+      if ( count == SHOT_STRING )       // No room, send the oldest now
+      {
+        send_one(&held[0]);
+        memmove(&held[0], &held[1], (count - 1) * sizeof(score_t));
+        count--;
+      }
+      held[count] = score;
+      count++;
+    }
+
+    count = release_scores(held, count, esp_timer_get_time());
+  }
+}
+
+/*----------------------------------------------------------------
+ * 
+ * @function: release_scores
+ * 
+ * @brief: Send the held scores that are due
+ * 
+ * @return: Number of scores still held
+ * 
+ *--------------------------------------------------------------*/
+static unsigned int release_scores
+(
+  score_t      held[],                  // Scores in the order they were shot
+  unsigned int count,                   // Number held
+  long long    now                      // esp_timer_get_time()
+)
+{
+  unsigned int i;
+
+  i = 0;
+  while ( i < count )
+  {
+    if ( held[i].release_time <= now )  // Due
+    {
+      send_one(&held[i]);
+      memmove(&held[i], &held[i+1], (count - i - 1) * sizeof(score_t));
+      count--;
+      continue;
+    }
+    if ( json_follow_order == FOLLOW_IN_ORDER )
+    {
+      break;                            // Nothing passes a held score
+    }
+    i++;
+  }
+
+  return count;
+}
+
+/*----------------------------------------------------------------
+ * 
+ * @function: next_release
+ * 
+ * @brief: Work out how long to wait for the next held score
+ * 
+ * @return: Ticks to wait on the score queue
+ * 
+ *--------------------------------------------------------------*/
+static TickType_t next_release
+(
+  score_t      held[],                  // Scores in the order they were shot
+  unsigned int count,                   // Number held
+  long long    now                      // esp_timer_get_time()
+)
+{
+  long long    first;
+  unsigned int i;
+
+  if ( count == 0 )
+  {
+    return portMAX_DELAY;               // Nothing held
+  }
+
+  first = held[0].release_time;
+  if ( json_follow_order != FOLLOW_IN_ORDER )
+  {
+    for (i=1; i != count; i++)
+    {
+      if ( held[i].release_time < first )
+      {
+        first = held[i].release_time;
+      }
+    }
+  }
+
+  if ( first <= now )
+  {
+    return 0;
+  }
+
+  return pdMS_TO_TICKS((first - now + 999) / 1000) + 1;  // Round up to the next tick
+}
+
+static void send_one
+(
+  score_t* score
+)
+{
+  if ( score->is_miss )
+  {
+    send_miss(score);
+  }
+  else
+  {
+    send_score(score);
+  }
+
+  return;
+}
+
 /*----------------------------------------------------------------
  * 
  * @function: tabata_enable
@@ -609,7 +948,7 @@ void tabata_task(void)
       {
         timer_new(&tabata_timer, json_tabata_on * ONE_SECOND);
         set_LED_PWM_now(0);             // Turn off the lights
-        SEND(sprintf(_xs, "{\"TABATA_STARTING\":%d}\r\n", (30));)
+        send_event(EVENT_TABATA_STARTING, 30);
         tabata_state = TABATA_REST;
       } 
       break;
@@ -619,7 +958,7 @@ void tabata_task(void)
       {
         timer_new(&tabata_timer, json_tabata_warn_on * ONE_SECOND);
         set_LED_PWM_now(json_LED_PWM);  //     Turn on the lights
-        SEND(sprintf(_xs, "{\"TABATA_WARN\":%d}\r\n", json_tabata_warn_on);)
+        send_event(EVENT_TABATA_WARN, json_tabata_warn_on);
         tabata_state = TABATA_WARNING;
       }
       break;
@@ -640,7 +979,7 @@ void tabata_task(void)
       {
         timer_new(&tabata_timer, json_tabata_warn_off * ONE_SECOND);
         set_LED_PWM_now(0);             // Turn off the lights
-        SEND(sprintf(_xs, "{\"TABATA_DARK\":%d}\r\n", json_tabata_warn_off);)
+        send_event(EVENT_TABATA_DARK, json_tabata_warn_off);
         tabata_state = TABATA_DARK;
       }
       break;
@@ -651,7 +990,7 @@ void tabata_task(void)
         in_shot_timer = FULL_SCALE;       // Set the timer on
         timer_new(&tabata_timer, json_tabata_on * ONE_SECOND);
         set_LED_PWM_now(json_LED_PWM);    // Turn on the lights
-        SEND(sprintf(_xs, "{\"TABATA_ON\":%d}\r\n", json_tabata_on);)
+        send_event(EVENT_TABATA_ON, json_tabata_on);
         tabata_state = TABATA_ON;
       }
       break;
@@ -660,7 +999,7 @@ void tabata_task(void)
       if ( tabata_timer == 0 )            // Don't do anything unless the time expires
       {
         timer_new(&tabata_timer, (long)(json_tabata_rest - json_tabata_warn_on - json_tabata_warn_off) * ONE_SECOND);
-        SEND(sprintf(_xs, "{\"TABATA_OFF\":%d}\r\n", (json_tabata_rest - json_tabata_warn_on - json_tabata_warn_off));)
+        send_event(EVENT_TABATA_OFF, (json_tabata_rest - json_tabata_warn_on - json_tabata_warn_off));
         set_LED_PWM_now(0);             // Turn off the LEDs
         tabata_state = TABATA_REST;
       }
@@ -690,15 +1029,13 @@ static bool discard_shot(void)
   if ( (json_rapid_enable != 0)                 // Rapid Fire
       &&  (rapid_count == 0) )                  // No shots remaining
   {
-    last_shot = this_shot;
     return true;                                // Discard any new shots    
   }
 
   if ( (json_tabata_enable != 0)                // Tabata cycle
     && ( tabata_state != TABATA_ON ) )          // Lights not on
   {
-    last_shot = this_shot;                      // Discard new shots
-    return true;
+    return true;                                // Discard new shots
   }
   
   return false;
@@ -754,7 +1091,7 @@ void rapid_fire_task(void)
       {
         timer_new(&rapid_timer, json_rapid_wait * ONE_SECOND);
         set_LED_PWM_now(0);             // Turn off the lights
-        SEND(sprintf(_xs, "{\"RAPID_ON\":%d}\r\n", (30));)
+        send_event(EVENT_RAPID_ON, 30);
         tabata_state = RAPID_WAIT;
       } 
       break;
@@ -763,7 +1100,7 @@ void rapid_fire_task(void)
       if ( rapid_timer == 0 )            // Don't do anything unless the time expires
       {
         timer_new(&rapid_timer, json_rapid_on * ONE_SECOND);
-        SEND(sprintf(_xs, "{\"RAPID_ON\":%d}\r\n", (json_rapid_time));)
+        send_event(EVENT_RAPID_ON, json_rapid_time);
         set_LED_PWM_now(0);             // Turn off the LEDs
         tabata_state = RAPID_ON;
       }
@@ -772,7 +1109,7 @@ void rapid_fire_task(void)
     case (RAPID_ON):                    // Keep the LEDs on for the tabata time
       if ( rapid_timer == 0 )           // Don't do anything unless the time expires
       {
-        SEND(sprintf(_xs, "{\"RAPID_OFF\":0}\r\n");)
+        send_event(EVENT_RAPID_OFF, 0);
         set_LED_PWM_now(0);             // Turn off the LEDs
         tabata_state = RAPID_OFF;
       }
@@ -1000,22 +1337,24 @@ extern int isr_state;
  {
 
   int i;
+  shot_record_t* shot;
 
-  printf("\r\nInterrupt target shot test: this: %d last %d\r\n", this_shot, last_shot);
+  printf("\r\nInterrupt target shot test: waiting: %d overflow: %d\r\n", shot_queue_count(&shot_queue), shot_queue.overflow);
 
 /*
  * Stay here watching the counters
  */
   while (1)
   {
-    while ( this_shot != last_shot )    // While we have a queue o shots
+    while ( (shot = shot_queue_peek(&shot_queue)) != NULL ) // While we have a queue o shots
     {
       printf("\r\n");
       for (i=0; i != 8; i++)
       {
-        printf("%s:%5d  ", which_one[i], record[last_shot].timer_count[i]);
+        printf("%s:%5d  ", which_one[i], shot->timer_count[i]);
       }
-      last_shot = (last_shot+1) % SHOT_STRING;
+      printf("skew: %dns", CYCLES_TO_NS(shot->capture_skew));
+      shot_queue_release(&shot_queue);
     }
     vTaskDelay(1);
   }
@@ -83,6 +83,7 @@
  */
 void freeETarget_init(void);                            // Get the target software ready
 void freeETarget_target_loop(void* arg);                // Target polling loop
+void freeETarget_shot_ready(BaseType_t* woken);         // Wake the target loop from an ISR
 void send_keep_alive(void);                             // Send out the keep alive signal for TCPIP
 void hello(void);                                       // Say Hello World
 void bye(void);                                         // Shut down and say goodbye
@@ -91,6 +92,8 @@ void polled_target_test(void);                          // Test the target aquis
 void interrupt_target_test(void);                       // Test the target aquisition software
 void tabata_task(void);                                 // Run the TABATA timersArm the Tabata counter
 void rapid_fire_task(void);                             // Run the Rapid Fire state machine
+void sensor_fault_task(void);                           // Show the sensors stuck on at arm()
+void freeETarget_score_task(void* arg);                 // Send the scores queued by reduce()
 
 /* 
  * freeRTOS Definitions 
@@ -110,10 +113,15 @@ struct shot_r
   unsigned int face_strike;     // Recording of face strike
   unsigned int sensor_status;   // Triggering register
   unsigned long shot_time;      // Shot time since start of after tabata start
+  long long    capture_time;    // esp_timer_get_time() when the counters were read
+  unsigned int capture_cycles;  // CPU cycle count when the counters were read
+  unsigned int capture_skew;    // CPU cycles between the first and last counter read
+  unsigned int rearm_time;      // ms the counters were stopped after the shot before
+  unsigned int sequence;        // Position in the shot queue
 };
 
 typedef struct shot_r shot_record_t;
-extern shot_record_t record[SHOT_STRING];      //Array of shot records
+void post_score(shot_record_t* shot, bool is_miss);     // Queue the score for the score task
 
 
 /*
@@ -125,11 +133,10 @@ extern const char    to_hex[];
 extern unsigned int  face_strike;
 extern const char    nesw[];                  // Cardinal Points
 extern unsigned int  is_trace;                // Tracing level(s)
-extern unsigned int  this_shot;               // Index into the shot array
 extern unsigned int  shot_number;
 extern volatile unsigned long power_save;     // Power down timer
 extern volatile unsigned int  run_state;      // IPC states 
-extern volatile unsigned long LED_timer;      // Turn off the LEDs when not in use
+extern unsigned int  score_overflow;          // Scores dropped by post_score()
 extern char _xs[512];
 
 #endif
@@ -12,6 +12,7 @@
 #include "driver\gpio.h"
 #include "esp_timer.h"
 #include "led_strip_types.h"
+#include "soc/gpio_reg.h"
 
 #include "freETarget.h"
 #include "diag_tools.h"
@@ -25,6 +26,7 @@
 #include "mfs.h"
 #include "dac.h"
 #include "analog_io.h"
+#include "shot_queue.h"
 
 #include "../managed_components/espressif__led_strip/src/led_strip_rmt_encoder.h"
 
@@ -61,24 +63,30 @@ volatile unsigned long paper_time;
  * Read in the running registers, and return a 1 for every
  * register that is running.
  * 
+ * All of the RUN lines are below GPIO 32 so the port is
+ * read once from GPIO_IN_REG and the bits picked out of
+ * the copy.  This is called from interrupt level.
+ * 
  *-----------------------------------------------------*/
-static unsigned int clock[] = { RUN_NORTH_LO, RUN_EAST_LO, RUN_SOUTH_LO, RUN_WEST_LO, 
-                                RUN_NORTH_HI, RUN_EAST_HI, RUN_SOUTH_HI, RUN_WEST_HI  };
-static unsigned int run_mask[] = {BIT_NORTH_LO, BIT_EAST_LO, BIT_SOUTH_LO, BIT_WEST_LO,
-                                  BIT_NORTH_HI, BIT_EAST_HI, BIT_SOUTH_HI, BIT_WEST_HI};
+static const DRAM_ATTR unsigned int clock[] = { RUN_NORTH_LO, RUN_EAST_LO, RUN_SOUTH_LO, RUN_WEST_LO, 
+                                                RUN_NORTH_HI, RUN_EAST_HI, RUN_SOUTH_HI, RUN_WEST_HI  };
+static const DRAM_ATTR unsigned int run_mask[] = {BIT_NORTH_LO, BIT_EAST_LO, BIT_SOUTH_LO, BIT_WEST_LO,
+                                                  BIT_NORTH_HI, BIT_EAST_HI, BIT_SOUTH_HI, BIT_WEST_HI};
 
-unsigned int is_running (void)
+unsigned int IRAM_ATTR is_running (void)
 {
   unsigned int  return_value;
+  unsigned int  port;                     // Copy of the input port
   unsigned int  i;
 
   return_value = 0;
 /*
  * Read the running inputs
  */
+  port = REG_READ(GPIO_IN_REG);
   for (i=0; i != 8; i++)
   {
-    if ( gpio_get_level(clock[i]) != 0 )
+    if ( (port & (1ul << clock[i])) != 0 )
     {
       return_value |= run_mask[i];
     }
@@ -119,6 +127,20 @@ void arm_timers(void)
   gpio_intr_enable(RUN_EAST_HI);
   gpio_intr_enable(RUN_SOUTH_HI);
   gpio_intr_enable(RUN_WEST_HI);
+  if ( json_acquire == ACQUIRE_INTERRUPT )    // Interrupt on the last sensor
+  {
+    gpio_intr_enable(RUN_NORTH_LO);
+    gpio_intr_enable(RUN_EAST_LO);
+    gpio_intr_enable(RUN_SOUTH_LO);
+    gpio_intr_enable(RUN_WEST_LO);
+  }
+  else
+  {
+    gpio_intr_disable(RUN_NORTH_LO);
+    gpio_intr_disable(RUN_EAST_LO);
+    gpio_intr_disable(RUN_SOUTH_LO);
+    gpio_intr_disable(RUN_WEST_LO);
+  }
   gpio_set_level(OSC_CONTROL, OSC_ON);        // Turn on the oscillator
 
   gpio_set_level(STOP_N, 1);                  // Then enable it
@@ -368,76 +390,6 @@ void commit_status_LEDs
 
 }
 
-/*-----------------------------------------------------
- * 
- * @function: read_timers
- * 
- * @brief:   Read the timer registers
- * 
- * @return:  All four timer registers read and stored
- * 
- *-----------------------------------------------------
- *
- * Force read each of the timers
- * 
- * Compensation for rise time
- * 
- * 
- * 
- *                   *
- *    vref_hi      * +   
- *               *   + vref_hi - vref_lo
- *             *     +
- *    vref_lo *      +
- *           *++++++++
- *         *   pcnt_hi3
- *        *
- *       * origin
- * 
- *                         vref_lo
- * origin = pcnt_lo - ----------------  * pcnt_hi
- *                    vref_hi - vref_lo
- * 
- * IMPORTANT
- * 
- * pcnt_hi is the time from the start of pcnt_lo starting
- * until vref_hi is triggered
- * 
- * 
- *-----------------------------------------------------*/
-void read_timers
-(
-  int timer[]
-)
-{
-  unsigned int i;
-  double pcnt_hi;                               // Reading from high counter 
-
-  for (i=0; i != 8; i++)
-  {
-    timer[i] = pcnt_read(i);
-  }
-
-  if ( (json_pcnt_latency != 0)                   // Latecy has a valid setting
-          && ((json_vref_hi - json_vref_lo) > 0 ) ) // The voltage references are good
-  {
-    for (i=N; i <= W; i++)                        // Add the rise time to the signal to get a better estimate
-    {
-      pcnt_hi = timer[i+4] - json_pcnt_latency;   // PCNT HI   (reading - latentcy)
-      if ( pcnt_hi > PCNT_NOT_TRIGGERED )         // Check to make sure the high timer was triggered by a shot
-      {                                           // and not dinged from the pellet trap
-        pcnt_hi = 0;                              // Not triggered by a shot
-      }
-      if ( pcnt_hi > 0 )
-      {
-        timer[i] = timer[i] + pcnt_hi * (json_vref_lo / (json_vref_hi - json_vref_lo));
-      }
-    }
-  }
-
-  return;
-}
-
 /*-----------------------------------------------------
  * 
  * @function: drive_paper
@@ -580,21 +532,40 @@ int is_paper_on(void)
  *----------------------------------------------------------------
  *
  *  This function reads the values from the counters and saves
- *  saves them into the record structure to be reduced later 
- *  on.
+ *  saves them into the shot queue to be reduced later on.
+ * 
+ *  Only integer work is done here.  The counts are stored raw
+ *  and corrected by reduce().
+ * 
+ *  The eight counts are taken by pcnt_snapshot() in one pass
+ *  so that they are as close together in time as possible.
+ * 
+ *  If the queue is full the shot is counted as an overflow
+ *  and dropped.
  *
  *--------------------------------------------------------------*/
 void aquire(void)
  {
+  shot_record_t* record;
+
 /*
- * Pull in the data amd save it in the record array
+ * Pull in the data amd save it in the shot queue
  */
-  read_timers(&record[this_shot].timer_count[0]);   // Record this count
-  record[this_shot].shot_time = 0;                  // Capture the time into the shot
-  record[this_shot].face_strike = face_strike;      // Record if it's a face strike
-  record[this_shot].sensor_status = is_running();   // Record the sensor status
-  record[this_shot].shot_number = shot_number++;    // Record the shot number and increment
-  this_shot = (this_shot+1) % SHOT_STRING;          // Prepare for the next shot
+  record = shot_queue_claim(&shot_queue);
+  if ( record == NULL )                             // No room
+  {
+    shot_number++;                                  // Keep the shot number
+    return;
+  }
+
+  record->capture_cycles = pcnt_snapshot(&record->timer_count[0], &record->capture_skew); // Record this count
+  record->capture_time = esp_timer_get_time();      // and when it was taken
+  record->rearm_time = rearm_time;                  // How long it took to re-arm after the last shot
+  record->shot_time = 0;                            // Capture the time into the shot
+  record->face_strike = face_strike;                // Record if it's a face strike
+  record->sensor_status = is_running();             // Record the sensor status
+  record->shot_number = shot_number++;              // Record the shot number and increment
+  shot_queue_publish(&shot_queue);                  // Hand it to reduce()
 
 /*
  * All done for now
@@ -20,7 +20,6 @@ void commit_status_LEDs(unsigned int blink_state);        // Write the LED contr
 unsigned int read_DIP(void);                              // Read the DIP switch register
 unsigned int read_counter(unsigned int direction);
 void stop_timers(void);                                   // Turn off the counter registers
-void read_timers(int* timer_count);                      // Read and return the counter registers
 void drive_paper(void);                                   // Turn on the paper motor
 void drive_paper_tick(void);                              // Turn the motor off when the time runs out
 void aquire(void);                                        // Read the clock registers
@@ -9,11 +9,14 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "nonvol.h"
+#include "nonvol_shadow.h"
 
 #include "freETarget.h"
 #include "diag_tools.h"
 #include "json.h"
 #include "ctype.h"
+#include "stdlib.h"
+#include "string.h"
 #include "stdio.h"
 #include "serial_io.h"
 #include "analog_io.h"
@@ -23,16 +26,36 @@
 #include "mechanical.h"
 #include "wifi.h"
 #include "mfs.h"
+#include "shot_queue.h"
+#include "timer.h"
+#include "tcpip_server.h"
+#include "udp_score.h"
 
 /*
  *  Function Prototypes
  */
-static void handle_json(void);    // Breakdown the JSON and execute it
+static void json_execute(const json_message_t* entry, char* value); // Carry out one command
+static void build_json_index(void);                                 // Sort JSON[] for searching
+static const json_message_t* find_json(char* key, unsigned int length); // Look up a key
 
 /*
  *  Variables
  */
-static char input_JSON[256];
+typedef struct json_context
+{
+  char          input[256];         // Command being collected
+  unsigned int  in;                 // Where the next character goes
+  bool          keep_space;         // Set to 1 if keeping spaces
+  bool          got_left_bracket;   // Set to 1 if we have a bracket
+  unsigned int  session;            // Connection the input came from
+} json_context_t;
+
+static json_context_t json_context[SERIAL_SOURCES]; // One for each input
+static int            json_reply_to = -1;           // Input being answered, -1 for all of them
+
+#define REPLY(message) {message} json_reply(_xs);   // Answer the command being handled
+static void json_reply(char* s);                    // Send to json_reply_to
+static void json_parse(json_context_t* context, char ch); // Add one character to a command
 
 int     json_calibre_x10;           // Pellet Calibre
 int     json_dip_switch;            // DIP switch overwritten by JSON message
@@ -85,25 +108,38 @@ int     json_token;                 // Token ring state
 double  json_vref_lo;               // Low Voltage DAC setting
 double  json_vref_hi;               // High Voltage DAC setting
 int     json_pcnt_latency;          // pcnt interrupt latency
+int     json_solver;                // compute_hit() algorithm
+int     json_acquire;               // Shot acquisition mode
+int     json_tcp_clients;           // Number of TCPIP clients allowed
+int     json_ring_adapt;            // Learn the ring down time
+int     json_follow_order;          // Order scores are released after the follow through
+int     json_input_echo;            // Ports that echo their input
+char    json_udp_address[UDP_ADDRESS_SIZE]; // Where the scores are published, empty if not
+int     json_udp_port;              // Port the scores are published to
+int     json_score_fields;          // What items are included in the score messages
 
        void show_echo(void);        // Display the current settings
 static void show_test(int v);       // Execute the self test once
 static void show_names(int v);
 static void set_trace(int v);       // Set the trace on and off
+static void set_score_format(int v);// JSON or binary scores on this link
 static void diag_delay(int x) ;     // Insert a delay
 
   
 const json_message_t JSON[] = {
 //    token                 value stored in RAM     double stored in RAM        convert    service fcn()     NONVOL location      Initial Value
+  {"\"ACQUIRE\":",        &json_acquire,                     0,                IS_INT32,  0,                NONVOL_ACQUIRE,          0 },    // Polled (0) or interrupt (1) shot acquisition
   {"\"ANGLE\":",          &json_sensor_angle,                0,                IS_INT32,  0,                NONVOL_SENSOR_ANGLE,    45 },    // Locate the sensor angles
-  {"\"BYE\":",            0,                                 0,                IS_VOID,   &bye,             0,                       0 },    // Shut down the target
+  {"\"BYE\":",            0,                                 0,                IS_VOID,   HANDLER(&bye),    0,                       0 },    // Shut down the target
   {"\"CALIBREx10\":",     &json_calibre_x10,                 0,                IS_INT32,  0,                NONVOL_CALIBRE_X10,     45 },    // Enter the projectile calibre (mm x 10)
   {"\"DELAY\":",          0,                                 0,                IS_INT32,  &diag_delay,                      0,       0 },    // Delay TBD seconds
-  {"\"ECHO\":",           0,                                 0,                IS_VOID,   &show_echo,       0,                       0 },    // Echo test
-  {"\"ECHO?\"",           0,                                 0,                IS_VOID,   &show_echo,       0,                       0 },    // Echo test
+  {"\"ECHO\":",           0,                                 0,                IS_VOID,   HANDLER(&show_echo), 0,                       0 },    // Echo test
+  {"\"ECHO?\"",           0,                                 0,                IS_VOID,   HANDLER(&show_echo), 0,                       0 },    // Echo test
   {"\"FACE_STRIKE\":",    &json_face_strike,                 0,                IS_INT32,  0,                NONVOL_FACE_STRIKE,      0 },    // Face Strike Count 
+  {"\"FOLLOW_ORDER\":",   &json_follow_order,                0,                IS_INT32,  0,                NONVOL_FOLLOW_ORDER,     0 },    // Release scores in shot order (0) or as each follow through ends (1)
   {"\"FOLLOW_THROUGH\":", &json_follow_through,              0,                IS_INT32,  0,                NONVOL_FOLLOW_THROUGH,   0 },    // Three second follow through
   {"\"INIT\":",           0,                                 0,                IS_INT32,  &init_nonvol,     NONVOL_INIT,             0 },    // Initialize the NONVOL memory
+  {"\"INPUT_ECHO\":",     &json_input_echo,                  0,                IS_INT32,  0,                NONVOL_INPUT_ECHO,       7 },    // Echo the input back to the sender on the console (1), AUX (2), TCPIP (4)
   {"\"KEEP_ALIVE\":",     &json_keep_alive,                  0,                IS_INT32,  0,                NONVOL_KEEP_ALIVE,     120 },    // TCPIP Keep alive period (in seconds)
   {"\"LED_BRIGHT\":",     &json_LED_PWM,                     0,                IS_INT32,  &set_LED_PWM_now, NONVOL_LED_PWM,         50 },    // Set the LED brightness
   {"\"MFS\":",            &json_multifunction,               0,                IS_INT32,  0,                NONVOL_MFS,  (LED_ADJUST*10000) 
@@ -121,7 +157,7 @@ const json_message_t JSON[] = {
                                                                                                                           + (NO_ACTION * 100) 
                                                                                                                           + (NO_ACTION * 10) 
                                                                                                                           + (NO_ACTION) },   // Multifunction switch action
-  {"\"MFS?\"",            0,                                 0,                IS_VOID,   &multifunction_show,                       0 },
+  {"\"MFS?\"",            0,                                 0,                IS_VOID,   HANDLER(&multifunction_show),              0 },
 
   {"\"MIN_RING_TIME\":",  &json_min_ring_time,               0,                IS_INT32,  0,                NONVOL_MIN_RING_TIME,  500 },    // Minimum time for ringing to stop (ms)
   {"\"NAME_ID\":",        &json_name_id,                     0,                IS_INT32,  &show_names,      NONVOL_NAME_ID,          0 },    // Give the board a name
@@ -133,9 +169,13 @@ const json_message_t JSON[] = {
   {"\"RAPID_ENABLE\":",   &json_rapid_enable,                0,                IS_INT32,  0,                0,                       0 },    // Enable the rapid fire fieature
   {"\"RAPID_TIME\":",     &json_rapid_time,                  0,                IS_INT32,  0,                0,                       0 },    // Set the duration of the rapid fire event and start
   {"\"RAPID_WAIT\":",     &json_rapid_wait,                  0,                IS_INT32,  0,                0,                       0 },    // Delay applied between enable and ready
+  {"\"RING_ADAPT\":",     &json_ring_adapt,                  0,                IS_INT32,  0,                NONVOL_RING_ADAPT,       0 },    // Re-arm when the sensors stop ringing (1) or after MIN_RING_TIME (0)
+  {"\"SCORE_FIELDS\":",   &json_score_fields,                0,                IS_INT32,  0,                NONVOL_SCORE_FIELDS,    27 },    // Shot (1), X-Y (2), polar (4), timers (8), diagnostics (16) in the scores
+  {"\"SCORE_FORMAT\":",   0,                                 0,                IS_INT32,  &set_score_format, 0,                      0 },    // Scores on this link as JSON (0) or binary frames (1)
   {"\"SEND_MISS\":",      &json_send_miss,                   0,                IS_INT32,  0,                NONVOL_SEND_MISS,        0 },    // Enable / Disable sending miss messages
   {"\"SENSOR\":",         0,                                 &json_sensor_dia, IS_FLOAT,  0,                NONVOL_SENSOR_DIA,  230000 },    // Generate the sensor postion array
   {"\"SN\":",             &json_serial_number,               0,                IS_FIXED,  0,                NONVOL_SERIAL_NO,   0xffff },    // Board serial number
+  {"\"SOLVER\":",         &json_solver,                      0,                IS_INT32,  0,                NONVOL_SOLVER,           0 },    // Select the shot location algorithm
   {"\"STEP_COUNT\":",     &json_step_count,                  0,                IS_INT32,  0,                NONVOL_STEP_COUNT,       0 },    // Set the duration of the stepper motor ON time
   {"\"STEP_TIME\":",      &json_step_time,                   0,                IS_INT32,  0,                NONVOL_STEP_TIME,        0 },    // Set the number of times stepper motor is stepped
   {"\"TABATA_ENABLE\":",  &json_tabata_enable,               0,                IS_INT32,  &tabata_enable,   0,                       0 },    // Enable the tabata feature
@@ -144,16 +184,19 @@ const json_message_t JSON[] = {
   {"\"TABATA_WARN_OFF\":",&json_tabata_warn_off,             0,                IS_INT32,  0,                0,                       0 },    // Time that the LEDs are ON during a warning cycle
   {"\"TABATA_WARN_ON\":", &json_tabata_warn_on,              0,                IS_INT32,  0,                0,                     200 },    // Time that the LEDs are OFF during a warning cycle
   {"\"TARGET_TYPE\":",    &json_target_type,                 0,                IS_INT32,  0,                NONVOL_TARGET_TYPE,      0 },    // Marify shot location (0 == Single Bull)
+  {"\"TCP_CLIENTS\":",    &json_tcp_clients,                 0,                IS_INT32,  0,                NONVOL_TCP_CLIENTS,      4 },    // Number of TCPIP clients allowed (restart to apply)
   {"\"TEST\":",           0,                                 0,                IS_INT32,  &show_test,       0,                       0 },    // Execute a self test
   {"\"TOKEN\":",          &json_token,                       0,                IS_INT32,  0,                NONVOL_TOKEN,            0 },    // Token ring state
   {"\"TRACE\":",          0,                                 0,                IS_INT32,  &set_trace,       0,                       0 },    // Enter / exit diagnostic trace
-  {"\"VERSION\":",        0,                                 0,                IS_INT32,  &POST_version,    0,                       0 },    // Return the version string
-  {"\"VREF_LO\":",        0,                                 &json_vref_lo,    IS_FLOAT,  &set_VREF,        NONVOL_VREF_LO,       1250 },    // Low trip point value (Volts)
-  {"\"VREF_HI\":",        0,                                 &json_vref_hi,    IS_FLOAT,  &set_VREF,        NONVOL_VREF_HI,       2000 },    // High trip point value (Volts)
+  {"\"UDP_ADDRESS\":",    (int*)&json_udp_address,           0,                IS_TEXT+UDP_ADDRESS_SIZE, 0, NONVOL_UDP_ADDRESS,      0 },    // Multicast, broadcast or PC address to publish the scores to (restart to apply)
+  {"\"UDP_PORT\":",       &json_udp_port,                    0,                IS_INT32,  0,                NONVOL_UDP_PORT,      1091 },    // Port the scores are published to (restart to apply)
+  {"\"VERSION\":",        0,                                 0,                IS_INT32,  HANDLER(&POST_version), 0,                       0 },    // Return the version string
+  {"\"VREF_LO\":",        0,                                 &json_vref_lo,    IS_FLOAT,  HANDLER(&set_VREF), NONVOL_VREF_LO,       1250 },    // Low trip point value (Volts)
+  {"\"VREF_HI\":",        0,                                 &json_vref_hi,    IS_FLOAT,  HANDLER(&set_VREF), NONVOL_VREF_HI,       2000 },    // High trip point value (Volts)
   {"\"WIFI_CHANNEL\":",   &json_wifi_channel,                0,                IS_INT32,  0,                NONVOL_WIFI_CHANNEL,     6 },    // Set the wifi channel
   {"\"WIFI_PWD\":",       (int*)&json_wifi_pwd,              0,                IS_SECRET+PWD_SIZE, 0,       NONVOL_WIFI_PWD,         0 },    // Password of SSID to attach to 
   {"\"WIFI_SSID\":",      (int*)&json_wifi_ssid,             0,                IS_TEXT+SSID_SIZE,  0,       NONVOL_WIFI_SSID,        0 },    // Name of SSID to attach to 
-  {"\"ZAPPLE\":",         0,                                 0,                IS_VOID,   &zapple,          0,                       0 },    // Start a ZAPPLE console monitor
+  {"\"ZAPPLE\":",         0,                                 0,                IS_VOID,   HANDLER(&zapple), 0,                       0 },    // Start a ZAPPLE console monitor
   {"\"Z_OFFSET\":",       &json_z_offset,                    0,                IS_INT32,  0,                NONVOL_Z_OFFSET,        13 },    // Distance from paper to sensor plane (mm)
   {"\"NORTH_X\":",        &json_north_x,                     0,                IS_INT32,  0,                NONVOL_NORTH_X,          0 },    //
   {"\"NORTH_Y\":",        &json_north_y,                     0,                IS_INT32,  0,                NONVOL_NORTH_Y,          0 },    //
@@ -168,6 +211,9 @@ const json_message_t JSON[] = {
 };
 
 int instr(char* s1, char* s2);
+
+static const json_message_t* json_index[sizeof(JSON)/sizeof(JSON[0])]; // JSON[] sorted by token
+static unsigned int json_index_size;                                    // Entries in json_index[]
 static void diag_delay(int x) { printf("\r\n\"DELAY\":%d", x); vTaskDelay(x*1000);  return;}
 
 /*-----------------------------------------------------
@@ -194,11 +240,7 @@ static void diag_delay(int x) { printf("\r\n\"DELAY\":%d", x); vTaskDelay(x*1000
  * corresponding memory location
  * 
  *-----------------------------------------------------*/
-static unsigned int in_JSON = 0;
-static unsigned int got_right_bracket = 0;
 static bool not_found;
-static bool keep_space;             // Set to 1 if keeping spaces
-static bool got_left_bracket;       // Set to 1 if we have a bracket
 
 static int to_int(char h)
 {
@@ -219,7 +261,11 @@ void freeETarget_json
     void *pvParameters
 )
 {
-  char          ch;
+  char          frame[sizeof(json_context[0].input)]; // Block of input from one port
+  int           length;
+  int           source;
+  int           echo;
+  int           i;
 
   DLT(DLT_CRITICAL, printf("freeETarget_json()");)
 
@@ -228,68 +274,40 @@ void freeETarget_json
     IF_NOT(IN_OPERATION) { vTaskDelay(ONE_SECOND); printf("*\r\n"); continue;}
 
 /*
- * See if anything is waiting and if so, add it in
+ * Go round the ports.  The input arrives a {...} at a time and
+ * each port keeps its own half finished command, so a client that
+ * stops in the middle of one does not spoil the others
  */
-    while ( serial_available(ALL) != 0 )
+    for (source=0; source != SERIAL_SOURCES; source++)
     {
-      ch = serial_getch(ALL);
-      SEND(sprintf(_xs, "%c%c", ch, 0);)
-      
-/*
- * Parse the stream
- */
-      switch (ch)
-      {     
-        case '}':
-          if ( in_JSON != 0 )
-          {
-            got_left_bracket = false;
-            got_right_bracket = in_JSON;
-            handle_json();                    // Fall through to reinitialize
-          }   
-
-        case '{':
-          in_JSON = 0;
-          input_JSON[0] = 0;
-          got_right_bracket = 0;
-          got_left_bracket = true;
-          keep_space = 0;
-          break;
-
-        case 0x08:                            // Backspace
-          if ( in_JSON != 0 )
-          {
-            in_JSON--;
-          }
-          input_JSON[in_JSON] = 0;            // Null terminate
-          break;
-
-        case '*':                             // Force echo for PC Client
-          if ( got_left_bracket == false )    // Whenever we are not between
-          {                                   // {}
-            POST_version();
-            show_echo();
-            break;
-          }                                   // Otherwise fall through
+      if ( json_context[source].session != serial_source_session(source) )
+      {
+        memset(&json_context[source], 0, sizeof(json_context_t)); // New connection, start over
+        json_context[source].session = serial_source_session(source);
+      }
 
-        case '"':                             // Start or end of text
-          keep_space = (keep_space ^ 1) & 1;
-        
-        default:
-          if ( (ch != ' ') || keep_space )
-          {
-            input_JSON[in_JSON] = ch;            // Add in the latest
-            if ( in_JSON < (sizeof(input_JSON)-1) )
-            {
-            in_JSON++;
-            }
-            input_JSON[in_JSON] = 0;                  // Null terminate
-          }
-          break;
-      }   // End switch
+      switch (source)
+      {
+        case SOURCE_CONSOLE: echo = json_input_echo & ECHO_CONSOLE; break;
+        case SOURCE_AUX:     echo = json_input_echo & ECHO_AUX;     break;
+        default:             echo = json_input_echo & ECHO_TCPIP;   break;
+      }
 
-    }     // End if char available
-    vTaskDelay( MIN_DELAY );
+      while ( (length = serial_source_frame(source, frame, sizeof(frame))) != 0 )
+      {
+        if ( echo )
+        {
+          serial_reply(source, frame, length);
+        }
+        json_reply_to = source;
+        for ( i=0; i != length; i++ )
+        {
+          json_parse(&json_context[source], frame[i]);
+        }
+        json_reply_to = -1;
+      }
+    }
+    serial_wait(ONE_SECOND);                  // Sleep until something arrives
   }
   
 /*
@@ -297,6 +315,103 @@ void freeETarget_json
  */
 }
 
+/*-----------------------------------------------------
+ * 
+ * @function: json_parse
+ * 
+ * @brief: Add one character to a port's command
+ * 
+ * @return: None
+ * 
+ *-----------------------------------------------------*/
+static void json_parse
+(
+    json_context_t* context,                  // Port the character came from
+    char            ch                        // Next character
+)
+{
+  switch (ch)
+  {     
+    case '}':
+      if ( context->in != 0 )
+      {
+        context->got_left_bracket = false;
+        handle_json(context->input);          // Fall through to reinitialize
+      }   
+
+    case '{':
+      context->in = 0;
+      context->input[0] = 0;
+      context->got_left_bracket = true;
+      context->keep_space = 0;
+      break;
+
+    case 0x08:                                // Backspace
+      if ( context->in != 0 )
+      {
+        context->in--;
+      }
+      context->input[context->in] = 0;        // Null terminate
+      break;
+
+    case '*':                                 // Force echo for PC Client
+      if ( context->got_left_bracket == false )// Whenever we are not between
+      {                                       // {}
+        POST_version();
+        show_echo();
+        break;
+      }                                       // Otherwise fall through
+
+    case '"':                                 // Start or end of text
+      context->keep_space = (context->keep_space ^ 1) & 1;
+  
+    default:
+      if ( (ch != ' ') || context->keep_space )
+      {
+        context->input[context->in] = ch;     // Add in the latest
+        if ( context->in < (sizeof(context->input)-1) )
+        {
+          context->in++;
+        }
+        context->input[context->in] = 0;      // Null terminate
+      }
+      break;
+  }
+
+  return;
+}
+
+/*-----------------------------------------------------
+ * 
+ * @function: json_reply
+ * 
+ * @brief: Answer the port the command came from
+ * 
+ * @return: None
+ * 
+ *-----------------------------------------------------
+ *
+ * Outside of a command (json_reply_to < 0) the text
+ * goes everywhere, as SEND() would.
+ * 
+ *-----------------------------------------------------*/
+static void json_reply
+(
+    char* s                                   // Text to send
+)
+{
+  if ( json_reply_to < 0 )
+  {
+    serial_to_all(s, ALL);
+  }
+  else
+  {
+    serial_reply(json_reply_to, s, strlen(s));
+  }
+
+  return;
+}
+
 /*-----------------------------------------------------
  * 
  * @function: handle_json
@@ -307,165 +422,347 @@ void freeETarget_json
  * 
  *-----------------------------------------------------
  *
- * The input stream is parsed one JSON token at a time
- * and the JSON[] is used to determine the action
+ * The input is walked once from left to right.  Each
+ * key, ex "SENSOR": is looked up in the sorted index
+ * of JSON[] and the value that follows it is passed
+ * to json_execute().  The value is then skipped,
+ * including any commas inside of quotes, to get to
+ * the next key.
+ * 
+ * Keys that do not take a value, ex "ECHO?" are 
+ * looked up without the colon.
  * 
  *-----------------------------------------------------*/
  
-static void handle_json(void)
+void handle_json
+(
+  char* input                       // JSON without the braces
+)
 {
-  int   x;
-  float f;
-  int   i, j, k;
-  char  s[64];          // Place to store a string
-  int   m;
+  char*                 key;        // Start of the current key
+  char*                 p;          // Where we are in the input
+  const json_message_t* entry;      // Matching JSON[] entry
+  bool                  in_quote;
+
+  if ( json_index_size == 0 )
+  {
+    build_json_index();
+  }
 
 /*
- * Found out where the braces are, extract the contents.
+ * Found out where the keys are and execute them
  */
   not_found = true;
-  for ( i=0; i != got_right_bracket; i++)                       // Go across the JSON input 
+  p = input;
+  while ( *p != 0 )
   {
-    j = 0;                                                      // Index across the JSON token table
-    
-    while ( (JSON[j].token != 0) )                              // Cycle through the tokens
+    if ( *p != '"' )                                            // Look for the start of a key
     {
-      x = 0;
-      if ( JSON[j].token != 0 )
-      {
-        k = instr(&input_JSON[i], JSON[j].token );              // Compare the input against the list of JSON tags
-        if ( k > 0 )                                            // Non zero, found something
-        {
-          not_found = false;                                    // Read and convert the JSON value
-          switch ( JSON[j].convert & IS_MASK )
-          {
-            default:
-            case IS_VOID:                                       // Void, default to zero
-            case IS_FIXED:                                      // Fixed cannot be changed
-              x = 0;
-            break;
-
-            case IS_MFS:                                      // 
-              x = atoi(&input_JSON[i+k]);                     // Integer
-              switch(JSON[j].convert & FLOAT_MASK)
-              {
-                case _HOLD1:
-                  x = multifunction_hold1(x);
-                  break;
-                
-                case _HOLD2:
-                  x = multifunction_hold2(x);
-                  break;
-                                  
-                case _TAP1:
-                  x = multifunction_tap1(x);
-                  break;
-                
-                case _TAP2:
-                  x = multifunction_tap2(x);
-                  break;
-                
-                case _HOLD12:
-                  x = multifunction_hold12(x);
-                  break;
-              }
+      p++;
+      continue;
+    }
 
-              if ( JSON[j].value != 0 )
-              {
-                *JSON[j].value = x;                             // Save the value
-              }
-              if ( JSON[i].non_vol != 0 )
-              {
-                nvs_set_i32(my_handle, JSON[j].non_vol, x);    // Store into NON-VOL
-              }
-              break;
+    key = p++;
+    while ( (*p != 0) && (*p != '"') )                          // Find the end of the key
+    {
+      p++;
+    }
+    if ( *p == 0 )
+    {
+      break;                                                    // Key was not finished
+    }
+    p++;                                                        // Include the closing quote
 
-            case IS_TEXT:                                       // Convert to text
-            case IS_SECRET:
-              while ( input_JSON[i+k] != '"' )                  // Skip to the opening quote
-              {
-                k++; 
-              }
-              k++;                                              // Advance to the text
+    entry = 0;
+    if ( *p == ':' )
+    {
+      entry = find_json(key, (p + 1) - key);                    // "KEY":
+    }
+    if ( entry == 0 )
+    {
+      entry = find_json(key, p - key);                          // "KEY?"
+    }
+    if ( *p == ':' )
+    {
+      p++;                                                      // Move to the value
+    }
 
-              m = 0;
-              s[0] = 0;                                         // Put in a null
-              while ( input_JSON[i+k] != '"' )                  // Skip to the opening quote
-              {
-                s[m] = input_JSON[i+k];                        // Save the value
-                m++;
-                s[m] = 0;                                      // Null terminate 
-                k++;
-              }             
-              if ( JSON[j].non_vol != 0 )                       // Save to persistent storage if present
-              {
-                nvs_set_str(my_handle, JSON[j].non_vol, s);     // Store into NON-VOL
-              }
-              break;
-              
-            case IS_INT32:                                      // Convert an integer
-              if ( (input_JSON[i+k] == '0')
-                  && ( (input_JSON[i+k+1] == 'X') || (input_JSON[i+k+1] == 'x')) )  // Is it Hex?
-              {
-                x = (to_int(input_JSON[i+k+2]) << 4) + to_int(input_JSON[i+k+3]);
-              }
-              else
-              {
-                x = atoi(&input_JSON[i+k]);                     // Integer
-              }
-              if ( JSON[j].value != 0 )
-              {
-                *JSON[j].value = x;                             // Save the value
-              }
-              if ( JSON[j].non_vol != 0 )
-              {
-                nvs_set_i32(my_handle, JSON[j].non_vol, x);    // Store into NON-VOL
-              }
-              break;
-  
-            case IS_FLOAT:                                      // Convert a floating point number
-              f = atof(&input_JSON[i+k]);                       // Float
-              x = f * 1000;                                     // Integer
-              if ( JSON[j].d_value != 0 )
-              {
-                *JSON[j].d_value = f;                             // Working Value
-              }
-              if ( JSON[j].non_vol != 0 )
-              {
-                nvs_set_i32(my_handle, JSON[j].non_vol, x);    // Store into NON-VOL as an integer * 1000
-              }
-              break;
-          }
+    if ( entry != 0 )
+    {
+      not_found = false;
+      json_execute(entry, p);
+    }
 
-          if ( JSON[j].f != 0 )                               // Call the handler if it is available
-          {
-            JSON[j].f(x);
-          }            
-        }
+/*
+ * Skip over the value to the next key
+ */
+    in_quote = false;
+    while ( (*p != 0) && ((*p != ',') || in_quote) )
+    {
+      if ( *p == '"' )
+      {
+        in_quote = !in_quote;
       }
-    j++;
+      p++;
     }
-     nvs_commit(my_handle);                                   // Save to memory
   }
 
+  nonvol_flush();                                               // Save to memory, one commit for the message
+
 /*
  * Report an error if input not found
  */
   if ( not_found == true )
   {
-    printf("\r\n\r\nCannot decode: {%s}", input_JSON);
+    printf("\r\n\r\nCannot decode: {%s}", input);
   }
   
 /*
  * All done
  */   
-  in_JSON   = 0;                // Start Over
-  got_right_bracket = 0;        // Need to wait for a new Right Bracket
-  got_left_bracket = false;
-  input_JSON[in_JSON] = 0;      // Clear the input
   return;
 }
 
+/*-----------------------------------------------------
+ * 
+ * @function: json_execute
+ * 
+ * @brief:  Convert the value and carry out the command
+ * 
+ * @return: None
+ * 
+ *-----------------------------------------------------
+ *
+ * The value is converted according to the JSON[] entry,
+ * saved in RAM and NONVOL if needed, and the service
+ * function called.
+ * 
+ *-----------------------------------------------------*/
+static void json_execute
+(
+  const json_message_t* entry,      // Command from JSON[]
+  char*                 value       // Text following the key
+)
+{
+  int   x;
+  float f;
+  char  s[64];          // Place to store a string
+  int   m;
+
+  x = 0;
+  switch ( entry->convert & IS_MASK )
+  {
+    default:
+    case IS_VOID:                                       // Void, default to zero
+    case IS_FIXED:                                      // Fixed cannot be changed
+      x = 0;
+    break;
+
+    case IS_MFS:                                      // 
+      x = atoi(value);                                // Integer
+      switch(entry->convert & FLOAT_MASK)
+      {
+        case _HOLD1:
+          x = multifunction_hold1(x);
+          break;
+        
+        case _HOLD2:
+          x = multifunction_hold2(x);
+          break;
+                          
+        case _TAP1:
+          x = multifunction_tap1(x);
+          break;
+        
+        case _TAP2:
+          x = multifunction_tap2(x);
+          break;
+        
+        case _HOLD12:
+          x = multifunction_hold12(x);
+          break;
+      }
+
+      if ( entry->value != 0 )
+      {
+        *entry->value = x;                              // Save the value
+      }
+      if ( entry->non_vol != 0 )
+      {
+        nonvol_set_i32(entry->non_vol, x);              // Store into NON-VOL
+      }
+      break;
+
+    case IS_TEXT:                                       // Convert to text
+    case IS_SECRET:
+      while ( (*value != 0) && (*value != '"') )        // Skip to the opening quote
+      {
+        value++; 
+      }
+      if ( *value != 0 )
+      {
+        value++;                                        // Advance to the text
+      }
+
+      m = 0;
+      s[0] = 0;                                         // Put in a null
+      while ( (*value != 0) && (*value != '"') && (m < sizeof(s)-1) ) // Copy to the closing quote
+      {
+        s[m] = *value;                                  // Save the value
+        m++;
+        s[m] = 0;                                       // Null terminate 
+        value++;
+      }             
+      if ( entry->non_vol != 0 )                        // Save to persistent storage if present
+      {
+        nonvol_set_str(entry->non_vol, s);              // Store into NON-VOL
+      }
+      break;
+      
+    case IS_INT32:                                      // Convert an integer
+      if ( (value[0] == '0')
+          && ( (value[1] == 'X') || (value[1] == 'x')) )  // Is it Hex?
+      {
+        x = (to_int(value[2]) << 4) + to_int(value[3]);
+      }
+      else
+      {
+        x = atoi(value);                                // Integer
+      }
+      if ( entry->value != 0 )
+      {
+        *entry->value = x;                              // Save the value
+      }
+      if ( entry->non_vol != 0 )
+      {
+        nonvol_set_i32(entry->non_vol, x);              // Store into NON-VOL
+      }
+      break;
+
+    case IS_FLOAT:                                      // Convert a floating point number
+      f = atof(value);                                  // Float
+      x = f * 1000;                                     // Integer
+      if ( entry->d_value != 0 )
+      {
+        *entry->d_value = f;                            // Working Value
+      }
+      if ( entry->non_vol != 0 )
+      {
+        nonvol_set_i32(entry->non_vol, x);              // Store into NON-VOL as an integer * 1000
+      }
+      break;
+  }
+
+  if ( entry->f != 0 )                                  // Call the handler if it is available
+  {
+    entry->f(x);
+  }            
+
+  return;
+}
+
+/*-----------------------------------------------------
+ * 
+ * @function: build_json_index
+ * 
+ * @brief:  Sort the JSON[] table for searching
+ * 
+ * @return: json_index[] filled in
+ * 
+ *-----------------------------------------------------
+ *
+ * JSON[] is kept in the order that show_echo() prints
+ * it, so a separate index sorted on the token is built
+ * the first time a message arrives.  The table is small
+ * so an insertion sort is used.
+ * 
+ *-----------------------------------------------------*/
+static void build_json_index(void)
+{
+  unsigned int          i, j;
+  const json_message_t* entry;
+
+  json_index_size = 0;
+  for (i=0; JSON[i].token != 0; i++)
+  {
+    entry = &JSON[i];
+    j = json_index_size;
+    while ( (j != 0) && (strcmp(json_index[j-1]->token, entry->token) > 0) )
+    {
+      json_index[j] = json_index[j-1];
+      j--;
+    }
+    json_index[j] = entry;
+    json_index_size++;
+  }
+
+  return;
+}
+
+/*-----------------------------------------------------
+ * 
+ * @function: find_json
+ * 
+ * @brief:  Binary search for a key in the JSON[] index
+ * 
+ * @return: Matching entry or 0 if not found
+ * 
+ *-----------------------------------------------------
+ *
+ * The key is not null terminated, so it is compared
+ * against the token for length characters, and the
+ * token must end there.
+ * 
+ *-----------------------------------------------------*/
+static const json_message_t* find_json
+(
+  char*        key,                 // Start of the key, ex "SENSOR":
+  unsigned int length               // Number of characters in the key
+)
+{
+  int          lo, hi, mid;
+  int          compare;
+  unsigned int i;
+  const char*  token;
+
+  lo = 0;
+  hi = json_index_size - 1;
+  while ( lo <= hi )
+  {
+    mid = (lo + hi) / 2;
+    token = json_index[mid]->token;
+
+    compare = 0;
+    for (i=0; i != length; i++)
+    {
+      compare = (unsigned char)key[i] - (unsigned char)token[i];
+      if ( (compare != 0) || (token[i] == 0) )
+      {
+        break;
+      }
+    }
+    if ( (compare == 0) && (token[length] != 0) )
+    {
+      compare = -1;                                 // Key is shorter than the token
+    }
+
+    if ( compare == 0 )
+    {
+      return json_index[mid];
+    }
+    if ( compare < 0 )
+    {
+      hi = mid - 1;
+    }
+    else
+    {
+      lo = mid + 1;
+    }
+  }
+
+  return 0;
+}
+
 // Compare two strings.  Return -1 if not equal, length of string if equal
 // S1 Long String, S2 Short String . if ( instr("CAT Sam", "CAT") == 3)
 int instr(char* s1, char* s2)
@@ -516,11 +813,11 @@ void show_echo(void)
 
   if ( (json_token == TOKEN_NONE) || (my_ring == TOKEN_UNDEF) )
   {
-    SEND(sprintf(_xs, "\r\n{\r\n\"NAME\":\"%s\", \r\n", names[json_name_id]);)
+    REPLY(sprintf(_xs, "\r\n{\r\n\"NAME\":\"%s\", \r\n", names[json_name_id]);)
   }
   else
   {
-    SEND(sprintf(_xs, "\r\n{\r\n\"NAME\":\"%s\", \r\n", names[json_name_id+my_ring]);)
+    REPLY(sprintf(_xs, "\r\n{\r\n\"NAME\":\"%s\", \r\n", names[json_name_id+my_ring]);)
   }
 
 /*
@@ -553,7 +850,7 @@ void show_echo(void)
               j++;
             }
             str_c[j] = 0;
-            SEND(sprintf(_xs, "%s \"%s\", \r\n", JSON[i].token, str_c);)
+            REPLY(sprintf(_xs, "%s \"%s\", \r\n", JSON[i].token, str_c);)
             break;
             
           case IS_MFS:                                        // Covert to a switch ID
@@ -580,16 +877,16 @@ void show_echo(void)
                   k = HOLD12(*JSON[i].value);
                   break;
               }
-          SEND(sprintf(_xs, "%s \"(%d) - %s\", \r\n", JSON[i].token, k, multifunction_str(k));)
+          REPLY(sprintf(_xs, "%s \"(%d) - %s\", \r\n", JSON[i].token, k, multifunction_str(k));)
           break;
 
         case IS_INT32:
         case IS_FIXED:
-          SEND(sprintf(_xs, "%s %d, \r\n", JSON[i].token, *JSON[i].value);)
+          REPLY(sprintf(_xs, "%s %d, \r\n", JSON[i].token, *JSON[i].value);)
           break;
 
         case IS_FLOAT:
-          SEND(sprintf(_xs, "%s %6.2f, \r\n", JSON[i].token, *JSON[i].d_value);)
+          REPLY(sprintf(_xs, "%s %6.2f, \r\n", JSON[i].token, *JSON[i].d_value);)
           break;
       }
       vTaskDelay(10); 
@@ -600,40 +897,45 @@ void show_echo(void)
 /*
  * Finish up with the special cases
  */
-  SEND(sprintf(_xs, "\n\rStatus\r\n");)                                                                    // Blank Line
-  SEND(sprintf(_xs, "\"TRACE\": %d, \n\r", is_trace);)         // TRUE to if trace is enabled
-  SEND(sprintf(_xs, "\"RUN_STATE\": %d, \n\r", run_state);)    // TRUE to if trace is enabled
-  SEND(sprintf(_xs, "\"RUNNING_MINUTES\": %10.6f, \n\r", esp_timer_get_time()/100000.0/60.0);)  // On Time
-  SEND(sprintf(_xs, "\"TIME_TO_SLEEP\": %4.2f, \n\r", (float)power_save/(float)(ONE_SECOND*60));)                 // How long until we sleep
-  SEND(sprintf(_xs, "\"TEMPERATURE\": %4.2f, \n\r", temperature_C());)                          // Temperature in degrees C
-  SEND(sprintf(_xs, "\"RELATIVE_HUMIDITY\": %4.2f, \n\r", humidity_RH());)
-  SEND(sprintf(_xs, "\"SPEED_OF_SOUND\": %4.2f, \n\r", speed_of_sound(temperature_C(), humidity_RH()));)
-  SEND(sprintf(_xs, "\"TIMER_COUNT\": %d, \n\r", (int)(SHOT_TIME * OSCILLATOR_MHZ));)             // Maximum number of clock cycles to record shot (target dependent)
-  SEND(sprintf(_xs, "\"V12\": %4.2f, \n\r", v12_supply());)    // 12 Volt LED supply
+  REPLY(sprintf(_xs, "\n\rStatus\r\n");)                                                                    // Blank Line
+  REPLY(sprintf(_xs, "\"TRACE\": %d, \n\r", is_trace);)         // TRUE to if trace is enabled
+  REPLY(sprintf(_xs, "\"RUN_STATE\": %d, \n\r", run_state);)    // TRUE to if trace is enabled
+  REPLY(sprintf(_xs, "\"SHOT_OVERFLOW\": %d, \n\r", shot_queue.overflow);)  // Shots dropped because reduce() fell behind
+  REPLY(sprintf(_xs, "\"SCORE_OVERFLOW\": %d, \n\r", score_overflow);)      // Scores dropped because the clients fell behind
+  REPLY(sprintf(_xs, "\"TCPIP_OVERFLOW\": %d, \n\r", tcpip_queue_overflow());) // Bytes too big for the TCPIP queue
+  REPLY(sprintf(_xs, "\"TCPIP_DROPPED\": %d, \n\r", tcpip_server_dropped());)  // Clients dropped for falling behind
+  REPLY(sprintf(_xs, "\"TIMER_OVERRUN\": %d, \n\r", timer_overrun());)      // Timer callbacks made late
+  REPLY(sprintf(_xs, "\"RUNNING_MINUTES\": %10.6f, \n\r", esp_timer_get_time()/100000.0/60.0);)  // On Time
+  REPLY(sprintf(_xs, "\"TIME_TO_SLEEP\": %4.2f, \n\r", (float)power_save/(float)(ONE_SECOND*60));)                 // How long until we sleep
+  REPLY(sprintf(_xs, "\"TEMPERATURE\": %4.2f, \n\r", temperature_C());)                          // Temperature in degrees C
+  REPLY(sprintf(_xs, "\"RELATIVE_HUMIDITY\": %4.2f, \n\r", humidity_RH());)
+  REPLY(sprintf(_xs, "\"SPEED_OF_SOUND\": %4.2f, \n\r", speed_of_sound(temperature_C(), humidity_RH()));)
+  REPLY(sprintf(_xs, "\"TIMER_COUNT\": %d, \n\r", (int)(SHOT_TIME * OSCILLATOR_MHZ));)             // Maximum number of clock cycles to record shot (target dependent)
+  REPLY(sprintf(_xs, "\"V12\": %4.2f, \n\r", v12_supply());)    // 12 Volt LED supply
   WiFi_MAC_address(str_c);
-  SEND(sprintf(_xs, "\"WiFi_MAC\": \"%02X:%02X:%02X:%02X:%02X:%02X\", \n\r", str_c[0], str_c[1],str_c[2], str_c[3], str_c[4], str_c[5]);)
+  REPLY(sprintf(_xs, "\"WiFi_MAC\": \"%02X:%02X:%02X:%02X:%02X:%02X\", \n\r", str_c[0], str_c[1],str_c[2], str_c[3], str_c[4], str_c[5]);)
   WiFi_my_ip_address(str_c);
-  SEND(sprintf(_xs, "\"WiFi_IP_ADDRESS\": \"%s:1090\", \n\r", str_c);)
+  REPLY(sprintf(_xs, "\"WiFi_IP_ADDRESS\": \"%s:1090\", \n\r", str_c);)
   if ( json_wifi_ssid[0] == 0 )                       // The SSID is undefined
   {
-    SEND(sprintf(_xs, "\"WiFi_MODE\": \"Access Point\",\n\r");)    // Print out the IP address
+    REPLY(sprintf(_xs, "\"WiFi_MODE\": \"Access Point\",\n\r");)    // Print out the IP address
   }
   else
   {
-    SEND(sprintf(_xs, "\"WiFi_MODE\": \"Station connected to SSID \"%s\",\n\r", (char*)&json_wifi_ssid);) 
+    REPLY(sprintf(_xs, "\"WiFi_MODE\": \"Station connected to SSID \"%s\",\n\r", (char*)&json_wifi_ssid);) 
   }
 
   if ( json_token == TOKEN_NONE )
   {
-    SEND(sprintf(_xs, "\"TOKEN_RING\":  %d, \n\r", my_ring);)           // My token ring address
-    SEND(sprintf(_xs, "\"TOKEN_OWNER\": %d, \n\r", whos_ring);)         // Who owns the token ring
+    REPLY(sprintf(_xs, "\"TOKEN_RING\":  %d, \n\r", my_ring);)           // My token ring address
+    REPLY(sprintf(_xs, "\"TOKEN_OWNER\": %d, \n\r", whos_ring);)         // Who owns the token ring
   }
   
-  SEND(sprintf(_xs, "\"VERSION\": %s, \n\r", SOFTWARE_VERSION);)        // Current software version
+  REPLY(sprintf(_xs, "\"VERSION\": %s, \n\r", SOFTWARE_VERSION);)        // Current software version
   nvs_get_i32(my_handle, NONVOL_PS_VERSION, &j);
-  SEND(sprintf(_xs, "\"PS_VERSION\": %d, \n\r", j);)                    // Current persistent storage version
-  SEND(sprintf(_xs, "\"BD_REV\": %4.2f \n\r", (float)(revision())/100.0);)                                             // Current board versoin
-  SEND(sprintf(_xs, "}\r\n");) 
+  REPLY(sprintf(_xs, "\"PS_VERSION\": %d, \n\r", j);)                    // Current persistent storage version
+  REPLY(sprintf(_xs, "\"BD_REV\": %4.2f \n\r", (float)(revision())/100.0);)                                             // Current board versoin
+  REPLY(sprintf(_xs, "}\r\n");) 
   
 /*
  *  All done, return
@@ -697,6 +999,41 @@ static void show_test(int test_number)
   return;
  }
 
+/*-----------------------------------------------------
+ * 
+ * @function: set_score_format
+ * 
+ * @brief:    Choose JSON or binary scores for this link
+ * 
+ * @return: None
+ * 
+ *-----------------------------------------------------
+ *
+ * Only the link the command came in on is changed.
+ * The answer is sent back so that a client can tell
+ * that the target knows about binary scores.  See
+ * score_frame.c
+ * 
+ *-----------------------------------------------------*/
+static void set_score_format
+  (
+  int format                // SCORE_JSON or SCORE_BINARY
+  )
+{
+  if ( (format != SCORE_JSON) && (format != SCORE_BINARY) )
+  {
+    format = SCORE_JSON;
+  }
+
+  if ( json_reply_to >= 0 )
+  {
+    serial_set_format(json_reply_to, format);
+  }
+  REPLY(sprintf(_xs, "{\"SCORE_FORMAT\":%d}\r\n", format);)
+
+  return;
+}
+
  /*-----------------------------------------------------
  * 
  * @function: set_trace
@@ -717,11 +1054,11 @@ static void show_test(int test_number)
  {
   trace |= DLT_CRITICAL;        // Critical is always enabled
     
-  if ( trace & DLT_CRITICAL)    {SEND(sprintf(_xs, "\r\r%03d DLT CRITICAL", DLT_CRITICAL);)}
-  if ( trace & DLT_APPLICATION) {SEND(sprintf(_xs, "\r\n%03d DLT APPLICATON", DLT_APPLICATION);)}
-  if ( trace & DLT_DIAG)        {SEND(sprintf(_xs, "\r\n%03d DLT DIAG", DLT_DIAG);)}
-  if ( trace & DLT_INFO)        {SEND(sprintf(_xs, "\r\n%03d DLT INFO", DLT_INFO);)}
-  SEND(sprintf(_xs, "\r\n");)
+  if ( trace & DLT_CRITICAL)    {REPLY(sprintf(_xs, "\r\r%03d DLT CRITICAL", DLT_CRITICAL);)}
+  if ( trace & DLT_APPLICATION) {REPLY(sprintf(_xs, "\r\n%03d DLT APPLICATON", DLT_APPLICATION);)}
+  if ( trace & DLT_DIAG)        {REPLY(sprintf(_xs, "\r\n%03d DLT DIAG", DLT_DIAG);)}
+  if ( trace & DLT_INFO)        {REPLY(sprintf(_xs, "\r\n%03d DLT INFO", DLT_INFO);)}
+  REPLY(sprintf(_xs, "\r\n");)
   
   is_trace = trace;
   return;   
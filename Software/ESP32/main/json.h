@@ -15,16 +15,20 @@
 void reset_JSON(void);            // Clear the JSON input buffer
 void freeETarget_json(void*);     // Task to scan the serial port looking for JSON input
 void show_echo(void);             // Display the settings
+void handle_json(char* input);    // Decode and execute a JSON message
 
 /* 
  * JSON message typedefs
  */
+typedef void (*json_handler_t)(int x);        // Service function, called with the value
+#define HANDLER(f)  ((json_handler_t)(f))     // For a service that takes no value, or an unsigned one
+
 typedef struct  {
   char*             token;    // JSON token string, ex "RADIUS": 
   int*              value;    // Where value is stored 
   double*         d_value;    // Where value is stored 
   int             convert;    // Conversion type
-  void        (*f)(int x);    // Function to execute with message
+  json_handler_t        f;    // Function to execute with message
   char*           non_vol;    // Storage in NON-VOL
   int          init_value;    // Initial Value
 } json_message_t;
@@ -103,4 +107,30 @@ extern int    json_multifunction2;// Multifunction Switch 2
 extern double json_vref_lo;       // Sensor Voltage Reference Low (V)
 extern double json_vref_hi;       // Sensor Voltage Reference High (V)
 extern int    json_pcnt_latency;  // pcnt interrupt latancy
+extern int    json_solver;        // Select the algorithm used by compute_hit()
+#define SOLVER_ITERATE         0  // Iterate on the law of cosines and average
+#define SOLVER_TDOA            1  // Closed form time difference of arrival and Gauss-Newton
+extern int    json_acquire;       // Select how the shot is acquired
+#define ACQUIRE_POLLED         0  // Poll the RUN lines every 1 ms
+#define ACQUIRE_INTERRUPT      1  // Read the counters on the edge of the last RUN line
+extern int    json_tcp_clients;   // Number of TCPIP clients allowed
+extern int    json_ring_adapt;    // Learn the ring down time
+extern int    json_follow_order;  // Order scores are released after the follow through
+#define FOLLOW_IN_ORDER        0  // In shot order, nothing passes a score that is held
+#define FOLLOW_AS_READY        1  // Each score as soon as its own follow through ends
+extern char   json_udp_address[]; // Where the scores are published, empty if not
+extern int    json_udp_port;      // Port the scores are published to
+extern int    json_input_echo;    // Ports that echo their input back to the sender
+#define ECHO_CONSOLE           1  // Console
+#define ECHO_AUX               2  // AUX port
+#define ECHO_TCPIP             4  // Each TCPIP client
+extern int    json_score_fields;  // What items are included in the score messages
+#define S_SHOT              0x01  // Include the shot number
+#define S_XY                0x02  // Include X-Y coordinates
+#define S_POLAR             0x04  // Include polar coordinates
+#define S_TIMERS            0x08  // Include counter values
+#define S_MISC              0x10  // Include miscelaneous diagnotics
+#define S_SCORE             0x20  // Include estimated score (reserved)
+#define S_ALL               0x3F
+#define S_DEFAULT           (S_SHOT | S_XY | S_TIMERS | S_MISC)
 #endif
@@ -0,0 +1,219 @@
+/*----------------------------------------------------------------
+ *
+ * json_writer.c
+ *
+ * Single pass writer for JSON messages
+ *
+ *----------------------------------------------------------------
+ *
+ * The message is built up in a buffer owned by the caller, usually
+ * a local variable, so more than one task can be writing at the
+ * same time.  Nothing is allocated, and the length is known when
+ * the message is finished so it does not have to be found again.
+ *
+ * Numbers are converted with integer arithmetic.  json_put_float()
+ * gives the same text as printf("%.2f") without going through the
+ * newlib floating point formatter.
+ *
+ * If the buffer fills up the message is truncated.
+ *
+ *---------------------------------------------------------------*/
+#include "stdio.h"
+#include "stdbool.h"
+#include "math.h"
+
+#include "json_writer.h"
+
+#define FIXED_LIMIT  (2.0e9)        // Largest scaled value done in integers
+
+static const unsigned long scale[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+/*----------------------------------------------------------------
+ *
+ * @function: json_writer_init
+ *
+ * @brief:    Start a new message
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+void json_writer_init
+(
+  json_writer_t* w,                 // Writer to be set up
+  char*          buffer,            // Where the message is built
+  unsigned int   size               // sizeof(buffer)
+)
+{
+  w->start = buffer;
+  w->next  = buffer;
+  w->end   = buffer + size - 1;     // Leave room for the '\0'
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: json_put_text
+ *
+ * @brief:    Copy a string into the message
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+void json_put_text
+(
+  json_writer_t* w,                 // Message being built
+  const char*    text               // '\0' terminated string
+)
+{
+  while ( (*text != 0) && (w->next < w->end) )
+  {
+    *w->next++ = *text++;
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: json_put_int
+ *            json_put_fixed
+ *
+ * @brief:    Write a signed integer
+ *
+ * @return:   None
+ *
+ *----------------------------------------------------------------
+ *
+ * json_put_fixed() places a decimal point so that the last places
+ * digits are the fraction, ex json_put_fixed(w, 1234, 2) -> 12.34
+ *
+ *--------------------------------------------------------------*/
+static void put_digits
+(
+  json_writer_t* w,                 // Message being built
+  unsigned long  value,             // Magnitude to write
+  unsigned int   places,            // Digits after the decimal point
+  bool           negative           // TRUE to write a leading '-'
+)
+{
+  char         digit[16];           // Digits in reverse order
+  unsigned int i;
+
+  i = 0;
+  do
+  {
+    if ( (places != 0) && (i == places) )
+    {
+      digit[i++] = '.';
+    }
+    digit[i++] = '0' + (value % 10);
+    value /= 10;
+  } while ( (value != 0) || (i <= places) );
+
+  if ( negative )
+  {
+    digit[i++] = '-';
+  }
+
+  while ( (i != 0) && (w->next < w->end) )
+  {
+    *w->next++ = digit[--i];
+  }
+
+  return;
+}
+
+void json_put_int
+(
+  json_writer_t* w,                 // Message being built
+  long           value              // Value to write
+)
+{
+  json_put_fixed(w, value, 0);
+
+  return;
+}
+
+void json_put_fixed
+(
+  json_writer_t* w,                 // Message being built
+  long           value,             // Value scaled by 10^places
+  unsigned int   places             // Digits after the decimal point
+)
+{
+  if ( value < 0 )
+  {
+    put_digits(w, 0UL - (unsigned long)value, places, true);
+  }
+  else
+  {
+    put_digits(w, (unsigned long)value, places, false);
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: json_put_float
+ *
+ * @brief:    Write a floating point number with fixed decimals
+ *
+ * @return:   None
+ *
+ *----------------------------------------------------------------
+ *
+ * The value is rounded to the nearest 10^-places and written with
+ * json_put_fixed().  Anything too big to fit into an unsigned long
+ * (or not a number) falls back to snprintf() so the text is the
+ * same either way.
+ *
+ *--------------------------------------------------------------*/
+void json_put_float
+(
+  json_writer_t* w,                 // Message being built
+  double         value,             // Value to write
+  unsigned int   places             // Digits after the decimal point (0-6)
+)
+{
+  double       magnitude;
+  unsigned int room;
+
+  if ( places >= sizeof(scale) / sizeof(scale[0]) )
+  {
+    places = sizeof(scale) / sizeof(scale[0]) - 1;
+  }
+
+  magnitude = fabs(value) * (double)scale[places];
+  if ( !(magnitude < FIXED_LIMIT) )
+  {
+    room = w->end - w->next;
+    room = snprintf(w->next, room + 1, "%.*f", places, value);
+    w->next = (room > (unsigned int)(w->end - w->next)) ? w->end : w->next + room;
+    return;
+  }
+
+  put_digits(w, (unsigned long)(magnitude + 0.5), places, signbit(value) != 0);
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: json_writer_done
+ *
+ * @brief:    Finish off the message
+ *
+ * @return:   Length of the message not including the '\0'
+ *
+ *--------------------------------------------------------------*/
+unsigned int json_writer_done
+(
+  json_writer_t* w                  // Message being built
+)
+{
+  *w->next = 0;
+
+  return w->next - w->start;
+}
@@ -0,0 +1,31 @@
+/*----------------------------------------------------------------
+ *
+ * json_writer.h
+ *
+ * Single pass writer for JSON messages
+ *
+ *---------------------------------------------------------------*/
+#ifndef _JSON_WRITER_H_
+#define _JSON_WRITER_H_
+
+/*
+ * Typedefs
+ */
+typedef struct json_writer
+{
+  char* start;                      // Start of the message buffer
+  char* next;                       // Next character to be written
+  char* end;                        // Last character that can be used ('\0')
+} json_writer_t;
+
+/*
+ * Global functions
+ */
+void         json_writer_init(json_writer_t* w, char* buffer, unsigned int size); // Start a new message
+void         json_put_text(json_writer_t* w, const char* text);                    // Copy a string
+void         json_put_int(json_writer_t* w, long value);                           // Signed integer
+void         json_put_fixed(json_writer_t* w, long value, unsigned int places);    // Integer scaled by 10^places
+void         json_put_float(json_writer_t* w, double value, unsigned int places);  // Same as %.<places>f
+unsigned int json_writer_done(json_writer_t* w);                                   // Terminate and return the length
+
+#endif
@@ -21,6 +21,7 @@
 #include "serial_io.h"
 #include "wifi.h"
 #include "diag_tools.h"
+#include "pcnt.h"
 
 void app_main(void)
 {
@@ -32,27 +33,23 @@ void app_main(void)
 
 /*
  * Everything is ready, start the threads.  Low task priority number == low priority
+ *
+ * The tasks that can read the counters stay on PCNT_CORE with the PCNT
+ * interrupts so that they never see a wrap half counted (see pcnt_extend.c)
  */
-   xTaskCreate(freeETarget_target_loop, "freeETarget_target_loop",   4096, NULL, 25, NULL);
+   xTaskCreatePinnedToCore(freeETarget_target_loop, "freeETarget_target_loop",   4096, NULL, 25, NULL, PCNT_CORE);
    vTaskDelay(1);
 
-   xTaskCreate(freeETarget_synchronous, "freeETarget_synchronous",   4096, NULL, 20, NULL);
+   xTaskCreatePinnedToCore(freeETarget_synchronous, "freeETarget_synchronous",   4096, NULL, 20, NULL, PCNT_CORE);
    vTaskDelay(1);
 
-   xTaskCreate(freeETarget_json,        "json_task",                 4096, NULL, 15, NULL);
+   xTaskCreatePinnedToCore(freeETarget_score_task,  "freeETarget_score_task",    4096, NULL, 18, NULL, PCNT_CORE);
    vTaskDelay(1);
 
-   xTaskCreate(WiFi_tcp_server_task,    "WiFi_tcp_server",           4096, NULL,  5, NULL);
-   vTaskDelay(1);
-   xTaskCreate(tcpip_accept_poll,       "tcpip_accept_poll",         4096, NULL,  2, NULL);
-   vTaskDelay(1);
-   xTaskCreate(tcpip_socket_poll_0,     "tcpip_socket_poll_0",       4096, NULL,  5, NULL);
+   xTaskCreatePinnedToCore(freeETarget_json,        "json_task",                 4096, NULL, 15, NULL, PCNT_CORE);
    vTaskDelay(1);
-   xTaskCreate(tcpip_socket_poll_1,     "tcpip_socket_poll_1",       4096, NULL,  5, NULL);
-   vTaskDelay(1);
-   xTaskCreate(tcpip_socket_poll_2,     "tcpip_socket_poll_2",       4096, NULL,  5, NULL);
-   vTaskDelay(1);
-   xTaskCreate(tcpip_socket_poll_3,     "tcpip_socket_poll_3",       4096, NULL,  5, NULL);
+
+   xTaskCreate(WiFi_tcp_server_task,    "WiFi_tcp_server",           4096, NULL,  5, NULL);
    vTaskDelay(1);
 
    freeETarget_timer_init();
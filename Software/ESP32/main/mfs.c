@@ -17,6 +17,7 @@
 #include "analog_io.h"
 #include "json.h"
 #include "nonvol.h"
+#include "nonvol_shadow.h"
 #include "serial_io.h"
 #include "timer.h"
 #include "mfs.h"
@@ -386,8 +387,8 @@ static void sw_state
       set_LED_PWM_now(json_LED_PWM);   // Set the brightness
       vTaskDelay(ONE_SECOND/4);
       
-      nvs_set_i32(my_handle, NONVOL_LED_PWM, json_LED_PWM);
-      nvs_commit(my_handle);
+      nonvol_set_i32(NONVOL_LED_PWM, json_LED_PWM);
+      nonvol_flush();
       break;
 
     case TARGET_TYPE:                     // Over ride the target type if the switch is closed
@@ -610,6 +611,6 @@ static void send_fake_score(void)
   shot.y = esp_random() % (5000);
   s_of_sound = speed_of_sound(temperature_C(), humidity_RH());
   shot.shot_number++;
-  send_score(&shot);
+  post_score(&shot, false);
   return;
 } 
\ No newline at end of file
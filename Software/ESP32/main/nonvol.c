@@ -11,12 +11,14 @@
  * ----------------------------------------------------*/
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "string.h"
 
 #include "freETarget.h"
 #include "diag_tools.h"
 #include "json.h"
 #include "serial_io.h"
 #include "nonvol.h"
+#include "nonvol_shadow.h"
 
 /*
  *  Local variables
@@ -68,6 +70,7 @@ void read_nonvol(void)
   {
     DLT(DLT_CRITICAL, printf("read_nonvol(): Failed to open NVM");)
   }
+  nonvol_shadow_init();
         
   nvs_get_i32(my_handle, "NONVOL_INIT", &nonvol_init);
 
@@ -107,7 +110,10 @@ void read_nonvol(void)
           if ( JSON[i].non_vol != 0 )                           // Is persistent storage enabled?
           {
             length = JSON[i].convert & FLOAT_MASK;
-            nvs_get_str(my_handle, JSON[i].non_vol, (char*)JSON[i].value, &length);
+            if ( nvs_get_str(my_handle, JSON[i].non_vol, (char*)JSON[i].value, &length) != ESP_OK )
+            {
+              *(char*)JSON[i].value = 0;                        // Not stored yet, start empty
+            }
           }
           break;
 
@@ -115,7 +121,10 @@ void read_nonvol(void)
         case IS_FIXED:
           if ( JSON[i].non_vol != 0 )                          // Is persistent storage enabled?
           {
-            nvs_get_i32(my_handle, JSON[i].non_vol, &x);       // Read in the value
+            if ( nvs_get_i32(my_handle, JSON[i].non_vol, &x) != ESP_OK ) // Read in the value
+            {
+              x = JSON[i].init_value;                          // Not stored yet, use the default
+            }
             *JSON[i].value = x;
           }
           else
@@ -127,7 +136,10 @@ void read_nonvol(void)
         case IS_FLOAT:
           if ( JSON[i].non_vol != 0 )
           {
-            nvs_get_i32(my_handle, JSON[i].non_vol, &x);       // Read in the value as an integer
+            if ( nvs_get_i32(my_handle, JSON[i].non_vol, &x) != ESP_OK ) // Read in the value as an integer
+            {
+              x = JSON[i].init_value;                          // Not stored yet, use the default
+            }
             *JSON[i].d_value = (float)x / 1000.0;
           }
           else
@@ -179,6 +191,7 @@ void factory_nonvol
 
   serial_number = 0;
   x = 0;
+  nonvol_flush();                         // Anything sent before the INIT goes first
   nvs_set_u32(my_handle, "NONVOL_V_SET", 0);
   if ( new_serial_number == false )
   {
@@ -286,6 +299,7 @@ void factory_nonvol
   {
     DLT(DLT_CRITICAL, printf("Failed to write factory defaults to NONVOL");)
   }
+  nonvol_forget();                                       // Written behind the RAM copy
     
 /*
  * All done, return
@@ -342,6 +356,63 @@ void init_nonvol
   return;
 }
 
+/*----------------------------------------------------------------
+ * 
+ * @function: nonvol_default
+ * 
+ * @brief:  Write the default for a key that is not stored yet
+ * 
+ * @return: None
+ *---------------------------------------------------------------
+ *
+ * The default comes from the JSON[] table.  A key that already
+ * has a value is left alone.
+ * 
+ *------------------------------------------------------------*/
+static void nonvol_default
+  (
+    const char* key               // NONVOL_* key added in this version
+  )
+{
+  unsigned int  i;                // Iteration counter
+  long          ps_value;         // Value read from persistent storage
+  size_t        length;           // Length of the stored string
+
+  i=0;
+  while ( JSON[i].token != 0 )
+  {
+    if ( (JSON[i].non_vol != 0) && (strcmp(JSON[i].non_vol, key) == 0) )
+    {
+      switch ( JSON[i].convert & IS_MASK )
+      {
+        case IS_TEXT:
+        case IS_SECRET:
+          if ( nvs_get_str(my_handle, key, NULL, &length) != ESP_OK )
+          {
+            nvs_set_str(my_handle, key, "");                      // Start with an empty string
+          }
+          break;
+
+        case IS_INT32:
+        case IS_FLOAT:
+          if ( nvs_get_i32(my_handle, key, &ps_value) != ESP_OK )
+          {
+            nvs_set_i32(my_handle, key, JSON[i].init_value);      // Initalize it from the table
+          }
+          break;
+
+        default:
+          break;
+      }
+      DLT(DLT_INFO, printf("nonvol_default(%s)", key);)
+      return;
+    }
+    i++;
+  }
+
+  return;
+}
+
 /*----------------------------------------------------------------
  * 
  * @function: update_nonvol
@@ -354,8 +425,11 @@ void init_nonvol
  * Check the stored nonvol value against the current persistent
  * storage version and update if needed.
  * 
+ * Each time a setting is added to the persistent storage the
+ * version goes up by one and a step is added here to write the
+ * default for the new key on a target that was set up before.
+ * 
  *------------------------------------------------------------*/
-
 void update_nonvol
   (
     unsigned int current_version  // Version present in persistent storage
@@ -365,6 +439,7 @@ void update_nonvol
   long          ps_value;         // Value read from persistent storage  
   
   DLT(DLT_CRITICAL, printf("update_nonvol(%d)\r\n", current_version);)
+  nonvol_flush();                         // Nothing staged is written over
 
 /*
  * Check to see if this persistent storage has never had a version number
@@ -390,11 +465,57 @@ void update_nonvol
       }
       i++;
    }
-   current_version = PS_VERSION;                            // Initialized, force in the current version
-   nvs_set_i32(my_handle, NONVOL_PS_VERSION, current_version);
-   nvs_commit(my_handle);
+   current_version = 0;                                     // Initialized, same as the first version
+  }
+
+/*
+ * Bring in the settings added since the stored version
+ */
+  if ( current_version < 1 )
+  {
+    nonvol_default(NONVOL_SOLVER);
+  }
+
+  if ( current_version < 2 )
+  {
+    nonvol_default(NONVOL_ACQUIRE);
+  }
+
+  if ( current_version < 3 )
+  {
+    nonvol_default(NONVOL_TCP_CLIENTS);
   }
 
+  if ( current_version < 4 )
+  {
+    nonvol_default(NONVOL_RING_ADAPT);
+  }
+
+  if ( current_version < 5 )
+  {
+    nonvol_default(NONVOL_FOLLOW_ORDER);
+  }
+
+  if ( current_version < 6 )
+  {
+    nonvol_default(NONVOL_INPUT_ECHO);
+  }
+
+  if ( current_version < 7 )
+  {
+    nonvol_default(NONVOL_UDP_ADDRESS);
+    nonvol_default(NONVOL_UDP_PORT);
+  }
+
+  if ( current_version < 8 )
+  {
+    nonvol_default(NONVOL_SCORE_FIELDS);
+  }
+
+  nvs_set_i32(my_handle, NONVOL_PS_VERSION, PS_VERSION);    // Now up to date
+  nvs_commit(my_handle);
+  nonvol_forget();                                          // Written behind the RAM copy
+
 /*
  * Up to date, return
  */
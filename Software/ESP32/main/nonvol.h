@@ -8,7 +8,7 @@
 #ifndef _NONVOL_H
 #define _NONVOL_H
 
-#define PS_VERSION        0                       // Persistent storage version
+#define PS_VERSION        8                       // Persistent storage version, see update_nonvol()
 #define PS_UNINIT(x)     ( ((x) == 0xABAB) || ((x) == 0xFFFF))  // Uninitilized value
 
 #define NAME_SPACE "freETarget"
@@ -56,16 +56,25 @@ void restore_nonvol(void);                        // Copyt the nonvol back
 #define NONVOL_PS_VERSION     "PS_VERSION"     // Persistent storage version
 #define NONVOL_PCNT_LATENCY   "PCNT_LATENCY"   // Correction applied to PCNT readings
 #define NONVOL_FOLLOW_THROUGH "FOLLOW_THROUGH" // Follow through timer
+#define NONVOL_FOLLOW_ORDER   "FOLLOW_ORDER"   // Order scores are released after the follow through
+#define NONVOL_INPUT_ECHO     "INPUT_ECHO"     // Ports that echo their input
+#define NONVOL_SCORE_FIELDS   "SCORE_FIELDS"   // What items are included in the score messages
 #define NONVOL_KEEP_ALIVE     "KEEP_ALIVE"     // Send out a keep alive at a r
 #define NONVOL_FACE_STRIKE    "FACE_STRIKE"    // Number of cycles to accept a face strike
 #define NONVOL_MIN_RING_TIME  "MIN_RING_TIME"  // Minimum time for ringing to stop 
+#define NONVOL_RING_ADAPT     "RING_ADAPT"     // Learn the ring down time
 #define NONVOL_TOKEN          "TOKEN"          // Token ring state
+#define NONVOL_TCP_CLIENTS    "TCP_CLIENTS"    // Number of TCPIP clients allowed
 #define NONVOL_VREF_LO        "VREF_LO"        // Sensor Reference Voltage low in V
 #define NONVOL_VREF_HI        "VREF_HI"        // Sensor Reference Voltage high in V
+#define NONVOL_UDP_ADDRESS    "UDP_ADDRESS"    // Where the scores are published
+#define NONVOL_UDP_PORT       "UDP_PORT"       // Port the scores are published to
 #define NONVOL_WIFI_CHANNEL   "WIFI_CHANNEL"   // Channel to use for WiFI
 #define NONVOL_WIFI_DHCP      "WIFI_DHCP"      // 
 #define NONVOL_WIFI_SSID      "WIFI_SSID"      // Storage for SSID
 #define NONVOL_WIFI_PWD       "WIFI_PWD"       // Storage for SSID Password
 #define NONVOL_WIFI_IP        "WIFI_IP"        // Storage forIP Address
 #define NONVOL_Z_OFFSET       "Z_OFFSET"       // Distance from sensor plane to paper plane
+#define NONVOL_SOLVER         "SOLVER"         // Algorithm used to locate the shot
+#define NONVOL_ACQUIRE        "ACQUIRE"        // Polled or interrupt driven shot acquisition
 #endif
@@ -0,0 +1,319 @@
+/*----------------------------------------------------------------
+ *
+ * nonvol_shadow.c
+ *
+ * RAM copy of the persistent storage with batched writes
+ *
+ *----------------------------------------------------------------
+ *
+ * Settings arriving in a JSON message are not written to NVS
+ * straight away.  They are staged in a RAM copy of the NONVOL_*
+ * keys and a bit is set in the dirty map.  When the message has
+ * been handled nonvol_flush() writes the dirty keys and commits
+ * once.
+ *
+ * The first time a key is used its value is read from NVS, so a
+ * setting that is sent again with the same value (the PC client
+ * sends everything on every Apply) does not cause a flash write.
+ *
+ * Code that writes NVS directly, such as factory_nonvol(), must
+ * call nonvol_flush() first so that anything staged before it is
+ * written in order, and nonvol_forget() afterwards so the RAM copy
+ * is read again.
+ *
+ * The json task and the synchronous task (mfs.c) both stage values,
+ * so the table is guarded by a mutex.  Flash writes can block, so a
+ * spin lock would not do.
+ *
+ *---------------------------------------------------------------*/
+#include "stdio.h"
+#include "string.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "freETarget.h"
+#include "diag_tools.h"
+#include "json.h"
+#include "nonvol.h"
+#include "nonvol_shadow.h"
+
+#define SHADOW_SIZE   64                // Number of keys that can be held
+#define SHADOW_TEXT   (SSID_SIZE + 1)   // Longest string held
+
+typedef struct shadow
+{
+  const char* key;                      // NONVOL_* key
+  bool        is_text;                  // TRUE if text holds the value
+  bool        is_stored;                // TRUE if the key exists in NVS
+  int         value;                    // Integer value
+  char        text[SHADOW_TEXT];        // String value
+} shadow_t;
+
+static shadow_t     shadow[SHADOW_SIZE];
+static unsigned int shadow_size;                        // Keys in use
+static unsigned int dirty[(SHADOW_SIZE + 31) / 32];     // One bit per key to be written
+static bool         needs_commit;                       // Written around the table, not committed yet
+static SemaphoreHandle_t shadow_lock;                   // Guards everything above
+
+unsigned int nonvol_writes;             // Values written to NVS
+unsigned int nonvol_skipped;            // Values not written because they did not change
+
+#define IS_DIRTY(i)   ((dirty[(i) / 32] & (1u << ((i) % 32))) != 0)
+#define SET_DIRTY(i)  dirty[(i) / 32] |= (1u << ((i) % 32))
+
+/*
+ * Before nonvol_shadow_init() there is only the one task
+ */
+#define LOCK()        if ( shadow_lock != NULL ) xSemaphoreTake(shadow_lock, portMAX_DELAY)
+#define UNLOCK()      if ( shadow_lock != NULL ) xSemaphoreGive(shadow_lock)
+
+/*----------------------------------------------------------------
+ *
+ * @function: nonvol_shadow_init
+ *
+ * @brief:    Create the lock, before the tasks are started
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+void nonvol_shadow_init(void)
+{
+  if ( shadow_lock == NULL )
+  {
+    shadow_lock = xSemaphoreCreateMutex();
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: find_shadow
+ *
+ * @brief:    Find the RAM copy of a key, reading it in if needed
+ *
+ * @return:   Shadow entry, or NULL if the table is full
+ *
+ *--------------------------------------------------------------*/
+static shadow_t* find_shadow
+(
+  const char* key,                  // NONVOL_* key
+  bool        is_text               // TRUE if the value is a string
+)
+{
+  unsigned int i;
+  shadow_t*    entry;
+  int32_t      x;
+  size_t       length;
+
+  for (i=0; i != shadow_size; i++)
+  {
+    if ( (shadow[i].key == key) || (strcmp(shadow[i].key, key) == 0) )
+    {
+      return &shadow[i];
+    }
+  }
+
+  if ( shadow_size == SHADOW_SIZE )
+  {
+    DLT(DLT_CRITICAL, printf("nonvol_shadow full, %s not staged", key);)
+    return NULL;
+  }
+
+/*
+ * New key, bring in what is stored now
+ */
+  entry = &shadow[shadow_size++];
+  entry->key     = key;
+  entry->is_text   = is_text;
+  entry->is_stored = false;
+  entry->value     = 0;
+  entry->text[0]   = 0;
+
+  if ( is_text )
+  {
+    length = sizeof(entry->text);
+    if ( nvs_get_str(my_handle, key, entry->text, &length) == ESP_OK )
+    {
+      entry->is_stored = true;
+    }
+    else
+    {
+      entry->text[0] = 0;
+    }
+  }
+  else
+  {
+    if ( nvs_get_i32(my_handle, key, &x) == ESP_OK )
+    {
+      entry->value     = x;
+      entry->is_stored = true;
+    }
+  }
+
+  return entry;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: nonvol_set_i32
+ *            nonvol_set_str
+ *
+ * @brief:    Stage a value to be written by nonvol_flush()
+ *
+ * @return:   None
+ *
+ *----------------------------------------------------------------
+ *
+ * If the table is full the value is written to NVS immediately
+ * and committed by the next nonvol_flush().
+ *
+ *--------------------------------------------------------------*/
+void nonvol_set_i32
+(
+  const char* key,                  // NONVOL_* key
+  int         value                 // Value to be saved
+)
+{
+  shadow_t* entry;
+
+  LOCK();
+  entry = find_shadow(key, false);
+  if ( entry == NULL )
+  {
+    nvs_set_i32(my_handle, key, value);
+    nonvol_writes++;
+    needs_commit = true;
+  }
+  else if ( entry->is_stored && (entry->value == value) )
+  {
+    nonvol_skipped++;
+  }
+  else
+  {
+    entry->value = value;
+    SET_DIRTY(entry - shadow);
+  }
+  UNLOCK();
+
+  return;
+}
+
+void nonvol_set_str
+(
+  const char* key,                  // NONVOL_* key
+  const char* value                 // String to be saved
+)
+{
+  shadow_t* entry;
+
+  LOCK();
+  entry = find_shadow(key, true);
+  if ( entry == NULL )
+  {
+    nvs_set_str(my_handle, key, value);
+    nonvol_writes++;
+    needs_commit = true;
+  }
+  else if ( entry->is_stored && (strncmp(entry->text, value, sizeof(entry->text) - 1) == 0) )
+  {
+    nonvol_skipped++;
+  }
+  else
+  {
+    strncpy(entry->text, value, sizeof(entry->text) - 1);
+    entry->text[sizeof(entry->text) - 1] = 0;
+    SET_DIRTY(entry - shadow);
+  }
+  UNLOCK();
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: write_dirty
+ *            nonvol_flush
+ *
+ * @brief:    Write the staged values and commit
+ *
+ * @return:   Number of values written
+ *
+ *----------------------------------------------------------------
+ *
+ * Nothing is committed if nothing has changed, either here or
+ * around the table when it was full.  write_dirty() is called with
+ * the lock held.
+ *
+ *--------------------------------------------------------------*/
+static unsigned int write_dirty(void)
+{
+  unsigned int i;
+  unsigned int count;
+
+  count = 0;
+  for (i=0; i != shadow_size; i++)
+  {
+    if ( IS_DIRTY(i) )
+    {
+      if ( shadow[i].is_text )
+      {
+        nvs_set_str(my_handle, shadow[i].key, shadow[i].text);
+      }
+      else
+      {
+        nvs_set_i32(my_handle, shadow[i].key, shadow[i].value);
+      }
+      shadow[i].is_stored = true;
+      count++;
+    }
+  }
+
+  if ( (count != 0) || needs_commit )
+  {
+    memset(dirty, 0, sizeof(dirty));
+    nonvol_writes += count;
+    needs_commit = false;
+    if ( nvs_commit(my_handle) != ESP_OK )
+    {
+      DLT(DLT_CRITICAL, printf("nonvol_flush(): commit failed");)
+    }
+  }
+
+  return count;
+}
+
+unsigned int nonvol_flush(void)
+{
+  unsigned int count;
+
+  LOCK();
+  count = write_dirty();
+  UNLOCK();
+
+  return count;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: nonvol_forget
+ *
+ * @brief:    Throw away the RAM copy
+ *
+ * @return:   None
+ *
+ *----------------------------------------------------------------
+ *
+ * Anything still staged is written first so that it is not lost.
+ *
+ *--------------------------------------------------------------*/
+void nonvol_forget(void)
+{
+  LOCK();
+  write_dirty();
+  shadow_size = 0;
+  UNLOCK();
+
+  return;
+}
@@ -0,0 +1,26 @@
+/*----------------------------------------------------------------
+ *
+ * nonvol_shadow.h
+ *
+ * RAM copy of the persistent storage with batched writes
+ *
+ *---------------------------------------------------------------*/
+#ifndef _NONVOL_SHADOW_H_
+#define _NONVOL_SHADOW_H_
+
+/*
+ * Global functions
+ */
+void         nonvol_shadow_init(void);                               // Create the lock
+void         nonvol_set_i32(const char* key, int value);          // Stage an integer for writing
+void         nonvol_set_str(const char* key, const char* value);  // Stage a string for writing
+unsigned int nonvol_flush(void);                                  // Write the staged values and commit
+void         nonvol_forget(void);                                 // Throw away the RAM copy
+
+/*
+ * Global variables
+ */
+extern unsigned int nonvol_writes;    // Values written to NVS
+extern unsigned int nonvol_skipped;   // Values not written because they did not change
+
+#endif
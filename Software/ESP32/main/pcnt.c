@@ -18,14 +18,18 @@
 #include "driver/pulse_cnt.h"
 #include "driver/gpio.h"
 #include "driver/timer.h"
+#include "esp_cpu.h"
+#include "esp_attr.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "nonvol.h"
+#include "nonvol_shadow.h"
 
 #include "freETarget.h"
 #include "diag_tools.h"
 #include "gpio_define.h"
 #include "pcnt.h"
+#include "pcnt_extend.h"
 #include "timer.h"
 #include "serial_io.h"
 #include "json.h"
@@ -45,14 +49,24 @@ static pcnt_chan_config_t          chan_b_config[SOC_PCNT_UNITS_PER_GROUP];  //
 static pcnt_channel_handle_t       pcnt_chan_b[SOC_PCNT_UNITS_PER_GROUP];
 
 static int north_pcnt_hi, east_pcnt_hi, south_pcnt_hi, west_pcnt_hi;
+static volatile unsigned int pcnt_wraps[SOC_PCNT_UNITS_PER_GROUP];           // Times each unit has reached PCNT_HIGH_LIMIT
+
+/*
+ *  PCNT registers
+ */
+#define PCNT_BASE       (0x60017000+0x00030)                    // Pointer to start of PCNT count registers
+#define PCNT_COUNT_REG  ((volatile unsigned int*)(PCNT_BASE))   // Count register for each unit
+#define PCNT_INT_RAW    ((volatile unsigned int*)(0x60017000+0x00040)) // Raw interrupt status, one bit per unit
 
 /*
  *  Function prototypes
  */
-static bool north_hi_pcnt_isr_callback(void *args);
-static bool east_hi_pcnt_isr_callback(void *args);
-static bool south_hi_pcnt_isr_callback(void *args);
-static bool west_hi_pcnt_isr_callback(void *args);
+static void north_hi_pcnt_isr_callback(void *args);
+static void east_hi_pcnt_isr_callback(void *args);
+static void south_hi_pcnt_isr_callback(void *args);
+static void west_hi_pcnt_isr_callback(void *args);
+static void run_lo_isr_callback(void *args);
+static bool pcnt_limit_callback(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *edata, void *user_ctx);
 
 /*************************************************************************
  * 
@@ -72,6 +86,10 @@ static bool west_hi_pcnt_isr_callback(void *args);
  * Channel B Count disabled
  * Channel B Control disabled
  * 
+ * The hardware counters are 16 bits.  A watch point on PCNT_HIGH_LIMIT
+ * counts the wraps so that the counts can be read as 32 bits and a shot
+ * can take longer than 3.3ms to reach the last sensor.
+ * 
  **************************************************************************/
 void pcnt_init
 (
@@ -92,8 +110,8 @@ void pcnt_init
 /*
  * Setup the unit
  */
-  unit_config[unit].low_limit  = -0x7fff;
-  unit_config[unit].high_limit = 0x7fff;
+  unit_config[unit].low_limit  = PCNT_LOW_LIMIT;
+  unit_config[unit].high_limit = PCNT_HIGH_LIMIT;
   pcnt_unit[unit] = NULL;
   ESP_ERROR_CHECK(pcnt_new_unit(&unit_config[unit], &pcnt_unit[unit]));
 
@@ -129,6 +147,10 @@ void pcnt_init
  */
   if ( is_first )
   {
+    if ( xPortGetCoreID() != PCNT_CORE )                                  // Interrupts go to the calling core
+    {
+      DLT(DLT_CRITICAL, printf("pcnt_init() on core %d, expected %d\r\n", xPortGetCoreID(), PCNT_CORE);)
+    }
     gpio_install_isr_service(0);                                          // Per GPIO interrupt handler
     gpio_set_intr_type(RUN_NORTH_HI, GPIO_INTR_POSEDGE);                  // RUN_XXX_HI interrupt on 
     gpio_set_intr_type(RUN_EAST_HI, GPIO_INTR_POSEDGE);                   // rising edge
@@ -138,14 +160,34 @@ void pcnt_init
     gpio_isr_handler_add(RUN_EAST_HI,  east_hi_pcnt_isr_callback, NULL);
     gpio_isr_handler_add(RUN_SOUTH_HI, south_hi_pcnt_isr_callback, NULL);
     gpio_isr_handler_add(RUN_WEST_HI,  west_hi_pcnt_isr_callback, NULL);
+    gpio_set_intr_type(RUN_NORTH_LO, GPIO_INTR_POSEDGE);                  // RUN_XXX_LO interrupt on
+    gpio_set_intr_type(RUN_EAST_LO, GPIO_INTR_POSEDGE);                   // rising edge
+    gpio_set_intr_type(RUN_SOUTH_LO, GPIO_INTR_POSEDGE);                  // Enabled by arm_timers()
+    gpio_set_intr_type(RUN_WEST_LO, GPIO_INTR_POSEDGE);                   // for ACQUIRE_INTERRUPT
+    gpio_isr_handler_add(RUN_NORTH_LO, run_lo_isr_callback, NULL);
+    gpio_isr_handler_add(RUN_EAST_LO,  run_lo_isr_callback, NULL);
+    gpio_isr_handler_add(RUN_SOUTH_LO, run_lo_isr_callback, NULL);
+    gpio_isr_handler_add(RUN_WEST_LO,  run_lo_isr_callback, NULL);
+    gpio_intr_disable(RUN_NORTH_LO);
+    gpio_intr_disable(RUN_EAST_LO);
+    gpio_intr_disable(RUN_SOUTH_LO);
+    gpio_intr_disable(RUN_WEST_LO);
     is_first = false;
   }
     
+/*
+ *  Count the wraps at the high limit
+ */
+  pcnt_event_callbacks_t callbacks = { .on_reach = pcnt_limit_callback };
+  ESP_ERROR_CHECK(pcnt_unit_add_watch_point(pcnt_unit[unit], PCNT_HIGH_LIMIT));
+  ESP_ERROR_CHECK(pcnt_unit_register_event_callbacks(pcnt_unit[unit], &callbacks, (void*)unit));
+
 /*
  *  All done, Clear the counter and return
  */
   ESP_ERROR_CHECK(pcnt_unit_enable(pcnt_unit[unit]));
   pcnt_unit_clear_count(pcnt_unit[unit]); 
+  pcnt_wraps[unit] = 0;
   ESP_ERROR_CHECK(pcnt_unit_start(pcnt_unit[unit]));
   return;
 }
@@ -163,7 +205,6 @@ void pcnt_init
  * The PCNT registers are 16 bits long with an overflow counter
  * 
  **************************************************************************/
-#define PCNT_BASE 0x60017000+0x00030    // Pointer to start of PCNT registers
 
 int pcnt_read
 (
@@ -180,7 +221,7 @@ int pcnt_read
     case 1:
     case 2:
     case 3:
-      pcnt_unit_get_count(pcnt_unit[unit], &value);
+      pcnt_extend_read(PCNT_COUNT_REG, PCNT_INT_RAW, pcnt_wraps, unit, 1, &value);
       break;
     case 4: value = north_pcnt_hi; break;
     case 5: value = east_pcnt_hi;  break;
@@ -191,6 +232,57 @@ int pcnt_read
   return value;
 }
 
+/*************************************************************************
+ * 
+ * @function: pcnt_snapshot()
+ * 
+ * description:  Read all of the counters in one pass
+ * 
+ * @return:   CPU cycle count when the first counter was read
+ * 
+ **************************************************************************
+ *
+ * pcnt_read() goes through the driver once per unit, and the low counters
+ * are still running for any sensor that has not latched yet.  Every
+ * cycle spent between the first and last read ends up as a difference 
+ * between the counts, and at 10MHz one count is 100ns of sound travel.
+ * 
+ * Here the four count registers are read back to back, the same way the
+ * RUN_XX_HI interrupts read them, and then the four captured high values
+ * are copied.  The CPU cycle counter is sampled before the first read and
+ * after the last so that the skew can be reported with the shot.  The 
+ * skew includes the two reads of the wrap state made by pcnt_extend_read().
+ * 
+ * Like the RUN_XX_HI interrupts, this assumes that pcnt_init() was called
+ * for units 0-3 in order so that pcnt_unit[i] is hardware unit i.
+ * 
+ **************************************************************************/
+unsigned int IRAM_ATTR pcnt_snapshot
+(
+  int           count[],                // Place to save the eight counts
+  unsigned int* skew                    // Cycles from first to last read
+)
+{
+  unsigned int start;                   // Cycle count before the first read
+  unsigned int stop;                    // Cycle count after the last read
+
+  start = esp_cpu_get_cycle_count();
+  pcnt_extend_read(PCNT_COUNT_REG, PCNT_INT_RAW, pcnt_wraps, NORTH_LO, 4, &count[NORTH_LO]);
+  stop = esp_cpu_get_cycle_count();
+
+  count[NORTH_HI] = north_pcnt_hi;      // Captured by the RUN_XX_HI interrupts
+  count[EAST_HI]  = east_pcnt_hi;
+  count[SOUTH_HI] = south_pcnt_hi;
+  count[WEST_HI]  = west_pcnt_hi;
+
+  if ( skew != NULL )
+  {
+    *skew = stop - start;
+  }
+
+  return start;
+}
+
 /*************************************************************************
  * 
  * @function: pcnt_clear()
@@ -211,6 +303,7 @@ void pcnt_clear(void)
   for (i=0; i != SOC_PCNT_UNITS_PER_GROUP; i++)
   {
     pcnt_unit_clear_count(pcnt_unit[i]);
+    pcnt_wraps[i] = 0;
   }
 
   north_pcnt_hi = 0;
@@ -434,7 +527,8 @@ void pcnt_cal(void)
           if ( (ch == 'Y') || (ch == 'y') )
           {
             json_pcnt_latency = north_average/count;
-            nvs_set_i32(my_handle, NONVOL_PCNT_LATENCY, json_pcnt_latency);
+            nonvol_set_i32(NONVOL_PCNT_LATENCY, json_pcnt_latency);
+            nonvol_flush();
             printf("\r\nSaved");
           }
 
@@ -498,32 +592,91 @@ void pcnt_cal(void)
  * captures the timer values.  The disable interrupts has been removed
  * because the signals are latched and a second interrupt will not occur
  * 
+ * In ACQUIRE_INTERRUPT mode every RUN edge (high or low) is also passed
+ * to freeETarget_sensor_edge() so that the counters are read as soon as
+ * the last sensor has latched.
+ * 
  **************************************************************************/
-#define PCNT_NORTH_HI (int*)(0x60017000 + 0x0030)         // PCNT unit 1 count
-#define PCNT_EAST_HI  (int*)(0x60017000 + 0x0034)         // PCNT unit 2 count
-#define PCNT_SOUTH_HI (int*)(0x60017000 + 0x0038)         // PCNT unit 3 count
-#define PCNT_WEST_HI  (int*)(0x60017000 + 0x003C)         // PCNT unit 4 count
 
-static bool IRAM_ATTR north_hi_pcnt_isr_callback(void *args)
+static void IRAM_ATTR north_hi_pcnt_isr_callback(void *args)
 {
-  north_pcnt_hi = *PCNT_NORTH_HI;
-  return pdFALSE; 
+  pcnt_extend_read(PCNT_COUNT_REG, PCNT_INT_RAW, pcnt_wraps, 0, 1, &north_pcnt_hi);
+  if ( freeETarget_sensor_edge() )       // TRUE if reduce() was woken
+  {
+    portYIELD_FROM_ISR();
+  }
+  return;
 }
 
-static bool IRAM_ATTR east_hi_pcnt_isr_callback(void *args)
+static void IRAM_ATTR east_hi_pcnt_isr_callback(void *args)
 {
-  east_pcnt_hi = *PCNT_EAST_HI;
-  return pdFALSE;
+  pcnt_extend_read(PCNT_COUNT_REG, PCNT_INT_RAW, pcnt_wraps, 1, 1, &east_pcnt_hi);
+  if ( freeETarget_sensor_edge() )       // TRUE if reduce() was woken
+  {
+    portYIELD_FROM_ISR();
+  }
+  return;
+}
+
+static void IRAM_ATTR south_hi_pcnt_isr_callback(void *args)
+{
+  pcnt_extend_read(PCNT_COUNT_REG, PCNT_INT_RAW, pcnt_wraps, 2, 1, &south_pcnt_hi);
+  if ( freeETarget_sensor_edge() )       // TRUE if reduce() was woken
+  {
+    portYIELD_FROM_ISR();
+  }
+  return;
 }
 
-static bool IRAM_ATTR south_hi_pcnt_isr_callback(void *args)
+static void IRAM_ATTR west_hi_pcnt_isr_callback(void *args)
 {
-  south_pcnt_hi = *PCNT_SOUTH_HI;
-  return pdFALSE; 
+  pcnt_extend_read(PCNT_COUNT_REG, PCNT_INT_RAW, pcnt_wraps, 3, 1, &west_pcnt_hi);
+  if ( freeETarget_sensor_edge() )       // TRUE if reduce() was woken
+  {
+    portYIELD_FROM_ISR();
+  }
+  return;
 }
 
-static bool IRAM_ATTR west_hi_pcnt_isr_callback(void *args)
+static void IRAM_ATTR run_lo_isr_callback(void *args)
 {
-  west_pcnt_hi = *PCNT_WEST_HI;
-  return pdFALSE; 
-}
\ No newline at end of file
+  if ( freeETarget_sensor_edge() )
+  {
+    portYIELD_FROM_ISR();
+  }
+  return;
+}
+
+/*************************************************************************
+ * 
+ * @function: pcnt_limit_callback()
+ * 
+ * description:  Count a wrap of the PCNT unit
+ * 
+ * @return:   pdFALSE, no task needs to be woken
+ * 
+ **************************************************************************
+ *
+ * Called from the PCNT interrupt when a unit reaches PCNT_HIGH_LIMIT and
+ * goes back to 0.  user_ctx is the unit number given to pcnt_init().
+ * 
+ * The driver clears the status bit before calling here.  The interrupt is
+ * allocated on PCNT_CORE by pcnt_init() and every task that reads the
+ * counters is pinned to PCNT_CORE in app_main(), so a reader never runs
+ * between the two (see pcnt_extend.c)
+ * 
+ **************************************************************************/
+static bool IRAM_ATTR pcnt_limit_callback
+(
+  pcnt_unit_handle_t             unit,     // Unit that reached the limit
+  const pcnt_watch_event_data_t* edata,    // Which watch point
+  void*                          user_ctx  // Unit number
+)
+{
+  if ( edata->watch_point_value == PCNT_HIGH_LIMIT )
+  {
+    pcnt_wraps[(int)user_ctx]++;
+  }
+
+  return pdFALSE;
+}
@@ -13,6 +13,7 @@
  */
 void pcnt_init(int  unit, int  control, int  signal);   // pcnt Control
 int  pcnt_read(unsigned int unit);                      // Read timer contents
+unsigned int pcnt_snapshot(int count[], unsigned int* skew); // Read all eight timers at once
 void pcnt_clear(void);                                  // Clear the timer contents
 void pcnt_test(int which_test);                         // Trigger the counters and verify operation
 void pcnt_cal(void);                                    // Trigger the counters print the time delay
@@ -33,6 +34,8 @@ void pcnt_cal(void);                                    // Trigger the counters
 #define SOUTH_HI    6
 #define WEST_HI     7
 
+#define PCNT_CORE           0           // Core that takes the PCNT interrupts and reads the counters
 #define PCNT_NOT_TRIGGERED  200         // Ignore any value over 200 counts
+#define CYCLES_TO_NS(x)     ((x) * 1000 / CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ) // CPU cycles to ns
 
 #endif
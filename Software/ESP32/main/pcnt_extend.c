@@ -0,0 +1,102 @@
+/*----------------------------------------------------------------
+ *
+ * pcnt_extend.c
+ *
+ * Extend the 16 bit PCNT counters to 32 bits
+ *
+ *----------------------------------------------------------------
+ *
+ * Each PCNT unit counts from 0 up to PCNT_HIGH_LIMIT and then goes
+ * back to 0.  At 10MHz that is about 3.3ms, which is shorter than
+ * the time sound takes to cross a large target.
+ *
+ * When the unit reaches the limit the hardware sets the unit's bit
+ * in the raw interrupt status register, and the limit interrupt
+ * in pcnt.c later adds one to wraps[] and clears the bit.  So the
+ * number of completed wraps is always
+ *
+ *      wraps[unit] + (status bit for the unit)
+ *
+ * and the 32 bit count is that times PCNT_HIGH_LIMIT plus the
+ * count register.
+ *
+ * The status and wraps are read before and after the count
+ * registers.  If either has changed a wrap happened while the
+ * registers were being read, and the read is done again.  The
+ * count registers themselves are still read back to back.
+ *
+ * The driver clears the status bit before wraps[] is incremented.
+ * A reader on the other core could land between the two and lose a
+ * wrap, so the limit interrupt and every reader are kept on
+ * PCNT_CORE (see pcnt_init() and app_main()).
+ *
+ * No driver calls are used so the same code can be run against a
+ * model of the counters on the host.
+ *
+ *---------------------------------------------------------------*/
+#include "stdio.h"
+#include "esp_attr.h"
+
+#include "pcnt_extend.h"
+
+#define MAX_UNITS 4                     // Units in the S3 PCNT group
+
+/*----------------------------------------------------------------
+ *
+ * @function: pcnt_extend_read
+ *
+ * @brief:    Read one or more counters as 32 bit values
+ *
+ * @return:   result[0..units-1] filled in
+ *
+ *--------------------------------------------------------------*/
+void IRAM_ATTR pcnt_extend_read
+(
+  const volatile unsigned int* count,   // Unit count registers
+  const volatile unsigned int* status,  // Raw interrupt status register
+  const volatile unsigned int* wraps,   // Wraps taken by the limit interrupt
+  unsigned int first,                   // First unit to read
+  unsigned int units,                   // Number of units to read
+  int result[]                          // 32 bit counts
+)
+{
+  unsigned int raw[MAX_UNITS];          // Count registers
+  unsigned int wrap[MAX_UNITS];         // wraps[] before the registers were read
+  unsigned int pending;                 // Status before the registers were read
+  unsigned int mask;                    // Status bits for the units being read
+  unsigned int i;
+  int          same;
+
+  mask = ((1u << units) - 1) << first;
+
+  do
+  {
+    pending = *status & mask;
+    for (i=0; i != units; i++)
+    {
+      wrap[i] = wraps[first + i];
+    }
+
+    for (i=0; i != units; i++)          // Keep these together
+    {
+      raw[i] = count[first + i];
+    }
+
+    same = (*status & mask) == pending;
+    for (i=0; i != units; i++)
+    {
+      same = same && (wraps[first + i] == wrap[i]);
+    }
+  } while ( !same );
+
+  for (i=0; i != units; i++)
+  {
+    if ( pending & (1u << (first + i)) )
+    {
+      wrap[i]++;                        // Wrapped, not serviced yet
+    }
+    result[i] = (int)(wrap[i] * PCNT_HIGH_LIMIT) + (short)(raw[i] & 0xffff);
+  }
+
+  return;
+}
@@ -0,0 +1,24 @@
+/*----------------------------------------------------------------
+ *
+ * pcnt_extend.h
+ *
+ * Extend the 16 bit PCNT counters to 32 bits
+ *
+ *---------------------------------------------------------------*/
+#ifndef _PCNT_EXTEND_H_
+#define _PCNT_EXTEND_H_
+
+#define PCNT_HIGH_LIMIT   0x7fff        // Counter resets to 0 when it gets here
+#define PCNT_LOW_LIMIT   -0x7fff
+
+/*
+ * Global functions
+ */
+void pcnt_extend_read(const volatile unsigned int* count,   // Unit count registers
+                      const volatile unsigned int* status,  // Raw interrupt status register
+                      const volatile unsigned int* wraps,   // Wraps taken by the limit interrupt
+                      unsigned int first,                   // First unit to read
+                      unsigned int units,                   // Number of units to read
+                      int result[]);                        // 32 bit counts
+
+#endif
@@ -0,0 +1,244 @@
+/*----------------------------------------------------------------
+ *
+ * ring_down.c
+ *
+ * Learn how long the sensors ring after a shot
+ *
+ *----------------------------------------------------------------
+ *
+ * After a shot the sensors keep ringing and would latch the RUN
+ * flip flops again.  The fixed scheme keeps the counters stopped
+ * for json_min_ring_time after the last latch, which limits the
+ * target to a couple of shots a second.
+ *
+ * Here the counters are held stopped for the learned ring down
+ * time of the slowest sensor, then armed and watched for
+ * RING_LISTEN ms:
+ *
+ *   - A RUN_XX_LO latch with no RUN_XX_HI is ringing that has
+ *     not yet died away below VREF_HI.  That sensor's ring down
+ *     time is moved out past this point, the counters are
+ *     stopped and the hold starts again.
+ *
+ *   - A RUN_XX_HI latch is a new shot.  The counters are left
+ *     running so that it can be read.
+ *
+ *   - If nothing latches the target is re-armed and the time
+ *     since the shot is the re-arm latency.  Any sensor that did
+ *     not ring after this shot has its ring down time reduced by
+ *     1/8 so that the hold follows the sensors back down.
+ *
+ * The hold is never shorter than RING_MIN_HOLD or longer than
+ * max_hold (json_min_ring_time).  Until a sensor has rung the
+ * hold starts at max_hold.
+ *
+ * Everything is integer and is called from the 1 ms timer
+ * interrupt.
+ *
+ *---------------------------------------------------------------*/
+#include "stdio.h"
+#include "stdbool.h"
+#include "esp_attr.h"
+
+#include "freETarget.h"
+#include "gpio.h"
+#include "ring_down.h"
+
+static const DRAM_ATTR unsigned int lo_bit[RING_SENSORS] = {BIT_NORTH_LO, BIT_EAST_LO, BIT_SOUTH_LO, BIT_WEST_LO};
+static const DRAM_ATTR unsigned int hi_bit[RING_SENSORS] = {BIT_NORTH_HI, BIT_EAST_HI, BIT_SOUTH_HI, BIT_WEST_HI};
+
+#define HI_MASK (BIT_NORTH_HI | BIT_EAST_HI | BIT_SOUTH_HI | BIT_WEST_HI)
+
+/*----------------------------------------------------------------
+ *
+ * @function: ring_down_init
+ *
+ * @brief:    Start again with the longest hold
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+void ring_down_init
+(
+  ring_down_t* r,                       // Ring down to be initialized
+  unsigned int max_hold                 // Longest hold allowed (ms)
+)
+{
+  unsigned int i;
+
+  if ( max_hold < RING_MIN_HOLD )
+  {
+    max_hold = RING_MIN_HOLD;
+  }
+
+  r->max_hold = max_hold;
+  for (i=0; i != RING_SENSORS; i++)
+  {
+    r->hold[i] = max_hold;              // Nothing learned yet
+  }
+  r->elapsed  = 0;
+  r->listen   = 0;
+  r->armed_at = 0;
+  r->rang     = 0;
+  r->rearm    = 0;
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: ring_down_start
+ *
+ * @brief:    A shot has been read and the counters stopped
+ *
+ * @return:   None
+ *
+ *----------------------------------------------------------------
+ *
+ * max_hold is picked up on every shot so that a change to
+ * json_min_ring_time takes effect straight away.
+ *
+ *--------------------------------------------------------------*/
+void IRAM_ATTR ring_down_start
+(
+  ring_down_t* r,                       // Ring down to start
+  unsigned int max_hold                 // json_min_ring_time (ms)
+)
+{
+  r->max_hold = (max_hold < RING_MIN_HOLD) ? RING_MIN_HOLD : max_hold;
+  r->elapsed = 0;
+  r->listen  = 0;
+  r->rang    = 0;
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: ring_down_hold_time
+ *
+ * @brief:    How long to keep the counters stopped
+ *
+ * @return:   Ring down time of the slowest sensor (ms)
+ *
+ *--------------------------------------------------------------*/
+unsigned int IRAM_ATTR ring_down_hold_time
+(
+  ring_down_t* r                        // Ring down to look at
+)
+{
+  unsigned int i;
+  unsigned int hold;
+
+  hold = RING_MIN_HOLD;
+  for (i=0; i != RING_SENSORS; i++)
+  {
+    if ( r->hold[i] > hold )
+    {
+      hold = r->hold[i];
+    }
+  }
+
+  if ( hold > r->max_hold )
+  {
+    hold = r->max_hold;
+  }
+
+  return hold;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: ring_down_tick
+ *
+ * @brief:    Decide what to do on this 1 ms tick
+ *
+ * @return:   RING_HOLD, RING_ARM, RING_STOP, RING_DONE or RING_SHOT
+ *
+ *----------------------------------------------------------------
+ *
+ * pin is the RUN mask read by is_running() on this tick.  While
+ * holding, the counters are stopped and pin is ignored.
+ *
+ * The caller stops the counters on RING_HOLD and RING_STOP, arms
+ * them on RING_ARM, and leaves them alone otherwise.
+ *
+ *--------------------------------------------------------------*/
+unsigned int IRAM_ATTR ring_down_tick
+(
+  ring_down_t* r,                       // Ring down being run
+  unsigned int pin                      // RUN lines latched
+)
+{
+  unsigned int i;
+  unsigned int until;
+
+  r->elapsed++;
+
+/*
+ * Holding, see if it is time to listen
+ */
+  if ( r->listen == 0 )
+  {
+    if ( r->elapsed < ring_down_hold_time(r) )
+    {
+      return RING_HOLD;
+    }
+    r->listen = RING_LISTEN;
+    r->armed_at = r->elapsed;
+    return RING_ARM;
+  }
+
+/*
+ * Listening, something has latched
+ */
+  if ( (pin & HI_MASK) != 0 )           // Loud enough to be a shot
+  {
+    r->listen = 0;
+    r->rearm = r->armed_at;
+    return RING_SHOT;
+  }
+
+  if ( pin != 0 )                       // Still ringing
+  {
+    until = r->elapsed + RING_LISTEN;
+    for (i=0; i != RING_SENSORS; i++)
+    {
+      if ( (pin & lo_bit[i]) && (r->hold[i] < until) )
+      {
+        r->hold[i] = until;             // Rings for longer than we thought
+      }
+      if ( pin & (lo_bit[i] | hi_bit[i]) )
+      {
+        r->rang |= 1u << i;
+      }
+    }
+    r->listen = 0;
+    return RING_STOP;
+  }
+
+/*
+ * Quiet.  When the listen is over, go back down on the sensors
+ * that did not ring
+ */
+  r->listen--;
+  if ( r->listen != 0 )
+  {
+    return RING_WAIT;
+  }
+
+  for (i=0; i != RING_SENSORS; i++)
+  {
+    if ( (r->rang & (1u << i)) == 0 )
+    {
+      r->hold[i] -= r->hold[i] >> 3;
+      if ( r->hold[i] < RING_MIN_HOLD )
+      {
+        r->hold[i] = RING_MIN_HOLD;
+      }
+    }
+  }
+  r->rearm = r->armed_at;
+
+  return RING_DONE;
+}
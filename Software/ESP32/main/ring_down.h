@@ -0,0 +1,47 @@
+/*----------------------------------------------------------------
+ *
+ * ring_down.h
+ *
+ * Learn how long the sensors ring after a shot
+ *
+ *---------------------------------------------------------------*/
+#ifndef _RING_DOWN_H_
+#define _RING_DOWN_H_
+
+#define RING_SENSORS    4               // N, E, S, W
+#define RING_MIN_HOLD   5               // Never hold for less than 5 ms
+#define RING_LISTEN     10              // Listen for 10 ms before calling it quiet
+
+/*
+ * What the timer interrupt should do next
+ */
+#define RING_HOLD       0               // Keep the counters stopped
+#define RING_WAIT       1               // Keep listening
+#define RING_ARM        2               // Arm the counters and listen
+#define RING_STOP       3               // Still ringing, stop the counters again
+#define RING_DONE       4               // Quiet, leave the counters armed
+#define RING_SHOT       5               // A new shot arrived while listening
+
+/*
+ * Typedefs
+ */
+typedef struct ring_down
+{
+  unsigned int hold[RING_SENSORS];      // Learned ring down time for each sensor (ms)
+  unsigned int max_hold;                // Longest time to hold (ms)
+  unsigned int elapsed;                 // Time since the shot was captured (ms)
+  unsigned int listen;                  // Time left to listen, 0 while holding (ms)
+  unsigned int armed_at;                // When the counters were last armed (ms)
+  unsigned int rang;                    // Sensors heard ringing after this shot
+  unsigned int rearm;                   // Time taken to re-arm after the last shot (ms)
+} ring_down_t;
+
+/*
+ * Global functions
+ */
+void         ring_down_init(ring_down_t* r, unsigned int max_hold);  // Forget what has been learned
+void         ring_down_start(ring_down_t* r, unsigned int max_hold); // Shot captured, counters stopped
+unsigned int ring_down_tick(ring_down_t* r, unsigned int pin);       // 1 ms tick, returns RING_*
+unsigned int ring_down_hold_time(ring_down_t* r);                    // Current hold time (ms)
+
+#endif
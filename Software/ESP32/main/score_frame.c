@@ -0,0 +1,458 @@
+/*----------------------------------------------------------------
+ *
+ * score_frame.c
+ *
+ * Binary framing for scores, misses and events
+ *
+ *----------------------------------------------------------------
+ *
+ * A link that asks for it with {"SCORE_FORMAT":1} gets its scores,
+ * misses and Tabata / rapid fire events as binary frames instead
+ * of JSON text.  A score is about 40 bytes instead of 200, which
+ * matters at 115200 baud and on the token ring.
+ *
+ * Every frame is
+ *
+ *   0xA5  type  length  payload[length]  crc_lo  crc_hi
+ *
+ * The CRC is CRC-16/CCITT (0x1021, starting at 0xFFFF) over the
+ * type, length and payload.  All numbers are little endian.
+ *
+ * A score or miss payload is
+ *
+ *   u16 shot, u8 flags, u8 lane, u32 time, i32 x, i32 y
+ *   [i32 real_x, i32 real_y]     RECORD_REAL
+ *   [u32 radius, i16 angle]      RECORD_POLAR
+ *   [u32 count[4], u32 timer[4]] RECORD_TIMERS
+ *   [u16 residual]               RECORD_RESIDUAL
+ *
+ * which carries the same fields as the JSON message.  An event is
+ * u8 event, i32 value.
+ *
+ * The decoder takes one byte at a time and skips anything that is
+ * not a good frame, so JSON text on the same link does no harm.
+ * The same code is built on the host for the PC side.
+ *
+ *---------------------------------------------------------------*/
+#include "string.h"
+
+#include "score_frame.h"
+
+/*
+ * Decoder states
+ */
+#define WAIT_SYNC     0
+#define WAIT_TYPE     1
+#define WAIT_LENGTH   2
+#define WAIT_PAYLOAD  3
+#define WAIT_CRC_LO   4
+#define WAIT_CRC_HI   5
+
+static const char* event_names[] = { "",
+                                     "TABATA_STARTING", "TABATA_WARN", "TABATA_DARK", "TABATA_ON", "TABATA_OFF",
+                                     "RAPID_ON", "RAPID_OFF" };
+
+/*
+ * CRC-16/CCITT four bits at a time
+ */
+static const unsigned short crc_table[16] =
+{
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/*----------------------------------------------------------------
+ *
+ * @function: score_frame_crc
+ *
+ * @brief:    Add bytes to a CRC-16/CCITT
+ *
+ * @return:   Updated CRC, start with 0xFFFF
+ *
+ *--------------------------------------------------------------*/
+unsigned int score_frame_crc
+(
+  const unsigned char* data,            // Bytes to add
+  unsigned int         length,          // Number of bytes
+  unsigned int         crc              // CRC so far
+)
+{
+  while ( length-- != 0 )
+  {
+    crc = (crc << 4) ^ crc_table[((crc >> 12) ^ (*data >> 4)) & 0x0F];
+    crc = (crc << 4) ^ crc_table[((crc >> 12) ^ *data) & 0x0F];
+    crc &= 0xFFFF;
+    data++;
+  }
+
+  return crc;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: put_u8, put_u16, put_u32
+ *            get_u16, get_u32
+ *
+ * @brief:    Little endian numbers in and out of the payload
+ *
+ *--------------------------------------------------------------*/
+static unsigned char* put_u8(unsigned char* p, unsigned int x)
+{
+  p[0] = x;
+  return p + 1;
+}
+
+static unsigned char* put_u16(unsigned char* p, unsigned int x)
+{
+  p[0] = x;
+  p[1] = x >> 8;
+  return p + 2;
+}
+
+static unsigned char* put_u32(unsigned char* p, unsigned int x)
+{
+  p[0] = x;
+  p[1] = x >> 8;
+  p[2] = x >> 16;
+  p[3] = x >> 24;
+  return p + 4;
+}
+
+static unsigned int get_u16(const unsigned char* p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static unsigned int get_u32(const unsigned char* p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: frame_close
+ *
+ * @brief:    Fill in the header and CRC around a payload
+ *
+ * @return:   Length of the frame
+ *
+ *--------------------------------------------------------------*/
+static unsigned int frame_close
+(
+  unsigned char* frame,                 // Start of the frame
+  unsigned int   type,                  // SCORE_FRAME_*
+  unsigned char* end                    // End of the payload
+)
+{
+  unsigned int length;
+  unsigned int crc;
+
+  length = end - &frame[SCORE_FRAME_HEADER];
+  frame[0] = SCORE_FRAME_SYNC;
+  frame[1] = type;
+  frame[2] = length;
+  crc = score_frame_crc(&frame[1], length + 2, 0xFFFF);
+  put_u16(end, crc);
+
+  return SCORE_FRAME_HEADER + length + SCORE_FRAME_CRC;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: score_frame_record
+ *            score_frame_event
+ *
+ * @brief:    Build a frame
+ *
+ * @return:   Length of the frame, 0 if the buffer is too small
+ *
+ *--------------------------------------------------------------*/
+unsigned int score_frame_record
+(
+  char*                 buffer,         // Where to put the frame
+  unsigned int          size,           // sizeof(buffer)
+  unsigned int          type,           // SCORE_FRAME_SCORE or SCORE_FRAME_MISS
+  const score_record_t* r               // What to send
+)
+{
+  unsigned char  frame[SCORE_FRAME_SIZE];
+  unsigned char* p;
+  unsigned int   length;
+  int            i;
+
+  p = &frame[SCORE_FRAME_HEADER];
+  p = put_u16(p, r->shot);
+  p = put_u8(p, r->flags);
+  p = put_u8(p, r->lane);
+  p = put_u32(p, r->time);
+  p = put_u32(p, r->x);
+  p = put_u32(p, r->y);
+  if ( r->flags & RECORD_REAL )
+  {
+    p = put_u32(p, r->real_x);
+    p = put_u32(p, r->real_y);
+  }
+  if ( r->flags & RECORD_POLAR )
+  {
+    p = put_u32(p, r->radius);
+    p = put_u16(p, r->angle);
+  }
+  if ( r->flags & RECORD_TIMERS )
+  {
+    for (i=0; i != 4; i++)
+    {
+      p = put_u32(p, r->count[i]);
+    }
+    for (i=0; i != 4; i++)
+    {
+      p = put_u32(p, r->timer[i]);
+    }
+  }
+  if ( r->flags & RECORD_RESIDUAL )
+  {
+    p = put_u16(p, r->residual);
+  }
+
+  length = frame_close(frame, type, p);
+  if ( length > size )
+  {
+    return 0;
+  }
+  memcpy(buffer, frame, length);
+
+  return length;
+}
+
+unsigned int score_frame_event
+(
+  char*         buffer,                 // Where to put the frame
+  unsigned int  size,                   // sizeof(buffer)
+  unsigned int  event,                  // EVENT_*
+  int           value                   // Value sent with it
+)
+{
+  unsigned char  frame[SCORE_FRAME_SIZE];
+  unsigned char* p;
+  unsigned int   length;
+
+  p = &frame[SCORE_FRAME_HEADER];
+  p = put_u8(p, event);
+  p = put_u32(p, value);
+
+  length = frame_close(frame, SCORE_FRAME_EVENT, p);
+  if ( length > size )
+  {
+    return 0;
+  }
+  memcpy(buffer, frame, length);
+
+  return length;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: unpack
+ *
+ * @brief:    Take a payload apart
+ *
+ * @return:   TRUE if the payload is the right length for its type
+ *
+ *--------------------------------------------------------------*/
+static int unpack
+(
+  score_decoder_t* d
+)
+{
+  const unsigned char* p;
+  const unsigned char* end;
+  score_record_t*      r;
+  int                  i;
+
+  p = d->payload;
+  end = &d->payload[d->length];
+
+  if ( d->type == SCORE_FRAME_EVENT )
+  {
+    if ( d->length != 5 )
+    {
+      return 0;
+    }
+    d->event.event = p[0];
+    d->event.value = (int)get_u32(&p[1]);
+    return 1;
+  }
+
+  if ( d->length < 16 )
+  {
+    return 0;
+  }
+  r = &d->record;
+  memset(r, 0, sizeof(score_record_t));
+  r->shot  = get_u16(p);
+  r->flags = p[2];
+  r->lane  = p[3];
+  r->time  = get_u32(&p[4]);
+  r->x     = (int)get_u32(&p[8]);
+  r->y     = (int)get_u32(&p[12]);
+  p += 16;
+
+  if ( r->flags & RECORD_REAL )
+  {
+    if ( p + 8 > end )
+    {
+      return 0;
+    }
+    r->real_x = (int)get_u32(&p[0]);
+    r->real_y = (int)get_u32(&p[4]);
+    p += 8;
+  }
+  if ( r->flags & RECORD_POLAR )
+  {
+    if ( p + 6 > end )
+    {
+      return 0;
+    }
+    r->radius = get_u32(&p[0]);
+    r->angle  = (short)get_u16(&p[4]);
+    p += 6;
+  }
+  if ( r->flags & RECORD_TIMERS )
+  {
+    if ( p + 32 > end )
+    {
+      return 0;
+    }
+    for (i=0; i != 4; i++)
+    {
+      r->count[i] = get_u32(&p[i * 4]);
+      r->timer[i] = get_u32(&p[16 + i * 4]);
+    }
+    p += 32;
+  }
+  if ( r->flags & RECORD_RESIDUAL )
+  {
+    if ( p + 2 > end )
+    {
+      return 0;
+    }
+    r->residual = get_u16(p);
+    p += 2;
+  }
+
+  return p == end;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: score_frame_reset
+ *            score_frame_decode
+ *
+ * @brief:    Pick the frames out of a stream of bytes
+ *
+ * @return:   Frame type when a good frame is complete, otherwise 0
+ *
+ *----------------------------------------------------------------
+ *
+ * The result is left in d->record or d->event.  A frame with a bad
+ * length or CRC is counted in d->errors and the search starts again
+ * with the next 0xA5.
+ *
+ *--------------------------------------------------------------*/
+void score_frame_reset
+(
+  score_decoder_t* d                    // Decoder to start over
+)
+{
+  memset(d, 0, sizeof(score_decoder_t));
+  d->state = WAIT_SYNC;
+
+  return;
+}
+
+unsigned int score_frame_decode
+(
+  score_decoder_t* d,                   // Decoder
+  unsigned char    ch                   // Next byte from the link
+)
+{
+  unsigned char header[2];
+
+  switch ( d->state )
+  {
+    default:
+    case WAIT_SYNC:
+      if ( ch == SCORE_FRAME_SYNC )
+      {
+        d->state = WAIT_TYPE;
+      }
+      break;
+
+    case WAIT_TYPE:
+      d->type = ch;
+      d->state = ((ch >= SCORE_FRAME_SCORE) && (ch <= SCORE_FRAME_EVENT)) ? WAIT_LENGTH : WAIT_SYNC;
+      break;
+
+    case WAIT_LENGTH:
+      d->length = ch;
+      d->at = 0;
+      if ( (ch == 0) || (ch > SCORE_FRAME_PAYLOAD) )
+      {
+        d->errors++;
+        d->state = WAIT_SYNC;
+        break;
+      }
+      d->state = WAIT_PAYLOAD;
+      break;
+
+    case WAIT_PAYLOAD:
+      d->payload[d->at++] = ch;
+      if ( d->at == d->length )
+      {
+        d->state = WAIT_CRC_LO;
+      }
+      break;
+
+    case WAIT_CRC_LO:
+      d->crc = ch;
+      d->state = WAIT_CRC_HI;
+      break;
+
+    case WAIT_CRC_HI:
+      d->crc |= ch << 8;
+      d->state = WAIT_SYNC;
+      header[0] = d->type;
+      header[1] = d->length;
+      if ( (score_frame_crc(d->payload, d->length, score_frame_crc(header, 2, 0xFFFF)) != d->crc)
+          || (unpack(d) == 0) )
+      {
+        d->errors++;
+        break;
+      }
+      d->frames++;
+      return d->type;
+  }
+
+  return 0;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: score_event_name
+ *
+ * @brief:    Name of an event as sent in JSON
+ *
+ * @return:   The name, "" if there is no such event
+ *
+ *--------------------------------------------------------------*/
+const char* score_event_name
+(
+  unsigned int event                    // EVENT_*
+)
+{
+  if ( event > EVENT_LAST )
+  {
+    return event_names[0];
+  }
+
+  return event_names[event];
+}
@@ -0,0 +1,93 @@
+/*----------------------------------------------------------------
+ *
+ * score_frame.h
+ *
+ * Binary framing for scores, misses and events
+ *
+ *---------------------------------------------------------------*/
+#ifndef _SCORE_FRAME_H_
+#define _SCORE_FRAME_H_
+
+#define SCORE_FRAME_SYNC      0xA5      // First byte of every frame
+#define SCORE_FRAME_HEADER    3         // Sync, type, length
+#define SCORE_FRAME_CRC       2         // CRC-16 at the end
+#define SCORE_FRAME_PAYLOAD   64        // Largest payload
+#define SCORE_FRAME_SIZE      (SCORE_FRAME_HEADER + SCORE_FRAME_PAYLOAD + SCORE_FRAME_CRC)
+
+/*
+ * Frame types
+ */
+#define SCORE_FRAME_SCORE     1         // score_record_t
+#define SCORE_FRAME_MISS      2         // score_record_t
+#define SCORE_FRAME_EVENT     3         // score_event_t
+
+/*
+ * score_record_t.flags
+ */
+#define RECORD_RING           0x01      // lane is the token ring number, not a name
+#define RECORD_REAL           0x02      // real_x and real_y are sent
+#define RECORD_POLAR          0x04      // radius and angle are sent
+#define RECORD_TIMERS         0x08      // count[] and timer[] are sent
+#define RECORD_RESIDUAL       0x10      // residual is sent
+
+/*
+ * Events
+ */
+#define EVENT_TABATA_STARTING 1
+#define EVENT_TABATA_WARN     2
+#define EVENT_TABATA_DARK     3
+#define EVENT_TABATA_ON       4
+#define EVENT_TABATA_OFF      5
+#define EVENT_RAPID_ON        6
+#define EVENT_RAPID_OFF       7
+#define EVENT_LAST            EVENT_RAPID_OFF
+
+/*
+ * Typedefs
+ */
+typedef struct score_record
+{
+  unsigned int  shot;                   // Shot number
+  unsigned int  flags;                  // RECORD_*
+  unsigned int  lane;                   // Index into names[] or ring number
+  unsigned int  time;                   // Shot time (0.01 s)
+  int           x, y;                   // Location on the target (0.01 mm)
+  int           real_x, real_y;         // Location before remap_target() (0.01 mm)
+  unsigned int  radius;                 // Distance from the centre (0.01 mm)
+  int           angle;                  // Angle (0.01 degrees)
+  unsigned int  residual;               // Solver residual (0.01 mm)
+  unsigned int  count[4];               // Timer counts N, E, S, W
+  unsigned int  timer[4];               // Raw timers N, E, S, W
+} score_record_t;
+
+typedef struct score_event
+{
+  unsigned int  event;                  // EVENT_*
+  int           value;                  // Seconds, as in the JSON message
+} score_event_t;
+
+typedef struct score_decoder
+{
+  int            state;                 // Where we are in the frame
+  unsigned int   type;                  // Frame type
+  unsigned int   length;                // Payload length
+  unsigned int   at;                    // Payload bytes received
+  unsigned int   crc;                   // CRC received
+  unsigned char  payload[SCORE_FRAME_PAYLOAD];
+  score_record_t record;                // Last score or miss decoded
+  score_event_t  event;                 // Last event decoded
+  unsigned long  frames;                // Frames decoded
+  unsigned long  errors;                // Frames thrown away
+} score_decoder_t;
+
+/*
+ * Global functions
+ */
+unsigned int score_frame_record(char* buffer, unsigned int size, unsigned int type, const score_record_t* r); // Frame a score or miss
+unsigned int score_frame_event(char* buffer, unsigned int size, unsigned int event, int value);                // Frame an event
+void         score_frame_reset(score_decoder_t* d);                        // Start looking for a frame
+unsigned int score_frame_decode(score_decoder_t* d, unsigned char ch);     // Add a byte, return the type when a frame is complete
+unsigned int score_frame_crc(const unsigned char* data, unsigned int length, unsigned int crc); // CRC-16/CCITT
+const char*  score_event_name(unsigned int event);                         // JSON name of an event
+
+#endif
@@ -10,15 +10,21 @@
  * 
  *------------------------------------------------------*/
 
+#define _GNU_SOURCE                   // fopencookie()
 #include "stdbool.h"
 #include "stdio.h"
+#include "string.h"
 #include "driver/uart.h"
 #include "driver/gpio.h"
+#include "freertos/event_groups.h"
 
 #include "freETarget.h"
 #include "diag_tools.h"
 #include "serial_io.h"
 #include "timer.h"
+#include "tcpip_server.h"
+#include "serial_ring.h"
+#include "tcpip_ring.h"
 
 /*
  *  Serial IO port configuration
@@ -52,14 +58,90 @@ uart_config_t uart_aux_config =
 const int uart_aux_size= (1024 * 2);
 QueueHandle_t uart_aux_queue;
 
-typedef struct queue_struct  {
-    char queue[1024];                 // Holding queue
-    int  in;                          // Index of input characters
-    int  out;                         // Index of output characters
-} queue_struct_t;
+static tcpip_ring_t   out_ring;       // TCPIP output, one cursor for each client
+static portMUX_TYPE   out_lock = portMUX_INITIALIZER_UNLOCKED; // Many writers, one server
+static FILE*          console_out;    // stdout after serial_io_init()
 
-static queue_struct_t in_buffer;      // TCPIP input buffer
-static queue_struct_t out_buffer;     // TCPIP input buffer
+/*
+ * Links that asked for binary scores with {"SCORE_FORMAT":1}
+ * Each TCPIP client keeps its own in out_ring
+ */
+static bool binary_console;           // Console
+static bool binary_aux;               // AUX port, ex the token ring
+
+/*
+ * Input rings, filled by serial_uart_task() and tcpip_socket_2_queue()
+ */
+static serial_ring_t console_ring;    // Console input
+static serial_ring_t aux_ring;        // AUX input
+static serial_ring_t tcpip_ring[TCPIP_MAX_CLIENTS];  // TCPIP input, one for each client
+static serial_ring_t tcpip_reply[TCPIP_MAX_CLIENTS]; // Output for one client only
+static bool          tcpip_replying[TCPIP_MAX_CLIENTS];  // TRUE if the last copy came from tcpip_reply[]
+static unsigned int  tcpip_session[TCPIP_MAX_CLIENTS];   // Counts the connections on each client
+static portMUX_TYPE  ring_lock = portMUX_INITIALIZER_UNLOCKED; // More than one task reads the rings
+#define UART_CHUNK    256             // Most bytes moved from the driver at a time
+
+/*
+ * Input events
+ */
+#define SERIAL_CONSOLE_BIT BIT0       // Console UART has input
+#define SERIAL_AUX_BIT     BIT1       // AUX UART has input
+#define SERIAL_TCPIP_BIT   BIT2       // TCPIP input queue has data
+#define SERIAL_ANY_BIT     (SERIAL_CONSOLE_BIT | SERIAL_AUX_BIT | SERIAL_TCPIP_BIT)
+
+typedef struct uart_events {
+    int             port;             // UART number
+    QueueHandle_t*  queue;            // Event queue from uart_driver_install()
+    EventBits_t     bit;              // Bit to set when data arrives
+    serial_ring_t*  ring;             // Where the input goes
+} uart_events_t;
+
+static EventGroupHandle_t serial_events;   // Input waiting
+static uart_events_t console_events = { UART_NUM_0, &uart_console_queue, SERIAL_CONSOLE_BIT, &console_ring };
+static uart_events_t aux_events     = { UART_NUM_1, &uart_aux_queue,     SERIAL_AUX_BIT,     &aux_ring };
+static void serial_uart_task(void* arg);
+static void serial_uart_drain(uart_events_t* uart);
+static int  ring_read(serial_ring_t* ring, char* buffer, int length, bool frame);
+static int  tcpip_read(char* buffer, int length, bool frame);
+
+/*
+ * Console output
+ */
+#define CONSOLE_BUFFER 512            // printf() output is collected here until a flush
+static char    console_buffer[CONSOLE_BUFFER];
+static char    console_last;          // Last character sent, for the CR LF check
+static ssize_t console_cookie_write(void* cookie, const char* buffer, size_t length);
+static void    console_write(const char* str, unsigned int length);
+static void    console_write_binary(const char* str, unsigned int length);
+static cookie_io_functions_t console_io = { NULL, console_cookie_write, NULL, NULL };
+
+#define RXTX_LED_TIME 1000            // Turn off the RX/TX LED 1000 ms after the last character
+static void rxtx_led_off(void* arg);
+static wheel_timer_t rxtx_led = WHEEL_TIMER(rxtx_led_off, NULL);
+
+/******************************************************************************
+ * 
+ * @function: rxtx_led_off
+ * 
+ * @brief: Turn off the RX/TX LED
+ * 
+ * @return: None
+ * 
+ *******************************************************************************
+ *
+ * Called from the timer wheel when nothing has been sent or received
+ * for RXTX_LED_TIME
+ * 
+ ******************************************************************************/
+static void rxtx_led_off
+(
+  void* arg
+)
+{
+  set_status_LED(LED_RXTX_OFF);
+
+  return;
+}
 
 /******************************************************************************
  * 
@@ -78,7 +160,8 @@ static queue_struct_t out_buffer;     // TCPIP input buffer
 
 void serial_io_init(void)
 {
-  
+  int i;
+
 /*
  *  Load the driver
  */
@@ -89,21 +172,43 @@ void serial_io_init(void)
  *  Setup the communications parameters
  */
   uart_param_config(uart_console, &uart_console_config);
-  setvbuf(stdout, NULL, _IONBF, 0);                         // Send something out as soon as you get it.
   uart_param_config(uart_aux,     &uart_aux_config);
 
+/*
+ *  Collect stdout and hand it to the driver a line at a time.  Tasks
+ *  created from here on pick up the new stdout from _GLOBAL_REENT
+ */
+  console_out = fopencookie(NULL, "w", console_io);
+  if ( console_out != NULL )
+  {
+    setvbuf(console_out, console_buffer, _IOLBF, sizeof(console_buffer));
+    _GLOBAL_REENT->_stdout = console_out;
+    stdout = console_out;
+  }
+
 /*
  *  Set UART pins(TX: IO4, RX: IO5, RTS: IO18, CTS: IO19)
  */
   ESP_ERROR_CHECK(uart_set_pin(UART_NUM_1, 17, 18, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
 
  /* 
-  *  Prepare the TCPIP queues
+  *  Prepare the input rings and TCPIP queues
   */
-  in_buffer.in   = 0;      // Queue pointers
-  in_buffer.out  = 0;       
-  out_buffer.in  = 0;      // Queue pointers
-  out_buffer.out = 0;
+  serial_ring_init(&console_ring);
+  serial_ring_init(&aux_ring);
+  for (i=0; i != TCPIP_MAX_CLIENTS; i++)
+  {
+    serial_ring_init(&tcpip_ring[i]);
+    serial_ring_init(&tcpip_reply[i]);
+  }
+  tcpip_ring_init(&out_ring);
+
+/*
+ *  Watch the UART events so that the readers can sleep
+ */
+  serial_events = xEventGroupCreate();
+  xTaskCreate(serial_uart_task, "serial_console", 2048, &console_events, 16, NULL);
+  xTaskCreate(serial_uart_task, "serial_aux",     2048, &aux_events,     16, NULL);
 
 /*
  * All done, return
@@ -111,6 +216,151 @@ void serial_io_init(void)
   return;
 }
 
+/******************************************************************************
+ * 
+ * @function: serial_uart_task
+ * 
+ * @brief: Turn UART events into input events
+ * 
+ * @return: Never
+ * 
+ *******************************************************************************
+ *
+ * The UART driver posts an event to the queue given to 
+ * uart_driver_install() when data arrives.  One of these tasks
+ * sleeps on each queue, moves everything the driver has into
+ * the port's ring, and sets the port's bit in serial_events 
+ * so that serial_wait() returns.
+ * 
+ * If the driver's buffer overflows the input is thrown away, as
+ * it is no longer in step.
+ * 
+ ******************************************************************************/
+static void serial_uart_task
+(
+  void* arg                           // uart_events_t for the port
+)
+{
+  uart_events_t* uart = (uart_events_t*)arg;
+  uart_event_t   event;
+
+  while (1)
+  {
+    if ( xQueueReceive(*uart->queue, &event, portMAX_DELAY) != pdTRUE )
+    {
+      continue;
+    }
+
+    switch (event.type)
+    {
+      case UART_DATA:
+        serial_uart_drain(uart);
+        break;
+
+      case UART_FIFO_OVF:
+      case UART_BUFFER_FULL:
+        DLT(DLT_CRITICAL, printf("UART %d input overrun", uart->port);)
+        uart_flush_input(uart->port);
+        xQueueReset(*uart->queue);
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+/******************************************************************************
+ * 
+ * @function: serial_uart_drain
+ * 
+ * @brief: Move the driver's input into the ring
+ * 
+ * @return: None
+ * 
+ *******************************************************************************
+ *
+ * The input is read in chunks of up to UART_CHUNK bytes.  If the
+ * ring is full the reader is given up to 100 ms to make room, 
+ * after which the input is dropped and counted in the ring's
+ * overflow.
+ * 
+ ******************************************************************************/
+static void serial_uart_drain
+(
+  uart_events_t* uart                 // Port to read
+)
+{
+  char   chunk[UART_CHUNK];
+  size_t waiting;
+  int    length;
+  int    patience;
+
+  while (1)
+  {
+    uart_get_buffered_data_len(uart->port, &waiting);
+    if ( waiting == 0 )
+    {
+      break;
+    }
+    if ( waiting > sizeof(chunk) )
+    {
+      waiting = sizeof(chunk);
+    }
+
+    patience = ONE_SECOND / 10;
+    while ( (serial_ring_space(uart->ring) < waiting) && (patience-- != 0) )
+    {
+      xEventGroupSetBits(serial_events, uart->bit);   // Make sure the reader knows
+      vTaskDelay(1);
+    }
+
+    length = uart_read_bytes(uart->port, chunk, waiting, 0);
+    if ( length <= 0 )
+    {
+      break;
+    }
+    if ( serial_ring_put(uart->ring, chunk, length) != length )
+    {
+      DLT(DLT_CRITICAL, printf("UART %d input ring overrun", uart->port);)
+    }
+    xEventGroupSetBits(serial_events, uart->bit);
+  }
+
+  return;
+}
+
+/******************************************************************************
+ * 
+ * @function: serial_wait
+ * 
+ * @brief: Sleep until input arrives
+ * 
+ * @return: None
+ * 
+ *******************************************************************************
+ *
+ * Returns when any port has received something since the last
+ * call, or after ticks.  The caller still uses serial_available()
+ * to find out what is waiting.
+ * 
+ ******************************************************************************/
+void serial_wait
+(
+  int ticks                           // Longest time to sleep
+)
+{
+  if ( serial_events == NULL )        // Not ready yet
+  {
+    vTaskDelay(ticks);
+    return;
+  }
+
+  xEventGroupWaitBits(serial_events, SERIAL_ANY_BIT, pdTRUE, pdFALSE, ticks);
+
+  return;
+}
+
 
 /*******************************************************************************
  * 
@@ -122,6 +372,10 @@ void serial_io_init(void)
  * 
  *******************************************************************************
  *
+ * Prompts such as "\r\nTest >" do not end in a new line and are
+ * followed by a loop waiting for the console.  If there is nothing
+ * to read, stdout is flushed so that the prompt is seen even before
+ * the 10 ms band is running.
  * 
  ******************************************************************************/
 int serial_available
@@ -132,32 +386,25 @@ int serial_available
 )
 {
   int n_available;
-  int length;
+  int i;
 
   n_available = 0;
 
   if ( console )
   {
-    uart_get_buffered_data_len(uart_console, (size_t*)&length);
-    n_available += length;
+    n_available += serial_ring_count(&console_ring);
   }
 
   if ( aux )
   {
-    uart_get_buffered_data_len(uart_aux, (size_t*)&length);
-    n_available += length;
+    n_available += serial_ring_count(&aux_ring);
   }
 
   if ( tcpip )
   {
-    if (in_buffer.in != in_buffer.out )
+    for (i=0; i != TCPIP_MAX_CLIENTS; i++)
     {
-      length = in_buffer.in - in_buffer.out;
-      if ( length < 0 )
-      {
-        length += sizeof(in_buffer.queue);
-      }
-      n_available += length;
+      n_available += serial_ring_count(&tcpip_ring[i]);
     }
   }
    
@@ -167,7 +414,11 @@ int serial_available
   if ( n_available != 0 )               // Something waiting,
   {
     set_status_LED(LED_RX);             // Turn on the Receive LED
-    timer_new(&LED_timer, ONE_SECOND);
+    timer_arm(&rxtx_led, RXTX_LED_TIME, 0);
+  }
+  else if ( console )
+  {
+    serial_console_flush();             // Show any prompt before waiting
   }
   return n_available;
 }
@@ -191,6 +442,8 @@ void serial_flush
   bool tcpip       // TRUE if flushing the TCPIP channel
 )
 {
+  int i;
+
   if ( console )
   {
     uart_flush(uart_console);
@@ -201,11 +454,25 @@ void serial_flush
     uart_flush(uart_aux);
   }
 
+  portENTER_CRITICAL(&ring_lock);     // The driver calls can block, the rings can't
+  if ( console )
+  {
+    serial_ring_flush(&console_ring);
+  }
+
+  if ( aux )
+  {
+    serial_ring_flush(&aux_ring);
+  }
+
   if ( tcpip )
   {
-    in_buffer.in  = 0;
-    in_buffer.out = 0;
+    for (i=0; i != TCPIP_MAX_CLIENTS; i++)
+    {
+      serial_ring_flush(&tcpip_ring[i]);
+    }
   }
+  portEXIT_CRITICAL(&ring_lock);
   return;
 }
 
@@ -231,43 +498,233 @@ char serial_getch
 {
   char ch;
 
-/*
- * Bring in the console bytes
- */
-  if ( console )
+  if ( serial_read(console, aux, tcpip, &ch, 1) == 1 )
   {
-    if ( uart_read_bytes(uart_console, &ch, 1, 0) > 0 )
-    {
-      return ch;
-    }
+    return ch;
   }
 
 /*
- *  Bring in the AUX bytes
+ * Got nothing
  */
-  if ( aux )
+  return 0;
+}
+
+/*******************************************************************************
+ * 
+ * @function: serial_read
+ *            serial_frame
+ * 
+ * @brief:    Read a block from one or more of the serial ports
+ * 
+ * @return:   Number of bytes read, 0 if nothing is waiting
+ * 
+ *******************************************************************************
+ *
+ * The bytes all come from one port, the first of console, AUX 
+ * and TCPIP that has something waiting.
+ * 
+ * serial_frame() stops at the end of a {...} and holds back a
+ * frame until it is complete (see serial_ring_frame()), so that
+ * the JSON parser is given whole messages.  Bytes outside of a 
+ * frame are passed straight through.
+ * 
+ *******************************************************************************-*/
+int serial_read
+  (
+    bool  console,      // Read the console
+    bool  aux,          // Read the AUX port
+    bool  tcpip,        // Read the TCPIP input
+    char* buffer,       // Where to put the bytes
+    int   length        // Room in buffer
+  )
+{
+  int got;
+
+  got = 0;
+  if ( console && (got == 0) )
   {
-    if ( uart_read_bytes(uart_aux, &ch, 1, 0) > 0 )
-    {
-      return ch;
-    }
+    got = ring_read(&console_ring, buffer, length, false);
+  }
+  if ( aux && (got == 0) )
+  {
+    got = ring_read(&aux_ring, buffer, length, false);
+  }
+  if ( tcpip && (got == 0) )
+  {
+    got = tcpip_read(buffer, length, false);
   }
 
-/*
- *  Bring in the TCPIP bytes
- */
-  if ( tcpip )
+  return got;
+}
+
+int serial_frame
+  (
+    bool  console,      // Read the console
+    bool  aux,          // Read the AUX port
+    bool  tcpip,        // Read the TCPIP input
+    char* buffer,       // Where to put the bytes
+    int   length        // Room in buffer
+  )
+{
+  int got;
+
+  got = 0;
+  if ( console && (got == 0) )
   {
-    if ( tcpip_queue_2_app(&ch, 1) > 0 )
-    {
-      return ch;
-    }
+    got = ring_read(&console_ring, buffer, length, true);
+  }
+  if ( aux && (got == 0) )
+  {
+    got = ring_read(&aux_ring, buffer, length, true);
+  }
+  if ( tcpip && (got == 0) )
+  {
+    got = tcpip_read(buffer, length, true);
   }
 
-/*
- * Got nothing
- */
-  return 0;
+  return got;
+}
+
+static int ring_read
+  (
+    serial_ring_t* ring,  // Ring to read
+    char*          buffer,// Where to put the bytes
+    int            length,// Room in buffer
+    bool           frame  // TRUE to stop at the end of a frame
+  )
+{
+  int got;
+
+  if ( (length <= 0) || (serial_ring_count(ring) == 0) )
+  {
+    return 0;
+  }
+
+  portENTER_CRITICAL(&ring_lock);
+  if ( frame )
+  {
+    got = serial_ring_frame(ring, buffer, length);
+  }
+  else
+  {
+    got = serial_ring_get(ring, buffer, length);
+  }
+  portEXIT_CRITICAL(&ring_lock);
+
+  return got;
+}
+
+static int tcpip_read
+  (
+    char*          buffer,// Where to put the bytes
+    int            length,// Room in buffer
+    bool           frame  // TRUE to stop at the end of a frame
+  )
+{
+  int got;
+  int i;
+
+  got = 0;
+  for (i=0; (i != TCPIP_MAX_CLIENTS) && (got == 0); i++)
+  {
+    got = ring_read(&tcpip_ring[i], buffer, length, frame);
+  }
+
+  return got;
+}
+
+/*******************************************************************************
+ * 
+ * @function: serial_source_frame
+ *            serial_source_session
+ * 
+ * @brief:    Read the next frame from one input
+ * 
+ * @return:   Number of bytes read, or the connection count
+ * 
+ *******************************************************************************
+ *
+ * The sources are the console, AUX and each TCPIP client on its own
+ * (see SOURCE_CONSOLE, SOURCE_AUX and SOURCE_TCPIP()).  The session
+ * changes whenever a new client takes over a TCPIP source, so that
+ * the reader can throw away anything left over from the last one.
+ * 
+ *******************************************************************************-*/
+int serial_source_frame
+  (
+    int   source,       // Input to read
+    char* buffer,       // Where to put the bytes
+    int   length        // Room in buffer
+  )
+{
+  if ( source == SOURCE_CONSOLE )
+  {
+    return ring_read(&console_ring, buffer, length, true);
+  }
+  if ( source == SOURCE_AUX )
+  {
+    return ring_read(&aux_ring, buffer, length, true);
+  }
+
+  return ring_read(&tcpip_ring[source - SOURCE_TCPIP(0)], buffer, length, true);
+}
+
+unsigned int serial_source_session
+  (
+    int   source        // Input to look at
+  )
+{
+  if ( source < SOURCE_TCPIP(0) )
+  {
+    return 0;
+  }
+
+  return tcpip_session[source - SOURCE_TCPIP(0)];
+}
+
+/*******************************************************************************
+ * 
+ * @function: serial_reply
+ * 
+ * @brief:    Send something back to one input only
+ * 
+ * @return:   None
+ * 
+ *******************************************************************************
+ *
+ * Used to answer a command on the link it came in on.  A TCPIP 
+ * reply goes into the client's own queue, which the server sends
+ * ahead of the output for everybody.
+ * 
+ *******************************************************************************-*/
+void serial_reply
+  (
+    int           source,   // Input to answer
+    char*         str,      // Bytes to send
+    unsigned int  length    // Number of bytes
+  )
+{
+  int client;
+
+  if ( source == SOURCE_CONSOLE )
+  {
+    serial_write_all(str, length, CONSOLE);
+    return;
+  }
+  if ( source == SOURCE_AUX )
+  {
+    serial_write_all(str, length, AUX);
+    return;
+  }
+
+  client = source - SOURCE_TCPIP(0);
+  if ( serial_ring_put(&tcpip_reply[client], str, length) != length )
+  {
+    DLT(DLT_CRITICAL, printf("TCPIP reply queue overrun");)
+  }
+  tcpip_server_wake();
+
+  return;
 }
 
 /*******************************************************************************
@@ -298,7 +755,7 @@ char serial_getch
  */
   if ( console )
   {
-    printf("%c", ch);
+    serial_console_write(&ch, 1);
   }
 
   if ( aux )
@@ -337,12 +794,40 @@ void serial_to_all
     length++;
   }
 
+  serial_write_all(str, length, console, aux, tcpip);
+
+  return;
+}
+
+/*******************************************************************************
+ * 
+ * @function: serial_write_all
+ * 
+ * @brief:    Send a block of known length to the available serial ports
+ * 
+ * @return:   None
+ * 
+ *******************************************************************************
+ *
+ * Used when the caller already knows how long the message is, for
+ * example a score built with json_writer.
+ * 
+ ******************************************************************************/
+void serial_write_all
+(
+  char*         str,                // Bytes to output
+  unsigned int  length,             // Number of bytes
+  bool          console,            // Output to the console
+  bool          aux,                // Output to the aux port
+  bool          tcpip               // Output to the TCPIP socket
+)
+{
 /*
  * Output to the devices
  */
   if ( console )
   {
-    printf("%s", str);
+    serial_console_write(str, length);
   }
   
   if ( aux )
@@ -359,7 +844,229 @@ void serial_to_all
  * All done
  */
   set_status_LED(LED_TX);
-  timer_new(&LED_timer, ONE_SECOND);
+  timer_arm(&rxtx_led, RXTX_LED_TIME, 0);
+
+  return;
+}
+
+/*******************************************************************************
+ * 
+ * @function: serial_set_format
+ *            serial_write_score
+ * 
+ * @brief:    Send scores as JSON or as binary frames on each link
+ * 
+ * @return:   None
+ * 
+ *******************************************************************************
+ *
+ * The format is chosen by a client with {"SCORE_FORMAT":n} and applies
+ * to the link the command came in on.  Each TCPIP client has its own
+ * format, and a new connection starts with JSON.
+ * 
+ * serial_write_score() is given the same score both ways and sends each
+ * link the one it asked for.  The TCPIP queue holds both, and each
+ * client is given its own form as it is taken off the queue.
+ * 
+ ******************************************************************************/
+void serial_set_format
+(
+  int   source,                     // Input the request came from
+  int   format                      // SCORE_JSON or SCORE_BINARY
+)
+{
+  if ( source == SOURCE_CONSOLE )
+  {
+    binary_console = (format == SCORE_BINARY);
+  }
+  else if ( source == SOURCE_AUX )
+  {
+    binary_aux = (format == SCORE_BINARY);
+  }
+  else if ( (source >= SOURCE_TCPIP(0)) && (source < SOURCE_TCPIP(TCPIP_MAX_CLIENTS)) )
+  {
+    portENTER_CRITICAL(&out_lock);
+    tcpip_ring_form(&out_ring, source - SOURCE_TCPIP(0), format == SCORE_BINARY);
+    portEXIT_CRITICAL(&out_lock);
+  }
+
+  return;
+}
+
+void serial_write_score
+(
+  char*         json,               // Score as JSON
+  unsigned int  json_length,        // Number of bytes
+  char*         frame,              // Score as a binary frame
+  unsigned int  frame_length,       // Number of bytes
+  bool          console,            // Output to the console
+  bool          aux,                // Output to the aux port
+  bool          tcpip               // Output to the TCPIP socket
+)
+{
+  unsigned int bytes_moved;         // Number of bytes queued for TCPIP
+
+  if ( frame_length == 0 )          // Could not be framed
+  {
+    serial_write_all(json, json_length, console, aux, tcpip);
+    return;
+  }
+
+  if ( (console && !binary_console) || (aux && !binary_aux) )
+  {
+    serial_write_all(json, json_length, console && !binary_console, aux && !binary_aux, false);
+  }
+
+  if ( console && binary_console )
+  {
+    console_write_binary(frame, frame_length);
+  }
+  if ( aux && binary_aux )
+  {
+    serial_write_all(frame, frame_length, false, true, false);
+  }
+
+  if ( tcpip )
+  {
+    portENTER_CRITICAL(&out_lock);
+    bytes_moved = tcpip_ring_put_pair(&out_ring, json, json_length, frame, frame_length);
+    portEXIT_CRITICAL(&out_lock);
+    if ( bytes_moved != 0 )
+    {
+      tcpip_server_wake();
+    }
+    else
+    {
+      DLT(DLT_CRITICAL, printf("TCPIP output queue overflow, score lost");)
+    }
+  }
+
+  return;
+}
+
+/*******************************************************************************
+ * 
+ * @function: serial_console_write
+ *            serial_console_flush
+ * 
+ * @brief:    Send a block to the console UART
+ * 
+ * @return:   None
+ * 
+ *******************************************************************************
+ *
+ * Anything waiting in stdout goes first so that the output stays
+ * in order, then the block is given to the driver in one call.
+ * The driver copies it into the TX ring and the UART interrupt
+ * sends it, so the CPU does not wait for the line.
+ * 
+ * serial_console_flush() empties stdout.  It is called at the end
+ * of every DLT() and from the 10 ms band so that plain printf()s
+ * are never held up for long.
+ * 
+ ******************************************************************************/
+void serial_console_write
+(
+  const char*   str,                // Bytes to output
+  unsigned int  length              // Number of bytes
+)
+{
+  if ( console_out == NULL )        // Not set up yet
+  {
+    fwrite(str, 1, length, stdout);
+    return;
+  }
+
+  flockfile(console_out);           // Nobody else gets in between
+  fflush(console_out);
+  console_write(str, length);
+  funlockfile(console_out);
+
+  return;
+}
+
+void serial_console_flush(void)
+{
+  fflush(stdout);
+
+  return;
+}
+
+/*******************************************************************************
+ * 
+ * @function: console_cookie_write
+ *            console_write
+ * 
+ * @brief:    Move a block of console output to the driver
+ * 
+ * @return:   Number of bytes taken
+ * 
+ *******************************************************************************
+ *
+ * stdout used to go through the VFS, which turned each \n into
+ * \r\n and wrote one character at a time.  A \n that does not
+ * already follow a \r still has one added, so the terminal sees
+ * the same thing, but everything else goes to the driver in one
+ * uart_write_bytes().
+ * 
+ ******************************************************************************/
+static ssize_t console_cookie_write
+(
+  void*       cookie,               // Not used
+  const char* buffer,               // Bytes from stdout
+  size_t      length                // Number of bytes
+)
+{
+  console_write(buffer, length);
+
+  return length;
+}
+
+static void console_write
+(
+  const char*   str,                // Bytes to output
+  unsigned int  length              // Number of bytes
+)
+{
+  unsigned int i;
+  unsigned int start;
+
+  start = 0;
+  for (i=0; i != length; i++)
+  {
+    if ( (str[i] == '\n') && (console_last != '\r') )
+    {
+      uart_write_bytes(uart_console, &str[start], i - start);
+      uart_write_bytes(uart_console, "\r", 1);
+      start = i;                    // The \n goes with the next block
+    }
+    console_last = str[i];
+  }
+  uart_write_bytes(uart_console, &str[start], length - start);
+
+  return;
+}
+
+/*
+ * A binary frame must go out exactly as it is, without the \r
+ */
+static void console_write_binary
+(
+  const char*   str,                // Bytes to output
+  unsigned int  length              // Number of bytes
+)
+{
+  if ( console_out != NULL )
+  {
+    flockfile(console_out);         // Nobody else gets in between
+    fflush(console_out);
+  }
+  uart_write_bytes(uart_console, str, length);
+  console_last = 0;
+  if ( console_out != NULL )
+  {
+    funlockfile(console_out);
+  }
 
   return;
 }
@@ -370,30 +1077,44 @@ void serial_to_all
  * 
  * @brief:    Put something into the output queue for later transmission
  * 
- * @return:   Buffer updated
+ * @return:   Number of bytes queued, 0 if the message was too big
  * 
  *******************************************************************************
  *
  * This function is called by the application to save data into the
- * TCPIP queue for later output onto the TCPIP channel
+ * TCPIP queue for later output onto the TCPIP channel.  The message 
+ * is copied in once and sent to each client as fast as it will take
+ * it.  A client that falls a whole queue behind is dropped by the
+ * server instead of holding up everybody else.
  * 
  ******************************************************************************/
 int tcpip_app_2_queue
 (
-  char* buffer,         // Where to return the bytes
-  int   length          // Maximum transfer size
+  char* buffer,         // Bytes to send
+  int   length          // Number of bytes
 )
 {
   int bytes_moved;      // Number of bytes written
 
-  bytes_moved = 0;
-  while ( length != 0 )
+  if ( length <= 0 )
   {
-    out_buffer.queue[out_buffer.in] = *buffer;
-    buffer++;
-    length--;
-    bytes_moved++;
-    out_buffer.in = (out_buffer.in+1) % sizeof(out_buffer.queue);
+    return 0;
+  }
+
+  portENTER_CRITICAL(&out_lock);
+  bytes_moved = tcpip_ring_put(&out_ring, buffer, length);
+  portEXIT_CRITICAL(&out_lock);
+
+/*
+ *  Let the server know there is something to send
+ */
+  if ( bytes_moved != 0 )
+  {
+    tcpip_server_wake();
+  }
+  else
+  {
+    DLT(DLT_CRITICAL, printf("TCPIP output queue overflow, %d bytes lost", length);)
   }
 
 /*
@@ -405,51 +1126,121 @@ int tcpip_app_2_queue
 /*******************************************************************************
  * 
  * @function: tcpip_queue_2_socket
+ *            tcpip_queue_sent
  * 
- * @brief:    Take waiting bytes out of the queue and into the socket
+ * @brief:    Copy the bytes waiting for one client, then take them
  * 
- * @return:   Buffer updated
+ * @return:   Number of bytes copied
  * 
  *******************************************************************************
  *
- * This function is the companion to tcpip_app_t_queue that finished sending
- * the data out to the socket
+ * This function is the companion to tcpip_app_2_queue.  The bytes stay
+ * in the queue until tcpip_queue_sent() says how many the socket took,
+ * so nothing is lost if the client can only take part of them.
  * 
  ******************************************************************************/
 int tcpip_queue_2_socket
 (
+  int   client,         // Client number
   char* buffer,         // Place to put data
-  int   length          // Number of bytes to read
+  int   length          // Most bytes to copy
 )
 {
-  int bytes_moved;       // Number of bytes read from queue
- 
-  if ( out_buffer.out == out_buffer.in )
+  int bytes_moved;       // Number of bytes copied from the queue
+
+  bytes_moved = serial_ring_peek(&tcpip_reply[client], buffer, length);
+  tcpip_replying[client] = (bytes_moved != 0);
+  if ( bytes_moved != 0 )
   {
-    return 0;            // Nothing to say
+    return bytes_moved;    // Answers go first
   }
 
-  bytes_moved = 0;
- 
-  while ( length != 0 )
-  {
-    *buffer = out_buffer.queue[out_buffer.out];
-    buffer++;
-    length--;
-    bytes_moved++;
-    out_buffer.out = (out_buffer.out+1) % sizeof(out_buffer.queue);
-    if ( out_buffer.out == out_buffer.in )
-    {
-      break;          // RUn out of things to read
-    }
-  }
+  portENTER_CRITICAL(&out_lock);
+  bytes_moved = tcpip_ring_peek(&out_ring, client, buffer, length);
+  portEXIT_CRITICAL(&out_lock);
 
-/*
- *  All done, return the number of bytes written to the queue
- */
   return bytes_moved;
 }
 
+void tcpip_queue_sent
+(
+  int   client,         // Client number
+  int   length          // Bytes the socket took
+)
+{
+  if ( tcpip_replying[client] )
+  {
+    serial_ring_skip(&tcpip_reply[client], length);
+    return;
+  }
+
+  portENTER_CRITICAL(&out_lock);
+  tcpip_ring_advance(&out_ring, client, length);
+  portEXIT_CRITICAL(&out_lock);
+
+  return;
+}
+
+/*******************************************************************************
+ * 
+ * @function: tcpip_queue_open
+ *            tcpip_queue_close
+ *            tcpip_queue_overrun
+ *            tcpip_queue_overflow
+ * 
+ * @brief:    Look after the clients of the output queue
+ * 
+ * @return:   TRUE if the client fell too far behind, or bytes lost
+ * 
+ *******************************************************************************
+ *
+ * A client opened on the queue gets everything queued from then on,
+ * and starts with empty input and reply queues.
+ * 
+ ******************************************************************************/
+void tcpip_queue_open
+(
+  int   client          // Client number
+)
+{
+  portENTER_CRITICAL(&out_lock);
+  tcpip_ring_open(&out_ring, client);
+  portEXIT_CRITICAL(&out_lock);
+
+  portENTER_CRITICAL(&ring_lock);
+  serial_ring_flush(&tcpip_ring[client]);
+  portEXIT_CRITICAL(&ring_lock);
+  serial_ring_flush(&tcpip_reply[client]);
+  tcpip_replying[client] = false;
+  tcpip_session[client]++;
+
+  return;
+}
+
+void tcpip_queue_close
+(
+  int   client          // Client number
+)
+{
+  portENTER_CRITICAL(&out_lock);
+  tcpip_ring_close(&out_ring, client);
+  portEXIT_CRITICAL(&out_lock);
+
+  return;
+}
+
+bool tcpip_queue_overrun
+(
+  int   client          // Client number
+)
+{
+  return tcpip_ring_overrun(&out_ring, client);
+}
+
+unsigned int tcpip_queue_overflow(void)
+{
+  return out_ring.overflow;
+}
 
 /*******************************************************************************
  * 
@@ -470,29 +1261,7 @@ int tcpip_queue_2_app
   int   length          // Maximum transfer size
 )
 {
-  int bytes_moved;
-
-  bytes_moved = 0;
-  if ( in_buffer.out == in_buffer.in )
-  {
-    return 0;              // Nothing waiting for us
-  }
-
-  while ( length )
-  {
-    *buffer = in_buffer.queue[in_buffer.out];
-    buffer++;
-    length--;
-    bytes_moved++;
-    in_buffer.out = (in_buffer.out+1) % sizeof(in_buffer.queue);
-    if ( in_buffer.out == in_buffer.in )
-    {
-      break;              // Reached the end
-    }
-  }
-
-  return bytes_moved;
-
+  return tcpip_read(buffer, length, false);
 }
 
 /*******************************************************************************
@@ -505,30 +1274,28 @@ int tcpip_queue_2_app
  * 
  *******************************************************************************
  *
- * The input from the TCPIP socket is buffered in the input queue.
+ * The input from each TCPIP socket is buffered in its own input queue
+ * so that two clients typing at once do not mix up their commands.
  * 
  ******************************************************************************/
 int tcpip_socket_2_queue
 (
+  int   client,         // Client the bytes came from
   char* buffer,         // String of bytes from the TCPIP input queue
   int   length          // Maximum transfer size
 )
 {
   int bytes_moved;
 
-  bytes_moved = 0;
-  while ( length )
+  bytes_moved = serial_ring_put(&tcpip_ring[client], buffer, length);
+  if ( bytes_moved != length )
   {
-    in_buffer.queue[in_buffer.in] = *buffer;
-    buffer++;
-    length--;
-    bytes_moved++;
-    in_buffer.in = (in_buffer.in+1) % sizeof(in_buffer.queue);
-    if ( in_buffer.out == in_buffer.in )
-    {
-      DLT(DLT_CRITICAL, printf("TCPIP input queue overrun\r\n");)   // Reached the end
-      break;
-    }
+    DLT(DLT_CRITICAL, printf("TCPIP input queue overrun\r\n");)   // Reached the end
+  }
+
+  if ( (bytes_moved != 0) && (serial_events != NULL) )
+  {
+    xEventGroupSetBits(serial_events, SERIAL_TCPIP_BIT);  // Wake the reader
   }
 
   return bytes_moved;
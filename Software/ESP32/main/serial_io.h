@@ -8,19 +8,37 @@
 #ifndef _SERIAL_IO_H_
 #define _SERIAL_IO_H_
 
+#include "tcpip_server.h"
+
 /*
  * Global functions
  */
 void serial_io_init(void);                                        // Initialize the Serial ports
 void serial_to_all(char* s, bool console, bool aux, bool tcpip);  // Multipurpose driver
+void serial_write_all(char* s, unsigned int length, bool console, bool aux, bool tcpip); // Multipurpose driver, length known
 void serial_putch(char ch, bool console, bool aux, bool tcpip);   // Output a single character
+void serial_console_write(const char* s, unsigned int length);    // Send a block to the console UART
+void serial_console_flush(void);                                  // Send anything left in stdout
 char serial_gets(bool console, bool aux, bool tcpip);             // Read from all of the ports
 char serial_getch(bool console, bool aux, bool tcpip);            // Read the selected port
+int serial_read(bool console, bool aux, bool tcpip, char* buffer, int length);  // Read a block from one port
+int serial_frame(bool console, bool aux, bool tcpip, char* buffer, int length); // Read up to the end of the next {...}
+int serial_source_frame(int source, char* buffer, int length);    // Read the next {...} from one input
+unsigned int serial_source_session(int source);                   // Changes when a new client takes over the input
+void serial_reply(int source, char* s, unsigned int length);      // Send to one input only
+void serial_set_format(int source, int format);                  // Choose JSON or binary scores for a link
+void serial_write_score(char* json, unsigned int json_length, char* frame, unsigned int frame_length, bool console, bool aux, bool tcpip); // Send a score in each link's format
 int serial_available(bool console, bool aux, bool tcpip);         // Find out how much is waiting for us
 void serial_flush(bool console, bool aux, bool tcpip);            // Get rid of everything
+void serial_wait(int ticks);                                      // Sleep until input arrives on any port
 int tcpip_app_2_queue(char* buffer, int length);                  // Save for later output to the socket  
-int tcpip_queue_2_socket(char* buffer, int length);               // Take from queue and put to socket
-int tcpip_socket_2_queue(char* buffer, int length);               // Take from socket and queue
+int tcpip_queue_2_socket(int client, char* buffer, int length);   // Copy what is waiting for one client
+void tcpip_queue_sent(int client, int length);                    // The client has taken length bytes
+void tcpip_queue_open(int client);                                // Start sending to a client
+void tcpip_queue_close(int client);                               // Stop sending to a client
+bool tcpip_queue_overrun(int client);                             // TRUE if the client fell too far behind
+unsigned int tcpip_queue_overflow(void);                          // Bytes too big to queue
+int tcpip_socket_2_queue(int client, char* buffer, int length);   // Take from socket and queue
 int tcpip_queue_2_app(char* buffer, int length);                  // Take from queue and return to application
 void serial_port_test(void);                                      // Loopback the AUX port
 
@@ -33,4 +51,18 @@ void serial_port_test(void);                                      // Loopback th
 #define TCPIP    false,  false,  true
 #define ALL      true,   true,   true
 
+/*
+ *  Inputs, each with its own parser and reply
+ */
+#define SOURCE_CONSOLE   0
+#define SOURCE_AUX       1
+#define SOURCE_TCPIP(n)  (2 + (n))
+#define SERIAL_SOURCES   SOURCE_TCPIP(TCPIP_MAX_CLIENTS)
+
+/*
+ *  Score formats
+ */
+#define SCORE_JSON       0
+#define SCORE_BINARY     1
+
 #endif
@@ -0,0 +1,333 @@
+/*----------------------------------------------------------------
+ *
+ * serial_ring.c
+ *
+ * Single producer / single consumer byte ring for serial input
+ *
+ *----------------------------------------------------------------
+ *
+ * Each input port has one of these.  The reader task for the
+ * port moves whole chunks from the driver into the ring, and the
+ * application takes them out again without calling the driver.
+ *
+ * in and out count every byte ever written and read, and wrap
+ * naturally, so in - out is always the number of bytes waiting.
+ * As in shot_queue.c the producer only writes in and the consumer
+ * only writes out, and a memory barrier makes sure the bytes are
+ * in place before the index that hands them over.
+ *
+ * serial_ring_frame() hands over the input a {...} frame at a
+ * time.  Bytes outside of a frame (ie * for an echo) go straight
+ * through, and an unfinished frame is held back until its } has
+ * arrived, unless it is too big for the caller or the ring.  The
+ * scan position is kept so that each byte is only looked at once.
+ *
+ *---------------------------------------------------------------*/
+#include "stdio.h"
+#include "string.h"
+
+#include "serial_ring.h"
+
+static void ring_copy(serial_ring_t* r, char* data, unsigned int length);
+static void ring_release(serial_ring_t* r, unsigned int length);
+
+/*----------------------------------------------------------------
+ *
+ * @function: serial_ring_init
+ *
+ * @brief:    Empty the ring and reset the counters
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+void serial_ring_init
+(
+  serial_ring_t* r                      // Ring to be initialized
+)
+{
+  r->in       = 0;
+  r->out      = 0;
+  r->overflow = 0;
+  r->scan     = 0;
+  r->open     = 0;
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: serial_ring_put
+ *            serial_ring_space
+ *
+ * @brief:    Producer side of the ring
+ *
+ * @return:   Bytes added, or room left
+ *
+ *----------------------------------------------------------------
+ *
+ * Bytes that do not fit are dropped and counted in overflow.
+ *
+ *--------------------------------------------------------------*/
+unsigned int serial_ring_put
+(
+  serial_ring_t* r,                     // Ring to write into
+  const char*    data,                  // Bytes to add
+  unsigned int   length                 // Number of bytes
+)
+{
+  unsigned int space;
+  unsigned int first;
+  unsigned int at;
+
+  space = serial_ring_space(r);
+  if ( length > space )
+  {
+    r->overflow += length - space;
+    length = space;
+  }
+
+  at = r->in & SERIAL_RING_MASK;
+  first = SERIAL_RING_SIZE - at;        // Room before the end
+  if ( first > length )
+  {
+    first = length;
+  }
+  memcpy(&r->buffer[at], data, first);
+  memcpy(&r->buffer[0], data + first, length - first);
+
+  __sync_synchronize();                 // Bytes are in place
+  r->in += length;                      // before they are handed over
+
+  return length;
+}
+
+unsigned int serial_ring_space
+(
+  serial_ring_t* r                      // Ring to look at
+)
+{
+  return SERIAL_RING_SIZE - (r->in - r->out);
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: serial_ring_get
+ *            serial_ring_peek
+ *            serial_ring_skip
+ *
+ * @brief:    Take bytes out of the ring
+ *
+ * @return:   Number of bytes copied
+ *
+ *----------------------------------------------------------------
+ *
+ * serial_ring_peek() leaves the bytes in the ring until
+ * serial_ring_skip() is called, for a reader that may only be
+ * able to pass on some of them.
+ *
+ *--------------------------------------------------------------*/
+unsigned int serial_ring_get
+(
+  serial_ring_t* r,                     // Ring to read from
+  char*          data,                  // Where to put the bytes
+  unsigned int   length                 // Most to take
+)
+{
+  length = serial_ring_peek(r, data, length);
+  serial_ring_skip(r, length);
+
+  return length;
+}
+
+unsigned int serial_ring_peek
+(
+  serial_ring_t* r,                     // Ring to read from
+  char*          data,                  // Where to put the bytes
+  unsigned int   length                 // Most to copy
+)
+{
+  unsigned int count;
+
+  count = serial_ring_count(r);
+  if ( length > count )
+  {
+    length = count;
+  }
+  ring_copy(r, data, length);
+
+  return length;
+}
+
+void serial_ring_skip
+(
+  serial_ring_t* r,                     // Ring to read from
+  unsigned int   length                 // Bytes to take
+)
+{
+  unsigned int count;
+
+  count = serial_ring_count(r);
+  if ( length > count )
+  {
+    length = count;
+  }
+  ring_release(r, length);
+
+  if ( r->scan > length )               // Keep the frame scan in step
+  {
+    r->scan -= length;
+  }
+  else
+  {
+    r->scan = 0;                        // Start looking again
+    r->open = 0;
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: serial_ring_frame
+ *
+ * @brief:    Take bytes up to the end of the next {...}
+ *
+ * @return:   Number of bytes copied, 0 if a frame is not complete
+ *
+ *----------------------------------------------------------------
+ *
+ * At most one frame is returned, with anything that came before
+ * it.  If the frame is longer than size, or fills the ring, it is
+ * handed over in pieces.
+ *
+ *--------------------------------------------------------------*/
+unsigned int serial_ring_frame
+(
+  serial_ring_t* r,                     // Ring to read from
+  char*          data,                  // Where to put the bytes
+  unsigned int   size                   // Room in data
+)
+{
+  unsigned int count;
+  unsigned int ready;                   // Bytes that can go
+  char         ch;
+
+  count = serial_ring_count(r);
+  ready = r->open ? 0 : r->scan;
+
+  while ( r->scan < count )
+  {
+    ch = r->buffer[(r->out + r->scan) & SERIAL_RING_MASK];
+    r->scan++;
+
+    if ( ch == '{' )                    // Start of a frame
+    {
+      r->open = 1;
+    }
+    else if ( ch == '}' )               // End of a frame
+    {
+      r->open = 0;
+      ready = r->scan;
+      break;
+    }
+    else if ( r->open == 0 )            // Outside of a frame
+    {
+      ready = r->scan;
+    }
+  }
+
+  if ( (ready == 0)
+      && ((r->scan >= size) || (count == SERIAL_RING_SIZE)) )  // Frame will never fit
+  {
+    ready = r->scan;
+  }
+  if ( ready > size )
+  {
+    ready = size;
+  }
+
+  ring_copy(r, data, ready);
+  ring_release(r, ready);
+  r->scan -= ready;
+
+  return ready;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: serial_ring_count
+ *            serial_ring_flush
+ *
+ * @brief:    Consumer side housekeeping
+ *
+ * @return:   Bytes waiting
+ *
+ *--------------------------------------------------------------*/
+unsigned int serial_ring_count
+(
+  serial_ring_t* r                      // Ring to look at
+)
+{
+  unsigned int count;
+
+  count = r->in - r->out;
+  __sync_synchronize();                 // See the bytes that go with in
+
+  return count;
+}
+
+void serial_ring_flush
+(
+  serial_ring_t* r                      // Ring to be emptied
+)
+{
+  r->out  = r->in;
+  r->scan = 0;
+  r->open = 0;
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: ring_copy
+ *            ring_release
+ *
+ * @brief:    Copy bytes out, then hand the space back
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+static void ring_copy
+(
+  serial_ring_t* r,
+  char*          data,
+  unsigned int   length
+)
+{
+  unsigned int first;
+  unsigned int at;
+
+  at = r->out & SERIAL_RING_MASK;
+  first = SERIAL_RING_SIZE - at;
+  if ( first > length )
+  {
+    first = length;
+  }
+  memcpy(data, &r->buffer[at], first);
+  memcpy(data + first, &r->buffer[0], length - first);
+
+  return;
+}
+
+static void ring_release
+(
+  serial_ring_t* r,
+  unsigned int   length
+)
+{
+  __sync_synchronize();                 // Bytes are copied
+  r->out += length;                     // before the space is handed back
+
+  return;
+}
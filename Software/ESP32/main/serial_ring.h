@@ -0,0 +1,40 @@
+/*----------------------------------------------------------------
+ *
+ * serial_ring.h
+ *
+ * Single producer / single consumer byte ring for serial input
+ *
+ *---------------------------------------------------------------*/
+#ifndef _SERIAL_RING_H_
+#define _SERIAL_RING_H_
+
+#define SERIAL_RING_SIZE  1024                // Must be a power of 2
+#define SERIAL_RING_MASK  (SERIAL_RING_SIZE - 1)
+
+/*
+ * Typedefs
+ */
+typedef struct serial_ring
+{
+  char                  buffer[SERIAL_RING_SIZE]; // Byte storage
+  volatile unsigned int in;                   // Bytes ever written (producer only)
+  volatile unsigned int out;                  // Bytes ever read (consumer only)
+  volatile unsigned int overflow;             // Bytes dropped because the ring was full
+  unsigned int          scan;                 // Bytes after out looked at by serial_ring_frame() (consumer only)
+  unsigned int          open;                 // TRUE if the scan is inside a {...} (consumer only)
+} serial_ring_t;
+
+/*
+ * Global functions
+ */
+void         serial_ring_init(serial_ring_t* r);                                   // Empty the ring and reset the counters
+unsigned int serial_ring_put(serial_ring_t* r, const char* data, unsigned int length); // Producer: Add bytes
+unsigned int serial_ring_space(serial_ring_t* r);                                  // Producer: Room left
+unsigned int serial_ring_get(serial_ring_t* r, char* data, unsigned int length);   // Consumer: Take bytes
+unsigned int serial_ring_peek(serial_ring_t* r, char* data, unsigned int length);  // Consumer: Copy bytes without taking them
+void         serial_ring_skip(serial_ring_t* r, unsigned int length);              // Consumer: Take bytes already copied
+unsigned int serial_ring_frame(serial_ring_t* r, char* data, unsigned int size);   // Consumer: Take up to the end of the next {...}
+unsigned int serial_ring_count(serial_ring_t* r);                                  // Consumer: Bytes waiting
+void         serial_ring_flush(serial_ring_t* r);                                  // Consumer: Throw away everything waiting
+
+#endif
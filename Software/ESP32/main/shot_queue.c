@@ -0,0 +1,227 @@
+/*----------------------------------------------------------------
+ *
+ * shot_queue.c
+ *
+ * Single producer / single consumer shot queue
+ *
+ *----------------------------------------------------------------
+ *
+ * The shots are written by aquire() at interrupt level and read
+ * by reduce() in the target task.
+ *
+ * The producer only ever writes in, and the consumer only ever
+ * writes out, so no lock is needed.  A memory barrier makes sure
+ * that the contents of a record are visible before the index that
+ * hands it over.
+ *
+ * One record is always left empty so that a full queue can be told
+ * apart from an empty one.  If the queue is full the new shot is
+ * dropped and counted in overflow.
+ *
+ * Every shot that arrives is given a sequence number, including
+ * the ones that are dropped, so a gap in the sequence shows that
+ * a shot was lost.  shot_queue_flush() also leaves a gap, so the
+ * target reports losses with shot_queue_lost() instead.
+ *
+ *---------------------------------------------------------------*/
+#include "stdio.h"
+#include "esp_attr.h"
+
+#include "freETarget.h"
+#include "shot_queue.h"
+
+#define NEXT(x) (((x) + 1) % SHOT_STRING)
+
+/*----------------------------------------------------------------
+ *
+ * @function: shot_queue_init
+ *
+ * @brief:    Empty the queue and reset the counters
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+void shot_queue_init
+(
+  shot_queue_t* q                   // Queue to be initialized
+)
+{
+  q->in       = 0;
+  q->out      = 0;
+  q->overflow = 0;
+  q->sequence = 0;
+  q->reported = 0;
+  __sync_synchronize();
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: shot_queue_claim
+ *            shot_queue_publish
+ *
+ * @brief:    Producer side of the queue
+ *
+ * @return:   Record to fill in, or NULL if the queue is full
+ *
+ *----------------------------------------------------------------
+ *
+ * The claimed record does not belong to the consumer until
+ * shot_queue_publish() is called.
+ *
+ *--------------------------------------------------------------*/
+shot_record_t* IRAM_ATTR shot_queue_claim
+(
+  shot_queue_t* q                   // Queue to write into
+)
+{
+  shot_record_t* record;
+
+  if ( NEXT(q->in) == q->out )      // No space left
+  {
+    q->sequence++;                  // Leave a gap in the sequence
+    q->overflow++;
+    return NULL;
+  }
+
+  record = &q->record[q->in];
+  record->sequence = q->sequence++;
+  return record;
+}
+
+void IRAM_ATTR shot_queue_publish
+(
+  shot_queue_t* q                   // Queue written into
+)
+{
+  __sync_synchronize();             // Record is complete
+  q->in = NEXT(q->in);              // before it is handed over
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: shot_queue_peek
+ *            shot_queue_release
+ *
+ * @brief:    Consumer side of the queue
+ *
+ * @return:   Oldest record waiting, or NULL if the queue is empty
+ *
+ *----------------------------------------------------------------
+ *
+ * The record returned by shot_queue_peek() stays in place until
+ * shot_queue_release() is called.
+ *
+ *--------------------------------------------------------------*/
+shot_record_t* shot_queue_peek
+(
+  shot_queue_t* q                   // Queue to read from
+)
+{
+  if ( q->in == q->out )
+  {
+    return NULL;                    // Nothing waiting
+  }
+
+  __sync_synchronize();             // Read the index before the record
+  return &q->record[q->out];
+}
+
+void shot_queue_release
+(
+  shot_queue_t* q                   // Queue read from
+)
+{
+  if ( q->in == q->out )
+  {
+    return;
+  }
+
+  __sync_synchronize();             // Finished with the record
+  q->out = NEXT(q->out);            // before it is given back
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: shot_queue_flush
+ *
+ * @brief:    Throw away everything that is waiting
+ *
+ * @return:   None
+ *
+ *----------------------------------------------------------------
+ *
+ * Only the consumer moves out, so this is safe to call while
+ * shots are still arriving.
+ *
+ *--------------------------------------------------------------*/
+void shot_queue_flush
+(
+  shot_queue_t* q                   // Queue to be emptied
+)
+{
+  __sync_synchronize();
+  q->out = q->in;
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: shot_queue_count
+ *
+ * @brief:    Number of records waiting
+ *
+ * @return:   0 to SHOT_STRING-1
+ *
+ *--------------------------------------------------------------*/
+unsigned int shot_queue_count
+(
+  shot_queue_t* q                   // Queue to look at
+)
+{
+  unsigned int in, out;
+
+  in  = q->in;
+  out = q->out;
+
+  if ( in >= out )
+  {
+    return in - out;
+  }
+
+  return in + SHOT_STRING - out;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: shot_queue_lost
+ *
+ * @brief:    Shots dropped because the queue was full
+ *
+ * @return:   Number dropped since the last call
+ *
+ *----------------------------------------------------------------
+ *
+ * Shots thrown away by shot_queue_flush() are not counted.
+ *
+ *--------------------------------------------------------------*/
+unsigned int shot_queue_lost
+(
+  shot_queue_t* q                   // Queue to look at
+)
+{
+  unsigned int overflow;
+  unsigned int lost;
+
+  overflow = q->overflow;           // Written by the producer
+  lost = overflow - q->reported;
+  q->reported = overflow;
+
+  return lost;
+}
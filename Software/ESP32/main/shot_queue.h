@@ -0,0 +1,43 @@
+/*----------------------------------------------------------------
+ *
+ * shot_queue.h
+ *
+ * Single producer / single consumer shot queue
+ *
+ *---------------------------------------------------------------*/
+#ifndef _SHOT_QUEUE_H_
+#define _SHOT_QUEUE_H_
+
+#include "freETarget.h"
+
+/*
+ * Typedefs
+ */
+typedef struct shot_queue
+{
+  shot_record_t         record[SHOT_STRING];  // Shot storage
+  volatile unsigned int in;                   // Next record to be written (producer only)
+  volatile unsigned int out;                  // Next record to be read (consumer only)
+  volatile unsigned int overflow;             // Shots dropped because the queue was full
+  unsigned int          sequence;             // Sequence number of the next shot (producer only)
+  unsigned int          reported;             // overflow already reported (consumer only)
+} shot_queue_t;
+
+/*
+ * Global functions
+ */
+void           shot_queue_init(shot_queue_t* q);      // Empty the queue and reset the counters
+shot_record_t* shot_queue_claim(shot_queue_t* q);     // Producer: Get the next free record
+void           shot_queue_publish(shot_queue_t* q);   // Producer: Make the claimed record visible
+shot_record_t* shot_queue_peek(shot_queue_t* q);      // Consumer: Oldest unread record
+void           shot_queue_release(shot_queue_t* q);   // Consumer: Finished with the oldest record
+void           shot_queue_flush(shot_queue_t* q);     // Consumer: Throw away everything waiting
+unsigned int   shot_queue_count(shot_queue_t* q);     // Number of records waiting
+unsigned int   shot_queue_lost(shot_queue_t* q);      // Consumer: Shots dropped since the last call
+
+/*
+ * Global variables
+ */
+extern shot_queue_t shot_queue;                       // Shots from aquire() to reduce()
+
+#endif
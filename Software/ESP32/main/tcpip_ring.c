@@ -0,0 +1,462 @@
+/*----------------------------------------------------------------
+ *
+ * tcpip_ring.c
+ *
+ * One writer, many reader byte ring for the TCPIP output
+ *
+ *----------------------------------------------------------------
+ *
+ * Everything sent to the TCPIP channel is written once and read
+ * by every connected client, each with its own cursor, so a
+ * client that is slow to take its data does not hold up the
+ * others.
+ *
+ * in and the cursors count every byte ever written and read and
+ * wrap naturally.  The free space is set by the reader that is
+ * furthest behind.  The writer never waits.  If a message will
+ * not fit, the readers in the way are taken off the ring and
+ * marked in overrun so that the server can drop them.  A message
+ * longer than the whole ring is thrown away and counted in
+ * overflow.
+ *
+ * Readers copy with tcpip_ring_peek() and only move their cursor
+ * with tcpip_ring_advance() once the bytes have been sent, so a
+ * partial send() loses nothing.
+ *
+ * A message can also be written two ways, such as a score as JSON
+ * and as a binary frame, with tcpip_ring_put_pair().  It is stored
+ * once as
+ *
+ *   0  first_lo  first_hi  second_lo  second_hi  first  second
+ *
+ * and each reader is given the form it picked with tcpip_ring_form()
+ * when it gets to it.  taken[] remembers how much of that form has
+ * been sent.  Text written with tcpip_ring_put() must not contain a
+ * 0 so that the two can be told apart.
+ *
+ * There is no locking here.  See serial_io.c
+ *
+ *---------------------------------------------------------------*/
+#include "stdio.h"
+#include "string.h"
+
+#include "tcpip_ring.h"
+
+#define READER_BIT(reader)  (1u << (reader))
+
+/*----------------------------------------------------------------
+ *
+ * @function: tcpip_ring_init
+ *
+ * @brief:    Empty the ring and forget the readers
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+void tcpip_ring_init
+(
+  tcpip_ring_t* r                       // Ring to be initialized
+)
+{
+  memset(r, 0, sizeof(tcpip_ring_t));
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: make_room
+ *            copy_in
+ *            tcpip_ring_put
+ *            tcpip_ring_put_pair
+ *
+ * @brief:    Add a message for every reader
+ *
+ * @return:   Bytes added, 0 if the message was thrown away
+ *
+ *--------------------------------------------------------------*/
+static int make_room
+(
+  tcpip_ring_t* r,                      // Ring to write into
+  unsigned int  length                  // Number of bytes to be added
+)
+{
+  int reader;
+
+  if ( length > TCPIP_RING_SIZE )
+  {
+    r->overflow += length;
+    return 0;
+  }
+
+/*
+ * Leave behind anybody who is too slow
+ */
+  for (reader=0; reader != TCPIP_RING_READERS; reader++)
+  {
+    if ( (r->active & READER_BIT(reader))
+        && ((r->in - r->cursor[reader]) + length > TCPIP_RING_SIZE) )
+    {
+      r->active  &= ~READER_BIT(reader);
+      r->overrun |= READER_BIT(reader);
+      r->dropped++;
+    }
+  }
+
+  return 1;
+}
+
+static void copy_in
+(
+  tcpip_ring_t* r,                      // Ring to write into
+  const char*   data,                   // Bytes to add
+  unsigned int  length                  // Number of bytes
+)
+{
+  unsigned int first;
+  unsigned int at;
+
+  at = r->in & TCPIP_RING_MASK;
+  first = TCPIP_RING_SIZE - at;         // Room before the end
+  if ( first > length )
+  {
+    first = length;
+  }
+  memcpy(&r->buffer[at], data, first);
+  memcpy(&r->buffer[0], data + first, length - first);
+  r->in += length;
+
+  return;
+}
+
+unsigned int tcpip_ring_put
+(
+  tcpip_ring_t* r,                      // Ring to write into
+  const char*   data,                   // Bytes to add
+  unsigned int  length                  // Number of bytes
+)
+{
+  if ( make_room(r, length) == 0 )
+  {
+    return 0;
+  }
+  copy_in(r, data, length);
+
+  return length;
+}
+
+unsigned int tcpip_ring_put_pair
+(
+  tcpip_ring_t* r,                      // Ring to write into
+  const char*   first,                  // Message as read by most readers
+  unsigned int  first_length,           // Number of bytes
+  const char*   second,                 // Same message for readers that asked for it
+  unsigned int  second_length           // Number of bytes
+)
+{
+  char         header[TCPIP_ITEM_HEADER];
+  unsigned int length;
+
+  length = TCPIP_ITEM_HEADER + first_length + second_length;
+  if ( make_room(r, length) == 0 )
+  {
+    return 0;
+  }
+
+  header[0] = TCPIP_RING_ITEM;
+  header[1] = first_length;
+  header[2] = first_length >> 8;
+  header[3] = second_length;
+  header[4] = second_length >> 8;
+  copy_in(r, header, TCPIP_ITEM_HEADER);
+  copy_in(r, first, first_length);
+  copy_in(r, second, second_length);
+
+  return length;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: tcpip_ring_open
+ *            tcpip_ring_close
+ *
+ * @brief:    Add or remove a reader
+ *
+ * @return:   None
+ *
+ *----------------------------------------------------------------
+ *
+ * A new reader starts at the end of the ring and only sees what
+ * is written from now on, and takes the first form of a pair.
+ *
+ *--------------------------------------------------------------*/
+void tcpip_ring_open
+(
+  tcpip_ring_t* r,                      // Ring to read
+  int           reader                  // Reader number
+)
+{
+  r->cursor[reader] = r->in;
+  r->taken[reader] = 0;
+  r->second &= ~READER_BIT(reader);     // Starts with the first form
+  r->wanted &= ~READER_BIT(reader);
+  r->overrun &= ~READER_BIT(reader);
+  r->active  |= READER_BIT(reader);
+
+  return;
+}
+
+void tcpip_ring_close
+(
+  tcpip_ring_t* r,                      // Ring being read
+  int           reader                  // Reader number
+)
+{
+  r->active  &= ~READER_BIT(reader);
+  r->overrun &= ~READER_BIT(reader);
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: set_form
+ *            tcpip_ring_form
+ *
+ * @brief:    Pick the form of a pair the reader takes
+ *
+ * @return:   None
+ *
+ *----------------------------------------------------------------
+ *
+ * A reader part way through a pair finishes it in the old form.
+ * The new form is kept in wanted and taken up by set_form() once
+ * taken[] is back to 0, here or in tcpip_ring_advance().
+ *
+ *--------------------------------------------------------------*/
+static void set_form
+(
+  tcpip_ring_t* r,                      // Ring being read
+  int           reader                  // Reader number
+)
+{
+  if ( r->taken[reader] == 0 )          // Not part way through a pair
+  {
+    r->second = (r->second & ~READER_BIT(reader)) | (r->wanted & READER_BIT(reader));
+  }
+
+  return;
+}
+
+void tcpip_ring_form
+(
+  tcpip_ring_t* r,                      // Ring being read
+  int           reader,                 // Reader number
+  int           second                  // TRUE for the second form
+)
+{
+  if ( second )
+  {
+    r->wanted |= READER_BIT(reader);
+  }
+  else
+  {
+    r->wanted &= ~READER_BIT(reader);
+  }
+  set_form(r, reader);
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: tcpip_ring_pending
+ *            tcpip_ring_overrun
+ *
+ * @brief:    Find out where a reader stands
+ *
+ * @return:   Bytes waiting, or TRUE if the reader was left behind
+ *
+ *--------------------------------------------------------------*/
+unsigned int tcpip_ring_pending
+(
+  tcpip_ring_t* r,                      // Ring to look at
+  int           reader                  // Reader number
+)
+{
+  if ( (r->active & READER_BIT(reader)) == 0 )
+  {
+    return 0;
+  }
+
+  return r->in - r->cursor[reader];
+}
+
+int tcpip_ring_overrun
+(
+  tcpip_ring_t* r,                      // Ring to look at
+  int           reader                  // Reader number
+)
+{
+  return (r->overrun & READER_BIT(reader)) != 0;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: copy_out
+ *            find_form
+ *
+ * @brief:    Copy from the ring, and find a reader's part of a pair
+ *
+ * @return:   find_form() returns TRUE if the reader is at a pair
+ *
+ *--------------------------------------------------------------*/
+static void copy_out
+(
+  tcpip_ring_t* r,                      // Ring to read
+  unsigned int  from,                   // Position in the ring
+  char*         data,                   // Where to put the bytes
+  unsigned int  length                  // Number of bytes
+)
+{
+  unsigned int first;
+  unsigned int at;
+
+  at = from & TCPIP_RING_MASK;
+  first = TCPIP_RING_SIZE - at;
+  if ( first > length )
+  {
+    first = length;
+  }
+  memcpy(data, &r->buffer[at], first);
+  memcpy(data + first, &r->buffer[0], length - first);
+
+  return;
+}
+
+static int find_form
+(
+  tcpip_ring_t* r,                      // Ring to read
+  int           reader,                 // Reader number
+  unsigned int* offset,                 // Where the reader's form starts from the cursor
+  unsigned int* length,                 // Length of the reader's form
+  unsigned int* size                    // Length of the whole pair
+)
+{
+  unsigned char header[TCPIP_ITEM_HEADER];
+  unsigned int  first_length;
+  unsigned int  second_length;
+
+  if ( (tcpip_ring_pending(r, reader) < TCPIP_ITEM_HEADER)
+      || (r->buffer[r->cursor[reader] & TCPIP_RING_MASK] != TCPIP_RING_ITEM) )
+  {
+    return 0;
+  }
+
+  copy_out(r, r->cursor[reader], (char*)header, TCPIP_ITEM_HEADER);
+  first_length  = header[1] | (header[2] << 8);
+  second_length = header[3] | (header[4] << 8);
+  *size = TCPIP_ITEM_HEADER + first_length + second_length;
+  if ( r->second & READER_BIT(reader) )
+  {
+    *offset = TCPIP_ITEM_HEADER + first_length;
+    *length = second_length;
+  }
+  else
+  {
+    *offset = TCPIP_ITEM_HEADER;
+    *length = first_length;
+  }
+
+  return 1;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: tcpip_ring_peek
+ *            tcpip_ring_advance
+ *
+ * @brief:    Copy the reader's bytes, then take them
+ *
+ * @return:   Number of bytes copied
+ *
+ *----------------------------------------------------------------
+ *
+ * A copy stops at the start of a pair, and a pair is copied on its
+ * own, so that the count given to tcpip_ring_advance() is always
+ * in one or the other.
+ *
+ *--------------------------------------------------------------*/
+unsigned int tcpip_ring_peek
+(
+  tcpip_ring_t* r,                      // Ring to read
+  int           reader,                 // Reader number
+  char*         data,                   // Where to put the bytes
+  unsigned int  length                  // Most to copy
+)
+{
+  unsigned int pending;
+  unsigned int offset, form, size;
+  char*        item;
+
+  while ( find_form(r, reader, &offset, &form, &size) && (form == 0) )
+  {
+    r->cursor[reader] += size;          // Nothing in this form, skip it
+  }
+
+  if ( find_form(r, reader, &offset, &form, &size) )
+  {
+    form -= r->taken[reader];
+    if ( length > form )
+    {
+      length = form;
+    }
+    copy_out(r, r->cursor[reader] + offset + r->taken[reader], data, length);
+    return length;
+  }
+
+  pending = tcpip_ring_pending(r, reader);
+  if ( length > pending )
+  {
+    length = pending;
+  }
+  copy_out(r, r->cursor[reader], data, length);
+
+  item = memchr(data, TCPIP_RING_ITEM, length);
+  if ( item != NULL )
+  {
+    length = item - data;               // Up to the next pair
+  }
+
+  return length;
+}
+
+void tcpip_ring_advance
+(
+  tcpip_ring_t* r,                      // Ring being read
+  int           reader,                 // Reader number
+  unsigned int  length                  // Bytes sent
+)
+{
+  unsigned int offset, form, size;
+
+  if ( find_form(r, reader, &offset, &form, &size) )
+  {
+    r->taken[reader] += length;
+    if ( r->taken[reader] >= form )     // Sent all of it
+    {
+      r->cursor[reader] += size;
+      r->taken[reader] = 0;
+      set_form(r, reader);              // Any change of form waiting
+    }
+    return;
+  }
+
+  if ( length > tcpip_ring_pending(r, reader) )
+  {
+    length = tcpip_ring_pending(r, reader);
+  }
+  r->cursor[reader] += length;
+
+  return;
+}
@@ -0,0 +1,49 @@
+/*----------------------------------------------------------------
+ *
+ * tcpip_ring.h
+ *
+ * One writer, many reader byte ring for the TCPIP output
+ *
+ *---------------------------------------------------------------*/
+#ifndef _TCPIP_RING_H_
+#define _TCPIP_RING_H_
+
+#define TCPIP_RING_SIZE     4096                // Must be a power of 2
+#define TCPIP_RING_MASK     (TCPIP_RING_SIZE - 1)
+#define TCPIP_RING_READERS  8                   // At least TCPIP_MAX_CLIENTS
+#define TCPIP_RING_ITEM     0                   // Starts a message written two ways
+#define TCPIP_ITEM_HEADER   5                   // Marker and the two lengths
+
+/*
+ * Typedefs
+ */
+typedef struct tcpip_ring
+{
+  char          buffer[TCPIP_RING_SIZE];        // Byte storage
+  unsigned int  in;                             // Bytes ever written
+  unsigned int  cursor[TCPIP_RING_READERS];     // Bytes ever read by each reader
+  unsigned int  active;                         // One bit for each reader in use
+  unsigned int  overrun;                        // One bit for each reader that fell too far behind
+  unsigned int  overflow;                       // Bytes not queued because they would never fit
+  unsigned int  dropped;                        // Readers that fell too far behind
+  unsigned int  second;                         // One bit for each reader that takes the second form
+  unsigned int  wanted;                         // Form each reader asked for, taken up between pairs
+  unsigned int  taken[TCPIP_RING_READERS];      // Bytes of the current form already taken
+} tcpip_ring_t;
+
+/*
+ * Global functions
+ */
+void         tcpip_ring_init(tcpip_ring_t* r);                                        // Empty the ring, no readers
+unsigned int tcpip_ring_put(tcpip_ring_t* r, const char* data, unsigned int length);  // Writer: Add a message
+unsigned int tcpip_ring_put_pair(tcpip_ring_t* r, const char* first, unsigned int first_length,
+                                 const char* second, unsigned int second_length);    // Writer: Add a message two ways
+void         tcpip_ring_form(tcpip_ring_t* r, int reader, int second);                // Pick the form a reader takes
+void         tcpip_ring_open(tcpip_ring_t* r, int reader);                            // Start a reader at the end
+void         tcpip_ring_close(tcpip_ring_t* r, int reader);                           // Stop a reader
+unsigned int tcpip_ring_pending(tcpip_ring_t* r, int reader);                         // Bytes the reader has not had
+unsigned int tcpip_ring_peek(tcpip_ring_t* r, int reader, char* data, unsigned int length); // Copy without taking
+void         tcpip_ring_advance(tcpip_ring_t* r, int reader, unsigned int length);    // Take bytes already copied
+int          tcpip_ring_overrun(tcpip_ring_t* r, int reader);                         // TRUE if the reader was left behind
+
+#endif
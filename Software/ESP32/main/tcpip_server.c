@@ -0,0 +1,520 @@
+/******************************************************************************
+ * 
+ * tcpip_server.c 
+ * 
+ * Single task TCP server
+ * 
+ ******************************************************************************
+ *
+ * One task looks after the listening socket and all of the client sockets
+ * using select().  Nothing is polled.
+ *
+ * Bytes from any client are put into the TCPIP input queue for the JSON task.
+ * Bytes put into the TCPIP output queue are sent to every client.
+ *
+ * Each client has its own place in the output queue and a non-blocking
+ * socket.  A client whose socket is full is left until select() says it
+ * can take more, and one that falls a whole queue behind is dropped, so a
+ * stalled PC does not hold up the scores to everybody else.
+ *
+ * select() cannot wait on the output queue, so the server also listens on a
+ * UDP socket bound to the loopback address.  tcpip_server_wake() sends one
+ * byte to it whenever something is queued for output, which wakes select()
+ * straight away.  Only one wake up is outstanding at a time.
+ *
+ * Only BSD socket calls are used so the same code runs over lwIP on the
+ * target and over the host sockets on a PC.
+ * 
+ * *****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "lwip/sockets.h"
+
+#include "freETarget.h"
+#include "serial_io.h"
+#include "diag_tools.h"
+#include "tcpip_server.h"
+
+#define KEEPALIVE_IDLE              true
+#define KEEPALIVE_INTERVAL          100
+#define KEEPALIVE_COUNT             50
+
+/*
+ * Variables
+ */
+static char greeting[] = "{\"CONNECTED\"}";
+static int  client[TCPIP_MAX_CLIENTS];      // Connected sockets, -1 if free
+static bool client_blocked[TCPIP_MAX_CLIENTS]; // TRUE if the socket was full
+static int  client_count;                   // Number of entries in use
+static int  client_dropped;                 // Clients dropped for falling behind
+static int  wake_rx = -1;                   // Loopback socket watched by select()
+static int  wake_tx = -1;                   // Loopback socket written by tcpip_server_wake()
+static struct sockaddr_in wake_addr;        // Where wake_rx is bound
+static volatile bool wake_pending;          // TRUE if a wake up is on its way
+static volatile bool stop_server;           // TRUE to leave tcpip_server()
+
+/*
+ * Private Functions
+ */
+static int  open_wake(void);                // Create the wake up sockets
+static void accept_client(int listen_sock, int max_clients); // Add a new client
+static void close_client(int i);            // Drop a client
+static void send_to_clients(void);          // Empty the output queue
+
+/*****************************************************************************
+ *
+ * @function: tcpip_server()
+ *
+ * @brief:    Serve the TCP clients
+ * 
+ * @return:   0 when stopped, -1 if the server could not be started
+ *
+ ******************************************************************************
+ *
+ * The listening socket, the wake up socket and every client are put into the
+ * read set, and the task sleeps in select() until one of them has something
+ * to say.
+ * 
+ *******************************************************************************/
+int tcpip_server
+(
+    int port,                               // Port to listen on
+    int max_clients                         // Number of clients allowed
+)
+{
+    struct sockaddr_in server_addr;
+    int    listen_sock;
+    int    option;
+    int    i, length, max_fd;
+    fd_set read_set;
+    fd_set write_set;
+    char   rx_buffer[256];
+
+    DLT(DLT_CRITICAL, printf("tcpip_server(%d, %d)", port, max_clients);)
+
+    if ( (max_clients <= 0) || (max_clients > TCPIP_MAX_CLIENTS) )
+    {
+        max_clients = TCPIP_MAX_CLIENTS;
+    }
+
+    for (i=0; i != TCPIP_MAX_CLIENTS; i++)
+    {
+        client[i] = -1;
+    }
+    client_count = 0;
+    stop_server = false;
+
+/*
+ * Start the server
+ */
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+
+    listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if ( listen_sock < 0 ) 
+    {
+        DLT(DLT_CRITICAL, printf("Unable to create socket: errno %d\r\n", errno);)
+        return -1;
+    }
+
+    option = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+    if ( (bind(listen_sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) != 0)
+        || (listen(listen_sock, max_clients) != 0) )
+    {
+        DLT(DLT_CRITICAL, printf("Unable to listen on port %d: errno %d\r\n", port, errno);)
+        close(listen_sock);
+        return -1;
+    }
+
+    if ( open_wake() != 0 )
+    {
+        close(listen_sock);
+        return -1;
+    }
+
+/*
+ * Wait for something to happen
+ */
+    while ( stop_server == false )
+    {
+        FD_ZERO(&read_set);
+        FD_ZERO(&write_set);
+        FD_SET(listen_sock, &read_set);
+        FD_SET(wake_rx, &read_set);
+        max_fd = (listen_sock > wake_rx) ? listen_sock : wake_rx;
+        for (i=0; i != TCPIP_MAX_CLIENTS; i++)
+        {
+            if ( client[i] >= 0 )
+            {
+                FD_SET(client[i], &read_set);
+                if ( client_blocked[i] )
+                {
+                    FD_SET(client[i], &write_set);  // Wait for room to send
+                }
+                if ( client[i] > max_fd )
+                {
+                    max_fd = client[i];
+                }
+            }
+        }
+
+        if ( select(max_fd + 1, &read_set, &write_set, NULL, NULL) < 0 )
+        {
+            if ( errno != EINTR )
+            {
+                DLT(DLT_CRITICAL, printf("tcpip_server select() errno %d", errno);)
+                vTaskDelay(ONE_SECOND);
+            }
+            continue;
+        }
+
+/*
+ * Output has been queued.  Clear the flag before emptying the queue so that
+ * anything queued from now on sends another wake up.
+ */
+        if ( FD_ISSET(wake_rx, &read_set) )
+        {
+            while ( recv(wake_rx, rx_buffer, sizeof(rx_buffer), MSG_DONTWAIT) > 0 )
+            {
+                continue;
+            }
+            wake_pending = false;
+        }
+
+/*
+ * Someone new
+ */
+        if ( FD_ISSET(listen_sock, &read_set) )
+        {
+            accept_client(listen_sock, max_clients);
+        }
+
+/*
+ * Input from the clients
+ */
+        for (i=0; i != TCPIP_MAX_CLIENTS; i++)
+        {
+            if ( (client[i] >= 0) && FD_ISSET(client[i], &write_set) )
+            {
+                client_blocked[i] = false;          // Room to send again
+            }
+            if ( (client[i] >= 0) && FD_ISSET(client[i], &read_set) )
+            {
+                length = recv(client[i], rx_buffer, sizeof(rx_buffer), 0);
+                if ( length > 0 )
+                {
+                    tcpip_socket_2_queue(i, rx_buffer, length);
+                }
+                else if ( (length == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)) )
+                {
+                    close_client(i);                // Closed or failed
+                }
+            }
+        }
+
+        send_to_clients();
+    }
+
+/*
+ *  Stopped, clean up
+ */
+    for (i=0; i != TCPIP_MAX_CLIENTS; i++)
+    {
+        if ( client[i] >= 0 )
+        {
+            close_client(i);
+        }
+    }
+    close(listen_sock);
+    close(wake_rx);
+    close(wake_tx);
+    wake_rx = -1;
+    wake_tx = -1;
+
+    return 0;
+}
+
+/*****************************************************************************
+ *
+ * @function: open_wake()
+ *
+ * @brief:    Create the loopback sockets used to wake up select()
+ * 
+ * @return:   0 if OK
+ *
+ ******************************************************************************/
+static int open_wake(void)
+{
+    socklen_t length;
+
+    wake_rx = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    wake_tx = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if ( (wake_rx < 0) || (wake_tx < 0) )
+    {
+        DLT(DLT_CRITICAL, printf("Unable to create wake up socket: errno %d\r\n", errno);)
+        return -1;
+    }
+
+    memset(&wake_addr, 0, sizeof(wake_addr));
+    wake_addr.sin_family = AF_INET;
+    wake_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    wake_addr.sin_port = 0;                 // Let the stack pick the port
+    length = sizeof(wake_addr);
+    if ( (bind(wake_rx, (struct sockaddr *)&wake_addr, sizeof(wake_addr)) != 0)
+        || (getsockname(wake_rx, (struct sockaddr *)&wake_addr, &length) != 0) )
+    {
+        DLT(DLT_CRITICAL, printf("Unable to bind wake up socket: errno %d\r\n", errno);)
+        return -1;
+    }
+
+    wake_pending = false;
+    return 0;
+}
+
+/*****************************************************************************
+ *
+ * @function: tcpip_server_wake()
+ *
+ * @brief:    Tell the server that there is output waiting
+ * 
+ * @return:   None
+ *
+ ******************************************************************************
+ *
+ * Called by tcpip_app_2_queue() after the bytes are in the queue.
+ * 
+ *******************************************************************************/
+void tcpip_server_wake(void)
+{
+    char ch = 0;
+
+    if ( (wake_tx < 0) || wake_pending )
+    {
+        return;                             // Not running or already on its way
+    }
+
+    wake_pending = true;
+    sendto(wake_tx, &ch, 1, MSG_DONTWAIT, (struct sockaddr *)&wake_addr, sizeof(wake_addr));
+
+    return;
+}
+
+/*****************************************************************************
+ *
+ * @function: tcpip_server_stop()
+ *
+ * @brief:    Make tcpip_server() return
+ * 
+ * @return:   None
+ *
+ ******************************************************************************/
+void tcpip_server_stop(void)
+{
+    stop_server = true;
+    wake_pending = false;
+    tcpip_server_wake();
+
+    return;
+}
+
+/*****************************************************************************
+ *
+ * @function: tcpip_server_clients()
+ *
+ * @brief:    Number of clients connected
+ * 
+ * @return:   0 to max_clients
+ *
+ ******************************************************************************/
+int tcpip_server_clients(void)
+{
+    return client_count;
+}
+
+/*****************************************************************************
+ *
+ * @function: tcpip_server_dropped()
+ *
+ * @brief:    Number of clients dropped for falling behind
+ * 
+ * @return:   Count since power up
+ *
+ ******************************************************************************/
+int tcpip_server_dropped(void)
+{
+    return client_dropped;
+}
+
+/*****************************************************************************
+ *
+ * @function: accept_client()
+ *
+ * @brief:    Take a new connection
+ * 
+ * @return:   None
+ *
+ ******************************************************************************
+ *
+ * The new socket is put into the first free slot and greeted.  If all of the
+ * slots are taken the connection is closed.
+ * 
+ *******************************************************************************/
+static void accept_client
+(
+    int listen_sock,                        // Socket with a connection waiting
+    int max_clients                         // Number of clients allowed
+)
+{
+    struct sockaddr_in source_addr;
+    socklen_t addr_len = sizeof(source_addr);
+    char addr_str[INET_ADDRSTRLEN];
+    int  keepAlive = 1;
+    int  keepIdle = KEEPALIVE_IDLE;
+    int  keepInterval = KEEPALIVE_INTERVAL;
+    int  keepCount = KEEPALIVE_COUNT;
+    int  noDelay = 1;
+    int  sock;
+    int  i;
+
+    sock = accept(listen_sock, (struct sockaddr *)&source_addr, &addr_len);
+    if ( sock < 0 )
+    {
+        return;
+    }
+
+    addr_str[0] = 0;
+    inet_ntop(AF_INET, &source_addr.sin_addr, addr_str, sizeof(addr_str));
+
+    if ( client_count >= max_clients )
+    {
+        DLT(DLT_CRITICAL, printf("Socket refused ip address: %s, %d clients connected\r\n", addr_str, client_count);)
+        close(sock);
+        return;
+    }
+
+    for (i=0; i != TCPIP_MAX_CLIENTS; i++)
+    {
+        if ( client[i] == -1 )
+        {
+            break;
+        }
+    }
+    client[i] = sock;
+    client_blocked[i] = false;
+    client_count++;
+
+/*
+ * Set tcp keepalive option
+ */
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
+
+/*
+ * Scores go out as soon as they are queued, not held back by Nagle
+ */
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(int));
+
+    send(sock, greeting, sizeof(greeting), 0);
+
+/*
+ * From now on the server never waits on this client
+ */
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    tcpip_queue_open(i);
+
+    DLT(DLT_CRITICAL, printf("Socket accepted ip address: %s\r\n", addr_str);)
+    return;
+}
+
+/*****************************************************************************
+ *
+ * @function: close_client()
+ *
+ * @brief:    Drop a client and free the slot
+ * 
+ * @return:   None
+ *
+ ******************************************************************************/
+static void close_client
+(
+    int i                                   // Slot to free
+)
+{
+    DLT(DLT_INFO, printf("Socket %d closed", client[i]);)
+
+    tcpip_queue_close(i);
+    close(client[i]);
+    client[i] = -1;
+    client_count--;
+
+    return;
+}
+
+/*****************************************************************************
+ *
+ * @function: send_to_clients()
+ *
+ * @brief:    Send each client what it has not had yet
+ * 
+ * @return:   None
+ *
+ ******************************************************************************
+ *
+ * Each client is sent as much as its socket will take.  A client whose
+ * socket is full waits for select(), one that fell too far behind or
+ * fails a send is dropped.
+ * 
+ *******************************************************************************/
+static void send_to_clients(void)
+{
+    char buffer[512];
+    int  to_write;
+    int  length;
+    int  i;
+
+    for (i=0; i != TCPIP_MAX_CLIENTS; i++)
+    {
+        if ( client[i] < 0 )
+        {
+            continue;
+        }
+
+        if ( tcpip_queue_overrun(i) )
+        {
+            DLT(DLT_CRITICAL, printf("Socket %d dropped, too far behind", client[i]);)
+            client_dropped++;
+            close_client(i);
+            continue;
+        }
+
+        while ( (client_blocked[i] == false)
+            && ((to_write = tcpip_queue_2_socket(i, buffer, sizeof(buffer))) > 0) )
+        {
+            length = send(client[i], buffer, to_write, MSG_DONTWAIT);
+            if ( length > 0 )
+            {
+                tcpip_queue_sent(i, length);
+            }
+            else if ( (length < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) )
+            {
+                client_blocked[i] = true;           // Try again when there is room
+            }
+            else
+            {
+                close_client(i);
+                break;
+            }
+        }
+    }
+
+    return;
+}
@@ -0,0 +1,23 @@
+/*----------------------------------------------------------------
+ *
+ * tcpip_server.h
+ *
+ * Single task TCP server
+ *
+ *---------------------------------------------------------------*/
+#ifndef _TCPIP_SERVER_H_
+#define _TCPIP_SERVER_H_
+
+#define TCPIP_PORT          1090    // Port the PC client connects to
+#define TCPIP_MAX_CLIENTS   8       // Largest number of clients that can be configured
+
+/*
+ * Global functions
+ */
+int  tcpip_server(int port, int max_clients); // Run the event loop until stopped
+void tcpip_server_wake(void);                 // Output has been queued
+void tcpip_server_stop(void);                 // Make tcpip_server() return
+int  tcpip_server_clients(void);              // Number of clients connected
+int  tcpip_server_dropped(void);              // Clients dropped for falling behind
+
+#endif
@@ -14,17 +14,27 @@
  * 
  * ----------------------------------------------------*/
 #include "stdbool.h"
+#include "stdint.h"
 #include "driver\timer.h"
 #include "freETarget.h"
 #include "diag_tools.h"
 #include "gpio_types.h"
 #include "json.h"
+#include "ring_down.h"
+#include "timer_wheel.h"
+#include "serial_io.h"
+#include "esp_timer.h"
 
 /*
  * Definitions
  */
 #define FREQUENCY 1000ul                        // 1000 Hz
 #define N_TIMERS       32                       // Keep space for 32 timers
+#define LEGACY_BITS     6                       // Hash table for the down counters
+#define LEGACY_SLOTS   (1 << LEGACY_BITS)       // is kept at least half empty
+#define LEGACY_MASK    (LEGACY_SLOTS - 1)
+#define LEGACY_HASH(p) (((unsigned int)(uintptr_t)(p) * 2654435761u) >> (32 - LEGACY_BITS))
+#define LEGACY_TICK    10                       // Down counters count in 10 ms
 #define PORT_STATE_IDLE 0                       // There are no sensor inputs
 #define PORT_STATE_WAIT 1                       // Some sensor inputs are present, but not all
 #define PORT_STATE_DONE 2                       // All of the inmputs are present
@@ -35,14 +45,30 @@
 /*
  * Local Variables
  */
-static volatile unsigned long* timers[N_TIMERS];  // Active timer list
+static volatile unsigned long* timers[LEGACY_SLOTS]; // Active down counters, hashed on the address
+static unsigned int  timer_count;                 // Number of down counters in timers[]
+static timer_wheel_t wheel;                       // Millisecond timer service
+static bool          wheel_ready;                 // TRUE once the wheel has been initialized
+static portMUX_TYPE  timer_lock = portMUX_INITIALIZER_UNLOCKED; // Tasks and the wheel share timers[] and wheel
+static esp_timer_handle_t wheel_handle;           // 1 ms esp_timer driving the wheel
        unsigned int isr_state;                    // What sensor state are we in 
-static volatile unsigned long isr_timer;          // Interrupt timer 
+static volatile unsigned long isr_timer;          // Interrupt timer (ms)
+static portMUX_TYPE isr_lock = portMUX_INITIALIZER_UNLOCKED; // Timer and GPIO interrupts share isr_state
+static ring_down_t  ring_down;                    // Learned ring down (RING_ADAPT)
+static unsigned int done_time;                    // ms spent in PORT_STATE_DONE
+static bool         shot_taken;                   // TRUE when captured() has queued a shot
+       unsigned int rearm_time;                   // ms the counters were stopped after the last shot
 
 /*
  *  Function Prototypes
  */
 static bool IRAM_ATTR freeETarget_timer_isr_callback(void *args);
+static void IRAM_ATTR ring_done(unsigned int pin);
+static void IRAM_ATTR captured(void);
+static void timer_service(void* arg);
+static void legacy_tick(void* arg);
+
+static wheel_timer_t legacy_timer = WHEEL_TIMER(legacy_tick, NULL);
 
 /*-----------------------------------------------------
  * 
@@ -62,11 +88,17 @@ static bool IRAM_ATTR freeETarget_timer_isr_callback(void *args);
  * by a 1 ms timer interrupt directly from the operating
  * system
  * 
+ * Everything else that needs a timer is run from the timer
+ * wheel (timer_wheel.c), which is moved on every 1 ms by an
+ * esp_timer.  The down counters from timer_new() are counted
+ * down every 10 ms by one of the wheel's timers.
+ * 
  *-----------------------------------------------------*/
 #include "freETarget.h"
 #include "timer.h"
 #include "mfs.h"
 #include "token.h"
+#include "compute_hit.h"
 
 #define TIMER_DIVIDER         (16)                    //  Hardware timer clock divider
 #define TIMER_SCALE           (1000/ TIMER_DIVIDER)   // convert counter value to seconds
@@ -90,8 +122,17 @@ void freeETarget_timer_init(void)
   timer_enable_intr(TIMER_GROUP_0, TIMER_1);                            // Interrupt associated with this interrupt
   timer_isr_callback_add(TIMER_GROUP_0, TIMER_1, freeETarget_timer_isr_callback, NULL, 0);
   timer_start(TIMER_GROUP_0, TIMER_1);
-  timer_new(&isr_timer, 0);
-  this_shot = 0;
+  ring_down_init(&ring_down, json_min_ring_time);
+
+  esp_timer_create_args_t wheel_args = {
+      .callback        = timer_service,
+      .arg             = NULL,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name            = "timer_wheel"
+  };
+  esp_timer_create(&wheel_args, &wheel_handle);
+  timer_arm(&legacy_timer, LEGACY_TICK, LEGACY_TICK);                  // Count down the timer_new() timers
+  esp_timer_start_periodic(wheel_handle, 1000);                        // Turn the wheel every 1 ms
 
 /*
  *  Timer running. return
@@ -136,7 +177,15 @@ void freeETarget_timer_start(void)                                        // Sta
  *        timed out
  * DONE - We have read the counters but need to
  *        wait for the ringing to stop
+ * 
+ * With RING_ADAPT set, the DONE state re-arms as soon as
+ * the learned ring down time has passed and the sensors
+ * are quiet (see ring_down.c).
  *        
+ * In ACQUIRE_INTERRUPT mode the IDLE and WAIT states are
+ * driven by freeETarget_sensor_edge() and this function 
+ * only looks after the WAIT time out and the ringing.
+ * The port is not read while the target is idle.
  * 
  *-----------------------------------------------------*/
 static bool IRAM_ATTR freeETarget_timer_isr_callback(void *args)
@@ -146,6 +195,19 @@ static bool IRAM_ATTR freeETarget_timer_isr_callback(void *args)
 
   IF_NOT(IN_OPERATION) return high_task_awoken == pdTRUE; // return whether we need to yield at the end of ISR 
 
+  if ( (json_acquire == ACQUIRE_INTERRUPT)
+      && (isr_state == PORT_STATE_IDLE) )      // Waiting for an edge
+  {
+    return high_task_awoken == pdTRUE;
+  }
+
+  portENTER_CRITICAL_ISR(&isr_lock);
+
+  if ( isr_timer != 0 )                         // Count down in 1 ms
+  {
+    isr_timer--;
+  }
+
 /*
  * Decide what to do if based on what inputs are present
  */
@@ -157,6 +219,10 @@ static bool IRAM_ATTR freeETarget_timer_isr_callback(void *args)
   switch (isr_state)
   {
     case PORT_STATE_IDLE:                       // Idle, Wait for something to show up
+      if ( json_acquire == ACQUIRE_INTERRUPT )  // Edge arrived while we were getting here
+      {
+        break;
+      }
       if ( pin != 0 )                           // Something has triggered
       { 
         isr_timer = MAX_WAIT_TIME;              // Start the wait timer
@@ -168,13 +234,17 @@ static bool IRAM_ATTR freeETarget_timer_isr_callback(void *args)
       if ( (pin == RUN_MASK)                    // We have all of the inputs
           || (isr_timer == 0) )                 // or ran out of time.  Read the timers and restart 
       { 
-        aquire();                               // Read the counters
-        isr_timer = json_min_ring_time;         // Reset the timer
-        isr_state = PORT_STATE_DONE;            // and wait for the all clear
+        captured();                             // Read the counters
       }
       break;
       
     case PORT_STATE_DONE:                       // Waiting for the ringing to stop
+      done_time++;
+      if ( json_ring_adapt != 0 )               // Learn when to re-arm
+      {
+        ring_done(pin);
+        break;
+      }
       if ( pin != 0 )                           // Something got latched
       {
         isr_timer = json_min_ring_time;
@@ -185,12 +255,20 @@ static bool IRAM_ATTR freeETarget_timer_isr_callback(void *args)
         if ( isr_timer == 0 )                   // Make sure there is no rigning
         {
           arm_timers();                         // and arm for the next time
+          rearm_time = done_time;
           isr_state = PORT_STATE_IDLE;          // and go back to idle
         } 
       }
       break;
   }
 
+  portEXIT_CRITICAL_ISR(&isr_lock);
+
+  if ( shot_taken )                             // Wake up the target loop
+  {
+    shot_taken = false;
+    freeETarget_shot_ready(&high_task_awoken);
+  }
 
 /*
  * Return from interrupts
@@ -198,6 +276,150 @@ static bool IRAM_ATTR freeETarget_timer_isr_callback(void *args)
   return high_task_awoken == pdTRUE; // return whether we need to yield at the end of ISR
 }
 
+/*-----------------------------------------------------
+ * 
+ * @function: freeETarget_sensor_edge
+ * 
+ * @brief:    A RUN line has latched
+ * 
+ * @return:   None
+ * 
+ *-----------------------------------------------------
+ *
+ * Called from the GPIO interrupts on the RUN_XX_LO and
+ * RUN_XX_HI lines.
+ * 
+ * The first edge starts the wait timer, and the edge
+ * that completes the RUN_MASK reads the counters 
+ * straight away rather than on the next 1 ms tick.
+ * 
+ * If some of the sensors never latch, the timer interrupt
+ * reads the counters when the wait timer runs out.
+ * 
+ * Returns TRUE if the target loop was woken and the 
+ * caller should yield.
+ * 
+ *-----------------------------------------------------*/
+bool IRAM_ATTR freeETarget_sensor_edge(void)
+{
+  BaseType_t high_task_awoken = pdFALSE;
+  unsigned int pin;                             // Value read from the port
+
+  if ( json_acquire != ACQUIRE_INTERRUPT )
+  {
+    return false;
+  }
+
+  IF_NOT(IN_OPERATION) return false;
+
+  portENTER_CRITICAL_ISR(&isr_lock);
+  pin = is_running();                           // One read of the port
+
+  switch (isr_state)
+  {
+    case PORT_STATE_IDLE:                       // First sensor
+      isr_timer = MAX_WAIT_TIME;                // Start the wait timer
+      isr_state = PORT_STATE_WAIT;              // It may also be the last
+      /* fall through */
+    case PORT_STATE_WAIT:
+      if ( pin == RUN_MASK )                    // Last sensor is in
+      {
+        captured();                             // Read the counters
+      }
+      break;
+
+    default:
+    case PORT_STATE_DONE:                       // Ringing is handled by the timer
+      break;
+  }
+  
+  portEXIT_CRITICAL_ISR(&isr_lock);
+
+  if ( shot_taken )                             // Wake up the target loop
+  {
+    shot_taken = false;
+    freeETarget_shot_ready(&high_task_awoken);
+  }
+
+  return high_task_awoken == pdTRUE;
+}
+
+/*-----------------------------------------------------
+ * 
+ * @function: captured
+ * 
+ * @brief:    Read the counters and wait for the ringing
+ * 
+ * @return:   None
+ * 
+ *-----------------------------------------------------
+ *
+ * Called with isr_lock held when all of the sensors are 
+ * in, or the wait has timed out.
+ * 
+ *-----------------------------------------------------*/
+static void IRAM_ATTR captured(void)
+{
+  aquire();                                     // Read the counters
+  shot_taken = true;                            // Tell the target loop on the way out
+  isr_timer = json_min_ring_time;               // Wait for the ringing to stop
+  isr_state = PORT_STATE_DONE;
+  done_time = 0;
+  ring_down_start(&ring_down, json_min_ring_time);
+
+  return;
+}
+
+/*-----------------------------------------------------
+ * 
+ * @function: ring_done
+ * 
+ * @brief:    Adaptive wait for the ringing to stop
+ * 
+ * @return:   None
+ * 
+ *-----------------------------------------------------
+ *
+ * Called every 1 ms in PORT_STATE_DONE when RING_ADAPT
+ * is set.  ring_down_tick() says what to do with the
+ * counters.
+ * 
+ *-----------------------------------------------------*/
+static void IRAM_ATTR ring_done
+(
+  unsigned int pin                              // RUN lines read this tick
+)
+{
+  switch ( ring_down_tick(&ring_down, pin) )
+  {
+    case RING_HOLD:                             // Keep the ringing out
+    case RING_STOP:
+      stop_timers();
+      break;
+
+    case RING_ARM:                              // Try listening
+      arm_timers();
+      break;
+
+    default:
+    case RING_WAIT:                             // Listening
+      break;
+
+    case RING_DONE:                             // Quiet and armed
+      rearm_time = ring_down.rearm;
+      isr_state = PORT_STATE_IDLE;
+      break;
+
+    case RING_SHOT:                             // The next shot is already here
+      rearm_time = ring_down.rearm;
+      isr_timer = MAX_WAIT_TIME;
+      isr_state = PORT_STATE_WAIT;
+      break;
+  }
+
+  return;
+}
+
 /*-----------------------------------------------------
  * 
  * @function: freeETarget_synchronous
@@ -212,12 +434,8 @@ static bool IRAM_ATTR freeETarget_timer_isr_callback(void *args)
  * 
  * Synchronous tasks are called on a 10ms time band
  * 
- * Unless you don't care about the time, always use
- * timer_new(&timer, ONE_SECOND * duration).
- * 
- * IMPORTANT
- * 
- * timers are NOT deleted when they expire.
+ * The timer_new() down counters are counted down by the
+ * timer wheel, not by this task.
  * 
  *-----------------------------------------------------*/
 #define TICK_10ms                1       // 1 TICK_10ms = 10 ms
@@ -233,22 +451,11 @@ void freeETarget_synchronous
 {
   unsigned int cycle_count = 0;
   unsigned int toggle = 0;
-  unsigned int i;
 
   DLT(DLT_CRITICAL, printf("freeETarget_synchronous()");)
-/*
- *  Decrement the timers on a 10ms (100Hz) interval
- */
+
   while (1)
   {
-    for (i=0; i != N_TIMERS; i++)   // Refresh the timers.  Decriment in 10ms increments
-    {
-      if ( (timers[i] != 0)
-        && ( *timers[i] != 0 ) )
-      {
-        (*timers[i])--;             // Decriment the timer
-      }
-    }
 /*
  *  10 ms band
  */
@@ -256,18 +463,14 @@ void freeETarget_synchronous
     multifunction_switch_tick();
     multifunction_switch();
     drive_paper_tick();
-    if ( LED_timer == 0 )               // Check to see if the timer ran down
-    {
-      set_status_LED(LED_RXTX_OFF);     // If so Turn off the LEDs
-      timer_delete(&LED_timer);
-      LED_timer = 1;                    // and kill the timer
-    }
+    serial_console_flush();                          // Anything printf()'d in the last 10 ms
 /*
  *  500 ms band
  */
     if ( (cycle_count  %  BAND_500ms) == 0 )
     {
       toggle ^= 1;
+      sensor_fault_task();
       commit_status_LEDs( toggle );
       tabata_task();
       rapid_fire_task();
@@ -280,6 +483,7 @@ void freeETarget_synchronous
     {
       bye();                                           // Dim the lights  
       send_keep_alive();
+      update_geometry();                               // Refresh the speed of sound
     }
 
 /*
@@ -290,6 +494,165 @@ void freeETarget_synchronous
   }
 }
 
+/*-----------------------------------------------------
+ * 
+ * @function: timer_service
+ * 
+ * @brief:    Turn the timer wheel
+ *  
+ * @return:   None
+ * 
+ *-----------------------------------------------------
+ *
+ * Called every 1 ms from the esp_timer task.
+ * 
+ * The timers that have run out are taken off the wheel
+ * one at a time with the lock held and called with it 
+ * released, so a callback can arm or cancel any timer.
+ * 
+ *-----------------------------------------------------*/
+static void timer_service
+(
+  void* arg
+)
+{
+  wheel_timer_t* t;
+  wheel_fn       fn;
+  void*          fn_arg;
+  unsigned long  now;
+
+  now = (unsigned long)(esp_timer_get_time() / 1000);
+
+  while ( 1 )
+  {
+    portENTER_CRITICAL(&timer_lock);
+    t = timer_wheel_expire(&wheel, now);
+    fn = (t != NULL) ? t->fn : NULL;
+    fn_arg = (t != NULL) ? t->arg : NULL;
+    portEXIT_CRITICAL(&timer_lock);
+
+    if ( t == NULL )
+    {
+      break;
+    }
+    if ( fn != NULL )
+    {
+      fn(fn_arg);
+    }
+  }
+
+  return;
+}
+
+/*-----------------------------------------------------
+ * 
+ * @function: legacy_tick
+ * 
+ * @brief:    Count down the timer_new() timers
+ *  
+ * @return:   None
+ * 
+ *-----------------------------------------------------
+ *
+ * Called every 10 ms from the timer wheel
+ * 
+ *-----------------------------------------------------*/
+static void legacy_tick
+(
+  void* arg
+)
+{
+  unsigned int i;
+
+  portENTER_CRITICAL(&timer_lock);
+  for (i=0; i != LEGACY_SLOTS; i++)
+  {
+    if ( (timers[i] != 0)
+      && ( *timers[i] != 0 ) )
+    {
+      (*timers[i])--;               // Decriment the timer
+    }
+  }
+  portEXIT_CRITICAL(&timer_lock);
+
+  return;
+}
+
+/*-----------------------------------------------------
+ * 
+ * @function: timer_arm()
+ *            timer_cancel()
+ * 
+ * @brief:    Start or stop a timer on the wheel
+ *  
+ * @return:   None
+ * 
+ *-----------------------------------------------------
+ *
+ * The timer calls t->fn(t->arg) from the esp_timer task
+ * delay ms from now, and then every period ms until it
+ * is cancelled (period 0 for once).
+ * 
+ * Arming a timer that is already running restarts it.
+ * Both take the same time however many timers are 
+ * running, so it is OK to restart a timer every time 
+ * something happens.
+ * 
+ * The timers must be static, or live for as long as they
+ * are armed.  Use WHEEL_TIMER(fn, arg) to set them up.
+ * 
+ *-----------------------------------------------------*/
+void timer_arm
+(
+  wheel_timer_t* t,                   // Timer to start
+  unsigned long  delay,               // ms to the first call
+  unsigned long  period               // ms between calls, 0 for once
+)
+{
+  unsigned long now;
+
+  portENTER_CRITICAL(&timer_lock);
+  now = (unsigned long)(esp_timer_get_time() / 1000);
+  if ( wheel_ready == false )         // First timer
+  {
+    timer_wheel_init(&wheel, now);
+    wheel_ready = true;
+  }
+  timer_wheel_arm(&wheel, t, now, delay, period);
+  portEXIT_CRITICAL(&timer_lock);
+
+  return;
+}
+
+void timer_cancel
+(
+  wheel_timer_t* t                    // Timer to stop
+)
+{
+  portENTER_CRITICAL(&timer_lock);
+  if ( wheel_ready )
+  {
+    timer_wheel_cancel(&wheel, t);
+  }
+  portEXIT_CRITICAL(&timer_lock);
+
+  return;
+}
+
+/*-----------------------------------------------------
+ * 
+ * @function: timer_overrun()
+ * 
+ * @brief:    Number of timers that ran out late
+ *  
+ * @return:   Timers called 1 ms or more after they ran out
+ * 
+ *-----------------------------------------------------*/
+unsigned int timer_overrun(void)
+{
+  return wheel.overrun;
+}
+
 /*-----------------------------------------------------
  * 
  * @function: timer_new()
@@ -302,8 +665,14 @@ void freeETarget_synchronous
  *-----------------------------------------------------
  *
  * 
- * These functions add or remove a timer from the active
- * timer list
+ * These functions add or remove a down counter from the
+ * active timer list.  The counters are decremented every
+ * 10 ms until they reach 0.
+ * 
+ * The list is a hash table on the address of the counter
+ * so that finding it does not need a search.  Entries
+ * are removed by moving the ones after them back so
+ * that a lookup can stop at the first empty slot.
  * 
  * IMPORTANT
  * 
@@ -316,6 +685,8 @@ void freeETarget_synchronous
  * timer_new can be called any number of times with the
  * same timer addess without creating a problem
  * 
+ * timers are NOT deleted when they expire.
+ * 
  *-----------------------------------------------------*/
 int timer_new
 (
@@ -330,19 +701,29 @@ int timer_new
     return 0;
   }
 
-  for (i=0;  i != N_TIMERS; i++ )   // Look through the space
+  portENTER_CRITICAL(&timer_lock);
+  i = LEGACY_HASH(new_timer);
+  while ( (timers[i] != 0)           // Look for it
+       && (timers[i] != new_timer) ) // or the end of the chain
+  {
+    i = (i + 1) & LEGACY_MASK;
+  }
+
+  if ( timers[i] == 0 )              // Not there yet
   {
-    if ( (timers[i] == 0)           // Got an empty timer slot
-      || (timers[i] == new_timer) ) // or it already exists
+    if ( timer_count == N_TIMERS )
     {
-      timers[i] = new_timer;        // Add it in
-      *new_timer = duration;
-      return 1;
+      portEXIT_CRITICAL(&timer_lock);
+      DLT(DLT_CRITICAL,  printf("No space for new timer");)
+      return 0;
     }
+    timers[i] = new_timer;           // Add it in
+    timer_count++;
   }
-  DLT(DLT_CRITICAL,  printf("No space for new timer");)
-  
-  return 0;
+  *new_timer = duration;
+  portEXIT_CRITICAL(&timer_lock);
+
+  return 1;
 }
 
 int timer_delete
@@ -350,17 +731,40 @@ int timer_delete
   volatile unsigned long* old_timer   // Pointer to new down counter
 )
 {
-  unsigned int i;
+  unsigned int i, j, home;
 
-  for (i=0;  i != N_TIMERS; i++ )   // Look through the space
+  portENTER_CRITICAL(&timer_lock);
+  i = LEGACY_HASH(old_timer);
+  while ( timers[i] != old_timer )    // Look for the existing timer
   {
-    if ( timers[i] == old_timer )   // Found the existing timer
+    if ( timers[i] == 0 )             // Not there
     {
-      timers[i] = 0;                // Remove the pointer
-      return 1;
+      portEXIT_CRITICAL(&timer_lock);
+      return 0;
     }
+    i = (i + 1) & LEGACY_MASK;
   }
 
-  return 0;
-  
+  timers[i] = 0;                      // Remove the pointer
+  timer_count--;
+
+  j = i;                              // Close up the chain
+  while ( 1 )
+  {
+    j = (j + 1) & LEGACY_MASK;
+    if ( timers[j] == 0 )
+    {
+      break;
+    }
+    home = LEGACY_HASH(timers[j]);
+    if ( ((j - home) & LEGACY_MASK) >= ((j - i) & LEGACY_MASK) )
+    {
+      timers[i] = timers[j];          // Can move back into the gap
+      timers[j] = 0;
+      i = j;
+    }
+  }
+  portEXIT_CRITICAL(&timer_lock);
+
+  return 1;
 }
@@ -8,6 +8,8 @@
 #ifndef _TIMER_H_
 #define _TIMER_H_
 
+#include "timer_wheel.h"
+
 /*
  * function Prototypes
  */
@@ -16,7 +18,16 @@ void freeETarget_timer_pause(void);                                        // St
 void freeETarget_timer_start(void);                                        // Start the timer
 int  timer_new(volatile unsigned long* timer_new, unsigned long duration); // Start a new timer
 int  timer_delete(volatile unsigned long* long_timer);                     // Remove a timer
+void timer_arm(wheel_timer_t* t, unsigned long delay, unsigned long period); // Start a callback timer (ms)
+void timer_cancel(wheel_timer_t* t);                                       // Stop a callback timer
+unsigned int timer_overrun(void);                                          // Callback timers that ran late
 void freeETarget_synchronous(void *pvParameters);                          // Synchronou scheduler
+bool freeETarget_sensor_edge(void);                                        // RUN line interrupt (ACQUIRE_INTERRUPT)
+
+/*
+ *  Variables
+ */
+extern unsigned int rearm_time;                                            // ms the counters were stopped after the last shot
 
 /*
  *  Definitions
@@ -0,0 +1,305 @@
+/*----------------------------------------------------------------
+ *
+ * timer_wheel.c
+ *
+ * Millisecond timer wheel with callbacks
+ *
+ *----------------------------------------------------------------
+ *
+ * The wheel has WHEEL_SLOTS lists, one for each ms.  A timer is
+ * put on the list for (expires % WHEEL_SLOTS), so arming and
+ * cancelling are a couple of pointer swaps no matter how many
+ * timers are running.  Timers further out than WHEEL_SLOTS ms
+ * share a slot with nearer ones and are skipped until their turn
+ * comes around.
+ *
+ * timer_wheel_expire() walks the wheel up to the current time
+ * and hands back the timers that have run out one at a time, so
+ * that the caller can let go of any lock before calling them.
+ * Periodic timers are put back on the wheel before they are
+ * handed back, so the callback is free to cancel or re-arm its
+ * own timer.
+ *
+ * If the wheel is not serviced for a while the missed ms are
+ * worked through in order and every timer that runs out late
+ * is counted in overrun.
+ *
+ * There is no locking or hardware here.  See timer.c
+ *
+ *---------------------------------------------------------------*/
+#include "stdio.h"
+
+#include "timer_wheel.h"
+
+static void wheel_link(timer_wheel_t* w, wheel_timer_t* t);
+static void wheel_unlink(timer_wheel_t* w, wheel_timer_t* t);
+
+/*----------------------------------------------------------------
+ *
+ * @function: timer_wheel_init
+ *
+ * @brief:    Empty the wheel
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+void timer_wheel_init
+(
+  timer_wheel_t* w,                     // Wheel to be initialized
+  unsigned long  now                    // Current time (ms)
+)
+{
+  unsigned int i;
+
+  for (i=0; i != WHEEL_SLOTS; i++)
+  {
+    w->slot[i].next = &w->slot[i];      // Empty lists point at themselves
+    w->slot[i].prev = &w->slot[i];
+  }
+  w->tick    = now;
+  w->active  = 0;
+  w->overrun = 0;
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: timer_wheel_set
+ *
+ * @brief:    Set what to call when the timer runs out
+ *
+ * @return:   None
+ *
+ *----------------------------------------------------------------
+ *
+ * Only for timers that are not armed.  Static timers can use
+ * WHEEL_TIMER() instead.
+ *
+ *--------------------------------------------------------------*/
+void timer_wheel_set
+(
+  wheel_timer_t* t,                     // Timer to set up
+  wheel_fn       fn,                    // Function to call
+  void*          arg                    // Passed to fn
+)
+{
+  t->next    = NULL;
+  t->prev    = NULL;
+  t->expires = 0;
+  t->period  = 0;
+  t->fn      = fn;
+  t->arg     = arg;
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: timer_wheel_arm
+ *
+ * @brief:    Start a timer, or restart it if it is running
+ *
+ * @return:   None
+ *
+ *----------------------------------------------------------------
+ *
+ * The timer runs out delay ms after now, and then every period
+ * ms after that until it is cancelled.  A timer that would run
+ * out before the wheel's current time runs out on the next call
+ * to timer_wheel_expire().
+ *
+ *--------------------------------------------------------------*/
+void timer_wheel_arm
+(
+  timer_wheel_t* w,                     // Wheel to use
+  wheel_timer_t* t,                     // Timer to start
+  unsigned long  now,                   // Current time (ms)
+  unsigned long  delay,                 // Time to the first call (ms)
+  unsigned long  period                 // Time between calls (ms), 0 for once
+)
+{
+  if ( t->next != NULL )                // Already running
+  {
+    wheel_unlink(w, t);
+  }
+
+  t->expires = now + delay;
+  if ( (long)(t->expires - w->tick) < 0 )
+  {
+    t->expires = w->tick;               // Already gone
+  }
+  t->period = period;
+  wheel_link(w, t);
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: timer_wheel_cancel
+ *
+ * @brief:    Stop a timer
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+void timer_wheel_cancel
+(
+  timer_wheel_t* w,                     // Wheel to use
+  wheel_timer_t* t                      // Timer to stop
+)
+{
+  if ( t->next != NULL )
+  {
+    wheel_unlink(w, t);
+  }
+
+  return;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: timer_wheel_pending
+ *
+ * @brief:    Find out if a timer is running
+ *
+ * @return:   TRUE if the timer is armed
+ *
+ *--------------------------------------------------------------*/
+int timer_wheel_pending
+(
+  wheel_timer_t* t                      // Timer to check
+)
+{
+  return t->next != NULL;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: timer_wheel_expire
+ *
+ * @brief:    Find the next timer that has run out
+ *
+ * @return:   The timer, or NULL if none are left up to now
+ *
+ *----------------------------------------------------------------
+ *
+ * A one shot timer is taken off the wheel and a periodic timer
+ * is moved on by its period.  The caller calls t->fn(t->arg).
+ *
+ *--------------------------------------------------------------*/
+wheel_timer_t* timer_wheel_expire
+(
+  timer_wheel_t* w,                     // Wheel to use
+  unsigned long  now                    // Current time (ms)
+)
+{
+  wheel_timer_t* head;
+  wheel_timer_t* t;
+
+  while ( (long)(now - w->tick) >= 0 )
+  {
+    if ( w->active == 0 )               // Nothing to look for
+    {
+      w->tick = now + 1;
+      break;
+    }
+
+    head = &w->slot[w->tick & WHEEL_MASK];
+    for ( t = head->next; t != head; t = t->next )
+    {
+      if ( t->expires == w->tick )      // This time around
+      {
+        wheel_unlink(w, t);
+        if ( t->expires != now )
+        {
+          w->overrun++;                 // Should have gone earlier
+        }
+        if ( t->period != 0 )
+        {
+          t->expires += t->period;      // Go again
+          wheel_link(w, t);
+        }
+        return t;
+      }
+    }
+    w->tick++;                          // This ms is finished
+  }
+
+  return NULL;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: timer_wheel_run
+ *
+ * @brief:    Call everything that has run out
+ *
+ * @return:   Number of callbacks made
+ *
+ *--------------------------------------------------------------*/
+unsigned int timer_wheel_run
+(
+  timer_wheel_t* w,                     // Wheel to use
+  unsigned long  now                    // Current time (ms)
+)
+{
+  wheel_timer_t* t;
+  unsigned int   calls;
+
+  calls = 0;
+  while ( (t = timer_wheel_expire(w, now)) != NULL )
+  {
+    if ( t->fn != NULL )
+    {
+      t->fn(t->arg);
+    }
+    calls++;
+  }
+
+  return calls;
+}
+
+/*----------------------------------------------------------------
+ *
+ * @function: wheel_link
+ *            wheel_unlink
+ *
+ * @brief:    Put a timer on, or take it off, its slot
+ *
+ * @return:   None
+ *
+ *--------------------------------------------------------------*/
+static void wheel_link
+(
+  timer_wheel_t* w,
+  wheel_timer_t* t
+)
+{
+  wheel_timer_t* head;
+
+  head = &w->slot[t->expires & WHEEL_MASK];
+  t->next = head;                       // Add to the end
+  t->prev = head->prev;
+  head->prev->next = t;
+  head->prev = t;
+  w->active++;
+
+  return;
+}
+
+static void wheel_unlink
+(
+  timer_wheel_t* w,
+  wheel_timer_t* t
+)
+{
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  t->next = NULL;
+  t->prev = NULL;
+  w->active--;
+
+  return;
+}
@@ -0,0 +1,50 @@
+/*----------------------------------------------------------------
+ *
+ * timer_wheel.h
+ *
+ * Millisecond timer wheel with callbacks
+ *
+ *---------------------------------------------------------------*/
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#define WHEEL_SLOTS     256             // Must be a power of 2, one slot per ms
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+
+/*
+ * Typedefs
+ */
+typedef void (*wheel_fn)(void* arg);    // Called when the timer runs out
+
+typedef struct wheel_timer
+{
+  struct wheel_timer* next;             // Next in the slot, NULL if not armed
+  struct wheel_timer* prev;             // Previous in the slot
+  unsigned long       expires;          // ms when the timer runs out
+  unsigned long       period;           // ms to re-arm after running out, 0 for one shot
+  wheel_fn            fn;               // What to call
+  void*               arg;              // and what to pass it
+} wheel_timer_t;
+
+typedef struct timer_wheel
+{
+  wheel_timer_t       slot[WHEEL_SLOTS];// Head of the list for each slot
+  unsigned long       tick;             // Next ms to be processed
+  unsigned int        active;           // Number of timers armed
+  unsigned int        overrun;          // Timers run out 1 ms or more late
+} timer_wheel_t;
+
+#define WHEEL_TIMER(fn, arg)  { NULL, NULL, 0, 0, (fn), (arg) }   // Static initializer
+
+/*
+ * Global functions
+ */
+void           timer_wheel_init(timer_wheel_t* w, unsigned long now);        // Empty the wheel
+void           timer_wheel_set(wheel_timer_t* t, wheel_fn fn, void* arg);    // Set the callback
+void           timer_wheel_arm(timer_wheel_t* w, wheel_timer_t* t, unsigned long now, unsigned long delay, unsigned long period); // Start or restart
+void           timer_wheel_cancel(timer_wheel_t* w, wheel_timer_t* t);       // Stop a timer
+int            timer_wheel_pending(wheel_timer_t* t);                        // TRUE if armed
+wheel_timer_t* timer_wheel_expire(timer_wheel_t* w, unsigned long now);      // Next timer to run out
+unsigned int   timer_wheel_run(timer_wheel_t* w, unsigned long now);         // Call everything that has run out
+
+#endif
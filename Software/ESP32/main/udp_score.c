@@ -0,0 +1,233 @@
+/******************************************************************************
+ *
+ * udp_score.c
+ *
+ * Publish the scores as UDP datagrams
+ *
+ ******************************************************************************
+ *
+ * Every score is sent once as a single datagram to a multicast group, the
+ * broadcast address or one PC.  Any number of scoreboards, range officer
+ * screens and loggers can listen without costing the target anything more,
+ * which the TCP server cannot do.
+ *
+ * Each datagram is the score with the lane name and a sequence number put
+ * in front of the other fields:
+ *
+ *   {"seq":12, "lane":"TARGET", "shot":3, "miss":0, ... }
+ *
+ * The sequence number goes up by one for every datagram so a listener can
+ * count what it missed.  It starts again at 1 when the publisher is opened.
+ *
+ * UDP gives no guarantee of delivery.  The stack is never waited on, and a
+ * datagram it will not take is counted and forgotten.
+ *
+ * Only BSD socket calls are used so the same code runs over lwIP on the
+ * target and over the host sockets on a PC.
+ *
+ * *****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "lwip/sockets.h"
+
+#include "freETarget.h"
+#include "diag_tools.h"
+#include "compute_hit.h"
+#include "json_writer.h"
+#include "udp_score.h"
+
+/*
+ * Variables
+ */
+static int                udp_sock = -1;    // Socket, -1 if not publishing
+static struct sockaddr_in udp_addr;         // Where the scores go
+static unsigned int       udp_sequence;     // Last sequence number sent
+static unsigned int       udp_dropped;      // Datagrams the stack would not take
+
+/*****************************************************************************
+ *
+ * @function: udp_score_open()
+ *
+ * @brief:    Start publishing the scores
+ *
+ * @return:   0 if OK or turned off, -1 if the socket could not be made
+ *
+ ******************************************************************************
+ *
+ * An empty address turns the publisher off.  A multicast address is sent
+ * with a TTL of UDP_SCORE_TTL so that it does not leave the range network.
+ *
+ *******************************************************************************/
+int udp_score_open
+(
+    const char* address,                    // Dotted address to send to
+    int         port                        // Port to send to
+)
+{
+    struct in_addr group;
+    unsigned char  ttl;
+    int            option;
+
+    udp_score_close();
+
+    if ( (address == NULL) || (address[0] == 0) )
+    {
+        return 0;                           // Not wanted
+    }
+
+    if ( port <= 0 )
+    {
+        port = UDP_SCORE_PORT;
+    }
+
+    if ( inet_aton(address, &group) == 0 )
+    {
+        DLT(DLT_CRITICAL, printf("UDP score address %s is not valid", address);)
+        return -1;
+    }
+
+    udp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if ( udp_sock < 0 )
+    {
+        DLT(DLT_CRITICAL, printf("Unable to create UDP socket: errno %d", errno);)
+        return -1;
+    }
+
+    option = 1;
+    setsockopt(udp_sock, SOL_SOCKET, SO_BROADCAST, &option, sizeof(option));
+    if ( IN_MULTICAST(ntohl(group.s_addr)) )
+    {
+        ttl = UDP_SCORE_TTL;
+        setsockopt(udp_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    }
+
+    memset(&udp_addr, 0, sizeof(udp_addr));
+    udp_addr.sin_family = AF_INET;
+    udp_addr.sin_addr = group;
+    udp_addr.sin_port = htons(port);
+    udp_sequence = 0;
+    udp_dropped = 0;
+
+    DLT(DLT_INFO, printf("Publishing scores to %s:%d", address, port);)
+
+    return 0;
+}
+
+/*****************************************************************************
+ *
+ * @function: udp_score_close()
+ *
+ * @brief:    Stop publishing the scores
+ *
+ * @return:   None
+ *
+ ******************************************************************************/
+void udp_score_close(void)
+{
+    if ( udp_sock >= 0 )
+    {
+        close(udp_sock);
+        udp_sock = -1;
+    }
+
+    return;
+}
+
+/*****************************************************************************
+ *
+ * @function: udp_score_send()
+ *
+ * @brief:    Publish one score
+ *
+ * @return:   Number of bytes sent, 0 if not publishing or dropped
+ *
+ ******************************************************************************
+ *
+ * The score is the message from format_score() or format_miss().  The
+ * opening { is replaced by the sequence number and lane name, and the line
+ * ends are left off.
+ *
+ *******************************************************************************/
+int udp_score_send
+(
+    const char* lane,                       // Name of this target
+    const char* score                       // Score message
+)
+{
+    char          datagram[SCORE_SIZE + 64]; // Score with the header in front
+    json_writer_t w;
+    unsigned int  length;
+
+    if ( udp_sock < 0 )
+    {
+        return 0;
+    }
+
+    while ( (*score != 0) && (*score != '{') )
+    {
+        score++;                            // Skip the line ends
+    }
+    if ( *score != 0 )
+    {
+        score++;                            // and the {
+    }
+    while ( *score == ' ' )
+    {
+        score++;
+    }
+
+/*
+ * Put the header in front
+ */
+    udp_sequence++;
+    json_writer_init(&w, datagram, sizeof(datagram));
+    json_put_text(&w, "{\"seq\":");
+    json_put_int(&w, udp_sequence);
+    json_put_text(&w, ", \"lane\":\"");
+    json_put_text(&w, lane);
+    json_put_text(&w, "\"");
+    if ( (*score != 0) && (*score != '}') )
+    {
+        json_put_text(&w, ", ");
+    }
+    json_put_text(&w, score);
+    length = json_writer_done(&w);
+
+    while ( (length != 0) && ((datagram[length-1] == '\r') || (datagram[length-1] == '\n')) )
+    {
+        length--;                           // Leave off the line ends
+    }
+
+/*
+ * Send it without waiting
+ */
+    if ( sendto(udp_sock, datagram, length, MSG_DONTWAIT, (struct sockaddr*)&udp_addr, sizeof(udp_addr)) != (int)length )
+    {
+        udp_dropped++;
+        return 0;
+    }
+
+    return length;
+}
+
+/*****************************************************************************
+ *
+ * @function: udp_score_sequence()
+ *            udp_score_dropped()
+ *
+ * @brief:    Report on the publisher
+ *
+ * @return:   Last sequence number used, or datagrams dropped
+ *
+ ******************************************************************************/
+unsigned int udp_score_sequence(void)
+{
+    return udp_sequence;
+}
+
+unsigned int udp_score_dropped(void)
+{
+    return udp_dropped;
+}
@@ -0,0 +1,25 @@
+/*----------------------------------------------------------------
+ *
+ * udp_score.h
+ *
+ * Publish the scores as UDP datagrams
+ *
+ *---------------------------------------------------------------*/
+#ifndef _UDP_SCORE_H_
+#define _UDP_SCORE_H_
+
+#define UDP_SCORE_PORT      1091    // Default port the scores are sent to
+#define UDP_SCORE_GROUP     "239.255.10.90" // Suggested multicast group for a range
+#define UDP_ADDRESS_SIZE    16      // Reserve 15+1 bytes for a dotted address
+#define UDP_SCORE_TTL       1       // Multicast stays on the range network
+
+/*
+ * Global functions
+ */
+int          udp_score_open(const char* address, int port); // Start publishing to address:port
+void         udp_score_close(void);                        // Stop publishing
+int          udp_score_send(const char* lane, const char* score); // Publish one score
+unsigned int udp_score_sequence(void);                     // Sequence number of the last datagram
+unsigned int udp_score_dropped(void);                      // Datagrams the stack would not take
+
+#endif